@@ -0,0 +1,27 @@
+#!/usr/bin/env bash
+
+# Compares path termination settings on the test scenes with a fixed time budget:
+# samples per second, the mean per-pixel sample variance, and the resulting efficiency
+# Usage: ./benchmark.sh [path/to/webgpu-raytracer] [seconds per run] [extra options...]
+
+executable=${1:-build/webgpu-raytracer}
+seconds=${2:-10}
+shift $(( $# < 2 ? $# : 2 ))
+
+scenes=(
+    test_scenes/bunny/bunny_100k.gltf
+    test_scenes/dragon/dragon-50k-glass.gltf
+    test_scenes/sponza/sponza_lights.gltf
+)
+
+output=$(mktemp --suffix=.png)
+
+for scene in "${scenes[@]}"; do
+    for roulette in off 3 1; do
+        echo "$scene, Russian roulette: $roulette"
+        "$executable" "$scene" --headless --output "$output" --time "$seconds" --russian-roulette "$roulette" "$@" \
+            | grep -E "^Rendered|^Mean per-pixel sample variance"
+    done
+done
+
+rm -f "$output"
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <webgpu-raytracer/shader_registry.hpp>
+
+#include <webgpu.h>
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <cstdint>
+
+struct AdaptiveSamplingOptions
+{
+    // A pixel has converged once the standard error of its mean luminance drops
+    // below this fraction of the luminance; zero disables adaptive sampling
+    float targetRelativeError = 0.f;
+
+    // Samples every pixel gets before its variance estimate is trusted
+    std::uint32_t minSampleCount = 16;
+
+    // The sample allocation map is rebuilt every this many frames
+    std::uint32_t updatePeriod = 8;
+};
+
+// Convergence of the most recent sample allocation map
+struct AdaptiveSamplingStats
+{
+    std::uint32_t tileCount = 0;
+    std::uint32_t activeTileCount = 0;
+    double meanSampleCount = 0.0;
+};
+
+// Adaptive sampling state of the Monte Carlo raytracer: per-pixel sample counts,
+// and the list of the 8x8 pixel tiles that haven't converged yet, which is rebuilt
+// periodically from the per-pixel luminance variance (adaptive_sampling.wgsl) and
+// turned into indirect dispatch arguments, so that the raytracer only spends samples
+// on these tiles. The convergence stats are read back asynchronously
+struct AdaptiveSampling
+{
+    static constexpr std::uint32_t TILE_SIZE = 8;
+
+    AdaptiveSampling(WGPUDevice device, WGPUQueue queue, ShaderRegistry & shaderRegistry, WGPUTextureFormat accumulationTextureFormat);
+    ~AdaptiveSampling();
+
+    // Accumulation texture, sample counts and active tiles, see computeAdaptive in raytrace_monte_carlo.wgsl
+    WGPUBindGroupLayout bindGroupLayout() const { return bindGroupLayout_; }
+    WGPUBindGroup bindGroup() const { return bindGroup_; }
+
+    // Dispatch arguments of one workgroup per active tile
+    WGPUBuffer dispatchArgsBuffer() const { return dispatchArgsBuffer_; }
+
+    // Must be recorded before the raytracing dispatch. Clears the sample counts on
+    // the first frame, and rebuilds the sample allocation map every updatePeriod frames
+    void update(WGPUCommandEncoder commandEncoder, WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize,
+        std::uint32_t frameID, AdaptiveSamplingOptions const & options);
+
+    // Starts reading back the stats of the last rebuilt map, call after submitting
+    void poll();
+
+    // The most recent stats that have been read back since the first frame
+    std::optional<AdaptiveSamplingStats> stats() const;
+
+private:
+    WGPUDevice device_;
+    WGPUQueue queue_;
+
+    WGPUBindGroupLayout bindGroupLayout_;
+    WGPUBindGroupLayout buildBindGroupLayout_;
+    WGPUPipelineLayout buildPipelineLayout_;
+    WGPUComputePipeline buildPipeline_;
+
+    WGPUBuffer paramsBuffer_;
+    WGPUBuffer dispatchArgsBuffer_;
+    WGPUBuffer mapBuffer_;
+
+    // Allocated on the first update
+    WGPUBuffer sampleCountsBuffer_ = nullptr;
+    WGPUBuffer activeTilesBuffer_ = nullptr;
+    WGPUBindGroup bindGroup_ = nullptr;
+    WGPUBindGroup buildBindGroup_ = nullptr;
+
+    WGPUTextureView accumulationTextureView_ = nullptr;
+    glm::uvec2 screenSize_{0, 0};
+
+    enum class MapState
+    {
+        Idle,
+        Resolved,
+        Mapping,
+    };
+
+    std::atomic<MapState> mapState_{MapState::Idle};
+
+    // Readbacks resolved before the last reset are dropped
+    std::atomic<std::uint32_t> generation_{0};
+    std::uint32_t resolvedGeneration_ = 0;
+    std::uint32_t resolvedTileCount_ = 0;
+
+    mutable std::mutex statsMutex_;
+    std::optional<AdaptiveSamplingStats> stats_;
+
+    void releaseState();
+    void recreateState(WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <span>
 #include <cstdint>
 
 struct AliasRecord
@@ -12,3 +13,7 @@ struct AliasRecord
 // Generate the data for sampling values in proportion to input probabilities
 // using the alias method
 std::vector<AliasRecord> generateAlias(std::vector<float> const & probabilities);
+
+// Same as generateAlias, writing into an existing table of the same size
+// as probabilities and without logging, for building many small tables
+void fillAliasTable(std::span<float const> probabilities, std::span<AliasRecord> result);
@@ -2,6 +2,13 @@
 
 #include <webgpu-raytracer/aabb.hpp>
 
+#include <vector>
+#include <span>
+#include <limits>
+#include <cstdint>
+
+struct ThreadPool;
+
 struct BVH
 {
     struct Node
@@ -19,8 +26,113 @@ struct BVH
 
     static_assert(sizeof(Node) == 32);
 
+    // Deepest tree the traversal stacks in geometry.wgsl and reference_renderer.cpp
+    // support; LBVH trees are deeper than SAH ones when Morton codes collide
+    static constexpr std::uint32_t MAX_DEPTH = 64;
+
     std::vector<Node> nodes;
+
+    // Leaves reference ranges of this array; with spatial
+    // splits a triangle can appear in it more than once
     std::vector<std::uint32_t> triangleIDs;
 };
 
-BVH buildBVH(std::vector<AABB> const & triangleAABB);
+struct BVHBuildOptions
+{
+    enum class Method
+    {
+        // Exact greedy SAH: sorts triangles along each axis
+        // and evaluates every possible split position
+        SweepSAH,
+
+        // Approximate greedy SAH: bins triangle centroids into
+        // a fixed number of buckets along each axis and only
+        // evaluates splits between the buckets
+        BinnedSAH,
+
+        // Binned SAH with spatial splits (SBVH): when the children
+        // of the best object split overlap, also evaluates splitting
+        // space into bins, with triangles straddling the split plane
+        // clipped and referenced from both children
+        SpatialSAH,
+
+        // Linear BVH: sorts triangles by the Morton code of their
+        // centroids and emits the binary radix tree over the codes,
+        // see e.g. Tero Karras, Maximizing Parallelism in the Construction
+        // of BVHs, Octrees, and k-d Trees (2012). One triangle per leaf.
+        // Same algorithm as the GPU builder in lbvh.wgsl, used to validate it
+        LBVH,
+    };
+
+    Method method = Method::SweepSAH;
+
+    // Used by the binned and spatial builders, and by the
+    // parallel top-level splitting of the binned builder
+    std::uint32_t binCount = 16;
+
+    // Maximal number of duplicated triangle references created
+    // by spatial splits, relative to the triangle count
+    float spatialSplitBudget = 0.3f;
+
+    // Zero means all hardware threads; the resulting
+    // tree doesn't depend on the thread count
+    std::uint32_t threadCount = 0;
+
+    enum class NodeOrder
+    {
+        // Order in which the builder created the nodes
+        Creation,
+
+        // Sibling pairs in depth-first order, i.e. the children
+        // of a node directly follow its sibling pair
+        DepthFirst,
+
+        // Sibling pairs clustered into treelets of 4 pairs (256 bytes),
+        // grown from the treelet root towards the children with the largest
+        // surface area; the subtrees below a treelet follow it
+        Treelet,
+    };
+
+    NodeOrder nodeOrder = NodeOrder::Creation;
+
+    // Maximal number of optimizeBVH passes lowering the SAH cost of the built
+    // tree, zero disables it. Like the build, the optimized tree doesn't depend
+    // on the thread count (nor on the machine speed), so it can be cached
+    std::uint32_t optimizationPassCount = 0;
+};
+
+char const * bvhMethodName(BVHBuildOptions::Method method);
+char const * bvhNodeOrderName(BVHBuildOptions::NodeOrder order);
+
+// Spatial splits clip the triangles given by triangleVertices (3 per triangle);
+// if they aren't provided, triangle bounding boxes are clipped instead
+BVH buildBVH(std::vector<AABB> const & triangleAABB, BVHBuildOptions const & options = {},
+    std::span<glm::vec3 const> triangleVertices = {});
+
+// Lowers the SAH cost of a built tree by treelet restructuring (Karras & Aila 2013):
+// bottom-up passes, parallel over disjoint subtrees, rearrange the up to 7 subtrees
+// below every node into the topology with the smallest surface area, until a pass
+// stops improving or maxPassCount passes are done. Leaves, their triangle ranges
+// and the node count are kept; passes that would exceed BVH::MAX_DEPTH are undone.
+// Returns the number of completed passes
+std::uint32_t optimizeBVH(std::span<BVH::Node> nodes, std::uint32_t maxPassCount, ThreadPool & pool);
+
+// Rearranges the nodes for better cache locality of the traversal, see
+// BVHBuildOptions::NodeOrder. Siblings stay adjacent (the right child is still
+// left child + 1) and every pair starts at a 64 byte boundary, so node 1 becomes
+// unused padding. Leaves keep their triangle ranges
+void reorderBVHNodes(std::vector<BVH::Node> & nodes, BVHBuildOptions::NodeOrder order);
+
+// Recomputes the bounds of all nodes bottom-up, keeping the tree topology.
+// triangleAABB is indexed like the leaves, i.e. by position in BVH::triangleIDs.
+// The top levels of the tree are refitted in parallel
+void refitBVH(std::span<BVH::Node> nodes, std::span<AABB const> triangleAABB, ThreadPool & pool);
+
+// Whether every node reachable from the root contains the bounds of its children,
+// or of its triangles for leaves (triangleAABB is indexed like in refitBVH)
+bool bvhBoundsContain(std::span<BVH::Node const> nodes, std::span<AABB const> triangleAABB);
+
+// Surface area heuristic cost of the whole tree, normalized
+// by the surface area of the root node
+float bvhSAHCost(BVH const & bvh);
+float bvhSAHCost(std::span<BVH::Node const> nodes);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <webgpu-raytracer/bvh.hpp>
+#include <webgpu-raytracer/reference_renderer.hpp>
+
+#include <glm/glm.hpp>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <span>
+#include <cstdint>
+
+// Quality & size of the tree below a single root
+struct BVHStats
+{
+    std::uint32_t nodeCount = 0;
+    std::uint32_t leafCount = 0;
+    std::uint32_t triangleReferenceCount = 0;
+    std::uint32_t maxDepth = 0;
+
+    // Same as bvhSAHCost, normalized by the root surface area
+    float sahCost = 0.f;
+
+    // Total surface area of the overlap of sibling bounds, relative
+    // to the total surface area of their parents
+    float overlapRatio = 0.f;
+
+    // Nodes, and vertex positions of the referenced triangles
+    // as stored for traversal (3 vec4 per reference)
+    std::uint64_t nodeBytes = 0;
+    std::uint64_t trianglePositionBytes = 0;
+
+    // Number of leaves by triangle count & by depth
+    std::vector<std::uint32_t> leafSizeHistogram;
+    std::vector<std::uint32_t> leafDepthHistogram;
+};
+
+// Only counts nodes reachable from root, so that it works for the
+// mesh BVHs of instanced scenes sharing a single node array
+BVHStats computeBVHStats(std::span<BVH::Node const> nodes, std::uint32_t root = 0);
+
+struct BVHReport
+{
+    std::string scene;
+    BVHBuildOptions options;
+    bool instancing = false;
+
+    // E.g. the scene BVH, the light BVH or per-mesh BVHs
+    std::vector<std::pair<std::string, BVHStats>> trees;
+
+    // Traversal probe from the scene camera, see measureBVHLocality
+    std::optional<BVHLocalityStats> rays;
+    glm::uvec2 raysImageSize{0};
+};
+
+// Machine-readable report for tracking acceleration structure
+// regressions; contains nothing that depends on timing
+void writeBVHReport(std::filesystem::path const & path, BVHReport const & report);
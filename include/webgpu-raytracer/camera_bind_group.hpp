@@ -1,6 +1,7 @@
 #pragma once
 
 #include <webgpu-raytracer/camera.hpp>
+#include <webgpu-raytracer/path_tracing_options.hpp>
 
 #include <webgpu.h>
 
@@ -9,7 +10,8 @@ struct CameraBindGroup
     CameraBindGroup(WGPUDevice device);
     ~CameraBindGroup();
 
-    void update(WGPUQueue queue, Camera const & camera, glm::uvec2 const & screenSize, std::uint32_t frameID, std::uint32_t globalFrameID);
+    void update(WGPUQueue queue, Camera const & camera, glm::uvec2 const & screenSize, std::uint32_t sampleID, std::uint32_t globalSampleID,
+        std::uint32_t sampleCount, PathTracingOptions const & pathTracingOptions);
 
     WGPUBindGroupLayout bindGroupLayout() const { return bindGroupLayout_; }
     WGPUBindGroup bindGroup() const { return bindGroup_; }
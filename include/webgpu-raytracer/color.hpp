@@ -2,4 +2,24 @@
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <span>
+
 static glm::vec3 const LUMINANCE_FACTORS { 0.299f, 0.587f, 0.114f };
+
+// Expects accumulated pixels with the mean color in RGB and the mean squared
+// luminance in alpha, as written by the Monte-Carlo raytracers. Returns the
+// variance of a single sample's luminance, averaged over the pixels
+inline double meanSampleVariance(std::span<glm::vec4 const> pixels)
+{
+    if (pixels.empty())
+        return 0.0;
+
+    double sum = 0.0;
+    for (auto const & pixel : pixels)
+    {
+        double const meanLuminance = glm::dot(LUMINANCE_FACTORS, glm::vec3(pixel));
+        sum += std::max(0.0, pixel.w - meanLuminance * meanLuminance);
+    }
+    return sum / pixels.size();
+}
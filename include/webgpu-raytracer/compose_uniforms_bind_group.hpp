@@ -9,7 +9,9 @@ struct ComposeUniformsBindGroup
     ComposeUniformsBindGroup(WGPUDevice device);
     ~ComposeUniformsBindGroup();
 
-    void update(WGPUQueue queue, float exposure);
+    // Nonzero heatmapRange shows the accumulation texture as a traversal
+    // cost heatmap, with heatmapRange visited nodes at the top of the ramp
+    void update(WGPUQueue queue, float exposure, float heatmapRange = 0.f);
 
     WGPUBindGroupLayout bindGroupLayout() const { return bindGroupLayout_; }
     WGPUBindGroup bindGroup() const { return bindGroup_; }
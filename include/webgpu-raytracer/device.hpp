@@ -0,0 +1,12 @@
+#pragma once
+
+#include <webgpu.h>
+
+WGPUInstance createInstance();
+
+// compatibleSurface may be null for offscreen rendering
+// Throws on error
+WGPUAdapter requestAdapter(WGPUInstance instance, WGPUSurface compatibleSurface);
+
+// Throws on error
+WGPUDevice requestDevice(WGPUAdapter adapter);
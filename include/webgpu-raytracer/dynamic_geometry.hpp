@@ -0,0 +1,65 @@
+#pragma once
+
+#include <webgpu-raytracer/scene_geometry.hpp>
+#include <webgpu-raytracer/thread_pool.hpp>
+#include <webgpu-raytracer/bvh.hpp>
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+struct DynamicGeometryOptions
+{
+    // Used for rebuilds; spatial splits fall back to binned SAH,
+    // since rebuilt trees reference every triangle exactly once
+    BVHBuildOptions bvhOptions;
+
+    // The BVH is rebuilt once refitting has increased its SAH cost by this
+    // factor compared to the last build; infinity means refitting only
+    float rebuildThreshold = 1.3f;
+};
+
+// Scene geometry with per-frame vertex positions, e.g. for rigid or deforming
+// animations. Every update refits the BVH and the light BVH to the new positions,
+// which is linear in the triangle count; the BVH is rebuilt, reordering the
+// triangles, only when its quality has degraded too much.
+// Light sampling probabilities are kept from the initial geometry
+struct DynamicGeometry
+{
+    DynamicGeometry(SceneGeometryView const & geometry, DynamicGeometryOptions const & options);
+
+    struct UpdateResult
+    {
+        // Triangles were reordered, so vertex attributes and
+        // emissive triangles have changed as well
+        bool rebuilt;
+
+        // Normalized SAH cost of the BVH after the update
+        float sahCost;
+
+        double duration;
+    };
+
+    // vertexPositions are in the layout of the geometry passed to the constructor
+    UpdateResult update(std::span<glm::vec4 const> vertexPositions);
+
+    SceneGeometry const & geometry() const { return geometry_; }
+
+private:
+    DynamicGeometryOptions options_;
+    ThreadPool pool_;
+    SceneGeometry geometry_;
+
+    // Index of every current triangle in the initial geometry
+    std::vector<std::uint32_t> sourceTriangles_;
+    std::uint32_t sourceTriangleCount_;
+
+    std::vector<AABB> triangleAABB_;
+    std::vector<AABB> emissiveTriangleAABB_;
+
+    float builtSAHCost_;
+
+    void rebuild();
+};
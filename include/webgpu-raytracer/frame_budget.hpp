@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+struct FrameBudgetOptions
+{
+    // Samples per pixel traced by every raytraced frame
+    std::uint32_t samplesPerDispatch = 1;
+
+    // If positive, samplesPerDispatch is only the initial value, and is then adjusted
+    // after every measured frame to bring the frame GPU time close to this many seconds
+    double targetFrameTime = 0.0;
+
+    // Keeps single dispatches short enough not to trigger GPU driver timeouts
+    std::uint32_t maxSamplesPerDispatch = 64;
+};
+
+// Picks the number of samples per pixel of every Monte Carlo dispatch. The cost
+// of a sample is estimated from the GPU time of past frames divided by their
+// sample counts, so the fixed per-frame cost (compose pass etc) is counted as
+// sampling time, which keeps the frame time below the target
+struct FrameBudgetController
+{
+    explicit FrameBudgetController(FrameBudgetOptions const & options = {});
+
+    std::uint32_t samplesPerDispatch() const { return samplesPerDispatch_; }
+
+    // GPU time of a frame that traced sampleCount samples per pixel
+    void addMeasurement(double frameTime, std::uint32_t sampleCount);
+
+private:
+    FrameBudgetOptions options_;
+    std::uint32_t samplesPerDispatch_;
+    double sampleTime_ = 0.0;
+};
@@ -6,4 +6,5 @@ WGPUBindGroupLayout createGeometryBindGroupLayout(WGPUDevice device);
 
 WGPUBindGroup createGeometryBindGroup(WGPUDevice device, WGPUBindGroupLayout bindGroupLayout, WGPUBuffer vertexPositionsBuffer,
     WGPUBuffer vertexAttributesBuffer, WGPUBuffer bvhNodesBuffer,
-    WGPUBuffer emissiveTrianglesBuffer, WGPUBuffer emissiveTrianglesAliasBuffer, WGPUBuffer emissiveBvhNodesBuffer);
+    WGPUBuffer emissiveTrianglesBuffer, WGPUBuffer emissiveTrianglesAliasBuffer, WGPUBuffer emissiveBvhNodesBuffer,
+    WGPUBuffer wideBvhNodesBuffer, WGPUBuffer quantizedBvhNodesBuffer, WGPUBuffer instancesBuffer, WGPUBuffer instanceBvhNodesBuffer);
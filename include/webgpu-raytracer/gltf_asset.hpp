@@ -1,5 +1,7 @@
 #pragma once
 
+#include <webgpu-raytracer/mapped_file.hpp>
+
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -7,14 +9,19 @@
 #include <string>
 #include <vector>
 #include <optional>
+#include <memory>
+#include <span>
 
 namespace glTF
 {
 
     struct Buffer
     {
+        // Empty for the binary chunk of a .glb file
         std::string uri;
-        std::vector<char> data;
+
+        // Points into one of the asset's memory-mapped files
+        std::span<char const> data;
     };
 
     struct BufferView
@@ -66,10 +73,18 @@ namespace glTF
 
     struct Image
     {
+        struct DataDeleter
+        {
+            void operator()(std::uint32_t * data) const;
+        };
+
+        // Empty for images stored in buffer views
         std::string uri;
-        std::uint32_t width;
-        std::uint32_t height;
-        std::vector<std::uint32_t> data;
+        std::uint32_t width = 0;
+        std::uint32_t height = 0;
+
+        // RGBA8 pixels, owned directly as decoded by stb_image
+        std::unique_ptr<std::uint32_t[], DataDeleter> data;
     };
 
     struct Texture
@@ -152,6 +167,13 @@ namespace glTF
         std::vector<BufferView> bufferViews;
         std::vector<Buffer> buffers;
         std::vector<Camera> cameras;
+
+        // Hash of the glTF file and all the files it references,
+        // zero if the asset was loaded without hashing
+        std::uint64_t contentHash = 0;
+
+        // Files backing the buffers' data
+        std::vector<std::shared_ptr<MappedFile const>> mappedFiles;
     };
 
 }
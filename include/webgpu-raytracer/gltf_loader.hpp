@@ -7,6 +7,8 @@
 namespace glTF
 {
 
-    Asset load(std::filesystem::path const & path);
+    // Hashing all the input files is only needed to look up the scene cache,
+    // without hashContent the asset's contentHash is left zero
+    Asset load(std::filesystem::path const & path, bool hashContent = true);
 
 }
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <webgpu-raytracer/shader_registry.hpp>
+#include <webgpu-raytracer/bvh.hpp>
+
+#include <webgpu.h>
+
+#include <vector>
+#include <cstdint>
+
+// Builds a binary LBVH on the GPU with compute shaders, see lbvh.wgsl.
+// The result has the same layout as BVHBuildOptions::Method::LBVH: one
+// triangle per leaf, children of internal node i at 1 + 2 * i and 2 + 2 * i
+struct GpuLBVHBuilder
+{
+    GpuLBVHBuilder(WGPUDevice device, ShaderRegistry & shaderRegistry);
+    ~GpuLBVHBuilder();
+
+    struct Result
+    {
+        // Triangles reordered to match the leaves, owned by the caller
+        WGPUBuffer vertexPositionsBuffer;
+        WGPUBuffer vertexAttributesBuffer;
+        WGPUBuffer bvhNodesBuffer;
+
+        // Read back after the build
+        std::vector<BVH::Node> nodes;
+        std::uint32_t maxDepth;
+
+        // GPU time of the build, without the readback
+        double buildTime;
+    };
+
+    // Triangle IDs in emissiveTrianglesBuffer (a TriangleArray) are remapped
+    // in place to the new triangle order
+    Result build(WGPUDevice device, WGPUQueue queue, WGPUBuffer vertexPositionsBuffer, WGPUBuffer vertexAttributesBuffer,
+        WGPUBuffer emissiveTrianglesBuffer, std::uint32_t triangleCount, std::uint32_t emissiveTriangleCount);
+
+private:
+    WGPUBindGroupLayout bindGroupLayout_;
+    WGPUPipelineLayout pipelineLayout_;
+
+    WGPUComputePipeline computeCentroidBoundsPipeline_;
+    WGPUComputePipeline computeMortonCodesPipeline_;
+    WGPUComputePipeline radixHistogramPipeline_;
+    WGPUComputePipeline radixScanPipeline_;
+    WGPUComputePipeline radixScatterPipeline_;
+    WGPUComputePipeline emitHierarchyPipeline_;
+    WGPUComputePipeline refitPipeline_;
+    WGPUComputePipeline gatherTrianglesPipeline_;
+    WGPUComputePipeline remapEmissiveTrianglesPipeline_;
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// Fast non-cryptographic 64-bit hash, used to detect changes in input
+// files. Consumes 8 bytes per step; the result depends on how the data
+// was split between update() calls
+struct Hasher
+{
+    void update(void const * data, std::size_t size)
+    {
+        auto bytes = static_cast<unsigned char const *>(data);
+
+        for (; size >= 8; bytes += 8, size -= 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, bytes, 8);
+            mix(word);
+        }
+
+        std::uint64_t tail = 0;
+        std::memcpy(&tail, bytes, size);
+        mix(tail ^ (std::uint64_t(size) << 56));
+    }
+
+    template <typename T>
+    void update(T const & value)
+    {
+        update(&value, sizeof(value));
+    }
+
+    std::uint64_t digest() const
+    {
+        // splitmix64 finalizer
+        std::uint64_t h = state_;
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+private:
+    std::uint64_t state_ = 0x9e3779b97f4a7c15ull;
+
+    void mix(std::uint64_t word)
+    {
+        state_ ^= word * 0x87c37b91114253d5ull;
+        state_ = (state_ << 31) | (state_ >> 33);
+        state_ *= 0x4cf5ad432745937full;
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <webgpu-raytracer/renderer.hpp>
+#include <webgpu-raytracer/scene_data.hpp>
+#include <webgpu-raytracer/camera.hpp>
+
+#include <webgpu.h>
+
+#include <glm/glm.hpp>
+
+#include <filesystem>
+#include <cstdint>
+
+// WebGPU device without a window or a surface, for rendering on
+// machines without a display (e.g. with a software Vulkan adapter)
+struct HeadlessContext
+{
+    HeadlessContext();
+    ~HeadlessContext();
+
+    WGPUDevice device() const { return device_; }
+
+    WGPUQueue queue() const { return queue_; }
+
+    // Format of the offscreen texture the renderer draws into
+    WGPUTextureFormat targetFormat() const { return WGPUTextureFormat_RGBA8UnormSrgb; }
+
+private:
+    WGPUDevice device_;
+    WGPUQueue queue_;
+};
+
+struct HeadlessOptions
+{
+    glm::uvec2 size{1024, 768};
+
+    // Rendering stops when either limit is reached,
+    // zero means no limit for either of them
+    std::uint32_t sampleCount = 0;
+    double timeBudget = 0.0;
+
+    // Rendering also stops once every pixel has converged to this relative error
+    // with adaptive sampling, zero disables it. Megakernel only, renderHeadless
+    // throws if it is combined with wavefront
+    float targetRelativeError = 0.f;
+
+    // .png files get the tonemapped image, .exr files get the raw accumulated radiance
+    std::filesystem::path output;
+
+    // Render the traversal cost heatmap instead and print its statistics;
+    // .exr files get the visited & intersected node counts per pixel
+    bool heatmap = false;
+
+    // Use the wavefront path tracer instead of the megakernel
+    bool wavefront = false;
+
+    // Animate the geometry for this many frames instead, see renderAnimationHeadless
+    std::uint32_t animationFrameCount = 0;
+};
+
+// Render the scene with the Monte Carlo raytracer (megakernel or wavefront, or the heatmap) and save the result
+void renderHeadless(HeadlessContext const & context, Renderer & renderer, Camera const & camera, SceneData const & sceneData, HeadlessOptions const & options);
+
+// Benchmark of dynamic geometry: every frame moves the geometry the scene data was created
+// from, updates its BVH, uploads it and renders one Monte Carlo frame, then prints the mean
+// update, upload and render times and saves the last frame. Scenes without instances are
+// deformed by a wave and refitted by DynamicGeometry (rebuilt when the SAH cost grows too much);
+// in instanced scenes every instance rotates around its center and the instance BVH is rebuilt.
+// Throws if the updated BVH bounds don't contain every triangle (instance), or if an instance
+// is emissive, since its light sampling data isn't updated (see SceneData::updateInstances)
+void renderAnimationHeadless(HeadlessContext const & context, Renderer & renderer, Camera const & camera, SceneData & sceneData,
+    SceneGeometryView const & geometry, BVHBuildOptions const & bvhOptions, HeadlessOptions const & options);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <filesystem>
+#include <cstdint>
+
+// All throw on error
+
+// Write 8-bit RGBA pixels as a PNG file
+void writePNG(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, std::uint8_t const * pixels);
+
+// Write the RGB channels of 32-bit float RGBA pixels as an uncompressed OpenEXR file
+void writeEXR(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, float const * pixels);
+
+// Write the RGB channels of 32-bit float RGBA radiance as a PNG file,
+// tonemapped the same way as compose.wgsl does with unit exposure
+void writeTonemappedPNG(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, float const * pixels);
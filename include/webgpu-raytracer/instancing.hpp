@@ -0,0 +1,30 @@
+#pragma once
+
+#include <webgpu-raytracer/scene_geometry.hpp>
+#include <webgpu-raytracer/aabb.hpp>
+#include <webgpu-raytracer/bvh.hpp>
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Instance of the mesh with the BVH rooted at bvhRoot, whose triangles
+// are [firstTriangle, firstTriangle + triangleCount) in the scene geometry
+SceneInstance makeSceneInstance(glm::mat4 const & objectToWorld, std::uint32_t bvhRoot, std::uint32_t firstTriangle, std::uint32_t triangleCount);
+
+glm::mat4 instanceObjectToWorld(SceneInstance const & instance);
+
+// World space bounds of the root node of the instance mesh BVH
+AABB instanceBounds(SceneInstance const & instance, std::span<BVH::Node const> bvhNodes);
+
+// Appends a mesh BVH to the scene BVH nodes, offsetting child indices by
+// the current node count and leaf triangles by firstTriangle. Returns the root
+std::uint32_t appendMeshBVH(std::vector<BVH::Node> & bvhNodes, std::span<BVH::Node const> meshNodes, std::uint32_t firstTriangle);
+
+// Builds the top-level BVH over the world space instance bounds. Instances are
+// reordered so that leaves reference them directly, like triangles in the mesh BVHs.
+// Moving instances also invalidates the world space emissive triangles and light BVH.
+// Spatial splits fall back to binned SAH, since every instance must be referenced once
+std::vector<BVH::Node> buildInstanceBVH(std::vector<SceneInstance> & instances, std::span<BVH::Node const> bvhNodes, BVHBuildOptions const & options);
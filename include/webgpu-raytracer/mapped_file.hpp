@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+    MappedFile() = default;
+
+    // Throws std::runtime_error on failure
+    explicit MappedFile(std::filesystem::path const & path);
+
+    MappedFile(MappedFile && other);
+    MappedFile & operator = (MappedFile && other);
+
+    ~MappedFile();
+
+    char const * data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+    std::span<char const> bytes() const { return {data_, size_}; }
+
+private:
+    char const * data_ = nullptr;
+    std::size_t size_ = 0;
+
+#ifdef _WIN32
+    void * fileHandle_ = nullptr;
+    void * mappingHandle_ = nullptr;
+#endif
+
+    void reset();
+};
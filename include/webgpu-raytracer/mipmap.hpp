@@ -0,0 +1,35 @@
+#pragma once
+
+#include <webgpu-raytracer/thread_pool.hpp>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// How RGBA8 texels are averaged when downsampling
+enum class TextureEncoding
+{
+    // Channels are averaged as is
+    Linear,
+    // RGB is converted to linear space before averaging, alpha is linear
+    SRGB,
+    // RGB is a unit vector packed as rgb * 2 - 1, renormalized after averaging
+    Normal,
+};
+
+struct MipLevel
+{
+    std::uint32_t width;
+    std::uint32_t height;
+    std::vector<std::uint32_t> pixels;
+};
+
+// Number of mip levels of a texture, down to the level where its
+// smaller dimension becomes 1. Level sizes are rounded down, so that
+// the mips of textures packed side by side don't overlap
+std::uint32_t mipLevelCount(glm::uvec2 const & size);
+
+// Generates mip levels 1 to mipLevelCount - 1 of an RGBA8 image with a box
+// filter, level 0 is the image itself. Rows are processed in parallel
+std::vector<MipLevel> generateMipmaps(ThreadPool & pool, std::uint32_t width, std::uint32_t height, std::uint32_t const * pixels, TextureEncoding encoding);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// Path termination, shared by the GPU raytracers and the CPU reference
+struct PathTracingOptions
+{
+    // Paths end after this many bounces
+    std::uint32_t maxDepth = 8;
+
+    // From this bounce on, paths survive with a probability given by their
+    // throughput, and survivors are reweighted so that the result stays unbiased.
+    // maxDepth or more disables Russian roulette
+    std::uint32_t russianRouletteDepth = 3;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <webgpu-raytracer/gltf_asset.hpp>
+#include <webgpu-raytracer/scene_geometry.hpp>
+#include <webgpu-raytracer/scene_cache.hpp>
+#include <webgpu-raytracer/mipmap.hpp>
+#include <webgpu-raytracer/alias.hpp>
+#include <webgpu-raytracer/bvh.hpp>
+
+#include <glm/glm.hpp>
+
+#include <filesystem>
+#include <optional>
+#include <vector>
+#include <cstdint>
+
+struct HDRIData
+{
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::vector<float> pixels;
+};
+
+struct SceneMaterial
+{
+    glm::vec4 baseColorFactorAndAlpha;
+    // vec4(0, roughness, metallic, ior)
+    glm::vec4 metallicRoughnessFactorAndIor;
+    glm::vec4 emissiveFactorAndTransmission;
+    // uvec4(albedo, material, normal, 0) indices into the image lists
+    glm::uvec4 textureIDs;
+};
+
+struct SceneImage
+{
+    std::uint32_t width;
+    std::uint32_t height;
+    // RGBA8 pixels, owned by the glTF asset
+    std::uint32_t const * pixels;
+    // Levels 1 and above
+    std::vector<MipLevel> mipmaps = {};
+};
+
+// Everything about the scene that is computed on the CPU: materials,
+// textures with their mipmaps, geometry with its BVHs and the environment
+// map sampling tables. Shared by the GPU scene upload (SceneData) and
+// the CPU reference renderer
+struct PreparedScene
+{
+    // Processed geometry is cached in cacheDirectory, unless it is empty.
+    // Images point into the asset, so it must outlive the prepared scene.
+    // With instancing, every glTF mesh is stored once with its own BVH
+    // and placed by instances, see SceneGeometry
+    PreparedScene(glTF::Asset const & asset, HDRIData environmentMap, BVHBuildOptions const & bvhOptions,
+        std::filesystem::path const & cacheDirectory, bool instancing = false);
+
+    PreparedScene(PreparedScene const &) = delete;
+
+    // Material 0 is the default rough diffuse material,
+    // image 0 of every list is a single default texel
+    std::vector<SceneMaterial> materials;
+
+    std::vector<SceneImage> albedoImages;
+    std::vector<SceneImage> materialImages;
+    std::vector<SceneImage> normalImages;
+
+    HDRIData environmentMap;
+
+    // See generateEnvironmentMapAlias in prepared_scene.cpp for the layout
+    std::vector<AliasRecord> environmentAliasTable;
+
+    SceneGeometryView const & geometry() const { return geometry_; }
+
+private:
+    std::optional<SceneCache> cache_;
+    SceneGeometry builtGeometry_;
+    SceneGeometryView geometry_;
+};
@@ -7,12 +7,16 @@
 #include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <optional>
+#include <cstdint>
 
 struct FrameProfiler
 {
-    FrameProfiler(WGPUQuerySet querySet, WGPUCommandEncoder commandEncoder);
+    FrameProfiler(WGPUQuerySet querySet, WGPUCommandEncoder commandEncoder, std::uint32_t queryCount);
 
-    bool timestamp(std::string name);
+    // Throws if the frame already has as many timestamps as
+    // were announced to Profiler::beginFrame
+    void timestamp(std::string name);
 
     std::vector<std::string> grabNames();
 
@@ -25,25 +29,41 @@ private:
     std::size_t maxSize_;
 };
 
+// GPU time between the first and the last timestamp of a frame
+struct ProfiledFrame
+{
+    std::uint64_t frameIndex = 0;
+    double time = 0.0;
+};
+
 struct Profiler
 {
     Profiler(WGPUDevice device);
     ~Profiler();
 
-    FrameProfiler beginFrame(WGPUCommandEncoder commandEncoder);
-    void endFrame(FrameProfiler frameProfiler);
+    // queryCount is the maximal number of timestamps the frame writes, including
+    // the one written here; the query set grows to fit it if needed
+    FrameProfiler beginFrame(WGPUCommandEncoder commandEncoder, std::uint32_t queryCount);
+
+    // Returns the index of the frame, see latestFrame
+    std::uint64_t endFrame(FrameProfiler frameProfiler);
     void poll();
 
+    // The most recent frame that has been read back
+    std::optional<ProfiledFrame> latestFrame() const;
+
     void dump();
 
 private:
     WGPUDevice device_;
     WGPUQuerySet querySet_;
+    std::uint32_t queryCount_;
 
     struct BufferPair
     {
         WGPUBuffer resolveBuffer;
         WGPUBuffer mapBuffer;
+        std::uint64_t size;
 
         void destroy();
     };
@@ -56,9 +76,12 @@ private:
     {
         BufferPair buffers;
         std::vector<std::string> names;
+        std::uint64_t frameIndex;
         Profiler * parent;
     };
 
+    std::uint64_t frameCount_ = 0;
+
     std::vector<std::unique_ptr<PendingData>> preparedBuffers_;
 
     std::mutex pendingBuffersMutex_;
@@ -70,10 +93,12 @@ private:
         double totalTime = 0.0;
     };
 
-    std::mutex profilingResultsMutex_;
+    mutable std::mutex profilingResultsMutex_;
     std::unordered_map<std::string, ProfilingData> profilingResults_;
+    std::optional<ProfiledFrame> latestFrame_;
 
-    WGPUBuffer newResolveBuffer();
-    WGPUBuffer newMapBuffer();
-    BufferPair newBufferPair();
+    WGPUQuerySet newQuerySet(std::uint32_t queryCount);
+    WGPUBuffer newResolveBuffer(std::uint64_t size);
+    WGPUBuffer newMapBuffer(std::uint64_t size);
+    BufferPair newBufferPair(std::uint64_t size);
 };
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <webgpu-raytracer/shader_registry.hpp>
+#include <webgpu-raytracer/scene_data.hpp>
+#include <webgpu-raytracer/camera_bind_group.hpp>
+
+#include <webgpu.h>
+
+struct RaytraceHeatmapPipeline
+{
+    RaytraceHeatmapPipeline(WGPUDevice device, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
+        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout traversalStatsBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout);
+    ~RaytraceHeatmapPipeline();
+
+    WGPUComputePipeline pipeline() const { return pipeline_; }
+
+private:
+    WGPUPipelineLayout pipelineLayout_;
+    WGPUComputePipeline pipeline_;
+};
+
+// Writes the visited & intersected node counts of every camera ray
+// to the accumulation texture, see raytrace_heatmap.wgsl
+void renderRaytraceHeatmap(WGPUCommandEncoder commandEncoder, WGPUComputePipeline raytraceHeatmapPipeline, WGPUBindGroup cameraBindGroup,
+    SceneData const & sceneData, WGPUBindGroup traversalStatsBindGroup, WGPUBindGroup accumulationStorageBindGroup, glm::uvec2 const & screenSize);
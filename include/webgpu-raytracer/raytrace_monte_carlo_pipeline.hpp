@@ -9,15 +9,25 @@
 struct RaytraceMonteCarloPipeline
 {
     RaytraceMonteCarloPipeline(WGPUDevice device, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
-        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout);
+        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout,
+        WGPUBindGroupLayout adaptiveSamplingBindGroupLayout);
     ~RaytraceMonteCarloPipeline();
 
     WGPUComputePipeline pipeline() const { return pipeline_; }
 
+    // Samples the active tiles of adaptive sampling only
+    WGPUComputePipeline adaptivePipeline() const { return adaptivePipeline_; }
+
 private:
     WGPUPipelineLayout pipelineLayout_;
+    WGPUPipelineLayout adaptivePipelineLayout_;
     WGPUComputePipeline pipeline_;
+    WGPUComputePipeline adaptivePipeline_;
 };
 
 void renderRaytraceMonteCarlo(WGPUCommandEncoder commandEncoder, WGPUTextureView colorTextureView, WGPUComputePipeline raytraceMonteCarloPipeline,
     WGPUBindGroup cameraBindGroup, SceneData const & sceneData, WGPUBindGroup accumulationStorageBindGroup, glm::uvec2 const & screenSize);
+
+// Dispatched indirectly with the tile count of the adaptive sampling map, see AdaptiveSampling
+void renderRaytraceMonteCarloAdaptive(WGPUCommandEncoder commandEncoder, WGPUComputePipeline raytraceMonteCarloAdaptivePipeline,
+    WGPUBindGroup cameraBindGroup, SceneData const & sceneData, WGPUBindGroup adaptiveSamplingBindGroup, WGPUBuffer dispatchArgsBuffer);
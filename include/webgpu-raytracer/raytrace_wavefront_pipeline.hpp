@@ -0,0 +1,86 @@
+#pragma once
+
+#include <webgpu-raytracer/shader_registry.hpp>
+#include <webgpu-raytracer/scene_data.hpp>
+#include <webgpu-raytracer/profiler.hpp>
+
+#include <webgpu.h>
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+// Path tracer split into separate kernels per bounce instead of a single
+// megakernel: extend traces the queued rays, shade samples the next direction
+// of the paths that hit something, and connect adds the light sampling
+// probability to the MIS weight of the bounces that need it, which requires a
+// light BVH traversal. Every kernel runs on a compacted queue of the live paths
+// only, sized with indirect dispatches. The screen is processed in chunks of
+// at most MAX_PATH_COUNT paths to bound the memory used by the queues.
+// Produces the same estimator as raytrace_monte_carlo.wgsl
+struct RaytraceWavefrontPipeline
+{
+    static constexpr std::uint32_t MAX_PATH_COUNT = 1 << 20;
+
+    RaytraceWavefrontPipeline(WGPUDevice device, WGPUQueue queue, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
+        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUTextureFormat accumulationTextureFormat);
+    ~RaytraceWavefrontPipeline();
+
+    // Sorts the hits of every bounce by material before shading, with a counting
+    // sort over their material IDs, so that neighbouring shading threads fetch the
+    // same material and texture layers. Off by default
+    void setSortByMaterial(bool sortByMaterial);
+
+    // Accumulates one sample per pixel. maxPathDepth must match the camera uniform,
+    // it sets the number of bounces dispatched. The path state is reallocated whenever
+    // the screen size, the depth or the accumulation texture change.
+    // Every stage gets its own profiler timestamp, summed over the bounces
+    void render(WGPUCommandEncoder commandEncoder, WGPUTextureView accumulationTextureView, WGPUBindGroup cameraBindGroup,
+        SceneData const & sceneData, glm::uvec2 const & screenSize, std::uint32_t maxPathDepth, FrameProfiler * frameProfiler = nullptr);
+
+    // Number of profiler timestamps written by render with the same arguments,
+    // for sizing the profiler query set
+    std::uint32_t timestampCount(glm::uvec2 const & screenSize, std::uint32_t maxPathDepth) const;
+
+private:
+    WGPUDevice device_;
+    WGPUQueue queue_;
+
+    WGPUBindGroupLayout stateBindGroupLayout_;
+    WGPUBindGroupLayout dispatchBindGroupLayout_;
+    WGPUPipelineLayout pipelineLayout_;
+    WGPUPipelineLayout dispatchPipelineLayout_;
+
+    WGPUComputePipeline generatePipeline_;
+    WGPUComputePipeline extendPipeline_;
+    WGPUComputePipeline shadePipeline_;
+    WGPUComputePipeline connectPipeline_;
+    WGPUComputePipeline accumulatePipeline_;
+    WGPUComputePipeline scanSortBinsPipeline_;
+    WGPUComputePipeline scatterSortedHitsPipeline_;
+    WGPUComputePipeline prepareDispatchPipeline_;
+
+    WGPUBuffer queueCountsBuffer_;
+    WGPUBuffer dispatchArgsBuffer_;
+    WGPUBuffer sortBinsBuffer_;
+
+    // Allocated on the first render
+    WGPUBuffer paramsBuffer_ = nullptr;
+    WGPUBuffer pathsBuffer_ = nullptr;
+    WGPUBuffer rayQueuesBuffer_ = nullptr;
+    WGPUBuffer hitsBuffer_ = nullptr;
+    WGPUBuffer pendingBouncesBuffer_ = nullptr;
+    WGPUBuffer sortedHitsBuffer_ = nullptr;
+    WGPUBindGroup stateBindGroup_ = nullptr;
+    WGPUBindGroup dispatchBindGroup_ = nullptr;
+
+    WGPUTextureView accumulationTextureView_ = nullptr;
+    glm::uvec2 screenSize_{0, 0};
+    std::uint32_t maxPathDepth_ = 0;
+
+    bool sortByMaterial_ = false;
+
+    void releaseState();
+    void writeParams();
+    void recreateState(WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize, std::uint32_t maxPathDepth);
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <webgpu-raytracer/prepared_scene.hpp>
+#include <webgpu-raytracer/camera.hpp>
+#include <webgpu-raytracer/path_tracing_options.hpp>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct ReferenceRenderOptions
+{
+    glm::uvec2 size{1024, 768};
+
+    // Rendering stops when either limit is reached,
+    // zero means no limit for either of them
+    std::uint32_t sampleCount = 0;
+    double timeBudget = 0.0;
+
+    // Zero means all hardware threads
+    std::uint32_t threadCount = 0;
+
+    // Must match the GPU renderer for the images to converge to the same result
+    PathTracingOptions pathTracing;
+};
+
+// Multithreaded CPU path tracer mirroring raytrace_monte_carlo.wgsl on the
+// same geometry and BVH buffers. Sample i of every pixel uses the same random
+// sequence as GPU frame i, so the result converges to the GPU image and serves
+// as ground truth for it. The image is split into tiles that are rendered in
+// parallel; the result doesn't depend on the thread count.
+// Returns linear RGB radiance and the mean squared luminance in alpha,
+// in the layout of the GPU accumulation texture
+std::vector<glm::vec4> renderReference(PreparedScene const & scene, Camera const & camera, ReferenceRenderOptions const & options);
+
+// Node fetches and triangle tests of the binary BVH traversal, summed over all rays
+struct BVHLocalityStats
+{
+    struct RayStats
+    {
+        std::uint64_t rayCount = 0;
+        std::uint64_t hitCount = 0;
+
+        // Same as visitedNodeCount in bvh_traverse.wgsl
+        std::uint64_t visitedNodeCount = 0;
+
+        std::uint64_t testedTriangleCount = 0;
+
+        // Distinct 128 byte cache lines touched by each ray
+        std::uint64_t cacheLineCount = 0;
+
+        // Misses in a 64-line LRU cache shared by the rays of each 8x4 pixel tile
+        std::uint64_t cacheMissCount = 0;
+    };
+
+    // Pixel center camera rays and one diffuse bounce from their hits
+    RayStats primary;
+    RayStats secondary;
+};
+
+// Traces rays through geometry.bvhNodes like intersectSceneBinary does and
+// measures how well the node fetches map onto cache lines; only the node
+// order in memory affects the cache statistics, the node and triangle
+// counts only depend on the tree itself
+BVHLocalityStats measureBVHLocality(SceneGeometryView const & geometry, Camera const & camera, glm::uvec2 const & size, std::uint32_t threadCount = 0);
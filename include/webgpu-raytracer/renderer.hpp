@@ -3,6 +3,10 @@
 #include <webgpu-raytracer/shader_registry.hpp>
 #include <webgpu-raytracer/scene_data.hpp>
 #include <webgpu-raytracer/camera.hpp>
+#include <webgpu-raytracer/path_tracing_options.hpp>
+#include <webgpu-raytracer/traversal_stats.hpp>
+#include <webgpu-raytracer/adaptive_sampling.hpp>
+#include <webgpu-raytracer/frame_budget.hpp>
 
 #include <webgpu.h>
 
@@ -21,13 +25,59 @@ struct Renderer
         Preview,
         RaytraceFirstHit,
         RaytraceMonteCarlo,
+
+        // Same image as RaytraceMonteCarlo, rendered with
+        // separate kernels per bounce, see RaytraceWavefrontPipeline
+        RaytraceWavefront,
+
+        // BVH traversal cost of the camera rays as a colour ramp, scaled
+        // to the 99th percentile of the previous frame divided by the exposure.
+        // The accumulation texture holds the visited & intersected node counts
+        TraversalHeatmap,
     };
 
     Mode renderMode() const;
     void setRenderMode(Mode mode);
 
+    // Path depth & Russian roulette of the Monte Carlo modes, restarts accumulation
+    void setPathTracingOptions(PathTracingOptions const & options);
+
+    // Sort hits by material before shading in the wavefront mode
+    void setWavefrontMaterialSorting(bool enabled);
+
+    // Only sample the pixels that haven't converged yet in the RaytraceMonteCarlo mode,
+    // restarts accumulation
+    void setAdaptiveSampling(AdaptiveSamplingOptions const & options);
+
+    // Samples per pixel per frame in the RaytraceMonteCarlo mode, fixed or adjusted to a
+    // target frame time; the other raytracing modes always trace one sample per frame
+    void setFrameBudget(FrameBudgetOptions const & options);
+
+    // Samples per pixel of the next RaytraceMonteCarlo frame
+    std::uint32_t samplesPerDispatch() const;
+
+    // Raytraced frames don't accumulate more than this many samples per pixel
+    // (in adaptive sampling, more than this many samples per sampled pixel), zero means no limit
+    void setSampleLimit(std::uint32_t sampleLimit);
+
+    // Samples per pixel accumulated since the last reset
+    // (in adaptive sampling, by the pixels that are still sampled)
+    std::uint32_t sampleCount() const;
+
     void renderFrame(WGPUTexture surfaceTexture, Camera const & camera, SceneData const & sceneData, float exposure);
 
+    // Raw accumulated radiance in RGBA32Float format, null until
+    // the first raytraced frame is rendered
+    WGPUTexture accumulationTexture() const;
+
+    // Read back asynchronously a few frames after being rendered in
+    // the heatmap mode, empty until the first readback completes
+    std::optional<TraversalHeatmapStats> traversalStats() const;
+
+    // Read back asynchronously after the sample allocation map is rebuilt,
+    // empty until the first readback after accumulation restarts completes
+    std::optional<AdaptiveSamplingStats> adaptiveSamplingStats() const;
+
 private:
     struct Impl;
     std::unique_ptr<Impl> pimpl_;
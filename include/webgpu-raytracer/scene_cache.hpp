@@ -0,0 +1,36 @@
+#pragma once
+
+#include <webgpu-raytracer/scene_geometry.hpp>
+#include <webgpu-raytracer/mapped_file.hpp>
+
+#include <filesystem>
+#include <optional>
+#include <cstdint>
+
+// Binary cache of the processed scene geometry. The file is a versioned
+// header followed by flat sections in the exact GPU buffer layout, so that
+// a cache hit is just a file mapping followed by buffer uploads.
+// Cache files use the native byte order and are only meant to be reused
+// on the same machine.
+struct SceneCache
+{
+    // Returns std::nullopt if the file doesn't exist, has a different
+    // key or format version, or is malformed
+    static std::optional<SceneCache> open(std::filesystem::path const & path, std::uint64_t key);
+
+    SceneGeometryView const & geometry() const { return geometry_; }
+
+private:
+    MappedFile file_;
+    SceneGeometryView geometry_;
+};
+
+// Writes the cache atomically, so that concurrent readers
+// never observe a partially written file
+void writeSceneCache(std::filesystem::path const & path, std::uint64_t key, SceneGeometryView const & geometry);
+
+// Combines the asset content hash with everything else that affects
+// the processed geometry
+std::uint64_t sceneCacheKey(std::uint64_t assetContentHash, BVHBuildOptions const & bvhOptions, bool instancing);
+
+std::filesystem::path sceneCachePath(std::filesystem::path const & cacheDirectory, std::uint64_t key);
@@ -1,27 +1,51 @@
 #pragma once
 
-#include <webgpu-raytracer/gltf_asset.hpp>
+#include <webgpu-raytracer/prepared_scene.hpp>
+#include <webgpu-raytracer/wide_bvh.hpp>
+#include <webgpu-raytracer/gpu_lbvh.hpp>
 
 #include <webgpu.h>
 
-struct HDRIData
-{
-    std::uint32_t width = 0;
-    std::uint32_t height = 0;
-    std::vector<float> pixels;
-};
-
 struct SceneData
 {
-    SceneData(glTF::Asset const & asset, HDRIData const & environmentMap, WGPUDevice device, WGPUQueue queue,
-        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout);
+    // Packs the textures into atlases, collapses the BVH if a wide layout
+    // is requested and uploads everything to the GPU,
+    // the prepared scene isn't referenced after construction
+    SceneData(PreparedScene const & scene, WGPUDevice device, WGPUQueue queue,
+        WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout,
+        BVHLayout bvhLayout = BVHLayout::Binary);
     ~SceneData();
 
+    // Replaces the binary BVH with an LBVH built on the GPU, reordering the
+    // triangles to match. Only supported for BVHLayout::Binary. The triangles
+    // of geometry (the one the scene data was created from) are shuffled before
+    // the build, and the result is checked against the CPU LBVH of the same input
+    void rebuildBVH(WGPUDevice device, WGPUQueue queue, GpuLBVHBuilder & builder, SceneGeometryView const & geometry);
+
+    // Uploads updated geometry, e.g. from DynamicGeometry. Vertex positions and
+    // BVHs are always uploaded, vertex attributes and emissive triangles only if
+    // the triangles were reordered. Buffers are recreated if their size changed.
+    // Only supported for BVHLayout::Binary and scenes without instances
+    void updateGeometry(WGPUDevice device, WGPUQueue queue, SceneGeometryView const & geometry, bool reordered);
+
+    // Uploads moved instances of an instanced scene together with the instance BVH
+    // rebuilt for them by buildInstanceBVH; mesh BVHs are left untouched.
+    // The instance count must not change. The world space copies of emissive
+    // triangles and the light sampling tables aren't rebuilt, so scenes
+    // with emissive instances are rejected
+    void updateInstances(WGPUDevice device, WGPUQueue queue, std::span<SceneInstance const> instances, std::span<BVH::Node const> instanceBvhNodes);
+
     WGPUBuffer vertexPositionsBuffer() const { return vertexPositionsBuffer_; }
     WGPUBuffer vertexAttributesBuffer() const { return vertexAttributesBuffer_; }
 
     std::uint32_t vertexCount() const { return vertexCount_; }
 
+    // Instances buffer starts with a 16 byte header; scenes without instances
+    // have a single identity instance covering all triangles
+    WGPUBuffer instancesBuffer() const { return instancesBuffer_; }
+    std::span<SceneInstance const> instances() const { return instances_; }
+    bool instanced() const { return instanced_; }
+
     WGPUBindGroup geometryBindGroup() const { return geometryBindGroup_; }
     WGPUBindGroup materialBindGroup() const { return materialBindGroup_; }
 
@@ -30,11 +54,20 @@ private:
     WGPUBuffer vertexAttributesBuffer_;
     WGPUBuffer materialBuffer_;
     WGPUBuffer bvhNodesBuffer_;
+    WGPUBuffer wideBvhNodesBuffer_;
+    WGPUBuffer quantizedBvhNodesBuffer_;
     WGPUBuffer emissiveTrianglesBuffer_;
     WGPUBuffer emissiveTrianglesAliasBuffer_;
     WGPUBuffer emissiveBvhNodesBuffer_;
+    WGPUBuffer instancesBuffer_;
+    WGPUBuffer instanceBvhNodesBuffer_;
 
     std::uint32_t vertexCount_;
+    std::uint32_t emissiveTriangleCount_;
+    BVHLayout bvhLayout_;
+    std::vector<SceneInstance> instances_;
+    bool instanced_;
+    bool emissiveInstances_;
 
     WGPUSampler sampler_;
 
@@ -49,7 +82,9 @@ private:
 
     WGPUTexture environmentTexture_;
     WGPUTextureView environmentTextureView_;
+    WGPUBuffer environmentAliasBuffer_;
 
+    WGPUBindGroupLayout geometryBindGroupLayout_;
     WGPUBindGroup geometryBindGroup_;
     WGPUBindGroup materialBindGroup_;
 };
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <webgpu-raytracer/bvh.hpp>
+#include <webgpu-raytracer/alias.hpp>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <span>
+#include <cstdint>
+
+struct VertexAttributes
+{
+    glm::vec3 normal;
+    std::uint32_t materialID;
+    glm::vec4 tangent;
+    glm::vec2 texcoords;
+    char padding[8];
+};
+
+static_assert(sizeof(VertexAttributes) == 48);
+
+struct EmissiveTriangle
+{
+    std::uint32_t index;
+    float probability;
+};
+
+// Placement of a mesh in an instanced scene
+struct SceneInstance
+{
+    // Rows of the affine object-to-world and world-to-object matrices
+    glm::vec4 objectToWorld[3];
+    glm::vec4 worldToObject[3];
+
+    // Root of the mesh BVH within SceneGeometry::bvhNodes
+    std::uint32_t bvhRoot;
+
+    // Mesh triangles, used for rasterization
+    std::uint32_t firstTriangle;
+    std::uint32_t triangleCount;
+
+    std::uint32_t padding = 0;
+};
+
+static_assert(sizeof(SceneInstance) == 112);
+
+// Scene geometry in the exact layout of the corresponding GPU buffers.
+// Without instances, triangles are in world space and bvhNodes is a single
+// BVH over all of them. With instances, every mesh is stored once in object
+// space with its own BVH in bvhNodes, and instanceBvhNodes is a BVH over the
+// world space instance bounds; emissive triangles are additionally stored in
+// world space after the mesh triangles, outside of any BVH, for light sampling
+struct SceneGeometry
+{
+    std::vector<glm::vec4> vertexPositions;
+    std::vector<VertexAttributes> vertexAttributes;
+    std::vector<BVH::Node> bvhNodes;
+    std::vector<EmissiveTriangle> emissiveTriangles;
+    std::vector<AliasRecord> emissiveAliasTable;
+    std::vector<BVH::Node> emissiveBvhNodes;
+    std::vector<SceneInstance> instances;
+    std::vector<BVH::Node> instanceBvhNodes;
+};
+
+// Non-owning view of the scene geometry, pointing either
+// to a SceneGeometry or to a memory-mapped scene cache file
+struct SceneGeometryView
+{
+    std::span<glm::vec4 const> vertexPositions;
+    std::span<VertexAttributes const> vertexAttributes;
+    std::span<BVH::Node const> bvhNodes;
+    std::span<EmissiveTriangle const> emissiveTriangles;
+    std::span<AliasRecord const> emissiveAliasTable;
+    std::span<BVH::Node const> emissiveBvhNodes;
+    std::span<SceneInstance const> instances;
+    std::span<BVH::Node const> instanceBvhNodes;
+
+    SceneGeometryView() = default;
+
+    SceneGeometryView(SceneGeometry const & geometry)
+        : vertexPositions(geometry.vertexPositions)
+        , vertexAttributes(geometry.vertexAttributes)
+        , bvhNodes(geometry.bvhNodes)
+        , emissiveTriangles(geometry.emissiveTriangles)
+        , emissiveAliasTable(geometry.emissiveAliasTable)
+        , emissiveBvhNodes(geometry.emissiveBvhNodes)
+        , instances(geometry.instances)
+        , instanceBvhNodes(geometry.instanceBvhNodes)
+    {}
+};
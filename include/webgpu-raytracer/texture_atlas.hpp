@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+// Packs textures of different sizes into the layers of a single 2D array
+// texture, storing each one at its native resolution. Layers are as large
+// as the largest texture, and textures are placed into horizontal shelves
+// of each layer, first-fit, in order of decreasing height.
+// Mip level k of a texture is placed at offset >> k with size >> k,
+// see mipLevelCount in mipmap.hpp
+struct TextureAtlas
+{
+    struct Placement
+    {
+        std::uint32_t layer;
+        glm::uvec2 offset;
+        glm::uvec2 size;
+        std::uint32_t mipLevelCount;
+    };
+
+    glm::uvec2 layerSize{1};
+    std::uint32_t layerCount = 0;
+    std::uint32_t mipLevelCount = 1;
+
+    // In the same order as the input sizes
+    std::vector<Placement> placements;
+
+    // Offset & size of a texture in level 0 texels,
+    // as expected by sampleAtlas in material.wgsl
+    glm::uvec4 rect(std::uint32_t index) const;
+};
+
+TextureAtlas packTextureAtlas(std::vector<glm::uvec2> const & sizes);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <cstddef>
+
+// Work-stealing thread pool: every worker owns a task deque, pushes
+// and pops its own tasks from the back and steals from the front
+// of other workers' deques when it runs out of work.
+// Threads waiting on a TaskGroup help executing pending tasks, so
+// tasks may freely spawn and wait for other tasks.
+struct ThreadPool
+{
+    // Thread count includes the thread that waits for the tasks,
+    // i.e. a pool with threadCount = 1 doesn't start any workers
+    // and executes everything on the waiting thread.
+    // Zero means std::thread::hardware_concurrency()
+    explicit ThreadPool(std::size_t threadCount = 0);
+    ~ThreadPool();
+
+    std::size_t threadCount() const;
+
+    void submit(std::function<void()> task);
+
+    // Execute a single pending task on the calling thread,
+    // returns false if there were no pending tasks
+    bool runPendingTask();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pimpl_;
+};
+
+struct TaskGroup
+{
+    TaskGroup(ThreadPool & pool);
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+
+    // Rethrows the first exception thrown by any of the tasks
+    void wait();
+
+private:
+    ThreadPool & pool_;
+    std::atomic<std::size_t> pendingCount_{0};
+
+    std::mutex exceptionMutex_;
+    std::exception_ptr exception_;
+};
+
+// Calls body(begin, end) for consecutive ranges of at most grainSize
+// indices covering [0, count). Range boundaries only depend on count
+// and grainSize, not on the number of threads
+void parallelFor(ThreadPool & pool, std::size_t count, std::size_t grainSize, std::function<void(std::size_t begin, std::size_t end)> const & body);
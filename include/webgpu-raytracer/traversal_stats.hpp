@@ -0,0 +1,61 @@
+#pragma once
+
+#include <webgpu.h>
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <cstdint>
+
+// Aggregate BVH traversal cost of the primary rays of a heatmap frame
+struct TraversalHeatmapStats
+{
+    std::uint32_t rayCount = 0;
+    double meanVisitedNodes = 0.0;
+    std::uint32_t maxVisitedNodes = 0;
+
+    // Saturates at the last histogram bin of raytrace_heatmap.wgsl, 1023 nodes
+    std::uint32_t p99VisitedNodes = 0;
+};
+
+// Counters written by raytrace_heatmap.wgsl, read back asynchronously
+// like the profiler timestamps, so that the heatmap doesn't stall the GPU
+struct TraversalStatsBuffer
+{
+    TraversalStatsBuffer(WGPUDevice device);
+    ~TraversalStatsBuffer();
+
+    WGPUBindGroupLayout bindGroupLayout() const { return bindGroupLayout_; }
+    WGPUBindGroup bindGroup() const { return bindGroup_; }
+
+    // Must be recorded before the heatmap dispatch
+    void clear(WGPUCommandEncoder commandEncoder);
+
+    // Copies the counters after the heatmap dispatch,
+    // unless the previous copy is still being read back
+    void resolve(WGPUCommandEncoder commandEncoder);
+
+    // Starts reading back the resolved counters, call after submitting
+    void poll();
+
+    // The most recent stats that have been read back
+    std::optional<TraversalHeatmapStats> stats() const;
+
+private:
+    WGPUBuffer buffer_;
+    WGPUBuffer mapBuffer_;
+    WGPUBindGroupLayout bindGroupLayout_;
+    WGPUBindGroup bindGroup_;
+
+    enum class MapState
+    {
+        Idle,
+        Resolved,
+        Mapping,
+    };
+
+    std::atomic<MapState> mapState_{MapState::Idle};
+
+    mutable std::mutex statsMutex_;
+    std::optional<TraversalHeatmapStats> stats_;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <webgpu-raytracer/bvh.hpp>
+
+#include <glm/glm.hpp>
+
+#include <optional>
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// Node layout used for scene traversal on the GPU
+enum class BVHLayout
+{
+    // BVH::Node as built, one AABB test per node fetch
+    Binary,
+
+    // Collapsed WideBVH with 4 or 8 children per node,
+    // all children are tested per node fetch
+    Wide4,
+    Wide8,
+
+    // Same as Wide4 and Wide8, with child bounds
+    // quantized to 8 bits, see QuantizedWideBVH
+    Wide4Quantized,
+    Wide8Quantized,
+};
+
+// BVH with up to 4 or 8 children per node, collapsed from a binary BVH.
+// A node is width / 4 consecutive child groups; the bounds of the four
+// children of a group are stored as SoA, so that the shader tests them
+// with vector operations. Children keep the left-to-right order of the
+// binary tree, so traversing them in order (or in reverse order, depending
+// on the ray direction along the node axis) is roughly front-to-back
+struct WideBVH
+{
+    struct ChildGroup
+    {
+        glm::vec4 minX;
+        glm::vec4 minY;
+        glm::vec4 minZ;
+        glm::vec4 maxX;
+        glm::vec4 maxY;
+        glm::vec4 maxZ;
+
+        // Wide node index for inner children, first triangle for leaf children.
+        // The top 2 bits of child.x of the first group of a node contain
+        // the node axis, like BVH::Node::leftChildOrFirstTriangle
+        glm::uvec4 child;
+
+        // Zero for inner children, EMPTY_CHILD for unused slots
+        glm::uvec4 triangleCount;
+    };
+
+    static_assert(sizeof(ChildGroup) == 128);
+
+    static constexpr std::uint32_t EMPTY_CHILD = 0xffffffffu;
+
+    // Maximal traversal stack size supported by the shader, see bvh_traverse.wgsl
+    static constexpr std::uint32_t MAX_STACK_SIZE = 64;
+
+    std::uint32_t width = 4;
+    std::vector<ChildGroup> groups;
+
+    // Traversal stack size needed in the worst case, when every child is hit
+    std::uint32_t maxStackSize = 0;
+
+    std::uint32_t nodeCount() const { return groups.size() / (width / 4); }
+};
+
+// Greedily collapses the binary tree top-down: a wide node starts with the
+// two children of a binary node and repeatedly replaces its inner child with
+// the largest surface area by that child's own children, until it has width children
+WideBVH collapseBVH(std::span<BVH::Node const> nodes, std::uint32_t width);
+
+// WideBVH with child bounds quantized to 8 bits relative to the bounds
+// of their child group, half the size of WideBVH::ChildGroup.
+// Quantized bounds are rounded outwards, so they always contain the exact ones
+struct QuantizedWideBVH
+{
+    struct ChildGroup
+    {
+        // Child bounds are origin + q * 2^(e - 127) with e the biased
+        // per-axis exponent stored in bits 0-7, 8-15 and 16-23 of exponents
+        glm::vec3 origin;
+        std::uint32_t exponents;
+
+        // Same as in WideBVH::ChildGroup
+        glm::uvec4 child;
+
+        // Indexed by [axis][lane]
+        std::uint8_t quantizedMin[3][4];
+        std::uint8_t quantizedMax[3][4];
+
+        // Zero for inner children, EMPTY_CHILD for unused slots
+        std::uint16_t triangleCount[4];
+    };
+
+    static_assert(sizeof(ChildGroup) == 64);
+
+    static constexpr std::uint16_t EMPTY_CHILD = 0xffffu;
+
+    std::uint32_t width = 4;
+    std::vector<ChildGroup> groups;
+    std::uint32_t maxStackSize = 0;
+};
+
+// Returns nothing if some leaf has too many triangles to be stored in the
+// quantized format, or if some child bounds can't be quantized conservatively
+// (every decoded child box is checked to contain the exact child bounds)
+std::optional<QuantizedWideBVH> quantizeBVH(WideBVH const & bvh);
+
+// Inverse of quantization, matches decoding in bvh_traverse.wgsl
+WideBVH::ChildGroup decodeChildGroup(QuantizedWideBVH::ChildGroup const & group);
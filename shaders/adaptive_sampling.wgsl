@@ -0,0 +1,74 @@
+use math.wgsl;
+
+// Builds the sample allocation map of adaptive sampling, see adaptive_sampling.cpp:
+// every 8x8 tile with a pixel that hasn't converged yet is appended to activeTiles,
+// and the tile count becomes the indirect dispatch size of computeAdaptive
+// in raytrace_monte_carlo.wgsl
+
+const ADAPTIVE_TILE_SIZE = 8u;
+
+// Dark pixels are compared against this luminance instead,
+// otherwise their relative error would never get small
+const ADAPTIVE_MIN_LUMINANCE = 0.01;
+
+struct AdaptiveSamplingParams
+{
+	screenSize : vec2u,
+	minSampleCount : u32,
+	targetRelativeError : f32,
+}
+
+struct AdaptiveSamplingState
+{
+	// Indirect dispatch arguments, one workgroup per active tile
+	activeTileCount : atomic<u32>,
+	dispatchY : u32,
+	dispatchZ : u32,
+	// Mean sample count of every tile, summed over the tiles
+	tileSampleCountSum : atomic<u32>,
+}
+
+@group(0) @binding(0) var<uniform> params : AdaptiveSamplingParams;
+@group(0) @binding(1) var accumulationTexture : texture_storage_2d<rgba32float, read_write>;
+@group(0) @binding(2) var<storage, read> sampleCounts : array<u32>;
+@group(0) @binding(3) var<storage, read_write> activeTiles : array<u32>;
+@group(0) @binding(4) var<storage, read_write> state : AdaptiveSamplingState;
+
+var<workgroup> tileActive : atomic<u32>;
+var<workgroup> tileSampleCount : atomic<u32>;
+
+// Standard error of the mean luminance relative to the luminance itself; the
+// accumulated alpha channel holds the mean squared luminance of the samples
+fn relativeError(pixel : vec2u, sampleCount : u32) -> f32 {
+	let accumulated = textureLoad(accumulationTexture, pixel);
+	let meanLuminance = luminance(accumulated.rgb);
+	let variance = max(0.0, accumulated.a - meanLuminance * meanLuminance);
+
+	return sqrt(variance / f32(sampleCount)) / max(meanLuminance, ADAPTIVE_MIN_LUMINANCE);
+}
+
+@compute @workgroup_size(ADAPTIVE_TILE_SIZE, ADAPTIVE_TILE_SIZE)
+fn buildSampleMap(@builtin(global_invocation_id) id : vec3u, @builtin(workgroup_id) tile : vec3u, @builtin(local_invocation_index) localIndex : u32) {
+	// No early return, all invocations must reach the barrier
+	if (id.x < params.screenSize.x && id.y < params.screenSize.y) {
+		let sampleCount = sampleCounts[id.x + id.y * params.screenSize.x];
+
+		atomicAdd(&tileSampleCount, sampleCount);
+
+		if (sampleCount < max(1u, params.minSampleCount) || relativeError(id.xy, sampleCount) > params.targetRelativeError) {
+			atomicStore(&tileActive, 1u);
+		}
+	}
+
+	workgroupBarrier();
+
+	if (localIndex == 0u) {
+		let tileSize = min(vec2u(ADAPTIVE_TILE_SIZE), params.screenSize - tile.xy * ADAPTIVE_TILE_SIZE);
+		atomicAdd(&state.tileSampleCountSum, atomicLoad(&tileSampleCount) / (tileSize.x * tileSize.y));
+
+		if (atomicLoad(&tileActive) != 0u) {
+			let slot = atomicAdd(&state.activeTileCount, 1u);
+			activeTiles[slot] = tile.x | (tile.y << 16u);
+		}
+	}
+}
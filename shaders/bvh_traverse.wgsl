@@ -1,37 +1,86 @@
 // N.B.: this file expects that the following global arrays are defined:
 //     vertexPositions
+//     vertexAttributes
 //     bvhNodes
+//     wideBvhNodes
+//     quantizedBvhNodes
 //     emissiveTriangles
 //     emissiveBvhNodes
+//     instances
+//     instanceBvhNodes
 
 struct SceneIntersection
 {
 	intersects : bool,
 	distance : f32,
 	triangleID : u32,
+	// NO_INSTANCE for scenes without instances
+	instanceID : u32,
+	// In world space
 	vertices : array<vec3f, 3>,
 	uv : vec2f,
 	visitedNodeCount : u32,
 	intersectedNodeCount : u32,
 }
 
-fn intersectScene(ray : Ray) -> SceneIntersection {
-	var result = SceneIntersection(
+fn emptySceneIntersection() -> SceneIntersection {
+	return SceneIntersection(
 		false,
 		1e30,
 		0u,
+		NO_INSTANCE,
 		array<vec3f, 3>(vec3f(0.0), vec3f(0.0), vec3f(0.0)),
 		vec2f(0.0),
 		0u,
 		0u
 	);
+}
+
+fn intersectLeafTriangles(ray : Ray, firstTriangle : u32, triangleCount : u32, result : ptr<function, SceneIntersection>) {
+	for (var i = 0u; i < triangleCount; i += 1u) {
+		let triangleID = firstTriangle + i;
+
+		let v0 = vertexPositions[3 * triangleID + 0u].xyz;
+		let v1 = vertexPositions[3 * triangleID + 1u].xyz;
+		let v2 = vertexPositions[3 * triangleID + 2u].xyz;
+
+		let hit = intersectRayTriangle(ray, v0, v1, v2);
+		if (hit.intersects && hit.distance < (*result).distance) {
+			(*result).intersects = true;
+			(*result).distance = hit.distance;
+			(*result).triangleID = triangleID;
+			(*result).vertices[0] = v0;
+			(*result).vertices[1] = v1;
+			(*result).vertices[2] = v2;
+			(*result).uv = hit.uv;
+		}
+	}
+}
+
+fn intersectScene(ray : Ray) -> SceneIntersection {
+	if (instances.count.x > 0u) {
+		return intersectSceneInstanced(ray);
+	} else if (wideBvhNodes.groupsPerNode.x > 0u) {
+		return intersectSceneWide(ray);
+	} else {
+		return intersectSceneBinary(ray);
+	}
+}
+
+fn intersectSceneBinary(ray : Ray) -> SceneIntersection {
+	var result = emptySceneIntersection();
+	traverseBinaryBVH(ray, 0u, &result);
+	return result;
+}
 
+// Finds hits closer than the current result in the binary BVH rooted at root
+fn traverseBinaryBVH(ray : Ray, root : u32, result : ptr<function, SceneIntersection>) {
 	var nodeStack = array<u32, MAX_BVH_STACK_SIZE>();
 	var nodeStackSize = 0u;
-	var currentNodeID = 0u;
+	var currentNodeID = root;
 
 	while (true) {
-		result.visitedNodeCount += 1u;
+		(*result).visitedNodeCount += 1u;
 
 		let node = bvhNodes[currentNodeID];
 
@@ -40,7 +89,7 @@ fn intersectScene(ray : Ray) -> SceneIntersection {
 
 		let hit = intersectRayAABB(ray, node.aabbMin.xyz, node.aabbMax.xyz);
 
-		if (!hit.intersects || hit.distance > result.distance) {
+		if (!hit.intersects || hit.distance > (*result).distance) {
 			if (nodeStackSize > 0u) {
 				currentNodeID = nodeStack[nodeStackSize - 1u];
 				nodeStackSize -= 1u;
@@ -50,27 +99,10 @@ fn intersectScene(ray : Ray) -> SceneIntersection {
 			}
 		}
 
-		result.intersectedNodeCount += 1u;
+		(*result).intersectedNodeCount += 1u;
 
 		if (triangleCount > 0) {
-			for (var i = 0u; i < triangleCount; i += 1u) {
-				let triangleID = leftChildOrFirstTriangle + i;
-
-				let v0 = vertexPositions[3 * triangleID + 0u].xyz;
-				let v1 = vertexPositions[3 * triangleID + 1u].xyz;
-				let v2 = vertexPositions[3 * triangleID + 2u].xyz;
-
-				let hit = intersectRayTriangle(ray, v0, v1, v2);
-				if (hit.intersects && hit.distance < result.distance) {
-					result.intersects = true;
-					result.distance = hit.distance;
-					result.triangleID = triangleID;
-					result.vertices[0] = v0;
-					result.vertices[1] = v1;
-					result.vertices[2] = v2;
-					result.uv = hit.uv;
-				}
-			}
+			intersectLeafTriangles(ray, leftChildOrFirstTriangle, triangleCount, result);
 
 			if (nodeStackSize > 0u) {
 				currentNodeID = nodeStack[nodeStackSize - 1u];
@@ -94,6 +126,252 @@ fn intersectScene(ray : Ray) -> SceneIntersection {
 			nodeStackSize += 1u;
 		}
 	}
+}
+
+// Two-level traversal: the instance BVH over world space instance bounds,
+// then the mesh BVH of every instance hit with the ray in object space.
+// Affine transforms keep the ray parameter, so distances stay comparable
+fn intersectSceneInstanced(ray : Ray) -> SceneIntersection {
+	var result = emptySceneIntersection();
+
+	var nodeStack = array<u32, MAX_BVH_STACK_SIZE>();
+	var nodeStackSize = 0u;
+	var currentNodeID = 0u;
+
+	while (true) {
+		result.visitedNodeCount += 1u;
+
+		let node = instanceBvhNodes[currentNodeID];
+
+		let leftChildOrFirstInstance = bitcast<u32>(node.aabbMin.w);
+		let instanceCount = bitcast<u32>(node.aabbMax.w);
+
+		let hit = intersectRayAABB(ray, node.aabbMin.xyz, node.aabbMax.xyz);
+
+		if (hit.intersects && hit.distance <= result.distance) {
+			result.intersectedNodeCount += 1u;
+
+			if (instanceCount > 0u) {
+				for (var i = 0u; i < instanceCount; i += 1u) {
+					let instanceID = leftChildOrFirstInstance + i;
+					let instance = instances.instances[instanceID];
+
+					let objectRay = Ray(transformPoint(instance.worldToObject, ray.origin), transformVector(instance.worldToObject, ray.direction));
+
+					let previousDistance = result.distance;
+					traverseBinaryBVH(objectRay, instance.bvhRoot, &result);
+
+					if (result.distance < previousDistance) {
+						result.instanceID = instanceID;
+					}
+				}
+			} else {
+				let firstChild = leftChildOrFirstInstance & (~BVH_NODE_AXIS_MASK);
+
+				// Ordered traversal: visit closer child first (i.e. put closer child higher on the stack)
+
+				let nodeAxis = leftChildOrFirstInstance >> BVH_NODE_AXIS_SHIFT;
+
+				let positive = u32(ray.direction[nodeAxis] > 0.0);
+
+				nodeStack[nodeStackSize] = firstChild + positive;
+				currentNodeID = firstChild + (1u - positive);
+
+				nodeStackSize += 1u;
+				continue;
+			}
+		}
+
+		if (nodeStackSize > 0u) {
+			currentNodeID = nodeStack[nodeStackSize - 1u];
+			nodeStackSize -= 1u;
+		} else {
+			break;
+		}
+	}
+
+	if (result.instanceID != NO_INSTANCE) {
+		let objectToWorld = instances.instances[result.instanceID].objectToWorld;
+		for (var k = 0u; k < 3u; k += 1u) {
+			result.vertices[k] = transformPoint(objectToWorld, result.vertices[k]);
+		}
+	}
+
+	return result;
+}
+
+// Vertex k of the intersected triangle with the normal and tangent in world space
+fn intersectionVertexAttributes(intersection : SceneIntersection, k : u32) -> Vertex {
+	var attributes = vertexAttributes[3u * intersection.triangleID + k];
+
+	if (intersection.instanceID != NO_INSTANCE) {
+		let instance = instances.instances[intersection.instanceID];
+		attributes.normal = normalize(transformNormal(instance.worldToObject, attributes.normal));
+		attributes.tangent = vec4f(normalize(transformVector(instance.objectToWorld, attributes.tangent.xyz)), attributes.tangent.w);
+	}
+
+	return attributes;
+}
+
+// Rebuilds a hit found by intersectScene from the parts of it that
+// were stored separately, e.g. in the hit queue of the wavefront renderer
+fn loadSceneIntersection(distance : f32, triangleID : u32, instanceID : u32, uv : vec2f) -> SceneIntersection {
+	var result = emptySceneIntersection();
+	result.intersects = true;
+	result.distance = distance;
+	result.triangleID = triangleID;
+	result.instanceID = instanceID;
+	result.uv = uv;
+
+	for (var k = 0u; k < 3u; k += 1u) {
+		result.vertices[k] = vertexPositions[3u * triangleID + k].xyz;
+	}
+
+	if (instanceID != NO_INSTANCE) {
+		let objectToWorld = instances.instances[instanceID].objectToWorld;
+		for (var k = 0u; k < 3u; k += 1u) {
+			result.vertices[k] = transformPoint(objectToWorld, result.vertices[k]);
+		}
+	}
+
+	return result;
+}
+
+fn unpackQuantizedBounds(packed : u32, origin : f32, scale : f32) -> vec4f {
+	let quantized = (vec4u(packed) >> vec4u(0u, 8u, 16u, 24u)) & vec4u(255u);
+	return origin + vec4f(quantized) * scale;
+}
+
+fn loadWideBVHChildGroup(index : u32) -> WideBVHChildGroup {
+	if (wideBvhNodes.groupsPerNode.y == 0u) {
+		return wideBvhNodes.groups[index];
+	}
+
+	let group = quantizedBvhNodes[index];
+
+	// Scale is 2^(e - 127), i.e. a float with the biased exponent e and zero mantissa
+	let scale = bitcast<vec3f>(((vec3u(group.exponents) >> vec3u(0u, 8u, 16u)) & vec3u(255u)) << vec3u(23u));
+
+	let triangleCount = (group.triangleCount.xxyy >> vec4u(0u, 16u, 0u, 16u)) & vec4u(0xffffu);
+
+	return WideBVHChildGroup(
+		unpackQuantizedBounds(group.quantizedBounds[0], group.origin.x, scale.x),
+		unpackQuantizedBounds(group.quantizedBounds[1], group.origin.y, scale.y),
+		unpackQuantizedBounds(group.quantizedBounds[2], group.origin.z, scale.z),
+		unpackQuantizedBounds(group.quantizedBounds[3], group.origin.x, scale.x),
+		unpackQuantizedBounds(group.quantizedBounds[4], group.origin.y, scale.y),
+		unpackQuantizedBounds(group.quantizedBounds[5], group.origin.z, scale.z),
+		group.child,
+		select(triangleCount, vec4u(WIDE_BVH_EMPTY_CHILD), triangleCount == vec4u(0xffffu))
+	);
+}
+
+fn intersectSceneWide(ray : Ray) -> SceneIntersection {
+	var result = emptySceneIntersection();
+
+	let groupsPerNode = wideBvhNodes.groupsPerNode.x;
+	let width = 4u * groupsPerNode;
+
+	let inverseDirection = 1.0 / ray.direction;
+
+	// Each stack entry keeps the entry distance of the node,
+	// so that nodes behind the closest hit found so far are skipped
+	var nodeStack = array<u32, MAX_WIDE_BVH_STACK_SIZE>();
+	var distanceStack = array<f32, MAX_WIDE_BVH_STACK_SIZE>();
+	var nodeStackSize = 0u;
+	var currentNodeID = 0u;
+
+	while (true) {
+		result.visitedNodeCount += 1u;
+
+		// Test all children of the node at once, 4 per child group
+
+		var childHit = array<bool, MAX_WIDE_BVH_WIDTH>();
+		var childDistance = array<f32, MAX_WIDE_BVH_WIDTH>();
+		var childID = array<u32, MAX_WIDE_BVH_WIDTH>();
+		var childTriangleCount = array<u32, MAX_WIDE_BVH_WIDTH>();
+		var nodeAxis = 0u;
+
+		for (var g = 0u; g < groupsPerNode; g += 1u) {
+			let group = loadWideBVHChildGroup(currentNodeID * groupsPerNode + g);
+
+			let tMinX = (group.minX - ray.origin.x) * inverseDirection.x;
+			let tMaxX = (group.maxX - ray.origin.x) * inverseDirection.x;
+			let tMinY = (group.minY - ray.origin.y) * inverseDirection.y;
+			let tMaxY = (group.maxY - ray.origin.y) * inverseDirection.y;
+			let tMinZ = (group.minZ - ray.origin.z) * inverseDirection.z;
+			let tMaxZ = (group.maxZ - ray.origin.z) * inverseDirection.z;
+
+			let t0 = max(min(tMinX, tMaxX), max(min(tMinY, tMaxY), min(tMinZ, tMaxZ)));
+			let t1 = min(max(tMinX, tMaxX), min(max(tMinY, tMaxY), max(tMinZ, tMaxZ)));
+
+			let distance = max(t0, vec4f(0.0));
+			let hit = (group.triangleCount != vec4u(WIDE_BVH_EMPTY_CHILD)) & (t1 >= t0) & (t1 >= vec4f(0.0)) & (distance <= vec4f(result.distance));
+
+			var child = group.child;
+			if (g == 0u) {
+				nodeAxis = child.x >> BVH_NODE_AXIS_SHIFT;
+				child.x &= ~BVH_NODE_AXIS_MASK;
+			}
+
+			for (var lane = 0u; lane < 4u; lane += 1u) {
+				childHit[4u * g + lane] = hit[lane];
+				childDistance[4u * g + lane] = distance[lane];
+				childID[4u * g + lane] = child[lane];
+				childTriangleCount[4u * g + lane] = group.triangleCount[lane];
+			}
+		}
+
+		// Ordered traversal: children are ordered along the node axis, so
+		// process them in reverse for rays going in the negative direction.
+		// Leaves are intersected right away, inner children are collected
+
+		let reverse = ray.direction[nodeAxis] <= 0.0;
+
+		var innerChildID = array<u32, MAX_WIDE_BVH_WIDTH>();
+		var innerChildDistance = array<f32, MAX_WIDE_BVH_WIDTH>();
+		var innerChildCount = 0u;
+
+		for (var k = 0u; k < width; k += 1u) {
+			let i = select(k, width - 1u - k, reverse);
+
+			if (!childHit[i] || childDistance[i] > result.distance) {
+				continue;
+			}
+
+			result.intersectedNodeCount += 1u;
+
+			if (childTriangleCount[i] > 0u) {
+				intersectLeafTriangles(ray, childID[i], childTriangleCount[i], &result);
+			} else {
+				innerChildID[innerChildCount] = childID[i];
+				innerChildDistance[innerChildCount] = childDistance[i];
+				innerChildCount += 1u;
+			}
+		}
+
+		// Put closer children higher on the stack
+
+		for (var k = innerChildCount; k > 0u; k -= 1u) {
+			nodeStack[nodeStackSize] = innerChildID[k - 1u];
+			distanceStack[nodeStackSize] = innerChildDistance[k - 1u];
+			nodeStackSize += 1u;
+		}
+
+		var found = false;
+		while (nodeStackSize > 0u) {
+			nodeStackSize -= 1u;
+			if (distanceStack[nodeStackSize] <= result.distance) {
+				currentNodeID = nodeStack[nodeStackSize];
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			break;
+		}
+	}
 
 	return result;
 }
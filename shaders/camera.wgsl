@@ -4,6 +4,13 @@ struct Camera
 	viewProjectionInverseMatrix : mat4x4f,
 	position: vec3f,
 	screenSize : vec2u,
-	frameID : u32,
-	globalFrameID : u32,
+	// Samples per pixel accumulated before this dispatch
+	sampleID : u32,
+	// Random seed of the first sample of this dispatch, not reset with the accumulation
+	globalSampleID : u32,
+	// See PathTracingOptions
+	maxPathDepth : u32,
+	russianRouletteDepth : u32,
+	// Samples per pixel traced by this dispatch, see FrameBudgetOptions
+	sampleCount : u32,
 }
@@ -3,6 +3,9 @@ use tonemap.wgsl;
 struct ComposeUniforms
 {
 	exposure : f32,
+	// Nonzero when the accumulation texture holds traversal costs of
+	// raytrace_heatmap.wgsl; visited node count at the top of the colour ramp
+	heatmapRange : f32,
 }
 
 @group(0) @binding(0) var accumulationTexture : texture_2d<f32>;
@@ -22,8 +25,35 @@ fn vertexMain(@builtin(vertex_index) index : u32) -> @builtin(position) vec4f {
 	}
 }
 
+// Polynomial approximation of the Turbo colour map, see
+// https://research.google/blog/turbo-an-improved-rainbow-colormap-for-visualization/
+// The result is already display-referred, no gamma correction needed
+fn turboColorMap(value : f32) -> vec3f {
+	let redVec4 = vec4f(0.13572138, 4.61539260, -42.66032258, 132.13108234);
+	let greenVec4 = vec4f(0.09140261, 2.19418839, 4.84296658, -14.18503333);
+	let blueVec4 = vec4f(0.10667330, 12.64194608, -60.58204836, 110.36276771);
+	let redVec2 = vec2f(-152.94239396, 59.28637943);
+	let greenVec2 = vec2f(4.27729857, 2.82956604);
+	let blueVec2 = vec2f(-89.90310912, 27.34824973);
+
+	let x = saturate(value);
+	let v4 = vec4f(1.0, x, x * x, x * x * x);
+	let v2 = v4.zw * v4.z;
+
+	return vec3f(
+		dot(v4, redVec4) + dot(v2, redVec2),
+		dot(v4, greenVec4) + dot(v2, greenVec2),
+		dot(v4, blueVec4) + dot(v2, blueVec2)
+	);
+}
+
 @fragment
 fn fragmentMain(@builtin(position) fragmentPosition : vec4f) -> @location(0) vec4f {
-	let linearColor = textureLoad(accumulationTexture, vec2i(fragmentPosition.xy), 0).rgb;
-	return vec4f(gammaCorrect(tonemap(linearColor * composeUniforms.exposure)), 1.0);
+	let accumulated = textureLoad(accumulationTexture, vec2i(fragmentPosition.xy), 0);
+
+	if (composeUniforms.heatmapRange > 0.0) {
+		return vec4f(turboColorMap(accumulated.r / composeUniforms.heatmapRange), 1.0);
+	}
+
+	return vec4f(gammaCorrect(tonemap(accumulated.rgb * composeUniforms.exposure)), 1.0);
 }
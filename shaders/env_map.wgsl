@@ -9,3 +9,20 @@ fn sampleEnvMap(environmentMap: texture_storage_2d<rgba32float, read>, direction
 
 	return min(vec3f(MAX_ENV_MAP_INTENSITY), textureLoad(environmentMap, vec2u(dimensions * vec2f(x, y))).xyz);
 }
+
+struct EnvMapAliasTable
+{
+	// Sum of the pixel weights, zero if the environment map is black
+	totalWeight : f32,
+
+	// Alias table over rows (one record per row) followed by
+	// an alias table over the pixels of each row
+	records : array<vec2u>,
+}
+
+// Inverse of the mapping used in sampleEnvMap
+fn envMapDirection(texcoord : vec2f) -> vec3f {
+	let azimuth = (texcoord.x - 0.5) * 2.0 * PI;
+	let elevation = (0.5 - texcoord.y) * PI;
+	return vec3f(cos(elevation) * cos(azimuth), sin(elevation), cos(elevation) * sin(azimuth));
+}
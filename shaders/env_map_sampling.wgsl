@@ -0,0 +1,48 @@
+use math.wgsl;
+
+// Expects environmentMap and environmentAliasTable to be declared
+
+// Sample a direction in proportion to the environment map pixel luminance
+// times the solid angle of the pixel
+fn sampleEnvMapDirection(randomState : ptr<function, RandomState>) -> vec3f {
+	let dimensions = textureDimensions(environmentMap);
+
+	let rowPick = f32(dimensions.y) * uniformFloat(randomState);
+	var row = min(dimensions.y - 1u, u32(floor(rowPick)));
+	let rowRecord = environmentAliasTable.records[row];
+	if (rowPick - f32(row) > bitcast<f32>(rowRecord.x)) {
+		row = rowRecord.y;
+	}
+
+	let columnPick = f32(dimensions.x) * uniformFloat(randomState);
+	var column = min(dimensions.x - 1u, u32(floor(columnPick)));
+	let columnRecord = environmentAliasTable.records[dimensions.y + row * dimensions.x + column];
+	if (columnPick - f32(column) > bitcast<f32>(columnRecord.x)) {
+		column = columnRecord.y;
+	}
+
+	let texcoord = (vec2f(f32(column), f32(row)) + vec2f(uniformFloat(randomState), uniformFloat(randomState))) / vec2f(dimensions);
+	return envMapDirection(texcoord);
+}
+
+// Solid angle probability density of sampleEnvMapDirection generating a direction
+fn envMapSamplingProbability(direction : vec3f) -> f32 {
+	if (environmentAliasTable.totalWeight <= 0.0) {
+		return 0.0;
+	}
+
+	let dimensions = vec2f(textureDimensions(environmentMap));
+	let x = atan2(direction.z, direction.x) / PI * 0.5 + 0.5;
+	let y = -atan2(direction.y, length(direction.xz)) / PI + 0.5;
+	let pixel = min(vec2u(dimensions * vec2f(x, y)), vec2u(dimensions) - vec2u(1u));
+
+	let color = min(vec3f(MAX_ENV_MAP_INTENSITY), textureLoad(environmentMap, pixel).xyz);
+
+	// Pixel weight uses the solid angle at the row center, while the
+	// density is with respect to the solid angle at the actual direction
+	let rowElevation = (0.5 - (f32(pixel.y) + 0.5) / dimensions.y) * PI;
+	let elevation = atan2(direction.y, length(direction.xz));
+
+	let pixelProbability = luminance(color) * cos(rowElevation) / environmentAliasTable.totalWeight;
+	return pixelProbability * dimensions.x * dimensions.y / (2.0 * PI * PI * max(cos(elevation), 1e-6));
+}
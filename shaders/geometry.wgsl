@@ -14,11 +14,57 @@ struct BVHNode
 	aabbMax : vec4f,
 }
 
-const MAX_BVH_DEPTH = 32u;
+// Same as BVH::MAX_DEPTH
+const MAX_BVH_DEPTH = 64u;
 const MAX_BVH_STACK_SIZE = MAX_BVH_DEPTH + 1u;
 const BVH_NODE_AXIS_MASK = 3u << 30u;
 const BVH_NODE_AXIS_SHIFT = 30u;
 
+// Four children of a wide BVH node, see WideBVH::ChildGroup
+struct WideBVHChildGroup
+{
+	minX : vec4f,
+	minY : vec4f,
+	minZ : vec4f,
+	maxX : vec4f,
+	maxY : vec4f,
+	maxZ : vec4f,
+	// Wide node index for inner children, first triangle for leaves;
+	// child.x of the first group of a node also contains the node axis
+	child : vec4u,
+	// Zero for inner children, WIDE_BVH_EMPTY_CHILD for unused slots
+	triangleCount : vec4u,
+}
+
+struct WideBVHNodeArray
+{
+	// groupsPerNode.x is width / 4, or 0 if the binary BVH should be used instead
+	// groupsPerNode.y is 1 if the child groups are quantized and stored in a
+	// QuantizedBVHChildGroup array instead
+	groupsPerNode : vec4u,
+
+	groups : array<WideBVHChildGroup>,
+}
+
+// Four children of a wide BVH node with 8-bit quantized bounds,
+// see QuantizedWideBVH::ChildGroup
+struct QuantizedBVHChildGroup
+{
+	// Bounds are origin + q * 2^(e - 127), where the biased exponents e
+	// are bytes 0, 1, 2 of exponents
+	origin : vec3f,
+	exponents : u32,
+	child : vec4u,
+	// Four bytes per u32, one per child: minX, minY, minZ, maxX, maxY, maxZ
+	quantizedBounds : array<u32, 6>,
+	// 16 bits per child, 0xffff for unused slots
+	triangleCount : vec2u,
+}
+
+const MAX_WIDE_BVH_WIDTH = 8u;
+const MAX_WIDE_BVH_STACK_SIZE = 64u;
+const WIDE_BVH_EMPTY_CHILD = 0xffffffffu;
+
 struct TriangleArray {
 	// count.y is unused
 	count : vec2u,
@@ -27,3 +73,36 @@ struct TriangleArray {
 	// triangle.y is triangle weight (sampling probability)
 	triangles : array<vec2u>,
 }
+
+// See SceneInstance
+struct Instance {
+	// Rows of the affine transformation matrices
+	objectToWorld : array<vec4f, 3>,
+	worldToObject : array<vec4f, 3>,
+	bvhRoot : u32,
+	firstTriangle : u32,
+	triangleCount : u32,
+	padding : u32,
+}
+
+struct InstanceArray {
+	// count.x is the instance count, or 0 if the scene isn't instanced
+	count : vec4u,
+
+	instances : array<Instance>,
+}
+
+const NO_INSTANCE = 0xffffffffu;
+
+fn transformPoint(rows : array<vec4f, 3>, p : vec3f) -> vec3f {
+	return vec3f(dot(rows[0], vec4f(p, 1.0)), dot(rows[1], vec4f(p, 1.0)), dot(rows[2], vec4f(p, 1.0)));
+}
+
+fn transformVector(rows : array<vec4f, 3>, v : vec3f) -> vec3f {
+	return vec3f(dot(rows[0].xyz, v), dot(rows[1].xyz, v), dot(rows[2].xyz, v));
+}
+
+// Multiplies by the transpose of the matrix, e.g. normals by worldToObject
+fn transformNormal(rows : array<vec4f, 3>, n : vec3f) -> vec3f {
+	return rows[0].xyz * n.x + rows[1].xyz * n.y + rows[2].xyz * n.z;
+}
@@ -0,0 +1,406 @@
+use geometry.wgsl;
+
+// Linear BVH builder, the GPU counterpart of BVHBuildOptions::Method::LBVH in bvh.cpp:
+//     1. computeCentroidBounds: bounds of the triangle centroids
+//     2. computeMortonCodes: (code, triangle) pairs
+//     3. radixHistogram, radixScan, radixScatter: stable LSD radix sort
+//        of the pairs by code, 8 bits per pass
+//     4. emitHierarchy: radix tree over the sorted codes, see
+//        Tero Karras, Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees (2012)
+//     5. refit: bottom-up node bounds, the second thread to reach a node continues upwards
+//     6. gatherTriangles, remapEmissiveTriangles: reorder triangles to match the leaves
+// The children of internal node i are stored at 1 + 2 * i and 2 + 2 * i, so that
+// they are adjacent as BVHNode requires; the root is node 0
+
+struct LBVHParams
+{
+	triangleCount : u32,
+	// Bit offset of the radix sort pass
+	sortShift : u32,
+	// Number of RADIX_TILE_SIZE tiles covering the triangles
+	tileCount : u32,
+	padding : u32,
+}
+
+// Floats are stored as order-preserving uints, minima are stored
+// inverted, so that zero-initialized values are neutral for atomicMax
+struct LBVHState
+{
+	centroidMin : array<atomic<u32>, 3>,
+	centroidMax : array<atomic<u32>, 3>,
+	maxDepth : atomic<u32>,
+	padding : u32,
+}
+
+struct LBVHRefitNode
+{
+	arrivals : atomic<u32>,
+	axis : u32,
+	aabbMin : array<atomic<u32>, 3>,
+	aabbMax : array<atomic<u32>, 3>,
+}
+
+@group(0) @binding(0) var<uniform> params : LBVHParams;
+@group(0) @binding(1) var<storage, read> vertexPositions : array<vec4f>;
+@group(0) @binding(2) var<storage, read> vertexAttributes : array<Vertex>;
+@group(0) @binding(3) var<storage, read_write> state : LBVHState;
+// (Morton code, triangle) pairs
+@group(0) @binding(4) var<storage, read_write> pairs : array<vec2u>;
+@group(0) @binding(5) var<storage, read_write> sortedPairs : array<vec2u>;
+// Digit-major per-tile digit counts, exclusive prefix sums after radixScan
+@group(0) @binding(6) var<storage, read_write> histograms : array<u32>;
+// (parent internal node << 1) | (1 if right child), internal nodes first, then leaves
+@group(0) @binding(7) var<storage, read_write> parents : array<u32>;
+@group(0) @binding(8) var<storage, read_write> refitNodes : array<LBVHRefitNode>;
+@group(0) @binding(9) var<storage, read_write> nodes : array<BVHNode>;
+@group(0) @binding(10) var<storage, read_write> sortedVertexPositions : array<vec4f>;
+@group(0) @binding(11) var<storage, read_write> sortedVertexAttributes : array<Vertex>;
+// Sorted index of every input triangle
+@group(0) @binding(12) var<storage, read_write> inversePermutation : array<u32>;
+@group(0) @binding(13) var<storage, read_write> emissiveTriangles : TriangleArray;
+
+const LBVH_WORKGROUP_SIZE = 256u;
+const RADIX_TILE_SIZE = 256u;
+const RADIX_DIGIT_COUNT = 256u;
+const MORTON_MAX_COORDINATE = 1023.0;
+
+fn orderedFloat(value : f32) -> u32 {
+	let bits = bitcast<u32>(value);
+	return select(bits | 0x80000000u, ~bits, (bits & 0x80000000u) != 0u);
+}
+
+fn unorderedFloat(value : u32) -> f32 {
+	return bitcast<f32>(select(~value, value & 0x7fffffffu, (value & 0x80000000u) != 0u));
+}
+
+struct TriangleBounds
+{
+	aabbMin : vec3f,
+	aabbMax : vec3f,
+}
+
+fn triangleBounds(triangleID : u32) -> TriangleBounds {
+	let v0 = vertexPositions[3u * triangleID + 0u].xyz;
+	let v1 = vertexPositions[3u * triangleID + 1u].xyz;
+	let v2 = vertexPositions[3u * triangleID + 2u].xyz;
+
+	return TriangleBounds(min(min(v0, v1), v2), max(max(v0, v1), v2));
+}
+
+fn triangleCentroid(triangleID : u32) -> vec3f {
+	let bounds = triangleBounds(triangleID);
+	return (bounds.aabbMin + bounds.aabbMax) * 0.5;
+}
+
+var<workgroup> workgroupCentroidMin : array<atomic<u32>, 3>;
+var<workgroup> workgroupCentroidMax : array<atomic<u32>, 3>;
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn computeCentroidBounds(@builtin(global_invocation_id) id : vec3u, @builtin(local_invocation_index) localIndex : u32) {
+	if (id.x < params.triangleCount) {
+		let centroid = triangleCentroid(id.x);
+		for (var axis = 0u; axis < 3u; axis += 1u) {
+			atomicMax(&workgroupCentroidMin[axis], ~orderedFloat(centroid[axis]));
+			atomicMax(&workgroupCentroidMax[axis], orderedFloat(centroid[axis]));
+		}
+	}
+
+	workgroupBarrier();
+
+	if (localIndex < 3u) {
+		atomicMax(&state.centroidMin[localIndex], atomicLoad(&workgroupCentroidMin[localIndex]));
+		atomicMax(&state.centroidMax[localIndex], atomicLoad(&workgroupCentroidMax[localIndex]));
+	}
+}
+
+// 2^(9 - floor(log2(extent))), matches mortonScale in bvh.cpp
+fn mortonScale(extent : f32) -> f32 {
+	if (!(extent > 0.0)) {
+		return 0.0;
+	}
+
+	let biasedExponent = i32(bitcast<u32>(extent) >> 23u);
+	return bitcast<f32>(u32(clamp(263 - biasedExponent, 1, 254)) << 23u);
+}
+
+fn expandMortonBits(value : u32) -> u32 {
+	var v = value;
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn computeMortonCodes(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= params.triangleCount) {
+		return;
+	}
+
+	let centroidMin = vec3f(
+		unorderedFloat(~atomicLoad(&state.centroidMin[0])),
+		unorderedFloat(~atomicLoad(&state.centroidMin[1])),
+		unorderedFloat(~atomicLoad(&state.centroidMin[2]))
+	);
+
+	let centroidMax = vec3f(
+		unorderedFloat(atomicLoad(&state.centroidMax[0])),
+		unorderedFloat(atomicLoad(&state.centroidMax[1])),
+		unorderedFloat(atomicLoad(&state.centroidMax[2]))
+	);
+
+	let centroid = triangleCentroid(id.x);
+
+	var code = 0u;
+	for (var axis = 0u; axis < 3u; axis += 1u) {
+		let q = min((centroid[axis] - centroidMin[axis]) * mortonScale(centroidMax[axis] - centroidMin[axis]), MORTON_MAX_COORDINATE);
+		code |= expandMortonBits(u32(max(q, 0.0))) << (2u - axis);
+	}
+
+	pairs[id.x] = vec2u(code, id.x);
+}
+
+fn radixDigit(key : u32) -> u32 {
+	return (key >> params.sortShift) & (RADIX_DIGIT_COUNT - 1u);
+}
+
+var<workgroup> tileDigitCounts : array<atomic<u32>, RADIX_DIGIT_COUNT>;
+
+@compute @workgroup_size(RADIX_TILE_SIZE)
+fn radixHistogram(@builtin(global_invocation_id) id : vec3u, @builtin(workgroup_id) tile : vec3u, @builtin(local_invocation_index) localIndex : u32) {
+	if (id.x < params.triangleCount) {
+		atomicAdd(&tileDigitCounts[radixDigit(pairs[id.x].x)], 1u);
+	}
+
+	workgroupBarrier();
+
+	histograms[localIndex * params.tileCount + tile.x] = atomicLoad(&tileDigitCounts[localIndex]);
+}
+
+var<workgroup> scanSums : array<u32, LBVH_WORKGROUP_SIZE>;
+
+// Exclusive prefix sum over all histograms, dispatched as a single workgroup:
+// each thread scans a contiguous chunk, chunk sums are scanned in shared memory
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn radixScan(@builtin(local_invocation_index) localIndex : u32) {
+	let total = RADIX_DIGIT_COUNT * params.tileCount;
+	let chunkSize = (total + LBVH_WORKGROUP_SIZE - 1u) / LBVH_WORKGROUP_SIZE;
+	let chunkBegin = min(total, localIndex * chunkSize);
+	let chunkEnd = min(total, chunkBegin + chunkSize);
+
+	var sum = 0u;
+	for (var i = chunkBegin; i < chunkEnd; i += 1u) {
+		sum += histograms[i];
+	}
+
+	scanSums[localIndex] = sum;
+
+	for (var offset = 1u; offset < LBVH_WORKGROUP_SIZE; offset *= 2u) {
+		workgroupBarrier();
+		let other = select(0u, scanSums[localIndex - offset], localIndex >= offset);
+		workgroupBarrier();
+		scanSums[localIndex] += other;
+	}
+
+	workgroupBarrier();
+
+	var prefix = scanSums[localIndex] - sum;
+	for (var i = chunkBegin; i < chunkEnd; i += 1u) {
+		let count = histograms[i];
+		histograms[i] = prefix;
+		prefix += count;
+	}
+}
+
+var<workgroup> tileDigits : array<u32, RADIX_TILE_SIZE>;
+
+@compute @workgroup_size(RADIX_TILE_SIZE)
+fn radixScatter(@builtin(global_invocation_id) id : vec3u, @builtin(workgroup_id) tile : vec3u, @builtin(local_invocation_index) localIndex : u32) {
+	let valid = id.x < params.triangleCount;
+
+	var pair = vec2u(0u);
+	var digit = RADIX_DIGIT_COUNT;
+	if (valid) {
+		pair = pairs[id.x];
+		digit = radixDigit(pair.x);
+	}
+
+	tileDigits[localIndex] = digit;
+
+	workgroupBarrier();
+
+	if (!valid) {
+		return;
+	}
+
+	// Rank among the preceding elements of the tile with the same digit keeps the sort stable
+	var rank = 0u;
+	for (var i = 0u; i < localIndex; i += 1u) {
+		rank += u32(tileDigits[i] == digit);
+	}
+
+	sortedPairs[histograms[digit * params.tileCount + tile.x] + rank] = pair;
+}
+
+// Length of the common prefix of sorted keys i and j, ties broken by index
+fn commonPrefix(i : i32, j : i32) -> i32 {
+	if (j < 0 || j >= i32(params.triangleCount)) {
+		return -1;
+	}
+
+	let keyI = pairs[i].x;
+	let keyJ = pairs[j].x;
+
+	if (keyI == keyJ) {
+		return 32 + i32(countLeadingZeros(u32(i) ^ u32(j)));
+	}
+
+	return i32(countLeadingZeros(keyI ^ keyJ));
+}
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn emitHierarchy(@builtin(global_invocation_id) globalID : vec3u) {
+	if (globalID.x + 1u >= params.triangleCount) {
+		return;
+	}
+
+	let i = i32(globalID.x);
+
+	// Direction of the node range
+	let d = select(-1, 1, commonPrefix(i, i + 1) - commonPrefix(i, i - 1) > 0);
+
+	// Find the other end of the range with exponential & binary search
+
+	let prefixMin = commonPrefix(i, i - d);
+
+	var lengthMax = 2;
+	while (commonPrefix(i, i + lengthMax * d) > prefixMin) {
+		lengthMax *= 2;
+	}
+
+	var length = 0;
+	for (var t = lengthMax / 2; t >= 1; t /= 2) {
+		if (commonPrefix(i, i + (length + t) * d) > prefixMin) {
+			length += t;
+		}
+	}
+
+	let j = i + length * d;
+	let prefixNode = commonPrefix(i, j);
+
+	// Find the split position with binary search
+
+	var split = 0;
+	for (var divisor = 2; ; divisor *= 2) {
+		let t = (length + divisor - 1) / divisor;
+		if (commonPrefix(i, i + (split + t) * d) > prefixNode) {
+			split += t;
+		}
+		if (t == 1) {
+			break;
+		}
+	}
+
+	let gamma = i + split * d + min(d, 0);
+
+	let leftIndex = select(u32(gamma), params.triangleCount - 1u + u32(gamma), min(i, j) == gamma);
+	let rightIndex = select(u32(gamma) + 1u, params.triangleCount + u32(gamma), max(i, j) == gamma + 1);
+
+	parents[leftIndex] = globalID.x << 1u;
+	parents[rightIndex] = (globalID.x << 1u) | 1u;
+
+	// Morton code bit 3k + 2 is x, 3k + 1 is y, 3k is z
+	refitNodes[globalID.x].axis = select(0u, 2u - u32(31 - prefixNode) % 3u, prefixNode < 32);
+}
+
+// Position of a non-root node in the node array
+fn nodePosition(parent : u32) -> u32 {
+	return 1u + 2u * (parent >> 1u) + (parent & 1u);
+}
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn refit(@builtin(global_invocation_id) id : vec3u) {
+	let triangleCount = params.triangleCount;
+
+	if (id.x >= triangleCount) {
+		return;
+	}
+
+	let bounds = triangleBounds(pairs[id.x].y);
+	let leaf = BVHNode(vec4f(bounds.aabbMin, bitcast<f32>(id.x)), vec4f(bounds.aabbMax, bitcast<f32>(1u)));
+
+	if (triangleCount == 1u) {
+		nodes[0] = leaf;
+		return;
+	}
+
+	let leafParent = parents[triangleCount - 1u + id.x];
+	nodes[nodePosition(leafParent)] = leaf;
+
+	var depth = 1u;
+	for (var node = leafParent >> 1u; node != 0u; node = parents[node] >> 1u) {
+		depth += 1u;
+	}
+	atomicMax(&state.maxDepth, depth);
+
+	// Both children merge their bounds into the parent, the second one to
+	// arrive sees the union and continues upwards. WGSL atomics are relaxed,
+	// but atomics on the same buffer are coherent on all supported backends
+
+	var aabbMin = bounds.aabbMin;
+	var aabbMax = bounds.aabbMax;
+	var node = leafParent >> 1u;
+
+	while (true) {
+		for (var axis = 0u; axis < 3u; axis += 1u) {
+			atomicMax(&refitNodes[node].aabbMin[axis], ~orderedFloat(aabbMin[axis]));
+			atomicMax(&refitNodes[node].aabbMax[axis], orderedFloat(aabbMax[axis]));
+		}
+
+		if (atomicAdd(&refitNodes[node].arrivals, 1u) == 0u) {
+			break;
+		}
+
+		for (var axis = 0u; axis < 3u; axis += 1u) {
+			aabbMin[axis] = unorderedFloat(~atomicLoad(&refitNodes[node].aabbMin[axis]));
+			aabbMax[axis] = unorderedFloat(atomicLoad(&refitNodes[node].aabbMax[axis]));
+		}
+
+		let firstChild = (1u + 2u * node) | (refitNodes[node].axis << BVH_NODE_AXIS_SHIFT);
+		let internal = BVHNode(vec4f(aabbMin, bitcast<f32>(firstChild)), vec4f(aabbMax, bitcast<f32>(0u)));
+
+		if (node == 0u) {
+			nodes[0] = internal;
+			break;
+		}
+
+		nodes[nodePosition(parents[node])] = internal;
+		node = parents[node] >> 1u;
+	}
+}
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn gatherTriangles(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= params.triangleCount) {
+		return;
+	}
+
+	let triangleID = pairs[id.x].y;
+
+	for (var k = 0u; k < 3u; k += 1u) {
+		sortedVertexPositions[3u * id.x + k] = vertexPositions[3u * triangleID + k];
+		sortedVertexAttributes[3u * id.x + k] = vertexAttributes[3u * triangleID + k];
+	}
+
+	inversePermutation[triangleID] = id.x;
+}
+
+@compute @workgroup_size(LBVH_WORKGROUP_SIZE)
+fn remapEmissiveTriangles(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= emissiveTriangles.count.x) {
+		return;
+	}
+
+	emissiveTriangles.triangles[id.x].x = inversePermutation[emissiveTriangles.triangles[id.x].x];
+}
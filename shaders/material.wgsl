@@ -4,4 +4,46 @@ struct Material
 	metallicRoughnessFactorAndIor : vec4f,
 	emissiveFactorAndTransmission : vec4f,
 	textureLayers : vec4u,
+	albedoRect : vec4u,
+	materialRect : vec4u,
+	normalRect : vec4u,
+}
+
+// Bilinear lookup of a single mip level of an atlas texture. Level k of a
+// texture is stored at offset >> k with size >> k texels, which doesn't
+// scale with the level 0 rect, so the clamp is done in the level's texels
+fn sampleAtlasLevel(atlas : texture_2d_array<f32>, atlasSampler : sampler, texcoord : vec2f, layer : u32, rect : vec4u, level : u32) -> vec4f {
+	let levelOffset = vec2f(rect.xy >> vec2u(level));
+	let levelSize = vec2f(rect.zw >> vec2u(level));
+	let position = clamp(fract(texcoord) * levelSize, vec2f(0.5), levelSize - 0.5);
+	return textureSampleLevel(atlas, atlasSampler, (levelOffset + position) / vec2f(textureDimensions(atlas, level)), layer, f32(level));
+}
+
+// Textures are packed into atlas layers at their native size, rect is the
+// (offset, size) of the texture within its layer in level 0 texels. Texture
+// coordinates are wrapped manually and clamped half a texel inside the rect,
+// so that bilinear filtering doesn't pick up the neighbouring textures.
+// uvLod is log2 of the sample footprint in texture coordinates, the level
+// is clamped to the mips the texture has in the atlas (see mipmap.hpp),
+// and the two nearest levels are blended like in the reference renderer
+fn sampleAtlas(atlas : texture_2d_array<f32>, atlasSampler : sampler, texcoord : vec2f, layer : u32, rect : vec4u, uvLod : f32) -> vec4f {
+	let textureSize = vec2f(rect.zw);
+	let maxLevel = firstLeadingBit(max(1u, min(rect.z, rect.w)));
+	let level = clamp(uvLod + 0.5 * log2(textureSize.x * textureSize.y), 0.0, f32(maxLevel));
+
+	let level0 = u32(level);
+	let level1 = min(level0 + 1u, maxLevel);
+
+	let sample0 = sampleAtlasLevel(atlas, atlasSampler, texcoord, layer, rect, level0);
+	if (level1 == level0) {
+		return sample0;
+	}
+
+	return mix(sample0, sampleAtlasLevel(atlas, atlasSampler, texcoord, layer, rect, level1), level - f32(level0));
+}
+
+// Ray cone texture LOD, see "Improved Shader and Texture Level of Detail Using Ray Cones"
+// by Akenine-Möller et al. Areas may be scaled by the same factor
+fn rayConeLod(coneWidth : f32, cosine : f32, triangleArea : f32, texcoordArea : f32) -> f32 {
+	return 0.5 * log2(max(texcoordArea, 1e-20) / max(triangleArea, 1e-20)) + log2(coneWidth / max(cosine, 1e-4));
 }
@@ -1,5 +1,12 @@
 const PI = 3.14159265358979323846;
 
+// Same as LUMINANCE_FACTORS in color.hpp
+const LUMINANCE_FACTORS = vec3f(0.299, 0.587, 0.114);
+
+fn luminance(color : vec3f) -> f32 {
+	return dot(color, LUMINANCE_FACTORS);
+}
+
 // Heaviside step function
 fn chiPlus(x : f32) -> f32 {
 	return step(0.0, x);
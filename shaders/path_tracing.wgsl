@@ -0,0 +1,207 @@
+// N.B.: this file expects the global arrays of bvh_traverse.wgsl,
+// the camera uniform and the following global material resources to be defined:
+//     materials
+//     environmentMap
+//     textureSampler
+//     albedoTexture
+//     materialTexture
+//     normalTexture
+//     environmentAliasTable
+
+// The surface let the ray pass through, it continues from the hit point
+const PATH_VERTEX_TRANSPARENT = 0u;
+// The sampled direction points inside a non-transmissive surface, the path ends
+const PATH_VERTEX_ABSORBED = 1u;
+// The path continues in the sampled direction
+const PATH_VERTEX_SCATTERED = 2u;
+
+struct PathVertex
+{
+	kind : u32,
+	// Continuation ray; for scattered rays the origin is the surface
+	// point itself, and the origin offset must be applied before tracing
+	ray : Ray,
+	originOffset : vec3f,
+	emission : vec3f,
+	// BRDF times cosine, to be divided by the total MIS probability
+	scatteringFactor : vec3f,
+	// Total MIS probability without the light sampling strategy, whose
+	// probability needs a light BVH traversal, see lightSamplingProbability
+	partialMISProbability : f32,
+	lightSamplingWeight : f32,
+	coneWidth : f32,
+	coneSpreadAngle : f32,
+}
+
+// Samples the continuation of a path at a scene hit
+fn shadePathVertex(ray : Ray, intersection : SceneIntersection, coneWidth : f32, coneSpreadAngle : f32, randomState : ptr<function, RandomState>) -> PathVertex {
+	var result = PathVertex(PATH_VERTEX_ABSORBED, ray, vec3f(0.0), vec3f(0.0), vec3f(0.0), 0.0, 0.0, coneWidth, coneSpreadAngle);
+
+	let intersectionPoint = ray.origin + ray.direction * intersection.distance;
+
+	let v0 = intersectionVertexAttributes(intersection, 0u);
+	let v1 = intersectionVertexAttributes(intersection, 1u);
+	let v2 = intersectionVertexAttributes(intersection, 2u);
+
+	let material = materials[v0.materialID];
+
+	let texcoord = v0.texcoord + intersection.uv.x * (v1.texcoord - v0.texcoord) + intersection.uv.y * (v2.texcoord - v0.texcoord);
+
+	let triangleCross = cross(intersection.vertices[1] - intersection.vertices[0], intersection.vertices[2] - intersection.vertices[0]);
+	let texcoordArea = abs(determinant(mat2x2f(v1.texcoord - v0.texcoord, v2.texcoord - v0.texcoord)));
+
+	result.coneWidth += coneSpreadAngle * intersection.distance;
+	let uvLod = rayConeLod(result.coneWidth, abs(dot(ray.direction, normalize(triangleCross))), length(triangleCross), texcoordArea);
+
+	let albedoSample = sampleAtlas(albedoTexture, textureSampler, texcoord, material.textureLayers.x, material.albedoRect, uvLod);
+
+	let alpha = albedoSample.a * material.baseColorFactorAndAlpha.a;
+
+	// TODO: better transparency
+	if (alpha < 0.5) {
+		result.kind = PATH_VERTEX_TRANSPARENT;
+		result.ray.origin = intersectionPoint + ray.direction * 1e-4;
+		return result;
+	}
+
+	let materialSample = sampleAtlas(materialTexture, textureSampler, texcoord, material.textureLayers.y, material.materialRect, uvLod);
+	let normalSample = sampleAtlas(normalTexture, textureSampler, texcoord, material.textureLayers.z, material.normalRect, uvLod);
+
+	let baseColor = material.baseColorFactorAndAlpha.rgb * albedoSample.rgb;
+	let metallic = material.metallicRoughnessFactorAndIor.b * materialSample.b;
+	let roughness = max(0.05, material.metallicRoughnessFactorAndIor.g * materialSample.g);
+	var ior = material.metallicRoughnessFactorAndIor.a;
+	let transmission = material.emissiveFactorAndTransmission.a;
+
+	var geometryNormal = normalize(triangleCross);
+
+	var shadingNormal = normalize(v0.normal + intersection.uv.x * (v1.normal - v0.normal) + intersection.uv.y * (v2.normal - v0.normal));
+
+	// Invert the normals if we're looking at the surface from the inside
+	if (dot(geometryNormal, ray.direction) > 0.0) {
+		geometryNormal = -geometryNormal;
+		shadingNormal = -shadingNormal;
+		ior = 1.0 / ior;
+	}
+
+	let tangent = normalize(v0.tangent.xyz + intersection.uv.x * (v1.tangent.xyz - v0.tangent.xyz) + intersection.uv.y * (v2.tangent.xyz - v0.tangent.xyz));
+	let bitangent = v0.tangent.w * normalize(cross(shadingNormal, tangent));
+
+	shadingNormal = normalize(mat3x3f(tangent, bitangent, shadingNormal) * (normalSample.xyz * 2.0 - vec3f(1.0)));
+
+	var newRay = Ray(intersectionPoint, vec3f(0.0));
+
+	// MIS weights empirically chosen depending on what works better for which materials:
+	//     roughness = 0, metallic = 0 : vndf + cosine + light + env map
+	//     roughness = 0, metallic = 1 : vndf
+	//     roughness = 1, metallic = 0 : cosine + light + env map
+	//     roughness = 1, metallic = 1 : vndf
+	//                transmission = 1 : vndf + transmission vndf
+
+	var cosineSamplingWeight = (1.0 - metallic) * (1.0 - transmission);
+	var lightSamplingWeight = (1.0 - metallic) * (1.0 - transmission) * select(0.0, 1.0, emissiveTriangles.count.x > 0u);
+	var envMapSamplingWeight = (1.0 - metallic) * (1.0 - transmission) * select(0.0, 1.0, environmentAliasTable.totalWeight > 0.0);
+	var vndfSamplingWeight = 1.0 - (1.0 - metallic) * roughness;
+	var vndfTransmissionWeight = transmission;
+
+	var sumSamplingWeights = cosineSamplingWeight + lightSamplingWeight + envMapSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight;
+
+	cosineSamplingWeight /= sumSamplingWeights;
+	lightSamplingWeight /= sumSamplingWeights;
+	envMapSamplingWeight /= sumSamplingWeights;
+	vndfSamplingWeight /= sumSamplingWeights;
+	vndfTransmissionWeight /= sumSamplingWeights;
+
+	let strategyPick = uniformFloat(randomState);
+
+	if (strategyPick < cosineSamplingWeight) {
+		newRay.direction = cosineHemisphere(randomState, shadingNormal);
+	} else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight) {
+		newRay.direction = sampleVNDF(randomState, shadingNormal, -ray.direction, roughness);
+	} else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight) {
+		newRay.direction = sampleTransmissionVNDF(randomState, shadingNormal, -ray.direction, roughness);
+	} else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight + envMapSamplingWeight) {
+		newRay.direction = sampleEnvMapDirection(randomState);
+	} else {
+		let lightPick = f32(emissiveTriangles.count.x) * uniformFloat(randomState);
+		var lightTriangleIndex = min(emissiveTriangles.count.x - 1, u32(floor(lightPick)));
+		let lightTriangleAliasRecord = emissiveAliasTable[lightTriangleIndex];
+		let lightSamplingProbability = bitcast<f32>(lightTriangleAliasRecord.x);
+		let lightTriangleAlias = lightTriangleAliasRecord.y;
+
+		if (lightPick - f32(lightTriangleIndex) > lightSamplingProbability) {
+			lightTriangleIndex = lightTriangleAlias;
+		}
+
+		let lightTriangle = emissiveTriangles.triangles[lightTriangleIndex].x;
+
+		var lightUV = vec2f(uniformFloat(randomState), uniformFloat(randomState));
+		if (dot(lightUV, vec2f(1.0)) > 1.0) {
+			lightUV = vec2f(1.0) - lightUV;
+		}
+
+		let lightV0 = vertexPositions[3 * lightTriangle + 0u].xyz;
+		let lightV1 = vertexPositions[3 * lightTriangle + 1u].xyz;
+		let lightV2 = vertexPositions[3 * lightTriangle + 2u].xyz;
+
+		let lightPoint = lightV0 * (1.0 - lightUV.x - lightUV.y) + lightV1 * lightUV.x + lightV2 * lightUV.y;
+
+		newRay.direction = normalize(lightPoint - intersectionPoint);
+	}
+
+	let cosineHemisphereProbability = max(0.0, dot(newRay.direction, shadingNormal)) / PI;
+	let vndfSamplingProbability = probabilityVNDF(shadingNormal, -ray.direction, newRay.direction, roughness);
+	let vndfTransmissionProbability = probabilityTransmissionVNDF(shadingNormal, -ray.direction, newRay.direction, roughness);
+	let envMapDirectionProbability = envMapSamplingProbability(newRay.direction);
+
+	// To properly apply MIS, one needs to compute the total probability of generating a reflected direction
+	// using _all_possible_strategies_, see https://lisyarus.github.io/blog/posts/multiple-importance-sampling.html
+	// The light sampling term is added by the caller
+	result.partialMISProbability = cosineHemisphereProbability * cosineSamplingWeight
+		+ vndfSamplingProbability * vndfSamplingWeight
+		+ vndfTransmissionProbability * vndfTransmissionWeight
+		+ envMapDirectionProbability * envMapSamplingWeight;
+	result.lightSamplingWeight = lightSamplingWeight;
+
+	result.emission = material.emissiveFactorAndTransmission.rgb;
+
+	let ndotr = dot(shadingNormal, newRay.direction);
+
+	if (transmission > 0.0 || ndotr > 0.0) {
+		let brdf = cookTorranceGGX(shadingNormal, newRay.direction, -ray.direction, baseColor, metallic, roughness, ior, transmission);
+
+		result.kind = PATH_VERTEX_SCATTERED;
+		result.ray = newRay;
+		result.scatteringFactor = brdf * abs(ndotr);
+
+		// Offset ray origin to side of the surface where new ray direction is pointing to,
+		// to prevent self-intersection artifacts
+		result.originOffset = sign(dot(newRay.direction, geometryNormal)) * geometryNormal * 1e-4;
+
+		// Crude approximation of the cone widening after a rough bounce
+		result.coneSpreadAngle += roughness * roughness;
+	}
+
+	// Otherwise the material is non-transmissive and the new ray points inside
+	// the object => brdf would return zero, colorFactor would be zero, and all
+	// further recursive rays will be useless. Instead, the path is absorbed
+
+	return result;
+}
+
+// Russian roulette after `depth` bounces: returns the probability that the path
+// survived, which the throughput must be divided by, or zero if it was terminated.
+// Paths are never terminated before camera.russianRouletteDepth bounces
+fn russianRoulette(throughput : vec3f, depth : u32, randomState : ptr<function, RandomState>) -> f32 {
+	if (depth < camera.russianRouletteDepth || depth >= camera.maxPathDepth) {
+		return 1.0;
+	}
+
+	let survival = min(1.0, max(throughput.r, max(throughput.g, throughput.b)));
+
+	if (uniformFloat(randomState) >= survival) {
+		return 0.0;
+	}
+
+	return survival;
+}
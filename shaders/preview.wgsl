@@ -19,6 +19,13 @@ struct VertexInput {
 	@location(2) materialID : u32,
 	@location(3) tangent : vec4f,
 	@location(4) texcoord : vec2f,
+	// Rows of the instance transformation matrices, see SceneInstance
+	@location(5) objectToWorld0 : vec4f,
+	@location(6) objectToWorld1 : vec4f,
+	@location(7) objectToWorld2 : vec4f,
+	@location(8) worldToObject0 : vec4f,
+	@location(9) worldToObject1 : vec4f,
+	@location(10) worldToObject2 : vec4f,
 }
 
 struct VertexOutput {
@@ -31,10 +38,14 @@ struct VertexOutput {
 
 @vertex
 fn vertexMain(in : VertexInput) -> VertexOutput {
+	let position = vec4f(in.position, 1.0);
+	let worldPosition = vec3f(dot(in.objectToWorld0, position), dot(in.objectToWorld1, position), dot(in.objectToWorld2, position));
+	let worldNormal = in.worldToObject0.xyz * in.normal.x + in.worldToObject1.xyz * in.normal.y + in.worldToObject2.xyz * in.normal.z;
+
 	return VertexOutput(
-		camera.viewProjectionMatrix * vec4f(in.position, 1.0),
-		in.position,
-		in.normal,
+		camera.viewProjectionMatrix * vec4f(worldPosition, 1.0),
+		worldPosition,
+		worldNormal,
 		in.texcoord,
 		in.materialID,
 	);
@@ -48,7 +59,9 @@ fn fragmentMain(in : VertexOutput, @builtin(front_facing) front_facing : bool) -
 
 	let lightDirection = normalize(vec3f(1.0, 3.0, 2.0));
 
-	let albedoSample = textureSampleLevel(albedoTexture, textureSampler, in.texcoord, material.textureLayers.x, 0.0);
+	let uvLod = log2(max(length(dpdx(in.texcoord)), length(dpdy(in.texcoord))));
+
+	let albedoSample = sampleAtlas(albedoTexture, textureSampler, in.texcoord, material.textureLayers.x, material.albedoRect, uvLod);
 
 	let alpha = albedoSample.a * material.baseColorFactorAndAlpha.a;
 
@@ -65,7 +78,7 @@ fn fragmentMain(in : VertexOutput, @builtin(front_facing) front_facing : bool) -
 
 	let reflectedColor = sampleEnvMap(environmentMap, reflectedDirection) * albedo;
 
-	let materialSample = textureSampleLevel(materialTexture, textureSampler, in.texcoord, material.textureLayers.y, 0.0);
+	let materialSample = sampleAtlas(materialTexture, textureSampler, in.texcoord, material.textureLayers.y, material.materialRect, uvLod);
 
 	let metallic = material.metallicRoughnessFactorAndIor.b * materialSample.b;
 
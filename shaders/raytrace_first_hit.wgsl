@@ -11,6 +11,10 @@ use raytrace_common.wgsl;
 @group(1) @binding(3) var<storage, read> emissiveTriangles : TriangleArray;
 @group(1) @binding(4) var<storage, read> emissiveAliasTable : array<vec2u>;
 @group(1) @binding(5) var<storage, read> emissiveBvhNodes : array<BVHNode>;
+@group(1) @binding(6) var<storage, read> wideBvhNodes : WideBVHNodeArray;
+@group(1) @binding(7) var<storage, read> quantizedBvhNodes : array<QuantizedBVHChildGroup>;
+@group(1) @binding(8) var<storage, read> instances : InstanceArray;
+@group(1) @binding(9) var<storage, read> instanceBvhNodes : array<BVHNode>;
 
 @group(2) @binding(0) var<storage, read> materials : array<Material>;
 
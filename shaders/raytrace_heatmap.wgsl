@@ -0,0 +1,75 @@
+use camera.wgsl;
+use geometry.wgsl;
+use raytrace_common.wgsl;
+
+// Traversal cost of every primary ray: visited & intersected node counts
+// are written to the red & green channels of the accumulation texture, and
+// aggregated into the counters below for the CPU readback, see traversal_stats.cpp
+
+const HEATMAP_HISTOGRAM_SIZE = 1024u;
+
+struct TraversalStats
+{
+	rayCount : atomic<u32>,
+	// 64-bit sum of visited node counts
+	visitedNodeSumLow : atomic<u32>,
+	visitedNodeSumHigh : atomic<u32>,
+	maxVisitedNodes : atomic<u32>,
+	// Rays by visited node count, the last bin also counts all longer traversals
+	histogram : array<atomic<u32>, HEATMAP_HISTOGRAM_SIZE>,
+}
+
+@group(0) @binding(0) var<uniform> camera : Camera;
+
+@group(1) @binding(0) var<storage, read> vertexPositions : array<vec4f>;
+@group(1) @binding(1) var<storage, read> vertexAttributes : array<Vertex>;
+@group(1) @binding(2) var<storage, read> bvhNodes : array<BVHNode>;
+@group(1) @binding(3) var<storage, read> emissiveTriangles : TriangleArray;
+@group(1) @binding(4) var<storage, read> emissiveAliasTable : array<vec2u>;
+@group(1) @binding(5) var<storage, read> emissiveBvhNodes : array<BVHNode>;
+@group(1) @binding(6) var<storage, read> wideBvhNodes : WideBVHNodeArray;
+@group(1) @binding(7) var<storage, read> quantizedBvhNodes : array<QuantizedBVHChildGroup>;
+@group(1) @binding(8) var<storage, read> instances : InstanceArray;
+@group(1) @binding(9) var<storage, read> instanceBvhNodes : array<BVHNode>;
+
+@group(2) @binding(0) var<storage, read_write> traversalStats : TraversalStats;
+
+@group(3) @binding(0) var accumulationTexture : texture_storage_2d<rgba32float, read_write>;
+
+use bvh_traverse.wgsl;
+
+var<workgroup> workgroupRayCount : atomic<u32>;
+var<workgroup> workgroupVisitedNodeSum : atomic<u32>;
+var<workgroup> workgroupMaxVisitedNodes : atomic<u32>;
+
+@compute @workgroup_size(8, 8)
+fn computeMain(@builtin(global_invocation_id) id: vec3<u32>, @builtin(local_invocation_index) localIndex : u32) {
+	// No early return, all invocations must reach the barrier
+	if (id.x < camera.screenSize.x && id.y < camera.screenSize.y) {
+		let screenPosition = 2.0 * vec2f(id.xy) / vec2f(camera.screenSize) - vec2f(1.0);
+
+		let cameraRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, screenPosition * vec2f(1.0, -1.0));
+
+		let intersection = intersectScene(cameraRay);
+
+		textureStore(accumulationTexture, id.xy, vec4f(f32(intersection.visitedNodeCount), f32(intersection.intersectedNodeCount), select(0.0, 1.0, intersection.intersects), 1.0));
+
+		atomicAdd(&workgroupRayCount, 1u);
+		atomicAdd(&workgroupVisitedNodeSum, intersection.visitedNodeCount);
+		atomicMax(&workgroupMaxVisitedNodes, intersection.visitedNodeCount);
+		atomicAdd(&traversalStats.histogram[min(intersection.visitedNodeCount, HEATMAP_HISTOGRAM_SIZE - 1u)], 1u);
+	}
+
+	workgroupBarrier();
+
+	if (localIndex == 0u) {
+		atomicAdd(&traversalStats.rayCount, atomicLoad(&workgroupRayCount));
+		atomicMax(&traversalStats.maxVisitedNodes, atomicLoad(&workgroupMaxVisitedNodes));
+
+		let sum = atomicLoad(&workgroupVisitedNodeSum);
+		let oldLow = atomicAdd(&traversalStats.visitedNodeSumLow, sum);
+		if (oldLow > 0xffffffffu - sum) {
+			atomicAdd(&traversalStats.visitedNodeSumHigh, 1u);
+		}
+	}
+}
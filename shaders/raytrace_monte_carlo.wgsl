@@ -14,6 +14,10 @@ use env_map.wgsl;
 @group(1) @binding(3) var<storage, read> emissiveTriangles : TriangleArray;
 @group(1) @binding(4) var<storage, read> emissiveAliasTable : array<vec2u>;
 @group(1) @binding(5) var<storage, read> emissiveBvhNodes : array<BVHNode>;
+@group(1) @binding(6) var<storage, read> wideBvhNodes : WideBVHNodeArray;
+@group(1) @binding(7) var<storage, read> quantizedBvhNodes : array<QuantizedBVHChildGroup>;
+@group(1) @binding(8) var<storage, read> instances : InstanceArray;
+@group(1) @binding(9) var<storage, read> instanceBvhNodes : array<BVHNode>;
 
 @group(2) @binding(0) var<storage, read> materials : array<Material>;
 @group(2) @binding(1) var environmentMap : texture_storage_2d<rgba32float, read>;
@@ -21,187 +25,133 @@ use env_map.wgsl;
 @group(2) @binding(3) var albedoTexture : texture_2d_array<f32>;
 @group(2) @binding(4) var materialTexture : texture_2d_array<f32>;
 @group(2) @binding(5) var normalTexture : texture_2d_array<f32>;
+@group(2) @binding(6) var<storage, read> environmentAliasTable : EnvMapAliasTable;
 
 @group(3) @binding(0) var accumulationTexture : texture_storage_2d<rgba32float, read_write>;
+// Only used by computeAdaptive, see adaptive_sampling.wgsl
+@group(3) @binding(1) var<storage, read_write> sampleCounts : array<u32>;
+@group(3) @binding(2) var<storage, read> activeTiles : array<u32>;
 
 use bvh_traverse.wgsl;
+use env_map_sampling.wgsl;
+use path_tracing.wgsl;
 
-fn raytraceMonteCarlo(ray : Ray, randomState : ptr<function, RandomState>) -> vec3f {
+fn raytraceMonteCarlo(ray : Ray, pixelSpreadAngle : f32, randomState : ptr<function, RandomState>) -> vec3f {
 	var accumulatedColor = vec3f(0.0);
 	var colorFactor = vec3f(1.0);
 
 	var currentRay = ray;
 
-	for (var rayDepth = 0u; rayDepth < 8u; rayDepth += 1u) {
+	// Ray cone used for texture LOD selection
+	var coneWidth = 0.0;
+	var coneSpreadAngle = pixelSpreadAngle;
+
+	for (var rayDepth = 0u; rayDepth < camera.maxPathDepth; rayDepth += 1u) {
 		let intersection = intersectScene(currentRay);
 
 		if (intersection.intersects) {
-			let intersectionPoint = currentRay.origin + currentRay.direction * intersection.distance;
-
-			let v0 = vertexAttributes[3 * intersection.triangleID + 0u];
-			let v1 = vertexAttributes[3 * intersection.triangleID + 1u];
-			let v2 = vertexAttributes[3 * intersection.triangleID + 2u];
-
-			let material = materials[v0.materialID];
-
-			let texcoord = v0.texcoord + intersection.uv.x * (v1.texcoord - v0.texcoord) + intersection.uv.y * (v2.texcoord - v0.texcoord);
+			let vertex = shadePathVertex(currentRay, intersection, coneWidth, coneSpreadAngle, randomState);
 
-			let albedoSample = textureSampleLevel(albedoTexture, textureSampler, texcoord, material.textureLayers.x, 0.0);
+			coneWidth = vertex.coneWidth;
+			coneSpreadAngle = vertex.coneSpreadAngle;
 
-			let alpha = albedoSample.a * material.baseColorFactorAndAlpha.a;
-
-			// TODO: better transparency
-			if (alpha < 0.5) {
-				currentRay.origin = intersectionPoint + currentRay.direction * 1e-4;
+			if (vertex.kind == PATH_VERTEX_TRANSPARENT) {
+				currentRay = vertex.ray;
 				continue;
 			}
 
-			let materialSample = textureSampleLevel(materialTexture, textureSampler, texcoord, material.textureLayers.y, 0.0);
-			let normalSample = textureSampleLevel(normalTexture, textureSampler, texcoord, material.textureLayers.z, 0.0);
-
-			let baseColor = material.baseColorFactorAndAlpha.rgb * albedoSample.rgb;
-			let metallic = material.metallicRoughnessFactorAndIor.b * materialSample.b;
-			let roughness = max(0.05, material.metallicRoughnessFactorAndIor.g * materialSample.g);
-			var ior = material.metallicRoughnessFactorAndIor.a;
-			let transmission = material.emissiveFactorAndTransmission.a;
-
-			var geometryNormal = normalize(cross(intersection.vertices[1] - intersection.vertices[0], intersection.vertices[2] - intersection.vertices[0]));
+			accumulatedColor += vertex.emission * colorFactor;
 
-			var shadingNormal = normalize(v0.normal + intersection.uv.x * (v1.normal - v0.normal) + intersection.uv.y * (v2.normal - v0.normal));
-
-			// Invert the normals if we're looking at the surface from the inside
-			if (dot(geometryNormal, currentRay.direction) > 0.0) {
-				geometryNormal = -geometryNormal;
-				shadingNormal = -shadingNormal;
-				ior = 1.0 / ior;
+			if (vertex.kind == PATH_VERTEX_ABSORBED) {
+				break;
 			}
 
-			let tangent = normalize(v0.tangent.xyz + intersection.uv.x * (v1.tangent.xyz - v0.tangent.xyz) + intersection.uv.y * (v2.tangent.xyz - v0.tangent.xyz));
-			let bitangent = v0.tangent.w * normalize(cross(shadingNormal, tangent));
-
-			shadingNormal = normalize(mat3x3f(tangent, bitangent, shadingNormal) * (normalSample.xyz * 2.0 - vec3f(1.0)));
-
-			var newRay = Ray(intersectionPoint, vec3f(0.0));
-
-			// MIS weights empirically chosen depending on what works better for which materials:
-			//     roughness = 0, metallic = 0 : vndf + cosine + light
-			//     roughness = 0, metallic = 1 : vndf
-			//     roughness = 1, metallic = 0 : cosine + light
-			//     roughness = 1, metallic = 1 : vndf
-			//                transmission = 1 : vndf + transmission vndf
-
-			var cosineSamplingWeight = (1.0 - metallic) * (1.0 - transmission);
-			var lightSamplingWeight = (1.0 - metallic) * (1.0 - transmission) * select(0.0, 1.0, emissiveTriangles.count.x > 0u);
-			var vndfSamplingWeight = 1.0 - (1.0 - metallic) * roughness;
-			var vndfTransmissionWeight = transmission;
-
-			var sumSamplingWeights = cosineSamplingWeight + lightSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight;
+			let totalMISProbability = vertex.partialMISProbability + lightSamplingProbability(vertex.ray) * vertex.lightSamplingWeight;
 
-			cosineSamplingWeight /= sumSamplingWeights;
-			lightSamplingWeight /= sumSamplingWeights;
-			vndfSamplingWeight /= sumSamplingWeights;
-			vndfTransmissionWeight /= sumSamplingWeights;
+			colorFactor *= vertex.scatteringFactor / max(1e-8, totalMISProbability);
 
-			let strategyPick = uniformFloat(randomState);
-
-			if (strategyPick < cosineSamplingWeight) {
-				newRay.direction = cosineHemisphere(randomState, shadingNormal);
-			} else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight) {
-				newRay.direction = sampleVNDF(randomState, shadingNormal, -currentRay.direction, roughness);
-			} else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight) {
-				newRay.direction = sampleTransmissionVNDF(randomState, shadingNormal, -currentRay.direction, roughness);
-			} else {
-				let lightPick = f32(emissiveTriangles.count.x) * uniformFloat(randomState);
-				var lightTriangleIndex = min(emissiveTriangles.count.x - 1, u32(floor(lightPick)));
-				let lightTriangleAliasRecord = emissiveAliasTable[lightTriangleIndex];
-				let lightSamplingProbability = bitcast<f32>(lightTriangleAliasRecord.x);
-				let lightTriangleAlias = lightTriangleAliasRecord.y;
-
-				if (lightPick - f32(lightTriangleIndex) > lightSamplingProbability) {
-					lightTriangleIndex = lightTriangleAlias;
-				}
+			let survival = russianRoulette(colorFactor, rayDepth + 1u, randomState);
+			if (survival == 0.0) {
+				break;
+			}
+			colorFactor /= survival;
 
-				let lightTriangle = emissiveTriangles.triangles[lightTriangleIndex].x;
+			currentRay = Ray(vertex.ray.origin + vertex.originOffset, vertex.ray.direction);
+		} else {
+			accumulatedColor += colorFactor * sampleEnvMap(environmentMap, currentRay.direction);
+			break;
+		}
+	}
 
-				var lightUV = vec2f(uniformFloat(randomState), uniformFloat(randomState));
-				if (dot(lightUV, vec2f(1.0)) > 1.0) {
-					lightUV = vec2f(1.0) - lightUV;
-				}
+	return accumulatedColor;
+}
 
-				let lightV0 = vertexPositions[3 * lightTriangle + 0u].xyz;
-				let lightV1 = vertexPositions[3 * lightTriangle + 1u].xyz;
-				let lightV2 = vertexPositions[3 * lightTriangle + 2u].xyz;
+// One clamped path traced sample through the pixel, seeded by the global sample index
+fn samplePixel(pixel : vec2u, sampleIndex : u32) -> vec3f {
+	var randomState = RandomState(0);
+	initRandom(&randomState, sampleIndex);
+	initRandom(&randomState, pixel.x);
+	initRandom(&randomState, pixel.y);
 
-				let lightPoint = lightV0 * (1.0 - lightUV.x - lightUV.y) + lightV1 * lightUV.x + lightV2 * lightUV.y;
+	let screenPosition = 2.0 * vec2f(f32(pixel.x) + uniformFloat(&randomState), f32(pixel.y) + uniformFloat(&randomState)) / vec2f(camera.screenSize) - vec2f(1.0);
 
-				newRay.direction = normalize(lightPoint - intersectionPoint);
-			}
+	let cameraRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, screenPosition * vec2f(1.0, -1.0));
 
-			let cosineHemisphereProbability = max(0.0, dot(newRay.direction, shadingNormal)) / PI;
-			let vndfSamplingProbability = probabilityVNDF(shadingNormal, -currentRay.direction, newRay.direction, roughness);
-			let vndfTransmissionProbability = probabilityTransmissionVNDF(shadingNormal, -currentRay.direction, newRay.direction, roughness);
-			let directLightSamplingProbability = lightSamplingProbability(newRay);
+	// Angle between rays through neighbouring pixels
+	let neighbourRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, (screenPosition + vec2f(2.0 / f32(camera.screenSize.x), 0.0)) * vec2f(1.0, -1.0));
+	let pixelSpreadAngle = length(neighbourRay.direction - cameraRay.direction);
 
-			// To properly apply MIS, one needs to compute the total probability of generating a reflected direction
-			// using _all_possible_strategies_, see https://lisyarus.github.io/blog/posts/multiple-importance-sampling.html
-			var totalMISProbability = cosineHemisphereProbability * cosineSamplingWeight
-				+ vndfSamplingProbability * vndfSamplingWeight
-				+ vndfTransmissionProbability * vndfTransmissionWeight
-				+ directLightSamplingProbability * lightSamplingWeight;
+	// No idea where negative values come from :(
+	return clamp(raytraceMonteCarlo(cameraRay, pixelSpreadAngle, &randomState), vec3f(0.0), vec3f(10.0));
+}
 
-			// totalMISProbability = 1.0 / (4.0 * PI);
-			// newRay.direction = uniformSphere(randomState);
+// Mean color and mean squared luminance of the camera.sampleCount samples of this dispatch
+fn samplePixelMean(pixel : vec2u) -> vec4f {
+	var sum = vec4f(0.0);
 
-			accumulatedColor += material.emissiveFactorAndTransmission.rgb * colorFactor;
+	for (var i = 0u; i < camera.sampleCount; i += 1u) {
+		let color = samplePixel(pixel, camera.globalSampleID + i);
+		let colorLuminance = luminance(color);
+		sum += vec4f(color, colorLuminance * colorLuminance);
+	}
 
-			let ndotr = dot(shadingNormal, newRay.direction);
+	return sum / f32(max(1u, camera.sampleCount));
+}
 
-			if (transmission > 0.0 || ndotr > 0.0) {
-				let brdf = cookTorranceGGX(shadingNormal, newRay.direction, -currentRay.direction, baseColor, metallic, roughness, ior, transmission);
+// Merges the samples of this dispatch into the running mean of the pixel, which already has
+// previousSampleCount samples. The alpha channel accumulates the second moment of the
+// luminance, for variance estimation
+fn accumulateSamples(pixel : vec2u, mean : vec4f, previousSampleCount : u32) {
+	let alpha = f32(camera.sampleCount) / f32(previousSampleCount + camera.sampleCount);
 
-				colorFactor *= brdf * abs(ndotr) / max(1e-8, totalMISProbability);
+	let accumulatedColor = textureLoad(accumulationTexture, pixel);
+	let storedColor = mix(accumulatedColor, mean, alpha);
+	textureStore(accumulationTexture, pixel, storedColor);
+}
 
-				// Offset ray origin to side of the surface where new ray direction is pointing to,
-				// to prevent self-intersection artifacts
-				newRay.origin += sign(dot(newRay.direction, geometryNormal)) * geometryNormal * 1e-4;
+@compute @workgroup_size(8, 8)
+fn computeMain(@builtin(global_invocation_id) id: vec3<u32>) {
+	let mean = samplePixelMean(id.xy);
 
-				currentRay = newRay;
-			}
-			else
-			{
-				// Non-transmissive material and the new ray points inside the object
-				// => brdf would return zero, colorFactor would be zero, and all
-				// further recursive rays will be useless
-				// Instead, just ignore this ray altogether
-				break;
-			}
-		} else {
-			accumulatedColor += colorFactor * sampleEnvMap(environmentMap, currentRay.direction);
-			break;
-		}
+	if (id.x < camera.screenSize.x && id.y < camera.screenSize.y) {
+		accumulateSamples(id.xy, mean, camera.sampleID);
 	}
-
-	return accumulatedColor;
 }
 
+// Adaptive sampling: one workgroup per unconverged 8x8 tile,
+// pixels keep their own sample counts since they converge separately
 @compute @workgroup_size(8, 8)
-fn computeMain(@builtin(global_invocation_id) id: vec3<u32>) {
-	var randomState = RandomState(0);
-	initRandom(&randomState, camera.globalFrameID);
-	initRandom(&randomState, id.x);
-	initRandom(&randomState, id.y);
+fn computeAdaptive(@builtin(workgroup_id) workgroupID : vec3u, @builtin(local_invocation_id) localID : vec3u) {
+	let tile = activeTiles[workgroupID.x];
+	let pixel = vec2u(tile & 0xffffu, tile >> 16u) * 8u + localID.xy;
 
-	let screenPosition = 2.0 * vec2f(f32(id.x) + uniformFloat(&randomState), f32(id.y) + uniformFloat(&randomState)) / vec2f(camera.screenSize) - vec2f(1.0);
-
-	let cameraRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, screenPosition * vec2f(1.0, -1.0));
+	if (pixel.x >= camera.screenSize.x || pixel.y >= camera.screenSize.y) {
+		return;
+	}
 
-	// No idea where negative values come from :(
-	let color = clamp(raytraceMonteCarlo(cameraRay, &randomState), vec3f(0.0), vec3f(10.0));
-	let alpha = 1.0 / (f32(camera.frameID) + 1.0);
+	let index = pixel.x + pixel.y * camera.screenSize.x;
+	let sampleCount = sampleCounts[index];
 
-	if (id.x < camera.screenSize.x && id.y < camera.screenSize.y) {
-		let accumulatedColor = textureLoad(accumulationTexture, id.xy);
-		let storedColor = mix(accumulatedColor, vec4f(color, 1.0), alpha);
-		textureStore(accumulationTexture, id.xy, storedColor);
-	}
+	accumulateSamples(pixel, samplePixelMean(pixel), sampleCount);
+	sampleCounts[index] = sampleCount + camera.sampleCount;
 }
@@ -0,0 +1,331 @@
+use camera.wgsl;
+use geometry.wgsl;
+use material.wgsl;
+use raytrace_common.wgsl;
+use random.wgsl;
+use brdf.wgsl;
+use env_map.wgsl;
+use wavefront.wgsl;
+
+struct PathState
+{
+	radiance : vec3f,
+	randomState : u32,
+	throughput : vec3f,
+	coneWidth : f32,
+	coneSpreadAngle : f32,
+}
+
+struct QueuedRay
+{
+	origin : vec3f,
+	// Index of the path in the current chunk
+	path : u32,
+	direction : vec3f,
+}
+
+// Closest hit of the ray with the same index in the input ray queue
+struct QueuedHit
+{
+	distance : f32,
+	triangleID : u32,
+	instanceID : u32,
+	intersects : u32,
+	uv : vec2f,
+	// Material bin & position inside it, see scatterSortedHits
+	sortBin : u32,
+	sortRank : u32,
+}
+
+struct SortBins
+{
+	counts : array<atomic<u32>, SORT_BIN_COUNT>,
+	offsets : array<u32, SORT_BIN_COUNT>,
+}
+
+// Scattered ray waiting for the light sampling term of its MIS probability
+struct PendingBounce
+{
+	origin : vec3f,
+	path : u32,
+	direction : vec3f,
+	lightSamplingWeight : f32,
+	originOffset : vec3f,
+	partialMISProbability : f32,
+	scatteringFactor : vec3f,
+}
+
+@group(0) @binding(0) var<uniform> camera : Camera;
+
+@group(1) @binding(0) var<storage, read> vertexPositions : array<vec4f>;
+@group(1) @binding(1) var<storage, read> vertexAttributes : array<Vertex>;
+@group(1) @binding(2) var<storage, read> bvhNodes : array<BVHNode>;
+@group(1) @binding(3) var<storage, read> emissiveTriangles : TriangleArray;
+@group(1) @binding(4) var<storage, read> emissiveAliasTable : array<vec2u>;
+@group(1) @binding(5) var<storage, read> emissiveBvhNodes : array<BVHNode>;
+@group(1) @binding(6) var<storage, read> wideBvhNodes : WideBVHNodeArray;
+@group(1) @binding(7) var<storage, read> quantizedBvhNodes : array<QuantizedBVHChildGroup>;
+@group(1) @binding(8) var<storage, read> instances : InstanceArray;
+@group(1) @binding(9) var<storage, read> instanceBvhNodes : array<BVHNode>;
+
+@group(2) @binding(0) var<storage, read> materials : array<Material>;
+@group(2) @binding(1) var environmentMap : texture_storage_2d<rgba32float, read>;
+@group(2) @binding(2) var textureSampler : sampler;
+@group(2) @binding(3) var albedoTexture : texture_2d_array<f32>;
+@group(2) @binding(4) var materialTexture : texture_2d_array<f32>;
+@group(2) @binding(5) var normalTexture : texture_2d_array<f32>;
+@group(2) @binding(6) var<storage, read> environmentAliasTable : EnvMapAliasTable;
+
+@group(3) @binding(0) var accumulationTexture : texture_storage_2d<rgba32float, read_write>;
+@group(3) @binding(1) var<uniform> params : WavefrontParams;
+@group(3) @binding(2) var<storage, read_write> paths : array<PathState>;
+// Both ray queues, one after another
+@group(3) @binding(3) var<storage, read_write> rayQueues : array<QueuedRay>;
+@group(3) @binding(4) var<storage, read_write> hits : array<QueuedHit>;
+@group(3) @binding(5) var<storage, read_write> pendingBounces : array<PendingBounce>;
+@group(3) @binding(6) var<storage, read_write> queueCounts : array<atomic<u32>, QUEUE_COUNT>;
+@group(3) @binding(7) var<storage, read_write> sortBins : SortBins;
+// Hit indices ordered by material
+@group(3) @binding(8) var<storage, read_write> sortedHits : array<u32>;
+
+use bvh_traverse.wgsl;
+use env_map_sampling.wgsl;
+use path_tracing.wgsl;
+
+const SCAN_WORKGROUP_SIZE = 256u;
+const SCAN_BINS_PER_THREAD = SORT_BIN_COUNT / SCAN_WORKGROUP_SIZE;
+
+var<workgroup> scanSums : array<u32, SCAN_WORKGROUP_SIZE>;
+
+fn sortByMaterial() -> bool {
+	return (params.flags & WAVEFRONT_SORT_BY_MATERIAL) != 0u;
+}
+
+fn queueCapacity() -> u32 {
+	return arrayLength(&rayQueues) / 2u;
+}
+
+fn pixelCoordinates(pixel : u32) -> vec2u {
+	return vec2u(pixel % camera.screenSize.x, pixel / camera.screenSize.x);
+}
+
+// Appends a ray to be traced during the next bounce
+fn pushRay(ray : Ray, path : u32) {
+	let outputQueue = 1u - params.inputQueue;
+	let slot = atomicAdd(&queueCounts[outputQueue], 1u);
+	rayQueues[outputQueue * queueCapacity() + slot] = QueuedRay(ray.origin, path, ray.direction);
+}
+
+// Starts a path for every pixel of the chunk and puts the camera rays into the first ray queue
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn generate(@builtin(global_invocation_id) id : vec3u) {
+	let path = id.x;
+
+	if (path >= params.pathCount) {
+		return;
+	}
+
+	if (path == 0u) {
+		atomicStore(&queueCounts[RAY_QUEUE_0], params.pathCount);
+	}
+
+	let pixel = pixelCoordinates(params.pixelOffset + path);
+
+	var randomState = RandomState(0);
+	initRandom(&randomState, camera.globalSampleID);
+	initRandom(&randomState, pixel.x);
+	initRandom(&randomState, pixel.y);
+
+	let screenPosition = 2.0 * vec2f(f32(pixel.x) + uniformFloat(&randomState), f32(pixel.y) + uniformFloat(&randomState)) / vec2f(camera.screenSize) - vec2f(1.0);
+
+	let cameraRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, screenPosition * vec2f(1.0, -1.0));
+
+	// Angle between rays through neighbouring pixels
+	let neighbourRay = computeCameraRay(camera.position, camera.viewProjectionInverseMatrix, (screenPosition + vec2f(2.0 / f32(camera.screenSize.x), 0.0)) * vec2f(1.0, -1.0));
+	let pixelSpreadAngle = length(neighbourRay.direction - cameraRay.direction);
+
+	paths[path] = PathState(vec3f(0.0), randomState.value, vec3f(1.0), 0.0, pixelSpreadAngle);
+	rayQueues[RAY_QUEUE_0 * queueCapacity() + path] = QueuedRay(cameraRay.origin, path, cameraRay.direction);
+}
+
+// Finds the closest hit of every queued ray
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn extend(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= atomicLoad(&queueCounts[params.inputQueue])) {
+		return;
+	}
+
+	let queued = rayQueues[params.inputQueue * queueCapacity() + id.x];
+
+	let intersection = intersectScene(Ray(queued.origin, queued.direction));
+
+	var sortBin = SORT_BIN_COUNT - 1u;
+	var sortRank = 0u;
+
+	if (sortByMaterial()) {
+		if (intersection.intersects) {
+			sortBin = min(vertexAttributes[3u * intersection.triangleID].materialID, SORT_BIN_COUNT - 2u);
+		}
+
+		sortRank = atomicAdd(&sortBins.counts[sortBin], 1u);
+	}
+
+	hits[id.x] = QueuedHit(intersection.distance, intersection.triangleID, intersection.instanceID, select(0u, 1u, intersection.intersects), intersection.uv, sortBin, sortRank);
+}
+
+// Exclusive prefix sum of the material bin sizes counted by extend, which
+// also empties the bins for the next bounce. Runs as a single workgroup
+@compute @workgroup_size(SCAN_WORKGROUP_SIZE)
+fn scanSortBins(@builtin(local_invocation_index) localIndex : u32) {
+	var counts : array<u32, SCAN_BINS_PER_THREAD>;
+	var threadSum = 0u;
+
+	for (var i = 0u; i < SCAN_BINS_PER_THREAD; i += 1u) {
+		counts[i] = atomicExchange(&sortBins.counts[localIndex * SCAN_BINS_PER_THREAD + i], 0u);
+		threadSum += counts[i];
+	}
+
+	scanSums[localIndex] = threadSum;
+	workgroupBarrier();
+
+	// Hillis-Steele inclusive scan over the per-thread sums
+	for (var offset = 1u; offset < SCAN_WORKGROUP_SIZE; offset *= 2u) {
+		var value = scanSums[localIndex];
+		if (localIndex >= offset) {
+			value += scanSums[localIndex - offset];
+		}
+		workgroupBarrier();
+		scanSums[localIndex] = value;
+		workgroupBarrier();
+	}
+
+	var binOffset = scanSums[localIndex] - threadSum;
+	for (var i = 0u; i < SCAN_BINS_PER_THREAD; i += 1u) {
+		sortBins.offsets[localIndex * SCAN_BINS_PER_THREAD + i] = binOffset;
+		binOffset += counts[i];
+	}
+}
+
+// Counting sort of the hits by material, so that neighbouring shading
+// threads read the same material and texture layers
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn scatterSortedHits(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= atomicLoad(&queueCounts[params.inputQueue])) {
+		return;
+	}
+
+	let hit = hits[id.x];
+	sortedHits[sortBins.offsets[hit.sortBin] + hit.sortRank] = id.x;
+}
+
+// Accumulates emission and samples the next direction of every path that hit something.
+// Scattered rays that need the light sampling probability go to the connect queue,
+// the rest go straight to the next ray queue
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn shade(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= atomicLoad(&queueCounts[params.inputQueue])) {
+		return;
+	}
+
+	let index = select(id.x, sortedHits[id.x], sortByMaterial());
+
+	let queued = rayQueues[params.inputQueue * queueCapacity() + index];
+	let hit = hits[index];
+
+	let ray = Ray(queued.origin, queued.direction);
+	var path = paths[queued.path];
+
+	if (hit.intersects == 0u) {
+		path.radiance += path.throughput * sampleEnvMap(environmentMap, ray.direction);
+		paths[queued.path] = path;
+		return;
+	}
+
+	let intersection = loadSceneIntersection(hit.distance, hit.triangleID, hit.instanceID, hit.uv);
+
+	var randomState = RandomState(path.randomState);
+	let vertex = shadePathVertex(ray, intersection, path.coneWidth, path.coneSpreadAngle, &randomState);
+
+	path.coneWidth = vertex.coneWidth;
+	path.coneSpreadAngle = vertex.coneSpreadAngle;
+
+	// Rays sampled at the last bounce would never be traced
+	let continues = params.depth + 1u < camera.maxPathDepth;
+
+	if (vertex.kind == PATH_VERTEX_TRANSPARENT) {
+		if (continues) {
+			pushRay(vertex.ray, queued.path);
+		}
+	} else {
+		path.radiance += vertex.emission * path.throughput;
+
+		if (vertex.kind == PATH_VERTEX_SCATTERED && continues) {
+			if (vertex.lightSamplingWeight > 0.0) {
+				let slot = atomicAdd(&queueCounts[CONNECT_QUEUE], 1u);
+				pendingBounces[slot] = PendingBounce(vertex.ray.origin, queued.path, vertex.ray.direction, vertex.lightSamplingWeight,
+					vertex.originOffset, vertex.partialMISProbability, vertex.scatteringFactor);
+			} else {
+				path.throughput *= vertex.scatteringFactor / max(1e-8, vertex.partialMISProbability);
+
+				let survival = russianRoulette(path.throughput, params.depth + 1u, &randomState);
+				if (survival > 0.0) {
+					path.throughput /= survival;
+					pushRay(Ray(vertex.ray.origin + vertex.originOffset, vertex.ray.direction), queued.path);
+				}
+			}
+		}
+	}
+
+	path.randomState = randomState.value;
+	paths[queued.path] = path;
+}
+
+// Completes the MIS probability of the pending bounces with the light sampling
+// term, which traverses the light BVH, and queues their rays for the next bounce
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn connect(@builtin(global_invocation_id) id : vec3u) {
+	if (id.x >= atomicLoad(&queueCounts[CONNECT_QUEUE])) {
+		return;
+	}
+
+	let bounce = pendingBounces[id.x];
+
+	let totalMISProbability = bounce.partialMISProbability + lightSamplingProbability(Ray(bounce.origin, bounce.direction)) * bounce.lightSamplingWeight;
+
+	var path = paths[bounce.path];
+	path.throughput *= bounce.scatteringFactor / max(1e-8, totalMISProbability);
+
+	var randomState = RandomState(path.randomState);
+	let survival = russianRoulette(path.throughput, params.depth + 1u, &randomState);
+	path.randomState = randomState.value;
+
+	if (survival > 0.0) {
+		path.throughput /= survival;
+		pushRay(Ray(bounce.origin + bounce.originOffset, bounce.direction), bounce.path);
+	}
+
+	paths[bounce.path] = path;
+}
+
+// Adds the radiance of the finished paths of the chunk to the accumulation texture
+@compute @workgroup_size(WAVEFRONT_WORKGROUP_SIZE)
+fn accumulate(@builtin(global_invocation_id) id : vec3u) {
+	let path = id.x;
+
+	if (path >= params.pathCount) {
+		return;
+	}
+
+	let pixel = pixelCoordinates(params.pixelOffset + path);
+
+	// No idea where negative values come from :(
+	let color = clamp(paths[path].radiance, vec3f(0.0), vec3f(10.0));
+	let alpha = 1.0 / (f32(camera.sampleID) + 1.0);
+
+	// Second moment of the luminance in the alpha channel, like raytrace_monte_carlo.wgsl
+	let colorLuminance = luminance(color);
+
+	let accumulatedColor = textureLoad(accumulationTexture, pixel);
+	let storedColor = mix(accumulatedColor, vec4f(color, colorLuminance * colorLuminance), alpha);
+	textureStore(accumulationTexture, pixel, storedColor);
+}
@@ -0,0 +1,32 @@
+// Definitions shared by the wavefront path tracing kernels,
+// see raytrace_wavefront.wgsl and wavefront_dispatch.wgsl
+
+const WAVEFRONT_WORKGROUP_SIZE = 64u;
+
+// Indices into the queue counters; the ray queues are ping-ponged between bounces
+const RAY_QUEUE_0 = 0u;
+const RAY_QUEUE_1 = 1u;
+const CONNECT_QUEUE = 2u;
+const QUEUE_COUNT = 4u;
+
+// Hits are sorted into one bin per material before shading; materials past
+// the last but one bin share it, and misses go to the last one
+const SORT_BIN_COUNT = 1024u;
+
+// WavefrontParams.flags
+const WAVEFRONT_SORT_BY_MATERIAL = 1u;
+
+// One record per dispatch, selected with a dynamic offset
+struct WavefrontParams
+{
+	// Paths of the current chunk are the pixels [pixelOffset, pixelOffset + pathCount)
+	pixelOffset : u32,
+	pathCount : u32,
+	depth : u32,
+	inputQueue : u32,
+	// Used by prepareDispatch only
+	dispatchQueue : u32,
+	dispatchSlot : u32,
+	resetQueueMask : u32,
+	flags : u32,
+}
@@ -0,0 +1,22 @@
+use wavefront.wgsl;
+
+@group(0) @binding(0) var<uniform> params : WavefrontParams;
+@group(0) @binding(1) var<storage, read_write> queueCounts : array<u32, QUEUE_COUNT>;
+@group(0) @binding(2) var<storage, read_write> dispatchArgs : array<u32>;
+
+// Writes the indirect dispatch arguments for processing one of the
+// queues, and empties the queues that the dispatched kernels fill
+@compute @workgroup_size(1)
+fn prepareDispatch() {
+	let workgroupCount = (queueCounts[params.dispatchQueue] + WAVEFRONT_WORKGROUP_SIZE - 1u) / WAVEFRONT_WORKGROUP_SIZE;
+
+	dispatchArgs[3u * params.dispatchSlot + 0u] = workgroupCount;
+	dispatchArgs[3u * params.dispatchSlot + 1u] = 1u;
+	dispatchArgs[3u * params.dispatchSlot + 2u] = 1u;
+
+	for (var queue = 0u; queue < QUEUE_COUNT; queue += 1u) {
+		if ((params.resetQueueMask & (1u << queue)) != 0u) {
+			queueCounts[queue] = 0u;
+		}
+	}
+}
@@ -0,0 +1,331 @@
+#include <webgpu-raytracer/adaptive_sampling.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+    // AdaptiveSamplingParams in adaptive_sampling.wgsl
+    struct Params
+    {
+        glm::uvec2 screenSize;
+        std::uint32_t minSampleCount;
+        float targetRelativeError;
+    };
+
+    // AdaptiveSamplingState in adaptive_sampling.wgsl: the indirect
+    // dispatch arguments followed by the sum of the tile sample counts
+    struct State
+    {
+        std::uint32_t activeTileCount;
+        std::uint32_t dispatchY;
+        std::uint32_t dispatchZ;
+        std::uint32_t tileSampleCountSum;
+    };
+
+    enum Binding : std::uint32_t
+    {
+        AccumulationBinding,
+        SampleCountsBinding,
+        ActiveTilesBinding,
+        BindingCount,
+    };
+
+    enum BuildBinding : std::uint32_t
+    {
+        BuildParamsBinding,
+        BuildAccumulationBinding,
+        BuildSampleCountsBinding,
+        BuildActiveTilesBinding,
+        BuildStateBinding,
+        BuildBindingCount,
+    };
+
+    WGPUBindGroupLayoutEntry layoutEntry(std::uint32_t binding, WGPUBufferBindingType type)
+    {
+        WGPUBindGroupLayoutEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.visibility = WGPUShaderStage_Compute;
+        entry.buffer.nextInChain = nullptr;
+        entry.buffer.type = type;
+        entry.buffer.hasDynamicOffset = false;
+        entry.buffer.minBindingSize = 0;
+        entry.sampler.nextInChain = nullptr;
+        entry.sampler.type = WGPUSamplerBindingType_Undefined;
+        entry.texture.nextInChain = nullptr;
+        entry.texture.sampleType = WGPUTextureSampleType_Undefined;
+        entry.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+        entry.texture.multisampled = false;
+        entry.storageTexture.nextInChain = nullptr;
+        entry.storageTexture.access = WGPUStorageTextureAccess_Undefined;
+        entry.storageTexture.format = WGPUTextureFormat_Undefined;
+        entry.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+        return entry;
+    }
+
+    WGPUBindGroupLayoutEntry accumulationLayoutEntry(std::uint32_t binding, WGPUTextureFormat accumulationTextureFormat)
+    {
+        auto entry = layoutEntry(binding, WGPUBufferBindingType_Undefined);
+        entry.storageTexture.access = WGPUStorageTextureAccess_ReadWrite;
+        entry.storageTexture.format = accumulationTextureFormat;
+        entry.storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+        return entry;
+    }
+
+    WGPUBindGroupEntry bufferEntry(std::uint32_t binding, WGPUBuffer buffer)
+    {
+        WGPUBindGroupEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.buffer = buffer;
+        entry.offset = 0;
+        entry.size = buffer ? wgpuBufferGetSize(buffer) : 0;
+        entry.sampler = nullptr;
+        entry.textureView = nullptr;
+        return entry;
+    }
+
+    WGPUBindGroupEntry textureEntry(std::uint32_t binding, WGPUTextureView textureView)
+    {
+        auto entry = bufferEntry(binding, nullptr);
+        entry.textureView = textureView;
+        return entry;
+    }
+
+    WGPUBuffer createBuffer(WGPUDevice device, char const * label, WGPUBufferUsageFlags usage, std::uint64_t size)
+    {
+        WGPUBufferDescriptor bufferDescriptor;
+        bufferDescriptor.nextInChain = nullptr;
+        bufferDescriptor.label = label;
+        bufferDescriptor.usage = usage;
+        bufferDescriptor.size = size;
+        bufferDescriptor.mappedAtCreation = false;
+
+        return wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+    }
+
+    WGPUBindGroupLayout createBindGroupLayout(WGPUDevice device, char const * label, WGPUBindGroupLayoutEntry const * entries, std::uint32_t entryCount)
+    {
+        WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
+        bindGroupLayoutDescriptor.nextInChain = nullptr;
+        bindGroupLayoutDescriptor.label = label;
+        bindGroupLayoutDescriptor.entryCount = entryCount;
+        bindGroupLayoutDescriptor.entries = entries;
+
+        return wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
+    }
+
+    WGPUBindGroup createBindGroup(WGPUDevice device, char const * label, WGPUBindGroupLayout layout, WGPUBindGroupEntry const * entries, std::uint32_t entryCount)
+    {
+        WGPUBindGroupDescriptor bindGroupDescriptor;
+        bindGroupDescriptor.nextInChain = nullptr;
+        bindGroupDescriptor.label = label;
+        bindGroupDescriptor.layout = layout;
+        bindGroupDescriptor.entryCount = entryCount;
+        bindGroupDescriptor.entries = entries;
+
+        return wgpuDeviceCreateBindGroup(device, &bindGroupDescriptor);
+    }
+
+    glm::uvec2 tileCount(glm::uvec2 const & screenSize)
+    {
+        return (screenSize + AdaptiveSampling::TILE_SIZE - 1u) / AdaptiveSampling::TILE_SIZE;
+    }
+
+}
+
+AdaptiveSampling::AdaptiveSampling(WGPUDevice device, WGPUQueue queue, ShaderRegistry & shaderRegistry, WGPUTextureFormat accumulationTextureFormat)
+    : device_(device)
+    , queue_(queue)
+{
+    WGPUBindGroupLayoutEntry layoutEntries[BindingCount];
+    layoutEntries[AccumulationBinding] = accumulationLayoutEntry(AccumulationBinding, accumulationTextureFormat);
+    layoutEntries[SampleCountsBinding] = layoutEntry(SampleCountsBinding, WGPUBufferBindingType_Storage);
+    layoutEntries[ActiveTilesBinding] = layoutEntry(ActiveTilesBinding, WGPUBufferBindingType_ReadOnlyStorage);
+
+    bindGroupLayout_ = createBindGroupLayout(device, "adaptive_sampling", layoutEntries, BindingCount);
+
+    WGPUBindGroupLayoutEntry buildLayoutEntries[BuildBindingCount];
+    buildLayoutEntries[BuildParamsBinding] = layoutEntry(BuildParamsBinding, WGPUBufferBindingType_Uniform);
+    buildLayoutEntries[BuildAccumulationBinding] = accumulationLayoutEntry(BuildAccumulationBinding, accumulationTextureFormat);
+    buildLayoutEntries[BuildSampleCountsBinding] = layoutEntry(BuildSampleCountsBinding, WGPUBufferBindingType_ReadOnlyStorage);
+    buildLayoutEntries[BuildActiveTilesBinding] = layoutEntry(BuildActiveTilesBinding, WGPUBufferBindingType_Storage);
+    buildLayoutEntries[BuildStateBinding] = layoutEntry(BuildStateBinding, WGPUBufferBindingType_Storage);
+
+    buildBindGroupLayout_ = createBindGroupLayout(device, "adaptive_sampling_build", buildLayoutEntries, BuildBindingCount);
+
+    WGPUPipelineLayoutDescriptor pipelineLayoutDescriptor;
+    pipelineLayoutDescriptor.nextInChain = nullptr;
+    pipelineLayoutDescriptor.label = nullptr;
+    pipelineLayoutDescriptor.bindGroupLayoutCount = 1;
+    pipelineLayoutDescriptor.bindGroupLayouts = &buildBindGroupLayout_;
+
+    buildPipelineLayout_ = wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDescriptor);
+
+    WGPUShaderModule shaderModule = shaderRegistry.loadShaderModule("adaptive_sampling");
+
+    WGPUComputePipelineDescriptor pipelineDescriptor;
+    pipelineDescriptor.nextInChain = nullptr;
+    pipelineDescriptor.label = "adaptive_sampling_build";
+    pipelineDescriptor.layout = buildPipelineLayout_;
+    pipelineDescriptor.compute.nextInChain = nullptr;
+    pipelineDescriptor.compute.module = shaderModule;
+    pipelineDescriptor.compute.entryPoint = "buildSampleMap";
+    pipelineDescriptor.compute.constantCount = 0;
+    pipelineDescriptor.compute.constants = nullptr;
+
+    buildPipeline_ = wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
+
+    paramsBuffer_ = createBuffer(device, "adaptiveSamplingParams", WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, sizeof(Params));
+    dispatchArgsBuffer_ = createBuffer(device, "adaptiveSamplingState", WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst,
+        sizeof(State));
+    mapBuffer_ = createBuffer(device, "adaptiveSamplingStateMap", WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst, sizeof(State));
+}
+
+AdaptiveSampling::~AdaptiveSampling()
+{
+    releaseState();
+
+    wgpuBufferRelease(mapBuffer_);
+    wgpuBufferRelease(dispatchArgsBuffer_);
+    wgpuBufferRelease(paramsBuffer_);
+    wgpuComputePipelineRelease(buildPipeline_);
+    wgpuPipelineLayoutRelease(buildPipelineLayout_);
+    wgpuBindGroupLayoutRelease(buildBindGroupLayout_);
+    wgpuBindGroupLayoutRelease(bindGroupLayout_);
+}
+
+void AdaptiveSampling::releaseState()
+{
+    if (!bindGroup_)
+        return;
+
+    wgpuBindGroupRelease(buildBindGroup_);
+    wgpuBindGroupRelease(bindGroup_);
+    wgpuBufferRelease(activeTilesBuffer_);
+    wgpuBufferRelease(sampleCountsBuffer_);
+
+    bindGroup_ = nullptr;
+}
+
+void AdaptiveSampling::recreateState(WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize)
+{
+    releaseState();
+
+    accumulationTextureView_ = accumulationTextureView;
+    screenSize_ = screenSize;
+
+    glm::uvec2 const tiles = tileCount(screenSize);
+
+    sampleCountsBuffer_ = createBuffer(device_, "adaptiveSamplingSampleCounts", WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst,
+        std::max<std::uint64_t>(1, std::uint64_t(screenSize.x) * screenSize.y) * sizeof(std::uint32_t));
+    activeTilesBuffer_ = createBuffer(device_, "adaptiveSamplingActiveTiles", WGPUBufferUsage_Storage,
+        std::max<std::uint64_t>(1, std::uint64_t(tiles.x) * tiles.y) * sizeof(std::uint32_t));
+
+    WGPUBindGroupEntry entries[BindingCount];
+    entries[AccumulationBinding] = textureEntry(AccumulationBinding, accumulationTextureView);
+    entries[SampleCountsBinding] = bufferEntry(SampleCountsBinding, sampleCountsBuffer_);
+    entries[ActiveTilesBinding] = bufferEntry(ActiveTilesBinding, activeTilesBuffer_);
+
+    bindGroup_ = createBindGroup(device_, "adaptive_sampling", bindGroupLayout_, entries, BindingCount);
+
+    WGPUBindGroupEntry buildEntries[BuildBindingCount];
+    buildEntries[BuildParamsBinding] = bufferEntry(BuildParamsBinding, paramsBuffer_);
+    buildEntries[BuildAccumulationBinding] = textureEntry(BuildAccumulationBinding, accumulationTextureView);
+    buildEntries[BuildSampleCountsBinding] = bufferEntry(BuildSampleCountsBinding, sampleCountsBuffer_);
+    buildEntries[BuildActiveTilesBinding] = bufferEntry(BuildActiveTilesBinding, activeTilesBuffer_);
+    buildEntries[BuildStateBinding] = bufferEntry(BuildStateBinding, dispatchArgsBuffer_);
+
+    buildBindGroup_ = createBindGroup(device_, "adaptive_sampling_build", buildBindGroupLayout_, buildEntries, BuildBindingCount);
+}
+
+void AdaptiveSampling::update(WGPUCommandEncoder commandEncoder, WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize,
+    std::uint32_t frameID, AdaptiveSamplingOptions const & options)
+{
+    if (!bindGroup_ || accumulationTextureView != accumulationTextureView_ || screenSize != screenSize_)
+        recreateState(accumulationTextureView, screenSize);
+
+    if (frameID == 0)
+    {
+        wgpuCommandEncoderClearBuffer(commandEncoder, sampleCountsBuffer_, 0, wgpuBufferGetSize(sampleCountsBuffer_));
+
+        ++generation_;
+        std::lock_guard lock{statsMutex_};
+        stats_ = std::nullopt;
+    }
+
+    if (frameID % std::max<std::uint32_t>(1, options.updatePeriod) != 0)
+        return;
+
+    // Queue writes are ordered before the commands submitted after them
+    Params const params{screenSize, options.minSampleCount, options.targetRelativeError};
+    wgpuQueueWriteBuffer(queue_, paramsBuffer_, 0, &params, sizeof(params));
+
+    State const state{0, 1, 1, 0};
+    wgpuQueueWriteBuffer(queue_, dispatchArgsBuffer_, 0, &state, sizeof(state));
+
+    glm::uvec2 const tiles = tileCount(screenSize);
+
+    WGPUComputePassDescriptor computePassDescriptor;
+    computePassDescriptor.nextInChain = nullptr;
+    computePassDescriptor.label = "adaptive_sampling_build";
+    computePassDescriptor.timestampWrites = nullptr;
+
+    WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, buildBindGroup_, 0, nullptr);
+    wgpuComputePassEncoderSetPipeline(computePassEncoder, buildPipeline_);
+    wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, tiles.x, tiles.y, 1);
+    wgpuComputePassEncoderEnd(computePassEncoder);
+    wgpuComputePassEncoderRelease(computePassEncoder);
+
+    if (mapState_ != MapState::Idle)
+        return;
+
+    wgpuCommandEncoderCopyBufferToBuffer(commandEncoder, dispatchArgsBuffer_, 0, mapBuffer_, 0, sizeof(State));
+    resolvedGeneration_ = generation_;
+    resolvedTileCount_ = tiles.x * tiles.y;
+    mapState_ = MapState::Resolved;
+}
+
+void AdaptiveSampling::poll()
+{
+    if (mapState_ != MapState::Resolved)
+        return;
+
+    mapState_ = MapState::Mapping;
+
+    auto callback = [](WGPUBufferMapAsyncStatus status, void * userData)
+    {
+        auto self = static_cast<AdaptiveSampling *>(userData);
+
+        if (status == WGPUBufferMapAsyncStatus_Success)
+        {
+            auto state = static_cast<State const *>(wgpuBufferGetConstMappedRange(self->mapBuffer_, 0, sizeof(State)));
+
+            AdaptiveSamplingStats stats;
+            stats.tileCount = self->resolvedTileCount_;
+            stats.activeTileCount = state->activeTileCount;
+            stats.meanSampleCount = state->tileSampleCountSum * 1.0 / std::max<std::uint32_t>(1, stats.tileCount);
+
+            wgpuBufferUnmap(self->mapBuffer_);
+
+            if (self->resolvedGeneration_ == self->generation_)
+            {
+                std::lock_guard lock{self->statsMutex_};
+                self->stats_ = stats;
+            }
+        }
+
+        self->mapState_ = MapState::Idle;
+    };
+
+    wgpuBufferMapAsync(mapBuffer_, WGPUMapMode_Read, 0, sizeof(State), callback, this);
+}
+
+std::optional<AdaptiveSamplingStats> AdaptiveSampling::stats() const
+{
+    std::lock_guard lock{statsMutex_};
+    return stats_;
+}
@@ -3,20 +3,14 @@
 
 #include <iostream>
 
-// Generate the data for sampling values in proportion to input probabilities
-// using the alias method
-std::vector<AliasRecord> generateAlias(std::vector<float> const & probabilities)
+void fillAliasTable(std::span<float const> probabilities, std::span<AliasRecord> result)
 {
-    Timer timer;
-
     struct IndexAndProbability
     {
         std::uint32_t index;
         float probability;
     };
 
-    std::vector<AliasRecord> result(probabilities.size());
-
     std::vector<IndexAndProbability> underValues;
     std::vector<IndexAndProbability> overValues;
 
@@ -66,6 +60,17 @@ std::vector<AliasRecord> generateAlias(std::vector<float> const & probabilities)
         };
     }
 
+}
+
+// Generate the data for sampling values in proportion to input probabilities
+// using the alias method
+std::vector<AliasRecord> generateAlias(std::vector<float> const & probabilities)
+{
+    Timer timer;
+
+    std::vector<AliasRecord> result(probabilities.size());
+    fillAliasTable(probabilities, result);
+
     std::cout << "Built alias table for " << probabilities.size() << " objects in " << timer.duration() << " seconds" << std::endl;
 
     return result;
@@ -1,11 +1,13 @@
 #include <webgpu-raytracer/application.hpp>
 #include <webgpu-raytracer/sdl_wgpu.h>
+#include <webgpu-raytracer/device.hpp>
 
 #include <wgpu.h>
 
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <algorithm>
 
 Application::Application()
 {
@@ -17,29 +19,7 @@ Application::Application()
 
     // Create WebGPU instance
 
-    WGPUInstanceExtras instanceExtras;
-    instanceExtras.chain.next = nullptr;
-    instanceExtras.chain.sType = (WGPUSType)WGPUSType_InstanceExtras;
-
-#if defined(__APPLE__)
-    instanceExtras.backends = WGPUInstanceBackend_Metal;
-#elif defined(_WIN32)
-    instanceExtras.backends = WGPUInstanceBackend_DX12;
-#else
-    instanceExtras.backends = WGPUInstanceBackend_Vulkan;
-#endif
-
-    instanceExtras.flags = WGPUInstanceFlag_Default;
-    instanceExtras.dx12ShaderCompiler = WGPUDx12Compiler_Undefined;
-    instanceExtras.gles3MinorVersion = WGPUGles3MinorVersion_Automatic;
-    instanceExtras.dxilPath = nullptr;
-    instanceExtras.dxcPath = nullptr;
-
-    WGPUInstanceDescriptor instanceDescriptor;
-    instanceDescriptor.nextInChain = (WGPUChainedStruct *)&instanceExtras;
-    WGPUInstance instance = wgpuCreateInstance(&instanceDescriptor);
-
-    std::cout << "Instance: " << instance << std::endl;
+    WGPUInstance instance = createInstance();
 
     // Create WebGPU surface
 
@@ -47,126 +27,10 @@ Application::Application()
 
     std::cout << "Surface: " << surface_ << std::endl;
 
-    // Request WebGPU adapter
-
-    WGPURequestAdapterOptions requestAdapterOptions;
-    requestAdapterOptions.nextInChain = nullptr;
-    requestAdapterOptions.compatibleSurface = surface_;
-    requestAdapterOptions.powerPreference = WGPUPowerPreference_HighPerformance;
-    requestAdapterOptions.forceFallbackAdapter = false;
-    requestAdapterOptions.backendType = WGPUBackendType_Undefined;
-
-    WGPUAdapter adapter = nullptr;
-
-    auto requestAdapterCallback = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, char const * message, void * userdata){
-        if (message)
-            std::cout << "Adapter callback message: " << message << std::endl;
-
-        if (status == WGPURequestAdapterStatus_Success)
-            *(WGPUAdapter *)(userdata) = adapter;
-        else
-            throw std::runtime_error(message);
-    };
-
-    wgpuInstanceRequestAdapter(instance, &requestAdapterOptions, requestAdapterCallback, &adapter);
-
-    std::cout << "Adapter: " << adapter << std::endl;
-
-    if (!adapter)
-        throw std::runtime_error("Adapter not created");
-
-    // List adapter features
-
-    std::vector<WGPUFeatureName> features;
-    features.resize(wgpuAdapterEnumerateFeatures(adapter, nullptr));
-    wgpuAdapterEnumerateFeatures(adapter, features.data());
-
-    std::cout << "Adapter features:" << std::endl;
-    for (auto const & feature : features)
-        std::cout << "    " << feature << std::endl;
-
-    // List adapter limits
-
-    WGPUSupportedLimits supportedLimits;
-    supportedLimits.nextInChain = nullptr;
-    wgpuAdapterGetLimits(adapter, &supportedLimits);
-
-    std::cout << "Supported limits:" << std::endl;
-    std::cout << "    maxTextureDimension1D: " << supportedLimits.limits.maxTextureDimension1D << std::endl;
-    std::cout << "    maxTextureDimension2D: " << supportedLimits.limits.maxTextureDimension2D << std::endl;
-    std::cout << "    maxTextureDimension3D: " << supportedLimits.limits.maxTextureDimension3D << std::endl;
-    std::cout << "    maxTextureArrayLayers: " << supportedLimits.limits.maxTextureArrayLayers << std::endl;
-    std::cout << "    maxBindGroups: " << supportedLimits.limits.maxBindGroups << std::endl;
-    std::cout << "    maxBindGroupsPlusVertexBuffers: " << supportedLimits.limits.maxBindGroupsPlusVertexBuffers << std::endl;
-    std::cout << "    maxBindingsPerBindGroup: " << supportedLimits.limits.maxBindingsPerBindGroup << std::endl;
-    std::cout << "    maxDynamicUniformBuffersPerPipelineLayout: " << supportedLimits.limits.maxDynamicUniformBuffersPerPipelineLayout << std::endl;
-    std::cout << "    maxDynamicStorageBuffersPerPipelineLayout: " << supportedLimits.limits.maxDynamicStorageBuffersPerPipelineLayout << std::endl;
-    std::cout << "    maxSampledTexturesPerShaderStage: " << supportedLimits.limits.maxSampledTexturesPerShaderStage << std::endl;
-    std::cout << "    maxSamplersPerShaderStage: " << supportedLimits.limits.maxSamplersPerShaderStage << std::endl;
-    std::cout << "    maxStorageBuffersPerShaderStage: " << supportedLimits.limits.maxStorageBuffersPerShaderStage << std::endl;
-    std::cout << "    maxStorageTexturesPerShaderStage: " << supportedLimits.limits.maxStorageTexturesPerShaderStage << std::endl;
-    std::cout << "    maxUniformBuffersPerShaderStage: " << supportedLimits.limits.maxUniformBuffersPerShaderStage << std::endl;
-    std::cout << "    maxUniformBufferBindingSize: " << supportedLimits.limits.maxUniformBufferBindingSize << std::endl;
-    std::cout << "    maxStorageBufferBindingSize: " << supportedLimits.limits.maxStorageBufferBindingSize << std::endl;
-    std::cout << "    minUniformBufferOffsetAlignment: " << supportedLimits.limits.minUniformBufferOffsetAlignment << std::endl;
-    std::cout << "    minStorageBufferOffsetAlignment: " << supportedLimits.limits.minStorageBufferOffsetAlignment << std::endl;
-    std::cout << "    maxVertexBuffers: " << supportedLimits.limits.maxVertexBuffers << std::endl;
-    std::cout << "    maxBufferSize: " << supportedLimits.limits.maxBufferSize << std::endl;
-    std::cout << "    maxVertexAttributes: " << supportedLimits.limits.maxVertexAttributes << std::endl;
-    std::cout << "    maxVertexBufferArrayStride: " << supportedLimits.limits.maxVertexBufferArrayStride << std::endl;
-    std::cout << "    maxInterStageShaderComponents: " << supportedLimits.limits.maxInterStageShaderComponents << std::endl;
-    std::cout << "    maxInterStageShaderVariables: " << supportedLimits.limits.maxInterStageShaderVariables << std::endl;
-    std::cout << "    maxColorAttachments: " << supportedLimits.limits.maxColorAttachments << std::endl;
-    std::cout << "    maxColorAttachmentBytesPerSample: " << supportedLimits.limits.maxColorAttachmentBytesPerSample << std::endl;
-    std::cout << "    maxComputeWorkgroupStorageSize: " << supportedLimits.limits.maxComputeWorkgroupStorageSize << std::endl;
-    std::cout << "    maxComputeInvocationsPerWorkgroup: " << supportedLimits.limits.maxComputeInvocationsPerWorkgroup << std::endl;
-    std::cout << "    maxComputeWorkgroupSizeX: " << supportedLimits.limits.maxComputeWorkgroupSizeX << std::endl;
-    std::cout << "    maxComputeWorkgroupSizeY: " << supportedLimits.limits.maxComputeWorkgroupSizeY << std::endl;
-    std::cout << "    maxComputeWorkgroupSizeZ: " << supportedLimits.limits.maxComputeWorkgroupSizeZ << std::endl;
-    std::cout << "    maxComputeWorkgroupsPerDimension: " << supportedLimits.limits.maxComputeWorkgroupsPerDimension << std::endl;
-
-    // Request WebGPU device
-
-    WGPURequiredLimits requiredLimits;
-    requiredLimits.nextInChain = nullptr;
-    requiredLimits.limits = supportedLimits.limits;
-    requiredLimits.limits.maxBufferSize = 1024 * 1024 * 1024;
-
-    WGPUFeatureName requiredFeatures[3]
-    {
-        WGPUFeatureName_Float32Filterable,
-        WGPUFeatureName_TimestampQuery,
-        (WGPUFeatureName)WGPUNativeFeature_TextureAdapterSpecificFormatFeatures,
-    };
-
-    WGPUDeviceDescriptor deviceDescriptor;
-    deviceDescriptor.nextInChain = nullptr;
-    deviceDescriptor.label = nullptr;
-    deviceDescriptor.requiredFeatureCount = 3;
-    deviceDescriptor.requiredFeatures = requiredFeatures;
-    deviceDescriptor.requiredLimits = &requiredLimits;
-    deviceDescriptor.defaultQueue.nextInChain = nullptr;
-    deviceDescriptor.defaultQueue.label = nullptr;
-    deviceDescriptor.deviceLostCallback = nullptr;
-    deviceDescriptor.deviceLostUserdata = nullptr;
-
-    auto requestDeviceCallback = [](WGPURequestDeviceStatus status, WGPUDevice device, char const * message, void * userdata)
-    {
-        if (message)
-            std::cout << "Device callback message: " << message << std::endl;
-
-        if (status == WGPURequestDeviceStatus_Success)
-            *(WGPUDevice *)(userdata) = device;
-        else
-            throw std::runtime_error(message);
-    };
-
-    wgpuAdapterRequestDevice(adapter, &deviceDescriptor, requestDeviceCallback, &device_);
-
-    std::cout << "Device: " << device_ << std::endl;
+    // Request WebGPU adapter & device
 
-    if (!device_)
-        throw std::runtime_error("Device not created");
+    WGPUAdapter adapter = requestAdapter(instance, surface_);
+    device_ = requestDevice(adapter);
 
     // Get preferred format for this combination of surface + adapter
 
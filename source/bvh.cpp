@@ -1,8 +1,16 @@
 #include <webgpu-raytracer/bvh.hpp>
 #include <webgpu-raytracer/timer.hpp>
+#include <webgpu-raytracer/thread_pool.hpp>
 
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <numeric>
+#include <deque>
 #include <iostream>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
 
 namespace
 {
@@ -107,23 +115,1848 @@ namespace
         }
     }
 
+    struct Bin
+    {
+        AABB aabb;
+        std::uint32_t triangleCount = 0;
+    };
+
+    struct BinnedSplit
+    {
+        std::uint32_t axis = 0;
+        std::uint32_t bin = 0;
+        float cost = std::numeric_limits<float>::infinity();
+    };
+
+    std::uint32_t binIndex(AABB const & centroidAABB, glm::vec3 const & binScale, std::uint32_t binCount, std::uint32_t axis, float centroid)
+    {
+        // NB: must produce exactly the same result when binning and when partitioning
+        float bin = (centroid - centroidAABB.min[axis]) * binScale[axis];
+        return std::min(binCount - 1, static_cast<std::uint32_t>(std::max(0.f, bin)));
+    }
+
+    // Evaluates all splits between bins along all 3 axes;
+    // bins contain binCount entries per axis, rightAABB is scratch space for binCount entries
+    BinnedSplit findBinnedSplit(Bin const * bins, std::uint32_t binCount, std::uint32_t triangleCount, AABB const & centroidAABB, AABB * rightAABB)
+    {
+        BinnedSplit best;
+
+        for (std::uint32_t axis = 0; axis < 3; ++axis)
+        {
+            // All centroids coincide along this axis
+            if (!(centroidAABB.max[axis] > centroidAABB.min[axis]))
+                continue;
+
+            auto const * axisBins = bins + axis * binCount;
+
+            rightAABB[binCount - 1] = axisBins[binCount - 1].aabb;
+            for (std::uint32_t i = binCount - 1; i > 0; --i)
+            {
+                rightAABB[i - 1] = rightAABB[i];
+                rightAABB[i - 1].extend(axisBins[i - 1].aabb);
+            }
+
+            // Split between bins i and i + 1
+            AABB leftAABB;
+            std::uint32_t leftCount = 0;
+            for (std::uint32_t i = 0; i + 1 < binCount; ++i)
+            {
+                leftAABB.extend(axisBins[i].aabb);
+                leftCount += axisBins[i].triangleCount;
+
+                std::uint32_t rightCount = triangleCount - leftCount;
+
+                if (leftCount == 0 || rightCount == 0)
+                    continue;
+
+                float cost = leftAABB.surfaceArea() * leftCount + rightAABB[i + 1].surfaceArea() * rightCount;
+
+                if (cost < best.cost)
+                {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = i;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    // Binned SAH builder, see e.g.
+    //     Ingo Wald, On fast Construction of SAH-based Bounding Volume Hierarchies (2007)
+    // Instead of sorting the triangles along each axis, triangle centroids are
+    // distributed into a fixed number of equally-sized bins spanning the centroid
+    // bounds of the node, and only the splits between bins are evaluated.
+    // This makes each node O(n) instead of O(n log n), and triangles are then
+    // partitioned in-place without any sorting.
+    struct BinnedBuilder
+    {
+        BinnedBuilder(BVH & bvh, std::vector<AABB> const & triangleAABB, std::vector<glm::vec3> const & triangleCentroid, std::uint32_t binCount)
+            : bvh(bvh)
+            , triangleAABB(triangleAABB)
+            , triangleCentroid(triangleCentroid)
+            , binCount(std::max<std::uint32_t>(2, binCount))
+        {
+            // Scratch arrays are shared by all nodes: a node is done with
+            // them before recursing into its children
+            bins.resize(3 * this->binCount);
+            rightAABB.resize(this->binCount);
+        }
+
+        template <typename Iterator>
+        void buildNode(std::uint32_t nodeID, Iterator trianglesBegin, Iterator trianglesEnd, std::uint32_t depth)
+        {
+            maxDepth = std::max(depth, maxDepth);
+
+            AABB aabb;
+            AABB centroidAABB;
+            for (auto it = trianglesBegin; it != trianglesEnd; ++it)
+            {
+                aabb.extend(triangleAABB[*it]);
+                centroidAABB.extend(triangleCentroid[*it]);
+            }
+
+            bvh.nodes[nodeID].aabbMin = aabb.min;
+            bvh.nodes[nodeID].aabbMax = aabb.max;
+
+            std::uint32_t const triangleCount = trianglesEnd - trianglesBegin;
+
+            float nodeSelfCost = triangleCount * aabb.surfaceArea();
+
+            BinnedSplit bestSplit;
+
+            glm::vec3 const binScale = float(binCount) / centroidAABB.diagonal();
+
+            if (triangleCount > 4 && depth < MAX_DEPTH)
+            {
+                std::fill(bins.begin(), bins.end(), Bin{});
+
+                for (auto it = trianglesBegin; it != trianglesEnd; ++it)
+                {
+                    for (std::uint32_t axis = 0; axis < 3; ++axis)
+                    {
+                        auto & bin = bins[axis * binCount + binIndex(centroidAABB, binScale, binCount, axis, triangleCentroid[*it][axis])];
+                        bin.aabb.extend(triangleAABB[*it]);
+                        bin.triangleCount += 1;
+                    }
+                }
+
+                bestSplit = findBinnedSplit(bins.data(), binCount, triangleCount, centroidAABB, rightAABB.data());
+            }
+
+            auto & node = bvh.nodes[nodeID];
+
+            if (triangleCount <= 4 || nodeSelfCost < bestSplit.cost || depth == MAX_DEPTH)
+            {
+                // Create leaf node
+                node.leftChildOrFirstTriangle = trianglesBegin - bvh.triangleIDs.begin();
+                node.triangleCount = triangleCount;
+            }
+            else
+            {
+                // Split into 2 child nodes
+
+                std::uint32_t leftChild = bvh.nodes.size();
+
+                node.leftChildOrFirstTriangle = leftChild | (bestSplit.axis << 30);
+                node.triangleCount = 0;
+
+                bvh.nodes.emplace_back();
+                bvh.nodes.emplace_back();
+
+                auto splitIt = std::partition(trianglesBegin, trianglesEnd, [&](std::uint32_t triangle){
+                    return binIndex(centroidAABB, binScale, binCount, bestSplit.axis, triangleCentroid[triangle][bestSplit.axis]) <= bestSplit.bin;
+                });
+
+                buildNode(leftChild, trianglesBegin, splitIt, depth + 1);
+                buildNode(leftChild + 1, splitIt, trianglesEnd, depth + 1);
+            }
+        }
+
+        BVH & bvh;
+        std::vector<AABB> const & triangleAABB;
+        std::vector<glm::vec3> const & triangleCentroid;
+        std::uint32_t const binCount;
+
+        std::vector<Bin> bins;
+        std::vector<AABB> rightAABB;
+
+        std::uint32_t maxDepth = 0;
+    };
+
+    // Two children overlapping by less than this fraction of the root
+    // surface area aren't worth trying spatial splits for
+    constexpr float SPATIAL_SPLIT_OVERLAP_THRESHOLD = 1e-5f;
+
+    bool isValid(AABB const & aabb)
+    {
+        return aabb.min.x <= aabb.max.x && aabb.min.y <= aabb.max.y && aabb.min.z <= aabb.max.z;
+    }
+
+    AABB intersect(AABB const & aabb1, AABB const & aabb2)
+    {
+        return AABB{glm::max(aabb1.min, aabb2.min), glm::min(aabb1.max, aabb2.max)};
+    }
+
+    struct SpatialBin
+    {
+        AABB aabb;
+        std::uint32_t entryCount = 0;
+        std::uint32_t exitCount = 0;
+    };
+
+    struct SpatialSplit
+    {
+        std::uint32_t axis = 0;
+        float position = 0.f;
+        float cost = std::numeric_limits<float>::infinity();
+        AABB leftAABB;
+        AABB rightAABB;
+        std::uint32_t leftCount = 0;
+        std::uint32_t rightCount = 0;
+    };
+
+    // Spatial split BVH builder, see
+    //     Martin Stich, Heiko Friedrich, Andreas Dietrich, Spatial Splits in Bounding Volume Hierarchies (2009)
+    // Nodes are built from triangle references, each with its own bounding box.
+    // Besides binned object splits, a node tries splitting its bounds into
+    // equally-sized spatial bins; references straddling the chosen plane are
+    // clipped to both sides and duplicated, unless moving the whole reference
+    // to one of the sides is cheaper. Duplication stops once the budget is spent
+    struct SpatialSplitBuilder
+    {
+        struct Reference
+        {
+            AABB aabb;
+            std::uint32_t triangle;
+        };
+
+        SpatialSplitBuilder(BVH & bvh, std::vector<AABB> const & triangleAABB, std::span<glm::vec3 const> triangleVertices, std::uint32_t binCount, std::uint32_t duplicateBudget)
+            : bvh(bvh)
+            , triangleAABB(triangleAABB)
+            , triangleVertices(triangleVertices)
+            , binCount(std::max<std::uint32_t>(2, binCount))
+            , remainingDuplicates(duplicateBudget)
+        {
+            bins.resize(3 * this->binCount);
+            rightAABB.resize(this->binCount);
+            spatialBins.resize(this->binCount);
+        }
+
+        // Bounds of the part of the reference between lo and hi along the axis
+        AABB clip(Reference const & reference, std::uint32_t axis, float lo, float hi) const
+        {
+            AABB result;
+
+            if (triangleVertices.empty())
+                result = reference.aabb;
+            else
+            {
+                for (std::uint32_t i = 0; i < 3; ++i)
+                {
+                    glm::vec3 const & v0 = triangleVertices[3 * reference.triangle + i];
+                    glm::vec3 const & v1 = triangleVertices[3 * reference.triangle + (i + 1) % 3];
+
+                    if (v0[axis] >= lo && v0[axis] <= hi)
+                        result.extend(v0);
+
+                    for (float plane : {lo, hi})
+                    {
+                        if ((v0[axis] < plane && v1[axis] > plane) || (v0[axis] > plane && v1[axis] < plane))
+                        {
+                            glm::vec3 p = v0 + (v1 - v0) * ((plane - v0[axis]) / (v1[axis] - v0[axis]));
+                            p[axis] = plane;
+                            result.extend(p);
+                        }
+                    }
+                }
+            }
+
+            result.min[axis] = std::max(result.min[axis], lo);
+            result.max[axis] = std::min(result.max[axis], hi);
+
+            return intersect(result, reference.aabb);
+        }
+
+        SpatialSplit findSpatialSplit(std::vector<Reference> const & references, AABB const & aabb)
+        {
+            SpatialSplit best;
+
+            for (std::uint32_t axis = 0; axis < 3; ++axis)
+            {
+                float const extent = aabb.max[axis] - aabb.min[axis];
+                if (!(extent > 0.f))
+                    continue;
+
+                float const binSize = extent / binCount;
+
+                auto binBoundary = [&](std::uint32_t i)
+                {
+                    return (i == binCount) ? aabb.max[axis] : aabb.min[axis] + i * binSize;
+                };
+
+                auto binIndex = [&](float x)
+                {
+                    return std::min(binCount - 1, static_cast<std::uint32_t>(std::max(0.f, (x - aabb.min[axis]) / binSize)));
+                };
+
+                std::fill(spatialBins.begin(), spatialBins.end(), SpatialBin{});
+
+                for (auto const & reference : references)
+                {
+                    std::uint32_t const firstBin = binIndex(reference.aabb.min[axis]);
+                    std::uint32_t const lastBin = binIndex(reference.aabb.max[axis]);
+
+                    for (std::uint32_t i = firstBin; i <= lastBin; ++i)
+                    {
+                        auto const clipped = (firstBin == lastBin) ? reference.aabb : clip(reference, axis, binBoundary(i), binBoundary(i + 1));
+                        if (isValid(clipped))
+                            spatialBins[i].aabb.extend(clipped);
+                    }
+
+                    spatialBins[firstBin].entryCount += 1;
+                    spatialBins[lastBin].exitCount += 1;
+                }
+
+                rightAABB[binCount - 1] = spatialBins[binCount - 1].aabb;
+                for (std::uint32_t i = binCount - 1; i > 0; --i)
+                {
+                    rightAABB[i - 1] = rightAABB[i];
+                    rightAABB[i - 1].extend(spatialBins[i - 1].aabb);
+                }
+
+                // Split plane between bins i and i + 1
+                AABB leftAABB;
+                std::uint32_t leftCount = 0;
+                std::uint32_t rightCount = references.size();
+                for (std::uint32_t i = 0; i + 1 < binCount; ++i)
+                {
+                    leftAABB.extend(spatialBins[i].aabb);
+                    leftCount += spatialBins[i].entryCount;
+                    rightCount -= spatialBins[i].exitCount;
+
+                    if (leftCount == 0 || rightCount == 0)
+                        continue;
+
+                    float cost = leftAABB.surfaceArea() * leftCount + rightAABB[i + 1].surfaceArea() * rightCount;
+
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.position = binBoundary(i + 1);
+                        best.leftAABB = leftAABB;
+                        best.rightAABB = rightAABB[i + 1];
+                        best.leftCount = leftCount;
+                        best.rightCount = rightCount;
+                    }
+                }
+            }
+
+            return best;
+        }
+
+        void partitionSpatial(std::vector<Reference> const & references, SpatialSplit const & split,
+            std::vector<Reference> & left, std::vector<Reference> & right)
+        {
+            float const infinity = std::numeric_limits<float>::infinity();
+
+            float const leftArea = split.leftAABB.surfaceArea();
+            float const rightArea = split.rightAABB.surfaceArea();
+
+            for (auto const & reference : references)
+            {
+                if (reference.aabb.max[split.axis] <= split.position)
+                {
+                    left.push_back(reference);
+                    continue;
+                }
+
+                if (reference.aabb.min[split.axis] >= split.position)
+                {
+                    right.push_back(reference);
+                    continue;
+                }
+
+                // Reference unsplitting: compare the cost of duplicating the
+                // reference with moving it to either side entirely
+
+                AABB leftWithReference = split.leftAABB;
+                leftWithReference.extend(reference.aabb);
+                AABB rightWithReference = split.rightAABB;
+                rightWithReference.extend(reference.aabb);
+
+                float const splitCost = leftArea * split.leftCount + rightArea * split.rightCount;
+                float const leftCost = leftWithReference.surfaceArea() * split.leftCount + rightArea * (split.rightCount - 1);
+                float const rightCost = leftArea * (split.leftCount - 1) + rightWithReference.surfaceArea() * split.rightCount;
+
+                Reference leftPart{clip(reference, split.axis, -infinity, split.position), reference.triangle};
+                Reference rightPart{clip(reference, split.axis, split.position, infinity), reference.triangle};
+
+                bool const canSplit = remainingDuplicates > 0 && isValid(leftPart.aabb) && isValid(rightPart.aabb);
+
+                if (canSplit && splitCost < leftCost && splitCost < rightCost)
+                {
+                    left.push_back(leftPart);
+                    right.push_back(rightPart);
+                    --remainingDuplicates;
+                }
+                else if (leftCost < rightCost)
+                    left.push_back(reference);
+                else
+                    right.push_back(reference);
+            }
+        }
+
+        // Chooses how to split a node with these references and bounds, returns
+        // false if the node should stay a leaf. Also used for the top levels of
+        // the tree by ParallelBuilder
+        bool splitNode(std::vector<Reference> const & references, AABB const & aabb, std::uint32_t depth,
+            std::vector<Reference> & left, std::vector<Reference> & right, std::uint32_t & splitAxis)
+        {
+            AABB centroidAABB;
+            for (auto const & reference : references)
+                centroidAABB.extend(reference.aabb.center());
+
+            std::uint32_t const triangleCount = references.size();
+
+            float nodeSelfCost = triangleCount * aabb.surfaceArea();
+
+            BinnedSplit objectSplit;
+            SpatialSplit spatialSplit;
+
+            glm::vec3 const binScale = float(binCount) / centroidAABB.diagonal();
+
+            if (triangleCount > 4 && depth < MAX_DEPTH)
+            {
+                std::fill(bins.begin(), bins.end(), Bin{});
+
+                for (auto const & reference : references)
+                {
+                    for (std::uint32_t axis = 0; axis < 3; ++axis)
+                    {
+                        auto & bin = bins[axis * binCount + binIndex(centroidAABB, binScale, binCount, axis, reference.aabb.center()[axis])];
+                        bin.aabb.extend(reference.aabb);
+                        bin.triangleCount += 1;
+                    }
+                }
+
+                objectSplit = findBinnedSplit(bins.data(), binCount, triangleCount, centroidAABB, rightAABB.data());
+
+                // Only try spatial splits if the object split children overlap
+                float overlap = 0.f;
+                if (std::isfinite(objectSplit.cost))
+                {
+                    AABB objectLeftAABB;
+                    AABB objectRightAABB;
+                    for (std::uint32_t i = 0; i < binCount; ++i)
+                        (i <= objectSplit.bin ? objectLeftAABB : objectRightAABB).extend(bins[objectSplit.axis * binCount + i].aabb);
+
+                    auto const overlapAABB = intersect(objectLeftAABB, objectRightAABB);
+                    if (isValid(overlapAABB))
+                        overlap = overlapAABB.surfaceArea();
+                }
+                else
+                    overlap = std::numeric_limits<float>::infinity();
+
+                if (remainingDuplicates > 0 && overlap > SPATIAL_SPLIT_OVERLAP_THRESHOLD * rootSurfaceArea)
+                    spatialSplit = findSpatialSplit(references, aabb);
+            }
+
+            float const bestSplitCost = std::min(objectSplit.cost, spatialSplit.cost);
+
+            if (triangleCount > 4 && nodeSelfCost >= bestSplitCost && depth < MAX_DEPTH)
+            {
+                if (spatialSplit.cost < objectSplit.cost)
+                {
+                    splitAxis = spatialSplit.axis;
+                    partitionSpatial(references, spatialSplit, left, right);
+                }
+
+                // Unsplitting could have moved all references to one side
+                if ((left.empty() || right.empty()) && std::isfinite(objectSplit.cost))
+                {
+                    left.clear();
+                    right.clear();
+                    splitAxis = objectSplit.axis;
+
+                    for (auto const & reference : references)
+                    {
+                        if (binIndex(centroidAABB, binScale, binCount, objectSplit.axis, reference.aabb.center()[objectSplit.axis]) <= objectSplit.bin)
+                            left.push_back(reference);
+                        else
+                            right.push_back(reference);
+                    }
+                }
+            }
+
+            return !left.empty() && !right.empty();
+        }
+
+        void buildNode(std::uint32_t nodeID, std::vector<Reference> references, std::uint32_t depth)
+        {
+            maxDepth = std::max(depth, maxDepth);
+
+            AABB aabb;
+            for (auto const & reference : references)
+                aabb.extend(reference.aabb);
+
+            auto & node = bvh.nodes[nodeID];
+
+            node.aabbMin = aabb.min;
+            node.aabbMax = aabb.max;
+
+            std::vector<Reference> left;
+            std::vector<Reference> right;
+            std::uint32_t splitAxis = 0;
+
+            if (!splitNode(references, aabb, depth, left, right, splitAxis))
+            {
+                // Create leaf node
+                node.leftChildOrFirstTriangle = bvh.triangleIDs.size();
+                node.triangleCount = references.size();
+
+                for (auto const & reference : references)
+                    bvh.triangleIDs.push_back(reference.triangle);
+                return;
+            }
+
+            references = {};
+
+            // Split into 2 child nodes
+
+            std::uint32_t leftChild = bvh.nodes.size();
+
+            node.leftChildOrFirstTriangle = leftChild | (splitAxis << 30);
+            node.triangleCount = 0;
+
+            bvh.nodes.emplace_back();
+            bvh.nodes.emplace_back();
+
+            buildNode(leftChild, std::move(left), depth + 1);
+            buildNode(leftChild + 1, std::move(right), depth + 1);
+        }
+
+        BVH & bvh;
+        std::vector<AABB> const & triangleAABB;
+        std::span<glm::vec3 const> triangleVertices;
+        std::uint32_t const binCount;
+
+        std::vector<Bin> bins;
+        std::vector<AABB> rightAABB;
+        std::vector<SpatialBin> spatialBins;
+
+        std::uint32_t remainingDuplicates;
+
+        // Spatial splits are only tried if the object split children overlap
+        // by more than SPATIAL_SPLIT_OVERLAP_THRESHOLD of the whole tree's area
+        float rootSurfaceArea = 0.f;
+
+        std::uint32_t maxDepth = 0;
+    };
+
+    // Nodes with at least this many triangles are split by the parallel
+    // top-level builder, smaller ones become independent subtree tasks
+    constexpr std::uint32_t PARALLEL_SUBTREE_SIZE = 1 << 14;
+
+    // Fixed chunk size for parallel binning & partitioning, so that
+    // the result doesn't depend on the number of threads
+    constexpr std::uint32_t PARALLEL_CHUNK_SIZE = 1 << 12;
+
+    // Refitting spawns a task per node above this depth
+    constexpr std::uint32_t PARALLEL_REFIT_DEPTH = 6;
+
+    // Splits the top levels of the tree using binned SAH, with binning
+    // and partitioning of each node parallelized over fixed-size chunks
+    // of triangles. With sweep SAH, the top levels are split by the same
+    // exact sweep instead, with the three axes sorted concurrently and ties
+    // broken by triangle ID. Subtrees below PARALLEL_SUBTREE_SIZE triangles are
+    // built by the selected serial builder as independent tasks, each into
+    // its own node and triangle arrays, and are stitched into the final arrays
+    // in the order they were created. Partitioning is stable, so the resulting
+    // tree is identical for any number of threads.
+    // With spatial splits, the top levels are split serially by a
+    // SpatialSplitBuilder working on triangle references instead, with the
+    // same overlap threshold and a shared duplicate budget. Subtrees are only
+    // started once the top levels are done, and the remaining budget is
+    // distributed between them proportionally to their reference counts,
+    // which also keeps the result deterministic.
+    struct ParallelBuilder
+    {
+        struct Subtree
+        {
+            std::uint32_t nodeID;
+            std::uint32_t trianglesBegin;
+            std::uint32_t trianglesEnd;
+            std::uint32_t depth;
+
+            // Only used with spatial splits
+            std::vector<SpatialSplitBuilder::Reference> references;
+            std::uint32_t duplicateBudget = 0;
+
+            BVH bvh;
+            std::uint32_t maxDepth = 0;
+        };
+
+        ParallelBuilder(BVH & bvh, std::vector<AABB> const & triangleAABB, std::vector<glm::vec3> const & triangleCentroid,
+            std::span<glm::vec3 const> triangleVertices, BVHBuildOptions const & options, ThreadPool & pool)
+            : bvh(bvh)
+            , triangleAABB(triangleAABB)
+            , triangleCentroid(triangleCentroid)
+            , triangleVertices(triangleVertices)
+            , options(options)
+            , binCount(std::max<std::uint32_t>(2, options.binCount))
+            , pool(pool)
+            , subtreeTasks(pool)
+        {}
+
+        void build()
+        {
+            if (options.method == BVHBuildOptions::Method::SpatialSAH)
+                buildSpatialTopLevel();
+            else
+            {
+                if (bvh.triangleIDs.size() >= PARALLEL_SUBTREE_SIZE)
+                    partitionScratch.resize(bvh.triangleIDs.size());
+
+                buildNode(0, 0, bvh.triangleIDs.size(), 0);
+            }
+
+            subtreeTasks.wait();
+
+            stitchSubtrees();
+        }
+
+        void buildSpatialTopLevel()
+        {
+            std::vector<SpatialSplitBuilder::Reference> references(bvh.triangleIDs.size());
+            parallelFor(pool, references.size(), PARALLEL_CHUNK_SIZE, [&](std::size_t begin, std::size_t end){
+                for (std::size_t i = begin; i < end; ++i)
+                    references[i] = {triangleAABB[bvh.triangleIDs[i]], bvh.triangleIDs[i]};
+            });
+
+            AABB aabb;
+            for (auto const & reference : references)
+                aabb.extend(reference.aabb);
+
+            rootSurfaceArea = aabb.surfaceArea();
+
+            std::uint32_t const duplicateBudget = options.spatialSplitBudget * references.size();
+
+            // The top-level builder only chooses splits, it never creates nodes
+            BVH unused;
+            SpatialSplitBuilder topLevel(unused, triangleAABB, triangleVertices, options.binCount, duplicateBudget);
+            topLevel.rootSurfaceArea = rootSurfaceArea;
+
+            buildSpatialNode(topLevel, 0, std::move(references), 0);
+
+            std::uint64_t subtreeReferenceCount = 0;
+            for (auto const & subtree : subtrees)
+                subtreeReferenceCount += subtree.references.size();
+
+            for (auto & subtree : subtrees)
+            {
+                subtree.duplicateBudget = std::uint64_t(topLevel.remainingDuplicates) * subtree.references.size() / std::max<std::uint64_t>(1, subtreeReferenceCount);
+                subtreeTasks.run([this, &subtree]{ buildSubtree(subtree); });
+            }
+        }
+
+        void buildSpatialNode(SpatialSplitBuilder & topLevel, std::uint32_t nodeID, std::vector<SpatialSplitBuilder::Reference> references, std::uint32_t depth)
+        {
+            if (references.size() < PARALLEL_SUBTREE_SIZE || depth == MAX_DEPTH)
+            {
+                addSpatialSubtree(nodeID, std::move(references), depth);
+                return;
+            }
+
+            maxDepth = std::max(depth, maxDepth);
+
+            AABB aabb;
+            for (auto const & reference : references)
+                aabb.extend(reference.aabb);
+
+            std::vector<SpatialSplitBuilder::Reference> left;
+            std::vector<SpatialSplitBuilder::Reference> right;
+            std::uint32_t splitAxis = 0;
+
+            // No useful split, let the serial builder decide
+            if (!topLevel.splitNode(references, aabb, depth, left, right, splitAxis))
+            {
+                addSpatialSubtree(nodeID, std::move(references), depth);
+                return;
+            }
+
+            references = {};
+
+            // Split into 2 child nodes
+
+            std::uint32_t leftChild = bvh.nodes.size();
+
+            bvh.nodes[nodeID].aabbMin = aabb.min;
+            bvh.nodes[nodeID].aabbMax = aabb.max;
+            bvh.nodes[nodeID].leftChildOrFirstTriangle = leftChild | (splitAxis << 30);
+            bvh.nodes[nodeID].triangleCount = 0;
+
+            bvh.nodes.emplace_back();
+            bvh.nodes.emplace_back();
+
+            buildSpatialNode(topLevel, leftChild, std::move(left), depth + 1);
+            buildSpatialNode(topLevel, leftChild + 1, std::move(right), depth + 1);
+        }
+
+        void addSpatialSubtree(std::uint32_t nodeID, std::vector<SpatialSplitBuilder::Reference> references, std::uint32_t depth)
+        {
+            auto & subtree = subtrees.emplace_back();
+            subtree.nodeID = nodeID;
+            subtree.trianglesBegin = 0;
+            subtree.trianglesEnd = 0;
+            subtree.depth = depth;
+            subtree.references = std::move(references);
+        }
+
+        void buildNode(std::uint32_t nodeID, std::uint32_t begin, std::uint32_t end, std::uint32_t depth)
+        {
+            std::uint32_t const triangleCount = end - begin;
+
+            if (triangleCount < PARALLEL_SUBTREE_SIZE || depth == MAX_DEPTH)
+            {
+                spawnSubtree(nodeID, begin, end, depth);
+                return;
+            }
+
+            maxDepth = std::max(depth, maxDepth);
+
+            if (options.method == BVHBuildOptions::Method::SweepSAH)
+            {
+                buildSweepNode(nodeID, begin, end, depth);
+                return;
+            }
+
+            std::uint32_t const chunkCount = (triangleCount + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+
+            auto forEachChunk = [&](auto const & body)
+            {
+                parallelFor(pool, chunkCount, 1, [&](std::size_t chunkBegin, std::size_t chunkEnd){
+                    for (std::size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+                        body(chunk, begin + chunk * PARALLEL_CHUNK_SIZE, std::min<std::uint32_t>(end, begin + (chunk + 1) * PARALLEL_CHUNK_SIZE));
+                });
+            };
+
+            // Node bounds
+
+            std::vector<AABB> chunkAABB(chunkCount);
+            std::vector<AABB> chunkCentroidAABB(chunkCount);
+
+            forEachChunk([&](std::size_t chunk, std::uint32_t chunkBegin, std::uint32_t chunkEnd){
+                for (std::uint32_t i = chunkBegin; i < chunkEnd; ++i)
+                {
+                    chunkAABB[chunk].extend(triangleAABB[bvh.triangleIDs[i]]);
+                    chunkCentroidAABB[chunk].extend(triangleCentroid[bvh.triangleIDs[i]]);
+                }
+            });
+
+            AABB aabb;
+            AABB centroidAABB;
+            for (std::uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                aabb.extend(chunkAABB[chunk]);
+                centroidAABB.extend(chunkCentroidAABB[chunk]);
+            }
+
+            bvh.nodes[nodeID].aabbMin = aabb.min;
+            bvh.nodes[nodeID].aabbMax = aabb.max;
+
+            // Binning
+
+            glm::vec3 const binScale = float(binCount) / centroidAABB.diagonal();
+
+            std::vector<Bin> chunkBins(chunkCount * 3 * binCount);
+
+            forEachChunk([&](std::size_t chunk, std::uint32_t chunkBegin, std::uint32_t chunkEnd){
+                auto * bins = chunkBins.data() + chunk * 3 * binCount;
+                for (std::uint32_t i = chunkBegin; i < chunkEnd; ++i)
+                {
+                    auto triangle = bvh.triangleIDs[i];
+                    for (std::uint32_t axis = 0; axis < 3; ++axis)
+                    {
+                        auto & bin = bins[axis * binCount + binIndex(centroidAABB, binScale, binCount, axis, triangleCentroid[triangle][axis])];
+                        bin.aabb.extend(triangleAABB[triangle]);
+                        bin.triangleCount += 1;
+                    }
+                }
+            });
+
+            std::vector<Bin> bins(3 * binCount);
+            for (std::uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                for (std::uint32_t i = 0; i < bins.size(); ++i)
+                {
+                    bins[i].aabb.extend(chunkBins[chunk * 3 * binCount + i].aabb);
+                    bins[i].triangleCount += chunkBins[chunk * 3 * binCount + i].triangleCount;
+                }
+            }
+
+            std::vector<AABB> rightAABB(binCount);
+            auto const split = findBinnedSplit(bins.data(), binCount, triangleCount, centroidAABB, rightAABB.data());
+
+            // No useful split at this granularity, let the serial builder decide
+            if (!(split.cost < triangleCount * aabb.surfaceArea()))
+            {
+                spawnSubtree(nodeID, begin, end, depth);
+                return;
+            }
+
+            // Stable partition: count left-side triangles per chunk,
+            // scatter into the scratch array, then copy back
+
+            auto goesLeft = [&](std::uint32_t triangle)
+            {
+                return binIndex(centroidAABB, binScale, binCount, split.axis, triangleCentroid[triangle][split.axis]) <= split.bin;
+            };
+
+            std::vector<std::uint32_t> chunkLeftOffset(chunkCount + 1, 0);
+
+            forEachChunk([&](std::size_t chunk, std::uint32_t chunkBegin, std::uint32_t chunkEnd){
+                std::uint32_t leftCount = 0;
+                for (std::uint32_t i = chunkBegin; i < chunkEnd; ++i)
+                    leftCount += goesLeft(bvh.triangleIDs[i]) ? 1 : 0;
+                chunkLeftOffset[chunk + 1] = leftCount;
+            });
+
+            for (std::uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+                chunkLeftOffset[chunk + 1] += chunkLeftOffset[chunk];
+
+            std::uint32_t const middle = begin + chunkLeftOffset[chunkCount];
+
+            forEachChunk([&](std::size_t chunk, std::uint32_t chunkBegin, std::uint32_t chunkEnd){
+                std::uint32_t left = begin + chunkLeftOffset[chunk];
+                std::uint32_t right = middle + (chunkBegin - begin - chunkLeftOffset[chunk]);
+                for (std::uint32_t i = chunkBegin; i < chunkEnd; ++i)
+                {
+                    auto triangle = bvh.triangleIDs[i];
+                    if (goesLeft(triangle))
+                        partitionScratch[left++] = triangle;
+                    else
+                        partitionScratch[right++] = triangle;
+                }
+            });
+
+            forEachChunk([&](std::size_t, std::uint32_t chunkBegin, std::uint32_t chunkEnd){
+                std::copy(partitionScratch.begin() + chunkBegin, partitionScratch.begin() + chunkEnd, bvh.triangleIDs.begin() + chunkBegin);
+            });
+
+            // Split into 2 child nodes
+
+            std::uint32_t leftChild = bvh.nodes.size();
+
+            bvh.nodes[nodeID].leftChildOrFirstTriangle = leftChild | (split.axis << 30);
+            bvh.nodes[nodeID].triangleCount = 0;
+
+            bvh.nodes.emplace_back();
+            bvh.nodes.emplace_back();
+
+            buildNode(leftChild, begin, middle, depth + 1);
+            buildNode(leftChild + 1, middle, end, depth + 1);
+        }
+
+        // Same split candidates and leaf criterion as the serial sweep builder
+        void buildSweepNode(std::uint32_t nodeID, std::uint32_t begin, std::uint32_t end, std::uint32_t depth)
+        {
+            std::uint32_t const triangleCount = end - begin;
+
+            std::array<std::vector<std::uint32_t>, 3> sortedTriangles;
+            std::array<float, 3> bestSplitCost;
+            std::array<std::uint32_t, 3> bestSplitPosition;
+            AABB aabb;
+
+            auto sweepAxis = [&](std::uint32_t axis)
+            {
+                auto & triangles = sortedTriangles[axis];
+                triangles.assign(bvh.triangleIDs.begin() + begin, bvh.triangleIDs.begin() + end);
+
+                std::sort(triangles.begin(), triangles.end(), [&](std::uint32_t triangle1, std::uint32_t triangle2){
+                    float const centroid1 = triangleCentroid[triangle1][axis];
+                    float const centroid2 = triangleCentroid[triangle2][axis];
+                    return centroid1 < centroid2 || (centroid1 == centroid2 && triangle1 < triangle2);
+                });
+
+                // Surface area of the triangles [i, triangleCount)
+                std::vector<float> rightToLeftArea(triangleCount + 1, 0.f);
+                AABB rightAABB;
+                for (std::uint32_t i = triangleCount; i-- > 0;)
+                {
+                    rightAABB.extend(triangleAABB[triangles[i]]);
+                    rightToLeftArea[i] = rightAABB.surfaceArea();
+                }
+
+                if (axis == 0)
+                    aabb = rightAABB;
+
+                bestSplitCost[axis] = std::numeric_limits<float>::infinity();
+                bestSplitPosition[axis] = 0;
+
+                AABB leftAABB;
+                for (std::uint32_t i = 1; i + 1 < triangleCount; ++i)
+                {
+                    leftAABB.extend(triangleAABB[triangles[i - 1]]);
+
+                    float const cost = leftAABB.surfaceArea() * i + rightToLeftArea[i] * (triangleCount - i);
+                    if (cost < bestSplitCost[axis])
+                    {
+                        bestSplitCost[axis] = cost;
+                        bestSplitPosition[axis] = i;
+                    }
+                }
+            };
+
+            {
+                TaskGroup group(pool);
+                group.run([&]{ sweepAxis(1); });
+                group.run([&]{ sweepAxis(2); });
+                sweepAxis(0);
+                group.wait();
+            }
+
+            std::uint32_t bestSplitAxis = 0;
+            for (std::uint32_t axis = 1; axis < 3; ++axis)
+                if (bestSplitCost[axis] < bestSplitCost[bestSplitAxis])
+                    bestSplitAxis = axis;
+
+            bvh.nodes[nodeID].aabbMin = aabb.min;
+            bvh.nodes[nodeID].aabbMax = aabb.max;
+
+            // Splitting doesn't pay off, the serial builder makes this node a leaf
+            if (triangleCount * aabb.surfaceArea() < bestSplitCost[bestSplitAxis])
+            {
+                spawnSubtree(nodeID, begin, end, depth);
+                return;
+            }
+
+            std::copy(sortedTriangles[bestSplitAxis].begin(), sortedTriangles[bestSplitAxis].end(), bvh.triangleIDs.begin() + begin);
+            sortedTriangles = {};
+
+            // Split into 2 child nodes
+
+            std::uint32_t const middle = begin + bestSplitPosition[bestSplitAxis];
+
+            std::uint32_t leftChild = bvh.nodes.size();
+
+            bvh.nodes[nodeID].leftChildOrFirstTriangle = leftChild | (bestSplitAxis << 30);
+            bvh.nodes[nodeID].triangleCount = 0;
+
+            bvh.nodes.emplace_back();
+            bvh.nodes.emplace_back();
+
+            buildNode(leftChild, begin, middle, depth + 1);
+            buildNode(leftChild + 1, middle, end, depth + 1);
+        }
+
+        void spawnSubtree(std::uint32_t nodeID, std::uint32_t begin, std::uint32_t end, std::uint32_t depth)
+        {
+            auto & subtree = subtrees.emplace_back();
+            subtree.nodeID = nodeID;
+            subtree.trianglesBegin = begin;
+            subtree.trianglesEnd = end;
+            subtree.depth = depth;
+
+            subtreeTasks.run([this, &subtree]{ buildSubtree(subtree); });
+        }
+
+        void buildSubtree(Subtree & subtree)
+        {
+            auto & local = subtree.bvh;
+            local.triangleIDs.assign(bvh.triangleIDs.begin() + subtree.trianglesBegin, bvh.triangleIDs.begin() + subtree.trianglesEnd);
+            local.nodes.emplace_back();
+
+            switch (options.method)
+            {
+            case BVHBuildOptions::Method::SweepSAH:
+                ::buildNode(local, triangleAABB, 0, local.triangleIDs.begin(), local.triangleIDs.end(), subtree.depth, subtree.maxDepth);
+                break;
+            case BVHBuildOptions::Method::BinnedSAH:
+                {
+                    BinnedBuilder builder(local, triangleAABB, triangleCentroid, options.binCount);
+                    builder.buildNode(0, local.triangleIDs.begin(), local.triangleIDs.end(), subtree.depth);
+                    subtree.maxDepth = builder.maxDepth;
+                }
+                break;
+            case BVHBuildOptions::Method::SpatialSAH:
+                {
+                    // Triangles come from the references built by buildSpatialTopLevel
+                    local.triangleIDs.clear();
+
+                    SpatialSplitBuilder builder(local, triangleAABB, triangleVertices, options.binCount, subtree.duplicateBudget);
+                    builder.rootSurfaceArea = rootSurfaceArea;
+                    builder.buildNode(0, std::move(subtree.references), subtree.depth);
+                    subtree.maxDepth = builder.maxDepth;
+                }
+                break;
+            case BVHBuildOptions::Method::LBVH:
+                // Built by buildLinearBVH without subtrees
+                throw std::logic_error("LBVH subtrees are not supported");
+            }
+        }
+
+        void stitchSubtrees()
+        {
+            // Subtrees were created in the order of their triangle ranges,
+            // but their triangle counts could have grown due to spatial splits
+            std::vector<std::uint32_t> triangleIDs;
+
+            for (auto & subtree : subtrees)
+            {
+                // Local node i > 0 goes to offset + i, local root replaces the placeholder node
+                std::uint32_t const offset = bvh.nodes.size() - 1;
+                std::uint32_t const triangleOffset = triangleIDs.size();
+
+                triangleIDs.insert(triangleIDs.end(), subtree.bvh.triangleIDs.begin(), subtree.bvh.triangleIDs.end());
+
+                auto relocate = [&](BVH::Node node)
+                {
+                    if (node.triangleCount > 0)
+                        node.leftChildOrFirstTriangle += triangleOffset;
+                    else
+                        node.leftChildOrFirstTriangle = ((node.leftChildOrFirstTriangle & 0x3fffffffu) + offset) | (node.leftChildOrFirstTriangle & 0xc0000000u);
+                    return node;
+                };
+
+                bvh.nodes[subtree.nodeID] = relocate(subtree.bvh.nodes[0]);
+                for (std::uint32_t i = 1; i < subtree.bvh.nodes.size(); ++i)
+                    bvh.nodes.push_back(relocate(subtree.bvh.nodes[i]));
+
+                maxDepth = std::max(maxDepth, subtree.maxDepth);
+
+                subtree.bvh = {};
+            }
+
+            bvh.triangleIDs = std::move(triangleIDs);
+        }
+
+        BVH & bvh;
+        std::vector<AABB> const & triangleAABB;
+        std::vector<glm::vec3> const & triangleCentroid;
+        std::span<glm::vec3 const> triangleVertices;
+        BVHBuildOptions const & options;
+        std::uint32_t const binCount;
+
+        ThreadPool & pool;
+        TaskGroup subtreeTasks;
+
+        // Deque keeps references to subtrees valid while new ones are added
+        std::deque<Subtree> subtrees;
+        std::vector<std::uint32_t> partitionScratch;
+
+        // Surface area of the whole tree, for the spatial split overlap threshold
+        float rootSurfaceArea = 0.f;
+
+        std::uint32_t maxDepth = 0;
+    };
+
+    // Morton codes use 10 bits per axis; centroids are scaled by a power of two
+    // instead of dividing by the extent, so that the codes computed here and in
+    // lbvh.wgsl are bit-exact
+    constexpr std::uint32_t MORTON_BITS_PER_AXIS = 10;
+
+    float mortonScale(float extent)
+    {
+        if (!(extent > 0.f))
+            return 0.f;
+
+        // 2^(9 - floor(log2(extent))), which maps the extent into [512, 1024)
+        std::int32_t const biasedExponent = std::bit_cast<std::uint32_t>(extent) >> 23;
+        return std::bit_cast<float>(std::uint32_t(std::clamp(263 - biasedExponent, 1, 254)) << 23);
+    }
+
+    std::uint32_t expandMortonBits(std::uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // X occupies the highest bit of each triple, so that a split
+    // at bit k of the code is a split along axis 2 - k % 3
+    std::uint32_t mortonCode(glm::vec3 const & centroid, glm::vec3 const & centroidMin, glm::vec3 const & scale)
+    {
+        std::uint32_t result = 0;
+        for (std::uint32_t axis = 0; axis < 3; ++axis)
+        {
+            float const q = std::min((centroid[axis] - centroidMin[axis]) * scale[axis], float((1u << MORTON_BITS_PER_AXIS) - 1));
+            result |= expandMortonBits(static_cast<std::uint32_t>(std::max(q, 0.f))) << (2 - axis);
+        }
+        return result;
+    }
+
+    // Radix tree emission, see Karras (2012). Internal node i in [0, n - 1) and
+    // leaves j in [0, n) index the sorted keys; ties are broken by index
+    struct RadixTree
+    {
+        std::vector<std::uint32_t> const & keys;
+
+        int delta(int i, int j) const
+        {
+            if (j < 0 || j >= static_cast<int>(keys.size()))
+                return -1;
+            if (keys[i] == keys[j])
+                return 32 + std::countl_zero(std::uint32_t(i) ^ std::uint32_t(j));
+            return std::countl_zero(keys[i] ^ keys[j]);
+        }
+
+        struct Internal
+        {
+            std::uint32_t split;
+            bool leftIsLeaf;
+            bool rightIsLeaf;
+            std::uint32_t axis;
+        };
+
+        Internal emit(int i) const
+        {
+            int const d = (delta(i, i + 1) - delta(i, i - 1)) > 0 ? 1 : -1;
+
+            int const deltaMin = delta(i, i - d);
+
+            int lengthMax = 2;
+            while (delta(i, i + lengthMax * d) > deltaMin)
+                lengthMax *= 2;
+
+            int length = 0;
+            for (int t = lengthMax / 2; t >= 1; t /= 2)
+                if (delta(i, i + (length + t) * d) > deltaMin)
+                    length += t;
+
+            int const j = i + length * d;
+            int const deltaNode = delta(i, j);
+
+            int split = 0;
+            for (int divisor = 2;; divisor *= 2)
+            {
+                int const t = (length + divisor - 1) / divisor;
+                if (delta(i, i + (split + t) * d) > deltaNode)
+                    split += t;
+                if (t == 1)
+                    break;
+            }
+
+            int const gamma = i + split * d + std::min(d, 0);
+
+            Internal result;
+            result.split = gamma;
+            result.leftIsLeaf = std::min(i, j) == gamma;
+            result.rightIsLeaf = std::max(i, j) == gamma + 1;
+            // Equal keys are split by index, the axis doesn't matter then
+            result.axis = (deltaNode < 32) ? 2 - (31 - deltaNode) % 3 : 0;
+            return result;
+        }
+    };
+
+    // Children of internal node i are stored at 1 + 2 * i and 2 + 2 * i, the
+    // root at 0, the same layout as written by lbvh.wgsl
+    struct LinearBuilder
+    {
+        BVH & bvh;
+        std::vector<AABB> const & triangleAABB;
+        std::vector<RadixTree::Internal> internal;
+
+        std::uint32_t maxDepth = 0;
+
+        AABB buildNode(std::uint32_t index, bool isLeaf, std::uint32_t position, std::uint32_t depth)
+        {
+            maxDepth = std::max(maxDepth, depth);
+
+            auto & node = bvh.nodes[position];
+
+            if (isLeaf)
+            {
+                auto const & aabb = triangleAABB[bvh.triangleIDs[index]];
+                node.aabbMin = aabb.min;
+                node.aabbMax = aabb.max;
+                node.leftChildOrFirstTriangle = index;
+                node.triangleCount = 1;
+                return aabb;
+            }
+
+            auto const & children = internal[index];
+
+            AABB aabb = buildNode(children.split, children.leftIsLeaf, 1 + 2 * index, depth + 1);
+            aabb.extend(buildNode(children.split + 1, children.rightIsLeaf, 2 + 2 * index, depth + 1));
+
+            auto & parent = bvh.nodes[position];
+            parent.aabbMin = aabb.min;
+            parent.aabbMax = aabb.max;
+            parent.leftChildOrFirstTriangle = (1 + 2 * index) | (children.axis << 30);
+            parent.triangleCount = 0;
+            return aabb;
+        }
+    };
+
+    BVH buildLinearBVH(std::vector<AABB> const & triangleAABB, ThreadPool & pool, std::uint32_t & maxDepth)
+    {
+        std::uint32_t const triangleCount = triangleAABB.size();
+
+        BVH result;
+
+        if (triangleCount == 0)
+        {
+            result.nodes.emplace_back();
+            return result;
+        }
+
+        AABB centroidAABB;
+        for (auto const & aabb : triangleAABB)
+            centroidAABB.extend(aabb.center());
+
+        glm::vec3 scale;
+        for (std::uint32_t axis = 0; axis < 3; ++axis)
+            scale[axis] = mortonScale(centroidAABB.max[axis] - centroidAABB.min[axis]);
+
+        std::vector<std::uint32_t> codes(triangleCount);
+        parallelFor(pool, triangleCount, PARALLEL_CHUNK_SIZE, [&](std::size_t begin, std::size_t end){
+            for (std::size_t i = begin; i < end; ++i)
+                codes[i] = mortonCode(triangleAABB[i].center(), centroidAABB.min, scale);
+        });
+
+        result.triangleIDs.resize(triangleCount);
+        std::iota(result.triangleIDs.begin(), result.triangleIDs.end(), 0u);
+        std::stable_sort(result.triangleIDs.begin(), result.triangleIDs.end(), [&](std::uint32_t triangle1, std::uint32_t triangle2){
+            return codes[triangle1] < codes[triangle2];
+        });
+
+        std::vector<std::uint32_t> sortedCodes(triangleCount);
+        for (std::uint32_t i = 0; i < triangleCount; ++i)
+            sortedCodes[i] = codes[result.triangleIDs[i]];
+
+        RadixTree tree{sortedCodes};
+
+        LinearBuilder builder{result, triangleAABB, std::vector<RadixTree::Internal>(triangleCount - 1)};
+        parallelFor(pool, triangleCount - 1, PARALLEL_CHUNK_SIZE, [&](std::size_t begin, std::size_t end){
+            for (std::size_t i = begin; i < end; ++i)
+                builder.internal[i] = tree.emit(i);
+        });
+
+        result.nodes.resize(2 * triangleCount - 1);
+        builder.buildNode(0, triangleCount == 1, 0, 0);
+
+        maxDepth = builder.maxDepth;
+        return result;
+    }
+
+    // Sibling pairs per treelet: 256 bytes, i.e. two 128 byte cache lines
+    constexpr std::uint32_t TREELET_PAIR_COUNT = 4;
+
+    constexpr std::uint32_t NODE_AXIS_MASK = 3u << 30;
+
+    struct NodeReorderer
+    {
+        std::vector<BVH::Node> const & nodes;
+        std::vector<BVH::Node> result;
+
+        static std::uint32_t leftChild(BVH::Node const & node)
+        {
+            return node.leftChildOrFirstTriangle & ~NODE_AXIS_MASK;
+        }
+
+        void link(std::uint32_t parent, std::uint32_t child)
+        {
+            auto & node = result[parent];
+            node.leftChildOrFirstTriangle = child | (node.leftChildOrFirstTriangle & NODE_AXIS_MASK);
+        }
+
+        // Both functions emit the sibling pair starting at the old index
+        // left together with everything below it, and return its new index
+
+        std::uint32_t emitDepthFirst(std::uint32_t left)
+        {
+            std::uint32_t const newLeft = result.size();
+            result.push_back(nodes[left]);
+            result.push_back(nodes[left + 1]);
+
+            for (std::uint32_t k = 0; k < 2; ++k)
+                if (nodes[left + k].triangleCount == 0)
+                    link(newLeft + k, emitDepthFirst(leftChild(nodes[left + k])));
+
+            return newLeft;
+        }
+
+        std::uint32_t emitTreelet(std::uint32_t left)
+        {
+            // Grow the treelet by repeatedly adding the children of its inner
+            // node with the largest surface area, i.e. the one most likely to be
+            // visited by a ray that reaches the treelet root
+
+            struct Entry
+            {
+                // Position of the node within the treelet
+                std::uint32_t pair;
+                std::uint32_t side;
+            };
+
+            std::vector<std::uint32_t> pairs{left};
+            std::vector<Entry> parents{{0, 0}};
+            std::vector<Entry> frontier;
+
+            auto oldNode = [&](Entry const & entry) -> BVH::Node const & { return nodes[pairs[entry.pair] + entry.side]; };
+
+            auto addToFrontier = [&](std::uint32_t pair)
+            {
+                for (std::uint32_t side = 0; side < 2; ++side)
+                    if (nodes[pairs[pair] + side].triangleCount == 0)
+                        frontier.push_back({pair, side});
+            };
+
+            addToFrontier(0);
+
+            while (pairs.size() < TREELET_PAIR_COUNT && !frontier.empty())
+            {
+                auto it = std::max_element(frontier.begin(), frontier.end(), [&](Entry const & entry1, Entry const & entry2){
+                    return AABB{oldNode(entry1).aabbMin, oldNode(entry1).aabbMax}.surfaceArea() < AABB{oldNode(entry2).aabbMin, oldNode(entry2).aabbMax}.surfaceArea();
+                });
+
+                Entry const parent = *it;
+                frontier.erase(it);
+
+                pairs.push_back(leftChild(oldNode(parent)));
+                parents.push_back(parent);
+                addToFrontier(pairs.size() - 1);
+            }
+
+            std::uint32_t const newLeft = result.size();
+            for (auto pair : pairs)
+            {
+                result.push_back(nodes[pair]);
+                result.push_back(nodes[pair + 1]);
+            }
+
+            for (std::uint32_t i = 1; i < pairs.size(); ++i)
+                link(newLeft + 2 * parents[i].pair + parents[i].side, newLeft + 2 * i);
+
+            // Subtrees below the treelet follow it in depth-first order
+            for (auto const & entry : frontier)
+                link(newLeft + 2 * entry.pair + entry.side, emitTreelet(leftChild(oldNode(entry))));
+
+            return newLeft;
+        }
+    };
+
+    // Subtrees rearranged by a single treelet restructuring; the optimal
+    // topology search visits 3^7 subset partitions per treelet
+    constexpr std::uint32_t TREELET_LEAF_COUNT = 7;
+
+    // Treelet restructuring spawns a task per node above this depth
+    constexpr std::uint32_t PARALLEL_OPTIMIZE_DEPTH = 6;
+
+    // Optimization stops once a pass lowers the SAH cost by less than this fraction
+    constexpr float MIN_OPTIMIZE_IMPROVEMENT = 1e-3f;
+
+    // Treelet restructuring, see Tero Karras & Timo Aila, Fast Parallel
+    // Construction of High-Quality Bounding Volume Hierarchies (2013).
+    // The treelet of a node is formed by repeatedly expanding its descendant
+    // with the largest surface area, and its up to 7 leaves (whole subtrees)
+    // are rearranged into the binary tree with the smallest total surface
+    // area of the inner nodes. Leaves of the BVH are never split or merged,
+    // so triangle ranges are kept, and the inner node slots of the treelet
+    // are reused, so the node count is kept as well.
+    // Treelets are processed bottom-up; those of disjoint subtrees don't
+    // share any nodes and are restructured in parallel
+    struct TreeletOptimizer
+    {
+        std::span<BVH::Node> nodes;
+        ThreadPool & pool;
+
+        static std::uint32_t leftChild(BVH::Node const & node)
+        {
+            return node.leftChildOrFirstTriangle & ~NODE_AXIS_MASK;
+        }
+
+        static AABB bounds(BVH::Node const & node)
+        {
+            return {node.aabbMin, node.aabbMax};
+        }
+
+        void optimizeSubtree(std::uint32_t nodeID, std::uint32_t depth)
+        {
+            if (nodes[nodeID].triangleCount > 0)
+                return;
+
+            std::uint32_t const left = leftChild(nodes[nodeID]);
+
+            if (depth < PARALLEL_OPTIMIZE_DEPTH)
+            {
+                TaskGroup group(pool);
+                group.run([&]{ optimizeSubtree(left, depth + 1); });
+                optimizeSubtree(left + 1, depth + 1);
+                group.wait();
+            }
+            else
+            {
+                optimizeSubtree(left, depth + 1);
+                optimizeSubtree(left + 1, depth + 1);
+            }
+
+            restructure(nodeID);
+        }
+
+        void restructure(std::uint32_t rootID)
+        {
+            // Sibling pairs owned by the inner nodes of the treelet; pairs[0]
+            // are the children of the treelet root. A treelet with n leaves
+            // has n - 1 inner nodes, and its n - 2 non-root inner nodes & n leaves
+            // fill exactly these n - 1 pairs, whatever the topology
+            std::array<std::uint32_t, TREELET_LEAF_COUNT - 1> pairs;
+            std::array<std::uint32_t, TREELET_LEAF_COUNT> leaves;
+
+            pairs[0] = leftChild(nodes[rootID]);
+            leaves[0] = pairs[0];
+            leaves[1] = pairs[0] + 1;
+
+            std::uint32_t pairCount = 1;
+            std::uint32_t leafCount = 2;
+
+            // Total surface area of the non-root inner nodes
+            float oldCost = 0.f;
+
+            while (leafCount < TREELET_LEAF_COUNT)
+            {
+                std::uint32_t best = leafCount;
+                float bestArea = -1.f;
+                for (std::uint32_t i = 0; i < leafCount; ++i)
+                {
+                    if (nodes[leaves[i]].triangleCount > 0)
+                        continue;
+
+                    float const area = bounds(nodes[leaves[i]]).surfaceArea();
+                    if (area > bestArea)
+                    {
+                        best = i;
+                        bestArea = area;
+                    }
+                }
+
+                if (best == leafCount)
+                    break;
+
+                oldCost += bestArea;
+
+                std::uint32_t const left = leftChild(nodes[leaves[best]]);
+                pairs[pairCount++] = left;
+                leaves[best] = left;
+                leaves[leafCount++] = left + 1;
+            }
+
+            if (leafCount < 3)
+                return;
+
+            // Optimal topology by dynamic programming over the subsets of
+            // leaves; a subset is always processed after its proper subsets,
+            // since they are smaller numbers
+
+            constexpr std::uint32_t MAX_SUBSET_COUNT = 1u << TREELET_LEAF_COUNT;
+
+            std::uint32_t const subsetCount = 1u << leafCount;
+
+            std::array<AABB, MAX_SUBSET_COUNT> subsetAABB;
+            std::array<float, MAX_SUBSET_COUNT> subsetCost;
+            std::array<std::uint8_t, MAX_SUBSET_COUNT> subsetSplit;
+
+            for (std::uint32_t subset = 1; subset < subsetCount; ++subset)
+            {
+                std::uint32_t const lowestBit = subset & (~subset + 1);
+                if (subset == lowestBit)
+                {
+                    subsetAABB[subset] = bounds(nodes[leaves[std::countr_zero(subset)]]);
+                    subsetCost[subset] = 0.f;
+                    continue;
+                }
+
+                subsetAABB[subset] = subsetAABB[lowestBit];
+                subsetAABB[subset].extend(subsetAABB[subset ^ lowestBit]);
+
+                // The part containing the lowest leaf is enumerated
+                // as the left one, to skip mirrored partitions
+                float bestCost = std::numeric_limits<float>::infinity();
+                std::uint32_t bestSplit = lowestBit;
+                for (std::uint32_t part = (subset - 1) & subset; part != 0; part = (part - 1) & subset)
+                {
+                    if ((part & lowestBit) == 0)
+                        continue;
+
+                    float const cost = subsetCost[part] + subsetCost[subset ^ part];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestSplit = part;
+                    }
+                }
+
+                subsetCost[subset] = subsetAABB[subset].surfaceArea() + bestCost;
+                subsetSplit[subset] = bestSplit;
+            }
+
+            std::uint32_t const fullSet = subsetCount - 1;
+            float const newCost = subsetCost[fullSet] - subsetAABB[fullSet].surfaceArea();
+
+            // Rounding differences must not flip a treelet back and forth
+            if (!(newCost < oldCost * (1.f - 1e-5f)))
+                return;
+
+            std::array<BVH::Node, TREELET_LEAF_COUNT> leafNodes;
+            for (std::uint32_t i = 0; i < leafCount; ++i)
+                leafNodes[i] = nodes[leaves[i]];
+
+            std::uint32_t nextPair = 1;
+
+            auto emitChildren = [&](auto const & self, std::uint32_t subset, std::uint32_t pair) -> void
+            {
+                std::uint32_t const parts[2]{subsetSplit[subset], subset ^ subsetSplit[subset]};
+
+                for (std::uint32_t side = 0; side < 2; ++side)
+                {
+                    auto & node = nodes[pair + side];
+
+                    if (std::has_single_bit(parts[side]))
+                    {
+                        node = leafNodes[std::countr_zero(parts[side])];
+                        continue;
+                    }
+
+                    std::uint32_t const childPair = pairs[nextPair++];
+                    self(self, parts[side], childPair);
+
+                    node.aabbMin = subsetAABB[parts[side]].min;
+                    node.aabbMax = subsetAABB[parts[side]].max;
+                    node.triangleCount = 0;
+                    node.leftChildOrFirstTriangle = childPair;
+                    orderChildren(node);
+                }
+            };
+
+            emitChildren(emitChildren, fullSet, pairs[0]);
+            orderChildren(nodes[rootID]);
+        }
+
+        // Splitting axis for ordered traversal: the one separating the child
+        // centers the most, with the left child at lower coordinates like
+        // in the builders
+        void orderChildren(BVH::Node & node)
+        {
+            std::uint32_t const left = leftChild(node);
+
+            glm::vec3 const delta = bounds(nodes[left + 1]).center() - bounds(nodes[left]).center();
+
+            std::uint32_t axis = 0;
+            for (std::uint32_t i = 1; i < 3; ++i)
+                if (std::abs(delta[i]) > std::abs(delta[axis]))
+                    axis = i;
+
+            if (delta[axis] < 0.f)
+                std::swap(nodes[left], nodes[left + 1]);
+
+            node.leftChildOrFirstTriangle = left | (axis << 30);
+        }
+    };
+
+    std::uint32_t bvhMaxDepth(std::span<BVH::Node const> nodes)
+    {
+        std::uint32_t maxDepth = 0;
+
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{{0, 0}};
+        while (!stack.empty())
+        {
+            auto [nodeID, depth] = stack.back();
+            stack.pop_back();
+
+            maxDepth = std::max(maxDepth, depth);
+
+            auto const & node = nodes[nodeID];
+            if (node.triangleCount > 0)
+                continue;
+
+            std::uint32_t const left = node.leftChildOrFirstTriangle & ~NODE_AXIS_MASK;
+            stack.push_back({left, depth + 1});
+            stack.push_back({left + 1, depth + 1});
+        }
+
+        return maxDepth;
+    }
+
 }
 
-BVH buildBVH(std::vector<AABB> const & triangleAABB)
+BVH buildBVH(std::vector<AABB> const & triangleAABB, BVHBuildOptions const & options, std::span<glm::vec3 const> triangleVertices)
 {
     Timer timer;
 
-    BVH result;
-    result.triangleIDs.resize(triangleAABB.size());
-    for (std::uint32_t i = 0; i < result.triangleIDs.size(); ++i)
-        result.triangleIDs[i] = i;
+    ThreadPool pool(options.threadCount);
 
+    BVH result;
     std::uint32_t maxDepth = 0;
 
-    result.nodes.emplace_back();
-    buildNode(result, triangleAABB, 0, result.triangleIDs.begin(), result.triangleIDs.end(), 0, maxDepth);
+    if (options.method == BVHBuildOptions::Method::LBVH)
+        result = buildLinearBVH(triangleAABB, pool, maxDepth);
+    else
+    {
+        result.triangleIDs.resize(triangleAABB.size());
+        for (std::uint32_t i = 0; i < result.triangleIDs.size(); ++i)
+            result.triangleIDs[i] = i;
+
+        std::vector<glm::vec3> triangleCentroid(triangleAABB.size());
+        parallelFor(pool, triangleAABB.size(), PARALLEL_CHUNK_SIZE, [&](std::size_t begin, std::size_t end){
+            for (std::size_t i = begin; i < end; ++i)
+                triangleCentroid[i] = triangleAABB[i].center();
+        });
+
+        result.nodes.emplace_back();
+
+        ParallelBuilder builder(result, triangleAABB, triangleCentroid, triangleVertices, options, pool);
+        builder.build();
+        maxDepth = builder.maxDepth;
+    }
+
+    if (options.optimizationPassCount > 0)
+    {
+        optimizeBVH(result.nodes, options.optimizationPassCount, pool);
+        maxDepth = bvhMaxDepth(result.nodes);
+    }
+
+    reorderBVHNodes(result.nodes, options.nodeOrder);
+
+    double const buildTime = timer.duration();
 
-    std::cout << "Built BVH for " << triangleAABB.size() << " triangles in " << timer.duration() << " seconds, max depth: " << maxDepth << std::endl;
+    std::cout << "Built BVH (" << bvhMethodName(options.method);
+    if (options.method == BVHBuildOptions::Method::BinnedSAH || options.method == BVHBuildOptions::Method::SpatialSAH)
+        std::cout << ", " << options.binCount << " bins";
+    if (options.nodeOrder != BVHBuildOptions::NodeOrder::Creation)
+        std::cout << ", " << bvhNodeOrderName(options.nodeOrder) << " node order";
+    std::cout << ", " << pool.threadCount() << " threads) for " << triangleAABB.size() << " triangles in " << buildTime << " seconds, max depth: " << maxDepth
+        << ", nodes: " << result.nodes.size();
+    if (options.method == BVHBuildOptions::Method::SpatialSAH)
+        std::cout << ", triangle references: " << result.triangleIDs.size() << " (" << (result.triangleIDs.size() * 100.f / std::max<std::size_t>(1, triangleAABB.size()) - 100.f)
+            << "% duplicates)";
+    std::cout << ", SAH cost: " << bvhSAHCost(result) << std::endl;
 
     return result;
 }
+
+std::uint32_t optimizeBVH(std::span<BVH::Node> nodes, std::uint32_t maxPassCount, ThreadPool & pool)
+{
+    if (nodes.size() < 5)
+        return 0;
+
+    Timer timer;
+
+    float const initialCost = bvhSAHCost(nodes);
+    float cost = initialCost;
+
+    std::vector<BVH::Node> previousNodes;
+    std::uint32_t passCount = 0;
+
+    while (passCount < maxPassCount)
+    {
+        previousNodes.assign(nodes.begin(), nodes.end());
+
+        TreeletOptimizer optimizer{nodes, pool};
+        optimizer.optimizeSubtree(0, 0);
+
+        // Restructuring ignores depth, and the traversal stacks are finite
+        if (bvhMaxDepth(nodes) > BVH::MAX_DEPTH)
+        {
+            std::copy(previousNodes.begin(), previousNodes.end(), nodes.begin());
+            std::cout << "BVH optimization pass exceeded the maximal depth, reverted" << std::endl;
+            break;
+        }
+
+        ++passCount;
+
+        float const newCost = bvhSAHCost(nodes);
+        bool const converged = newCost > cost * (1.f - MIN_OPTIMIZE_IMPROVEMENT);
+        cost = newCost;
+
+        if (converged)
+            break;
+    }
+
+    std::cout << "Optimized BVH in " << passCount << " treelet restructuring passes, " << timer.duration() << " seconds, SAH cost: "
+        << initialCost << " -> " << cost << std::endl;
+
+    return passCount;
+}
+
+void reorderBVHNodes(std::vector<BVH::Node> & nodes, BVHBuildOptions::NodeOrder order)
+{
+    if (order == BVHBuildOptions::NodeOrder::Creation || nodes.size() < 3)
+        return;
+
+    NodeReorderer reorderer{nodes, {}};
+    reorderer.result.reserve(nodes.size() + 1);
+    reorderer.result.push_back(nodes[0]);
+
+    // Padding, so that sibling pairs start at 64 byte boundaries. Its
+    // bounds are empty rather than inverted to keep the SAH cost finite
+    auto & padding = reorderer.result.emplace_back();
+    padding.aabbMin = padding.aabbMax = nodes[0].aabbMin;
+
+    std::uint32_t const firstChild = NodeReorderer::leftChild(nodes[0]);
+    if (order == BVHBuildOptions::NodeOrder::DepthFirst)
+        reorderer.link(0, reorderer.emitDepthFirst(firstChild));
+    else
+        reorderer.link(0, reorderer.emitTreelet(firstChild));
+
+    nodes = std::move(reorderer.result);
+}
+
+void refitBVH(std::span<BVH::Node> nodes, std::span<AABB const> triangleAABB, ThreadPool & pool)
+{
+    // The BVH of an empty scene is a single empty node
+    if (nodes.size() < 2 && (nodes.empty() || nodes[0].triangleCount == 0))
+        return;
+
+    // Children may precede their parents in the node array (e.g. in LBVH),
+    // so the tree is traversed recursively instead of in reverse node order
+    auto refit = [&](auto const & self, std::uint32_t nodeID, std::uint32_t depth) -> AABB
+    {
+        auto & node = nodes[nodeID];
+
+        AABB aabb;
+
+        if (node.triangleCount > 0)
+        {
+            for (std::uint32_t i = 0; i < node.triangleCount; ++i)
+                aabb.extend(triangleAABB[node.leftChildOrFirstTriangle + i]);
+        }
+        else
+        {
+            std::uint32_t const leftChild = node.leftChildOrFirstTriangle & 0x3fffffffu;
+
+            if (depth < PARALLEL_REFIT_DEPTH)
+            {
+                AABB leftAABB;
+
+                TaskGroup group(pool);
+                group.run([&]{ leftAABB = self(self, leftChild, depth + 1); });
+                aabb = self(self, leftChild + 1, depth + 1);
+                group.wait();
+
+                aabb.extend(leftAABB);
+            }
+            else
+            {
+                aabb = self(self, leftChild, depth + 1);
+                aabb.extend(self(self, leftChild + 1, depth + 1));
+            }
+        }
+
+        node.aabbMin = aabb.min;
+        node.aabbMax = aabb.max;
+        return aabb;
+    };
+
+    refit(refit, 0, 0);
+}
+
+bool bvhBoundsContain(std::span<BVH::Node const> nodes, std::span<AABB const> triangleAABB)
+{
+    if (nodes.size() < 2 && (nodes.empty() || nodes[0].triangleCount == 0))
+        return true;
+
+    auto contains = [](BVH::Node const & node, AABB const & aabb)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+            if (!(node.aabbMin[axis] <= aabb.min[axis] && node.aabbMax[axis] >= aabb.max[axis]))
+                return false;
+        return true;
+    };
+
+    // Only the nodes reachable from the root, reordered trees contain a padding node
+    std::vector<std::uint32_t> stack{0};
+    while (!stack.empty())
+    {
+        auto const & node = nodes[stack.back()];
+        stack.pop_back();
+
+        if (node.triangleCount > 0)
+        {
+            for (std::uint32_t i = 0; i < node.triangleCount; ++i)
+                if (!contains(node, triangleAABB[node.leftChildOrFirstTriangle + i]))
+                    return false;
+            continue;
+        }
+
+        std::uint32_t const leftChild = node.leftChildOrFirstTriangle & ~NODE_AXIS_MASK;
+        for (std::uint32_t child : {leftChild, leftChild + 1})
+        {
+            if (!contains(node, AABB{nodes[child].aabbMin, nodes[child].aabbMax}))
+                return false;
+            stack.push_back(child);
+        }
+    }
+
+    return true;
+}
+
+float bvhSAHCost(BVH const & bvh)
+{
+    return bvhSAHCost(std::span<BVH::Node const>(bvh.nodes));
+}
+
+float bvhSAHCost(std::span<BVH::Node const> nodes)
+{
+    // Traversal & triangle intersection costs are both taken to be 1,
+    // matching the heuristic used by the builders
+
+    if (nodes.empty())
+        return 0.f;
+
+    auto surfaceArea = [](BVH::Node const & node)
+    {
+        return AABB{node.aabbMin, node.aabbMax}.surfaceArea();
+    };
+
+    float const rootArea = surfaceArea(nodes[0]);
+    if (!std::isfinite(rootArea) || rootArea <= 0.f)
+        return 0.f;
+
+    double cost = 0.0;
+    for (auto const & node : nodes)
+    {
+        if (node.triangleCount > 0)
+            cost += surfaceArea(node) * node.triangleCount;
+        else
+            cost += surfaceArea(node);
+    }
+
+    return cost / rootArea;
+}
+
+char const * bvhMethodName(BVHBuildOptions::Method method)
+{
+    switch (method)
+    {
+    case BVHBuildOptions::Method::SweepSAH:
+        return "sweep SAH";
+    case BVHBuildOptions::Method::BinnedSAH:
+        return "binned SAH";
+    case BVHBuildOptions::Method::SpatialSAH:
+        return "spatial split SAH";
+    case BVHBuildOptions::Method::LBVH:
+        return "LBVH";
+    }
+
+    return "unknown";
+}
+
+char const * bvhNodeOrderName(BVHBuildOptions::NodeOrder order)
+{
+    switch (order)
+    {
+    case BVHBuildOptions::NodeOrder::Creation:
+        return "creation";
+    case BVHBuildOptions::NodeOrder::DepthFirst:
+        return "depth-first";
+    case BVHBuildOptions::NodeOrder::Treelet:
+        return "treelet";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,214 @@
+#include <webgpu-raytracer/bvh_stats.hpp>
+
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+
+    constexpr std::uint32_t NODE_AXIS_MASK = 3u << 30;
+
+    // Vertex positions are stored as vec4, three per triangle reference
+    constexpr std::uint64_t TRIANGLE_POSITION_SIZE = 3 * sizeof(glm::vec4);
+
+    AABB nodeBounds(BVH::Node const & node)
+    {
+        return {node.aabbMin, node.aabbMax};
+    }
+
+    float overlapArea(BVH::Node const & node1, BVH::Node const & node2)
+    {
+        glm::vec3 const min = glm::max(node1.aabbMin, node2.aabbMin);
+        glm::vec3 const max = glm::min(node1.aabbMax, node2.aabbMax);
+
+        for (int axis = 0; axis < 3; ++axis)
+            if (max[axis] < min[axis])
+                return 0.f;
+
+        return AABB{min, max}.surfaceArea();
+    }
+
+    void increment(std::vector<std::uint32_t> & histogram, std::uint32_t index)
+    {
+        if (histogram.size() <= index)
+            histogram.resize(index + 1, 0);
+        ++histogram[index];
+    }
+
+    using Writer = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+
+    void writeHistogram(Writer & writer, std::vector<std::uint32_t> const & histogram)
+    {
+        writer.StartArray();
+        for (auto count : histogram)
+            writer.Uint(count);
+        writer.EndArray();
+    }
+
+    void writeTree(Writer & writer, BVHStats const & stats)
+    {
+        writer.StartObject();
+        writer.Key("nodes");
+        writer.Uint(stats.nodeCount);
+        writer.Key("leaves");
+        writer.Uint(stats.leafCount);
+        writer.Key("triangleReferences");
+        writer.Uint(stats.triangleReferenceCount);
+        writer.Key("maxDepth");
+        writer.Uint(stats.maxDepth);
+        writer.Key("sahCost");
+        writer.Double(stats.sahCost);
+        writer.Key("overlapRatio");
+        writer.Double(stats.overlapRatio);
+        writer.Key("nodeBytes");
+        writer.Uint64(stats.nodeBytes);
+        writer.Key("trianglePositionBytes");
+        writer.Uint64(stats.trianglePositionBytes);
+        writer.Key("leafSizeHistogram");
+        writeHistogram(writer, stats.leafSizeHistogram);
+        writer.Key("leafDepthHistogram");
+        writeHistogram(writer, stats.leafDepthHistogram);
+        writer.EndObject();
+    }
+
+    void writeRays(Writer & writer, BVHLocalityStats::RayStats const & stats)
+    {
+        double const rayCount = std::max<std::uint64_t>(1, stats.rayCount);
+
+        writer.StartObject();
+        writer.Key("rays");
+        writer.Uint64(stats.rayCount);
+        writer.Key("hits");
+        writer.Uint64(stats.hitCount);
+        writer.Key("nodesPerRay");
+        writer.Double(stats.visitedNodeCount / rayCount);
+        writer.Key("trianglesPerRay");
+        writer.Double(stats.testedTriangleCount / rayCount);
+        writer.Key("cacheLinesPerRay");
+        writer.Double(stats.cacheLineCount / rayCount);
+        writer.Key("cacheMissesPerRay");
+        writer.Double(stats.cacheMissCount / rayCount);
+        writer.EndObject();
+    }
+
+}
+
+BVHStats computeBVHStats(std::span<BVH::Node const> nodes, std::uint32_t root)
+{
+    BVHStats result;
+
+    if (nodes.empty())
+        return result;
+
+    double cost = 0.0;
+    double parentArea = 0.0;
+    double siblingOverlapArea = 0.0;
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{{root, 0}};
+    while (!stack.empty())
+    {
+        auto [nodeID, depth] = stack.back();
+        stack.pop_back();
+
+        auto const & node = nodes[nodeID];
+        float const area = nodeBounds(node).surfaceArea();
+
+        result.nodeCount += 1;
+        result.maxDepth = std::max(result.maxDepth, depth);
+
+        // The BVH of an empty scene is a single empty node
+        if (node.triangleCount > 0 || nodes.size() == 1)
+        {
+            result.leafCount += 1;
+            result.triangleReferenceCount += node.triangleCount;
+            increment(result.leafSizeHistogram, node.triangleCount);
+            increment(result.leafDepthHistogram, depth);
+            cost += area * node.triangleCount;
+            continue;
+        }
+
+        std::uint32_t const left = node.leftChildOrFirstTriangle & ~NODE_AXIS_MASK;
+
+        cost += area;
+        parentArea += area;
+        siblingOverlapArea += overlapArea(nodes[left], nodes[left + 1]);
+
+        stack.push_back({left, depth + 1});
+        stack.push_back({left + 1, depth + 1});
+    }
+
+    float const rootArea = nodeBounds(nodes[root]).surfaceArea();
+    if (std::isfinite(rootArea) && rootArea > 0.f)
+        result.sahCost = cost / rootArea;
+    if (parentArea > 0.0)
+        result.overlapRatio = siblingOverlapArea / parentArea;
+
+    result.nodeBytes = std::uint64_t(result.nodeCount) * sizeof(BVH::Node);
+    result.trianglePositionBytes = result.triangleReferenceCount * TRIANGLE_POSITION_SIZE;
+
+    return result;
+}
+
+void writeBVHReport(std::filesystem::path const & path, BVHReport const & report)
+{
+    rapidjson::StringBuffer buffer;
+    Writer writer(buffer);
+
+    writer.StartObject();
+
+    writer.Key("scene");
+    writer.String(report.scene.c_str());
+
+    writer.Key("builder");
+    writer.StartObject();
+    writer.Key("method");
+    writer.String(bvhMethodName(report.options.method));
+    writer.Key("binCount");
+    writer.Uint(report.options.binCount);
+    writer.Key("spatialSplitBudget");
+    writer.Double(report.options.spatialSplitBudget);
+    writer.Key("nodeOrder");
+    writer.String(bvhNodeOrderName(report.options.nodeOrder));
+    writer.Key("optimizationPassCount");
+    writer.Uint(report.options.optimizationPassCount);
+    writer.Key("instancing");
+    writer.Bool(report.instancing);
+    writer.EndObject();
+
+    writer.Key("trees");
+    writer.StartObject();
+    for (auto const & [name, stats] : report.trees)
+    {
+        writer.Key(name.c_str());
+        writeTree(writer, stats);
+    }
+    writer.EndObject();
+
+    if (report.rays)
+    {
+        writer.Key("rays");
+        writer.StartObject();
+        writer.Key("width");
+        writer.Uint(report.raysImageSize.x);
+        writer.Key("height");
+        writer.Uint(report.raysImageSize.y);
+        writer.Key("primary");
+        writeRays(writer, report.rays->primary);
+        writer.Key("secondary");
+        writeRays(writer, report.rays->secondary);
+        writer.EndObject();
+    }
+
+    writer.EndObject();
+
+    std::ofstream file(path);
+    file.write(buffer.GetString(), buffer.GetSize());
+    file << '\n';
+    if (!file)
+        throw std::runtime_error("Failed to write " + path.string());
+}
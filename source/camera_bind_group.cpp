@@ -10,8 +10,12 @@ namespace
         glm::vec3 position;
         char padding1[4];
         glm::uvec2 screenSize;
-        std::uint32_t frameID;
-        std::uint32_t globalFrameID;
+        std::uint32_t sampleID;
+        std::uint32_t globalSampleID;
+        std::uint32_t maxPathDepth;
+        std::uint32_t russianRouletteDepth;
+        std::uint32_t sampleCount;
+        char padding2[4];
     };
 
 }
@@ -80,16 +84,22 @@ CameraBindGroup::~CameraBindGroup()
     wgpuBufferRelease(uniformBuffer_);
 }
 
-void CameraBindGroup::update(WGPUQueue queue, Camera const & camera, glm::uvec2 const & screenSize, std::uint32_t frameID, std::uint32_t globalFrameID)
+void CameraBindGroup::update(WGPUQueue queue, Camera const & camera, glm::uvec2 const & screenSize, std::uint32_t sampleID, std::uint32_t globalSampleID,
+    std::uint32_t sampleCount, PathTracingOptions const & pathTracingOptions)
 {
     CameraUniform uniform
     {
         .viewProjectionMatrix = camera.viewProjectionMatrix(),
         .viewProjectionInverseMatrix = glm::inverse(uniform.viewProjectionMatrix),
         .position = camera.position(),
+        .padding1 = {},
         .screenSize = screenSize,
-        .frameID = frameID,
-        .globalFrameID = globalFrameID,
+        .sampleID = sampleID,
+        .globalSampleID = globalSampleID,
+        .maxPathDepth = pathTracingOptions.maxDepth,
+        .russianRouletteDepth = pathTracingOptions.russianRouletteDepth,
+        .sampleCount = sampleCount,
+        .padding2 = {},
     };
 
     wgpuQueueWriteBuffer(queue, uniformBuffer_, 0, &uniform, sizeof(uniform));
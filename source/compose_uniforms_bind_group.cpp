@@ -6,6 +6,7 @@ namespace
     struct ComposeUniforms
     {
         float exposure;
+        float heatmapRange;
     };
 
 }
@@ -74,11 +75,12 @@ ComposeUniformsBindGroup::~ComposeUniformsBindGroup()
     wgpuBindGroupLayoutRelease(bindGroupLayout_);
 }
 
-void ComposeUniformsBindGroup::update(WGPUQueue queue, float exposure)
+void ComposeUniformsBindGroup::update(WGPUQueue queue, float exposure, float heatmapRange)
 {
     ComposeUniforms uniforms
     {
         .exposure = exposure,
+        .heatmapRange = heatmapRange,
     };
 
     wgpuQueueWriteBuffer(queue, uniformBuffer_, 0, &uniforms, sizeof(uniforms));
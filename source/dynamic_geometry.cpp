@@ -0,0 +1,149 @@
+#include <webgpu-raytracer/dynamic_geometry.hpp>
+#include <webgpu-raytracer/timer.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+
+    constexpr std::size_t PARALLEL_CHUNK_SIZE = 1 << 12;
+
+    AABB triangleBounds(glm::vec4 const * vertices)
+    {
+        AABB aabb;
+        aabb.extend(glm::vec3(vertices[0]));
+        aabb.extend(glm::vec3(vertices[1]));
+        aabb.extend(glm::vec3(vertices[2]));
+        return aabb;
+    }
+
+}
+
+DynamicGeometry::DynamicGeometry(SceneGeometryView const & geometry, DynamicGeometryOptions const & options)
+    : options_(options)
+    , pool_(options.bvhOptions.threadCount)
+{
+    if (!geometry.instances.empty())
+        throw std::runtime_error("Dynamic geometry doesn't support instanced scenes, move instances with buildInstanceBVH instead");
+
+    geometry_.vertexPositions.assign(geometry.vertexPositions.begin(), geometry.vertexPositions.end());
+    geometry_.vertexAttributes.assign(geometry.vertexAttributes.begin(), geometry.vertexAttributes.end());
+    geometry_.bvhNodes.assign(geometry.bvhNodes.begin(), geometry.bvhNodes.end());
+    geometry_.emissiveTriangles.assign(geometry.emissiveTriangles.begin(), geometry.emissiveTriangles.end());
+    geometry_.emissiveAliasTable.assign(geometry.emissiveAliasTable.begin(), geometry.emissiveAliasTable.end());
+    geometry_.emissiveBvhNodes.assign(geometry.emissiveBvhNodes.begin(), geometry.emissiveBvhNodes.end());
+
+    sourceTriangleCount_ = geometry_.vertexPositions.size() / 3;
+    sourceTriangles_.resize(sourceTriangleCount_);
+    for (std::uint32_t i = 0; i < sourceTriangleCount_; ++i)
+        sourceTriangles_[i] = i;
+
+    builtSAHCost_ = bvhSAHCost(geometry_.bvhNodes);
+}
+
+DynamicGeometry::UpdateResult DynamicGeometry::update(std::span<glm::vec4 const> vertexPositions)
+{
+    Timer timer;
+
+    if (vertexPositions.size() != 3 * sourceTriangleCount_)
+        throw std::runtime_error("Vertex count doesn't match the initial geometry");
+
+    std::uint32_t const triangleCount = sourceTriangles_.size();
+    triangleAABB_.resize(triangleCount);
+
+    parallelFor(pool_, triangleCount, PARALLEL_CHUNK_SIZE, [&](std::size_t begin, std::size_t end){
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            auto const source = vertexPositions.data() + 3 * sourceTriangles_[i];
+            std::copy(source, source + 3, geometry_.vertexPositions.data() + 3 * i);
+            triangleAABB_[i] = triangleBounds(source);
+        }
+    });
+
+    refitBVH(geometry_.bvhNodes, triangleAABB_, pool_);
+
+    UpdateResult result;
+    result.sahCost = bvhSAHCost(geometry_.bvhNodes);
+    result.rebuilt = result.sahCost > builtSAHCost_ * options_.rebuildThreshold;
+
+    if (result.rebuilt)
+    {
+        std::cout << "BVH SAH cost grew from " << builtSAHCost_ << " to " << result.sahCost << " after refitting, rebuilding" << std::endl;
+        rebuild();
+        result.sahCost = builtSAHCost_;
+    }
+
+    // The first element of emissiveTriangles is the header, see geometry.wgsl
+    std::uint32_t const emissiveTriangleCount = geometry_.emissiveTriangles.front().index;
+    emissiveTriangleAABB_.resize(emissiveTriangleCount);
+    for (std::uint32_t i = 0; i < emissiveTriangleCount; ++i)
+        emissiveTriangleAABB_[i] = triangleAABB_[geometry_.emissiveTriangles[i + 1].index];
+
+    refitBVH(geometry_.emissiveBvhNodes, emissiveTriangleAABB_, pool_);
+
+    result.duration = timer.duration();
+    return result;
+}
+
+void DynamicGeometry::rebuild()
+{
+    // Spatial splits may have duplicated triangles in the initial geometry,
+    // only the first copy of each one is kept
+
+    std::vector<std::uint32_t> uniqueTriangles;
+    std::vector<AABB> uniqueAABB;
+    {
+        std::vector<bool> seen(sourceTriangleCount_, false);
+        for (std::uint32_t i = 0; i < sourceTriangles_.size(); ++i)
+        {
+            if (seen[sourceTriangles_[i]])
+                continue;
+            seen[sourceTriangles_[i]] = true;
+            uniqueTriangles.push_back(i);
+            uniqueAABB.push_back(triangleAABB_[i]);
+        }
+    }
+
+    auto bvhOptions = options_.bvhOptions;
+    if (bvhOptions.method == BVHBuildOptions::Method::SpatialSAH)
+        bvhOptions.method = BVHBuildOptions::Method::BinnedSAH;
+
+    BVH bvh = buildBVH(uniqueAABB, bvhOptions);
+
+    std::uint32_t const triangleCount = bvh.triangleIDs.size();
+
+    std::vector<glm::vec4> vertexPositions(3 * triangleCount);
+    std::vector<VertexAttributes> vertexAttributes(3 * triangleCount);
+    std::vector<std::uint32_t> sourceTriangles(triangleCount);
+    std::vector<AABB> triangleAABB(triangleCount);
+    std::vector<std::uint32_t> sourceToNew(sourceTriangleCount_);
+
+    for (std::uint32_t i = 0; i < triangleCount; ++i)
+    {
+        std::uint32_t const oldTriangle = uniqueTriangles[bvh.triangleIDs[i]];
+        for (std::uint32_t k = 0; k < 3; ++k)
+        {
+            vertexPositions[3 * i + k] = geometry_.vertexPositions[3 * oldTriangle + k];
+            vertexAttributes[3 * i + k] = geometry_.vertexAttributes[3 * oldTriangle + k];
+        }
+        sourceTriangles[i] = sourceTriangles_[oldTriangle];
+        triangleAABB[i] = triangleAABB_[oldTriangle];
+        sourceToNew[sourceTriangles[i]] = i;
+    }
+
+    // The light BVH indexes emissiveTriangles, so only the triangle IDs change
+    auto & emissiveTriangles = geometry_.emissiveTriangles;
+    std::uint32_t const emissiveTriangleCount = emissiveTriangles.front().index;
+    for (std::uint32_t i = 1; i <= emissiveTriangleCount; ++i)
+        emissiveTriangles[i].index = sourceToNew[sourceTriangles_[emissiveTriangles[i].index]];
+
+    geometry_.vertexPositions = std::move(vertexPositions);
+    geometry_.vertexAttributes = std::move(vertexAttributes);
+    geometry_.bvhNodes = std::move(bvh.nodes);
+    sourceTriangles_ = std::move(sourceTriangles);
+    triangleAABB_ = std::move(triangleAABB);
+
+    builtSAHCost_ = bvhSAHCost(geometry_.bvhNodes);
+}
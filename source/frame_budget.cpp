@@ -0,0 +1,35 @@
+#include <webgpu-raytracer/frame_budget.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+    // Weight of the newest measurement in the running estimate of the sample time
+    constexpr double SMOOTHING = 0.25;
+
+    // Limits the growth per measurement, the sample time estimate of
+    // a scene that just got more expensive lags behind
+    constexpr std::uint32_t MAX_GROWTH = 2;
+
+}
+
+FrameBudgetController::FrameBudgetController(FrameBudgetOptions const & options)
+    : options_(options)
+    , samplesPerDispatch_(std::clamp<std::uint32_t>(options.samplesPerDispatch, 1, std::max<std::uint32_t>(1, options.maxSamplesPerDispatch)))
+{}
+
+void FrameBudgetController::addMeasurement(double frameTime, std::uint32_t sampleCount)
+{
+    if (options_.targetFrameTime <= 0.0 || sampleCount == 0 || !(frameTime > 0.0))
+        return;
+
+    double const sampleTime = frameTime / sampleCount;
+    sampleTime_ = (sampleTime_ == 0.0) ? sampleTime : std::lerp(sampleTime_, sampleTime, SMOOTHING);
+
+    double const budget = std::floor(options_.targetFrameTime / sampleTime_);
+    std::uint32_t const maxSamples = std::min(std::max<std::uint32_t>(1, options_.maxSamplesPerDispatch), samplesPerDispatch_ * MAX_GROWTH);
+
+    samplesPerDispatch_ = std::clamp<double>(budget, 1.0, maxSamples);
+}
@@ -2,7 +2,7 @@
 
 WGPUBindGroupLayout createGeometryBindGroupLayout(WGPUDevice device)
 {
-    WGPUBindGroupLayoutEntry layoutEntries[6];
+    WGPUBindGroupLayoutEntry layoutEntries[10];
 
     layoutEntries[0].nextInChain = nullptr;
     layoutEntries[0].binding = 0;
@@ -112,10 +112,82 @@ WGPUBindGroupLayout createGeometryBindGroupLayout(WGPUDevice device)
     layoutEntries[5].storageTexture.format = WGPUTextureFormat_Undefined;
     layoutEntries[5].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
 
+    layoutEntries[6].nextInChain = nullptr;
+    layoutEntries[6].binding = 6;
+    layoutEntries[6].visibility = WGPUShaderStage_Compute;
+    layoutEntries[6].buffer.nextInChain = nullptr;
+    layoutEntries[6].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    layoutEntries[6].buffer.hasDynamicOffset = false;
+    layoutEntries[6].buffer.minBindingSize = 0;
+    layoutEntries[6].sampler.nextInChain = nullptr;
+    layoutEntries[6].sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntries[6].texture.nextInChain = nullptr;
+    layoutEntries[6].texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntries[6].texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntries[6].texture.multisampled = false;
+    layoutEntries[6].storageTexture.nextInChain = nullptr;
+    layoutEntries[6].storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntries[6].storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntries[6].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
+    layoutEntries[7].nextInChain = nullptr;
+    layoutEntries[7].binding = 7;
+    layoutEntries[7].visibility = WGPUShaderStage_Compute;
+    layoutEntries[7].buffer.nextInChain = nullptr;
+    layoutEntries[7].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    layoutEntries[7].buffer.hasDynamicOffset = false;
+    layoutEntries[7].buffer.minBindingSize = 0;
+    layoutEntries[7].sampler.nextInChain = nullptr;
+    layoutEntries[7].sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntries[7].texture.nextInChain = nullptr;
+    layoutEntries[7].texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntries[7].texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntries[7].texture.multisampled = false;
+    layoutEntries[7].storageTexture.nextInChain = nullptr;
+    layoutEntries[7].storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntries[7].storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntries[7].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
+    layoutEntries[8].nextInChain = nullptr;
+    layoutEntries[8].binding = 8;
+    layoutEntries[8].visibility = WGPUShaderStage_Compute;
+    layoutEntries[8].buffer.nextInChain = nullptr;
+    layoutEntries[8].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    layoutEntries[8].buffer.hasDynamicOffset = false;
+    layoutEntries[8].buffer.minBindingSize = 0;
+    layoutEntries[8].sampler.nextInChain = nullptr;
+    layoutEntries[8].sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntries[8].texture.nextInChain = nullptr;
+    layoutEntries[8].texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntries[8].texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntries[8].texture.multisampled = false;
+    layoutEntries[8].storageTexture.nextInChain = nullptr;
+    layoutEntries[8].storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntries[8].storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntries[8].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
+    layoutEntries[9].nextInChain = nullptr;
+    layoutEntries[9].binding = 9;
+    layoutEntries[9].visibility = WGPUShaderStage_Compute;
+    layoutEntries[9].buffer.nextInChain = nullptr;
+    layoutEntries[9].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    layoutEntries[9].buffer.hasDynamicOffset = false;
+    layoutEntries[9].buffer.minBindingSize = 0;
+    layoutEntries[9].sampler.nextInChain = nullptr;
+    layoutEntries[9].sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntries[9].texture.nextInChain = nullptr;
+    layoutEntries[9].texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntries[9].texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntries[9].texture.multisampled = false;
+    layoutEntries[9].storageTexture.nextInChain = nullptr;
+    layoutEntries[9].storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntries[9].storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntries[9].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
     WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
     bindGroupLayoutDescriptor.nextInChain = nullptr;
     bindGroupLayoutDescriptor.label = "geometry";
-    bindGroupLayoutDescriptor.entryCount = 6;
+    bindGroupLayoutDescriptor.entryCount = 10;
     bindGroupLayoutDescriptor.entries = layoutEntries;
 
     return wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
@@ -123,9 +195,10 @@ WGPUBindGroupLayout createGeometryBindGroupLayout(WGPUDevice device)
 
 WGPUBindGroup createGeometryBindGroup(WGPUDevice device, WGPUBindGroupLayout bindGroupLayout, WGPUBuffer vertexPositionsBuffer,
     WGPUBuffer vertexAttributesBuffer,WGPUBuffer bvhNodesBuffer,
-    WGPUBuffer emissiveTrianglesBuffer, WGPUBuffer emissiveTrianglesAliasBuffer, WGPUBuffer emissiveBvhNodesBuffer)
+    WGPUBuffer emissiveTrianglesBuffer, WGPUBuffer emissiveTrianglesAliasBuffer, WGPUBuffer emissiveBvhNodesBuffer,
+    WGPUBuffer wideBvhNodesBuffer, WGPUBuffer quantizedBvhNodesBuffer, WGPUBuffer instancesBuffer, WGPUBuffer instanceBvhNodesBuffer)
 {
-    WGPUBindGroupEntry entries[6];
+    WGPUBindGroupEntry entries[10];
 
     entries[0].nextInChain = nullptr;
     entries[0].binding = 0;
@@ -175,11 +248,43 @@ WGPUBindGroup createGeometryBindGroup(WGPUDevice device, WGPUBindGroupLayout bin
     entries[5].sampler = nullptr;
     entries[5].textureView = nullptr;
 
+    entries[6].nextInChain = nullptr;
+    entries[6].binding = 6;
+    entries[6].buffer = wideBvhNodesBuffer;
+    entries[6].offset = 0;
+    entries[6].size = wgpuBufferGetSize(wideBvhNodesBuffer);
+    entries[6].sampler = nullptr;
+    entries[6].textureView = nullptr;
+
+    entries[7].nextInChain = nullptr;
+    entries[7].binding = 7;
+    entries[7].buffer = quantizedBvhNodesBuffer;
+    entries[7].offset = 0;
+    entries[7].size = wgpuBufferGetSize(quantizedBvhNodesBuffer);
+    entries[7].sampler = nullptr;
+    entries[7].textureView = nullptr;
+
+    entries[8].nextInChain = nullptr;
+    entries[8].binding = 8;
+    entries[8].buffer = instancesBuffer;
+    entries[8].offset = 0;
+    entries[8].size = wgpuBufferGetSize(instancesBuffer);
+    entries[8].sampler = nullptr;
+    entries[8].textureView = nullptr;
+
+    entries[9].nextInChain = nullptr;
+    entries[9].binding = 9;
+    entries[9].buffer = instanceBvhNodesBuffer;
+    entries[9].offset = 0;
+    entries[9].size = wgpuBufferGetSize(instanceBvhNodesBuffer);
+    entries[9].sampler = nullptr;
+    entries[9].textureView = nullptr;
+
     WGPUBindGroupDescriptor bindGroupDescriptor;
     bindGroupDescriptor.nextInChain = nullptr;
     bindGroupDescriptor.label = "geometry";
     bindGroupDescriptor.layout = bindGroupLayout;
-    bindGroupDescriptor.entryCount = 6;
+    bindGroupDescriptor.entryCount = 10;
     bindGroupDescriptor.entries = entries;
 
     return wgpuDeviceCreateBindGroup(device, &bindGroupDescriptor);
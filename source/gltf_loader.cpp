@@ -1,14 +1,17 @@
 #include <webgpu-raytracer/gltf_loader.hpp>
+#include <webgpu-raytracer/mapped_file.hpp>
+#include <webgpu-raytracer/hash.hpp>
+#include <webgpu-raytracer/thread_pool.hpp>
+#include <webgpu-raytracer/timer.hpp>
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-#include <fstream>
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 
 namespace glTF
 {
@@ -16,54 +19,191 @@ namespace glTF
     namespace
     {
 
-        std::vector<char> loadBuffer(std::filesystem::path const & assetPath, std::string const & bufferUri)
+        // See https://registry.khronos.org/glTF/specs/2.0/glTF-2.0.html#glb-file-format-specification
+        constexpr std::uint32_t GLB_MAGIC = 0x46546C67;
+        constexpr std::uint32_t GLB_CHUNK_JSON = 0x4E4F534A;
+        constexpr std::uint32_t GLB_CHUNK_BIN = 0x004E4942;
+
+        struct GLBChunks
+        {
+            std::span<char const> json;
+            std::optional<std::span<char const>> binary;
+        };
+
+        bool isGLB(MappedFile const & file)
+        {
+            std::uint32_t magic = 0;
+            if (file.size() >= sizeof(magic))
+                std::memcpy(&magic, file.data(), sizeof(magic));
+            return magic == GLB_MAGIC;
+        }
+
+        GLBChunks parseGLB(std::filesystem::path const & path, MappedFile const & file)
         {
-            auto const bufferPath = assetPath.parent_path() / bufferUri;
+            // magic, version, length
+            std::uint32_t header[3];
+            if (file.size() < sizeof(header))
+                throw std::runtime_error("Truncated GLB header in " + path.string());
+            std::memcpy(header, file.data(), sizeof(header));
+
+            if (header[1] != 2)
+                throw std::runtime_error("Unsupported GLB version " + std::to_string(header[1]) + " in " + path.string());
+
+            std::size_t const length = std::min<std::size_t>(header[2], file.size());
+
+            GLBChunks result;
+
+            std::size_t offset = sizeof(header);
+            while (offset + 8 <= length)
+            {
+                // length, type
+                std::uint32_t chunkHeader[2];
+                std::memcpy(chunkHeader, file.data() + offset, sizeof(chunkHeader));
+                offset += sizeof(chunkHeader);
 
-            std::vector<char> result;
-            result.resize(std::filesystem::file_size(bufferPath));
+                if (chunkHeader[0] > length - offset)
+                    throw std::runtime_error("Truncated GLB chunk in " + path.string());
 
-            std::ifstream input(bufferPath, std::ios::binary);
-            input.read(result.data(), result.size());
+                std::span<char const> chunk(file.data() + offset, chunkHeader[0]);
+
+                // The JSON chunk must come first, at most one binary chunk
+                // follows, and any other chunks should be ignored
+                if (offset == sizeof(header) + sizeof(chunkHeader) && chunkHeader[1] == GLB_CHUNK_JSON)
+                    result.json = chunk;
+                else if (chunkHeader[1] == GLB_CHUNK_BIN && !result.binary)
+                    result.binary = chunk;
+
+                offset += (chunkHeader[0] + 3) & ~3u;
+            }
+
+            if (result.json.empty())
+                throw std::runtime_error("No JSON chunk in " + path.string());
 
             return result;
         }
 
-        Image loadImage(std::filesystem::path const & assetPath, std::string const & uri)
+        std::shared_ptr<MappedFile const> mapFile(Asset & asset, std::filesystem::path const & path)
         {
-            auto imagePath = assetPath.parent_path() / uri;
+            auto file = std::make_shared<MappedFile const>(path);
+            asset.mappedFiles.push_back(file);
+            return file;
+        }
 
-            Image result;
-            result.uri = uri;
+        void decodeImage(Image & image, std::string const & uri, std::span<char const> encoded)
+        {
+            image.uri = uri;
 
-            int channels;
-            auto pixels = stbi_load(imagePath.c_str(), (int *)&result.width, (int *)&result.height, &channels, 4);
+            int width, height, channels;
+            auto pixels = stbi_load_from_memory((stbi_uc const *)encoded.data(), encoded.size(), &width, &height, &channels, 4);
+            if (!pixels)
+                throw std::runtime_error("Failed to load image " + (uri.empty() ? std::string("<embedded>") : uri) + ": " + stbi_failure_reason());
 
-            result.data.resize(result.width * result.height);
-            std::copy(pixels, pixels + result.width * result.height * 4, (char *)result.data.data());
+            image.width = width;
+            image.height = height;
+            image.data.reset(reinterpret_cast<std::uint32_t *>(pixels));
+        }
 
-            stbi_image_free(pixels);
+        struct ImageLoadStats
+        {
+            std::uint64_t fileHash = 0;
+            std::size_t encodedSize = 0;
+            double readTime = 0.0;
+            double decodeTime = 0.0;
+        };
 
-            return result;
-        }
+    }
 
+    void Image::DataDeleter::operator()(std::uint32_t * data) const
+    {
+        stbi_image_free(data);
     }
 
-    Asset load(std::filesystem::path const & path)
+    Asset load(std::filesystem::path const & path, bool hashContent)
     {
-        std::ifstream input(path);
-        if (!input)
-            throw std::runtime_error("Failed to open " + path.string());
+        auto input = std::make_shared<MappedFile const>(path);
+
+        Hasher hasher;
+        if (hashContent)
+            hasher.update(input->data(), input->size());
+
+        std::span<char const> json = input->bytes();
+        std::optional<std::span<char const>> binaryChunk;
+
+        if (isGLB(*input))
+        {
+            auto chunks = parseGLB(path, *input);
+            json = chunks.json;
+            binaryChunk = chunks.binary;
+        }
 
-        rapidjson::IStreamWrapper inputWrapper(input);
         rapidjson::Document document;
-        document.ParseStream(inputWrapper);
+        document.Parse(json.data(), json.size());
 
         if (document.HasParseError())
             throw std::runtime_error("Failed to parse " + path.string() + ": " + std::to_string((int)document.GetParseError()));
 
         Asset result;
 
+        if (binaryChunk)
+            result.mappedFiles.push_back(input);
+
+        // Images are decoded on a thread pool in the background while
+        // the rest of the document is processed and buffers are mapped.
+        // NB: tasks reference the asset and the stats, so the task group
+        // must be destroyed before them, even if an exception is thrown
+
+        Timer imagesTimer;
+        std::vector<ImageLoadStats> imageStats;
+
+        ThreadPool pool;
+        TaskGroup imageTasks(pool);
+
+        auto decodeImageAsync = [&](std::uint32_t imageID, std::string const & uri, std::optional<std::span<char const>> encoded)
+        {
+            imageTasks.run([&, imageID, uri, encoded]{
+                auto & stats = imageStats[imageID];
+
+                Timer readTimer;
+
+                MappedFile file;
+                auto data = encoded.value_or(std::span<char const>{});
+
+                // Images in buffer views are hashed as part of their buffer
+                if (!encoded)
+                {
+                    file = MappedFile(path.parent_path() / uri);
+                    data = file.bytes();
+
+                    if (hashContent)
+                    {
+                        Hasher fileHasher;
+                        fileHasher.update(data.data(), data.size());
+                        stats.fileHash = fileHasher.digest();
+                    }
+                }
+
+                stats.encodedSize = data.size();
+                stats.readTime = readTimer.duration();
+
+                Timer decodeTimer;
+                decodeImage(result.images[imageID], uri, data);
+                stats.decodeTime = decodeTimer.duration();
+            });
+        };
+
+        if (document.HasMember("images"))
+        {
+            auto const & imagesIn = document["images"].GetArray();
+
+            result.images.resize(imagesIn.Size());
+            imageStats.resize(imagesIn.Size());
+
+            // Images referencing buffer views are started after the buffers are loaded
+            for (std::uint32_t imageID = 0; imageID < imagesIn.Size(); ++imageID)
+                if (imagesIn[imageID].HasMember("uri"))
+                    decodeImageAsync(imageID, imagesIn[imageID]["uri"].GetString(), std::nullopt);
+        }
+
         if (document.HasMember("nodes"))
         for (auto const & nodeIn : document["nodes"].GetArray())
         {
@@ -227,13 +367,6 @@ namespace glTF
             }
         }
 
-        if (document.HasMember("images"))
-        for (auto const & imageIn : document["images"].GetArray())
-        {
-            auto & image = result.images.emplace_back();
-            image = loadImage(path, imageIn["uri"].GetString());
-        }
-
         if (document.HasMember("textures"))
         for (auto const & textureIn : document["textures"].GetArray())
         {
@@ -300,10 +433,63 @@ namespace glTF
         if (document.HasMember("buffers"))
         for (auto const & bufferIn : document["buffers"].GetArray())
         {
+            auto const bufferID = result.buffers.size();
             auto & buffer = result.buffers.emplace_back();
 
-            buffer.uri = bufferIn["uri"].GetString();
-            buffer.data = loadBuffer(path, buffer.uri);
+            std::span<char const> data;
+
+            if (bufferIn.HasMember("uri"))
+            {
+                buffer.uri = bufferIn["uri"].GetString();
+                data = mapFile(result, path.parent_path() / buffer.uri)->bytes();
+                if (hashContent)
+                    hasher.update(data.data(), data.size());
+            }
+            else if (bufferID == 0 && binaryChunk)
+            {
+                // Already hashed as part of the .glb file
+                data = *binaryChunk;
+            }
+            else
+                throw std::runtime_error("Buffer " + std::to_string(bufferID) + " in " + path.string() + " has no data");
+
+            std::size_t const byteLength = bufferIn["byteLength"].GetUint64();
+            if (data.size() < byteLength)
+                throw std::runtime_error("Buffer " + std::to_string(bufferID) + " in " + path.string() + " is truncated");
+
+            buffer.data = data.first(byteLength);
+        }
+
+        for (std::uint32_t bufferViewID = 0; bufferViewID < result.bufferViews.size(); ++bufferViewID)
+        {
+            auto const & bufferView = result.bufferViews[bufferViewID];
+
+            if (bufferView.buffer >= result.buffers.size())
+                throw std::runtime_error("Buffer view " + std::to_string(bufferViewID) + " in " + path.string() + " references a missing buffer");
+
+            std::size_t const bufferSize = result.buffers[bufferView.buffer].data.size();
+            if (bufferView.byteOffset > bufferSize || bufferView.byteLength > bufferSize - bufferView.byteOffset)
+                throw std::runtime_error("Buffer view " + std::to_string(bufferViewID) + " in " + path.string() + " is out of its buffer's bounds");
+        }
+
+        if (document.HasMember("images"))
+        {
+            auto const & imagesIn = document["images"].GetArray();
+
+            for (std::uint32_t imageID = 0; imageID < imagesIn.Size(); ++imageID)
+            {
+                if (imagesIn[imageID].HasMember("uri"))
+                    continue;
+
+                auto const & imageIn = imagesIn[imageID];
+                if (!imageIn.HasMember("bufferView") || !imageIn["bufferView"].IsUint() || imageIn["bufferView"].GetUint() >= result.bufferViews.size())
+                    throw std::runtime_error("Image " + std::to_string(imageID) + " in " + path.string() + " has neither a uri nor a valid buffer view");
+
+                auto const & bufferView = result.bufferViews[imageIn["bufferView"].GetUint()];
+                auto const encoded = result.buffers[bufferView.buffer].data.subspan(bufferView.byteOffset, bufferView.byteLength);
+
+                decodeImageAsync(imageID, "", encoded);
+            }
         }
 
         if (document.HasMember("cameras"))
@@ -327,6 +513,36 @@ namespace glTF
             }
         }
 
+        imageTasks.wait();
+
+        double totalReadTime = 0.0;
+        double totalDecodeTime = 0.0;
+        for (auto const & stats : imageStats)
+        {
+            hasher.update(stats.fileHash);
+
+            totalReadTime += stats.readTime;
+            totalDecodeTime += stats.decodeTime;
+        }
+
+        if (!result.images.empty())
+        {
+            std::cout << "Loaded " << result.images.size() << " images in " << imagesTimer.duration() << " seconds using " << pool.threadCount()
+                << " threads (read: " << totalReadTime << " seconds, decode: " << totalDecodeTime << " seconds in total)" << std::endl;
+
+            for (std::uint32_t imageID = 0; imageID < result.images.size(); ++imageID)
+            {
+                auto const & image = result.images[imageID];
+                auto const & stats = imageStats[imageID];
+
+                std::cout << "    Image " << imageID << " " << (image.uri.empty() ? std::string("<embedded>") : image.uri) << ": " << image.width << "x" << image.height
+                    << ", " << stats.encodedSize / 1024 << " KB, read: " << stats.readTime << " seconds, decode: " << stats.decodeTime << " seconds" << std::endl;
+            }
+        }
+
+        if (hashContent)
+            result.contentHash = hasher.digest();
+
         for (std::uint32_t nodeID = 0; nodeID < result.nodes.size(); ++nodeID)
         {
             for (auto childID : result.nodes[nodeID].children)
@@ -0,0 +1,394 @@
+#include <webgpu-raytracer/gpu_lbvh.hpp>
+#include <webgpu-raytracer/timer.hpp>
+
+#include <wgpu.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <cstring>
+
+namespace
+{
+
+    constexpr std::uint32_t WORKGROUP_SIZE = 256;
+    constexpr std::uint32_t RADIX_DIGIT_COUNT = 256;
+    constexpr std::uint32_t RADIX_PASS_COUNT = 4;
+    constexpr std::uint32_t MAX_WORKGROUP_COUNT = 65535;
+
+    // Uniform buffer dynamic offsets must be aligned to
+    // minUniformBufferOffsetAlignment, which is at most 256
+    constexpr std::uint32_t PARAMS_STRIDE = 256;
+
+    struct Params
+    {
+        std::uint32_t triangleCount;
+        std::uint32_t sortShift;
+        std::uint32_t tileCount;
+        std::uint32_t padding;
+    };
+
+    // Sizes of LBVHState and LBVHRefitNode in lbvh.wgsl
+    constexpr std::uint32_t STATE_SIZE = 32;
+    constexpr std::uint32_t REFIT_NODE_SIZE = 32;
+    constexpr std::uint32_t STATE_MAX_DEPTH_OFFSET = 24;
+
+    enum Binding : std::uint32_t
+    {
+        ParamsBinding,
+        VertexPositionsBinding,
+        VertexAttributesBinding,
+        StateBinding,
+        PairsBinding,
+        SortedPairsBinding,
+        HistogramsBinding,
+        ParentsBinding,
+        RefitNodesBinding,
+        NodesBinding,
+        SortedVertexPositionsBinding,
+        SortedVertexAttributesBinding,
+        InversePermutationBinding,
+        EmissiveTrianglesBinding,
+        BindingCount,
+    };
+
+    WGPUBindGroupLayoutEntry bufferLayoutEntry(std::uint32_t binding, WGPUBufferBindingType type, bool hasDynamicOffset)
+    {
+        WGPUBindGroupLayoutEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.visibility = WGPUShaderStage_Compute;
+        entry.buffer.nextInChain = nullptr;
+        entry.buffer.type = type;
+        entry.buffer.hasDynamicOffset = hasDynamicOffset;
+        entry.buffer.minBindingSize = 0;
+        entry.sampler.nextInChain = nullptr;
+        entry.sampler.type = WGPUSamplerBindingType_Undefined;
+        entry.texture.nextInChain = nullptr;
+        entry.texture.sampleType = WGPUTextureSampleType_Undefined;
+        entry.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+        entry.texture.multisampled = false;
+        entry.storageTexture.nextInChain = nullptr;
+        entry.storageTexture.access = WGPUStorageTextureAccess_Undefined;
+        entry.storageTexture.format = WGPUTextureFormat_Undefined;
+        entry.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+        return entry;
+    }
+
+    WGPUBindGroupEntry bufferEntry(std::uint32_t binding, WGPUBuffer buffer, std::uint64_t size)
+    {
+        WGPUBindGroupEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.buffer = buffer;
+        entry.offset = 0;
+        entry.size = size;
+        entry.sampler = nullptr;
+        entry.textureView = nullptr;
+        return entry;
+    }
+
+    WGPUBuffer createBuffer(WGPUDevice device, char const * label, WGPUBufferUsageFlags usage, std::uint64_t size)
+    {
+        WGPUBufferDescriptor bufferDescriptor;
+        bufferDescriptor.nextInChain = nullptr;
+        bufferDescriptor.label = label;
+        bufferDescriptor.usage = usage;
+        // Zero-sized bindings are invalid
+        bufferDescriptor.size = std::max<std::uint64_t>(16, (size + 3) / 4 * 4);
+        bufferDescriptor.mappedAtCreation = false;
+
+        return wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+    }
+
+    WGPUComputePipeline createPipeline(WGPUDevice device, WGPUPipelineLayout pipelineLayout, WGPUShaderModule shaderModule, char const * entryPoint)
+    {
+        WGPUComputePipelineDescriptor pipelineDescriptor;
+        pipelineDescriptor.nextInChain = nullptr;
+        pipelineDescriptor.label = entryPoint;
+        pipelineDescriptor.layout = pipelineLayout;
+        pipelineDescriptor.compute.nextInChain = nullptr;
+        pipelineDescriptor.compute.module = shaderModule;
+        pipelineDescriptor.compute.entryPoint = entryPoint;
+        pipelineDescriptor.compute.constantCount = 0;
+        pipelineDescriptor.compute.constants = nullptr;
+
+        return wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
+    }
+
+    void submit(WGPUQueue queue, WGPUCommandEncoder commandEncoder)
+    {
+        WGPUCommandBufferDescriptor commandBufferDescriptor;
+        commandBufferDescriptor.nextInChain = nullptr;
+        commandBufferDescriptor.label = nullptr;
+
+        WGPUCommandBuffer commandBuffer = wgpuCommandEncoderFinish(commandEncoder, &commandBufferDescriptor);
+
+        wgpuQueueSubmit(queue, 1, &commandBuffer);
+
+        wgpuCommandBufferRelease(commandBuffer);
+        wgpuCommandEncoderRelease(commandEncoder);
+    }
+
+    WGPUCommandEncoder createCommandEncoder(WGPUDevice device)
+    {
+        WGPUCommandEncoderDescriptor commandEncoderDescriptor;
+        commandEncoderDescriptor.nextInChain = nullptr;
+        commandEncoderDescriptor.label = nullptr;
+
+        return wgpuDeviceCreateCommandEncoder(device, &commandEncoderDescriptor);
+    }
+
+    std::vector<char> readBuffer(WGPUDevice device, WGPUQueue queue, WGPUBuffer source, std::uint64_t offset, std::uint64_t size)
+    {
+        WGPUBuffer buffer = createBuffer(device, "readback", WGPUBufferUsage_CopyDst | WGPUBufferUsage_MapRead, size);
+
+        WGPUCommandEncoder commandEncoder = createCommandEncoder(device);
+        wgpuCommandEncoderCopyBufferToBuffer(commandEncoder, source, offset, buffer, 0, size);
+        submit(queue, commandEncoder);
+
+        std::optional<WGPUBufferMapAsyncStatus> mapStatus;
+
+        auto callback = [](WGPUBufferMapAsyncStatus status, void * userData)
+        {
+            *static_cast<std::optional<WGPUBufferMapAsyncStatus> *>(userData) = status;
+        };
+
+        wgpuBufferMapAsync(buffer, WGPUMapMode_Read, 0, size, callback, &mapStatus);
+
+        while (!mapStatus)
+            wgpuDevicePoll(device, true, nullptr);
+
+        if (*mapStatus != WGPUBufferMapAsyncStatus_Success)
+        {
+            wgpuBufferRelease(buffer);
+            throw std::runtime_error("Failed to map readback buffer: " + std::to_string(*mapStatus));
+        }
+
+        auto mappedData = static_cast<char const *>(wgpuBufferGetConstMappedRange(buffer, 0, size));
+        std::vector<char> result(mappedData, mappedData + size);
+
+        wgpuBufferUnmap(buffer);
+        wgpuBufferRelease(buffer);
+
+        return result;
+    }
+
+    std::uint32_t workgroupCount(std::uint32_t threadCount)
+    {
+        return (threadCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+    }
+
+}
+
+GpuLBVHBuilder::GpuLBVHBuilder(WGPUDevice device, ShaderRegistry & shaderRegistry)
+{
+    WGPUBindGroupLayoutEntry layoutEntries[BindingCount];
+
+    layoutEntries[ParamsBinding] = bufferLayoutEntry(ParamsBinding, WGPUBufferBindingType_Uniform, true);
+    layoutEntries[VertexPositionsBinding] = bufferLayoutEntry(VertexPositionsBinding, WGPUBufferBindingType_ReadOnlyStorage, false);
+    layoutEntries[VertexAttributesBinding] = bufferLayoutEntry(VertexAttributesBinding, WGPUBufferBindingType_ReadOnlyStorage, false);
+    for (std::uint32_t binding = StateBinding; binding < BindingCount; ++binding)
+        layoutEntries[binding] = bufferLayoutEntry(binding, WGPUBufferBindingType_Storage, false);
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
+    bindGroupLayoutDescriptor.nextInChain = nullptr;
+    bindGroupLayoutDescriptor.label = "lbvh";
+    bindGroupLayoutDescriptor.entryCount = BindingCount;
+    bindGroupLayoutDescriptor.entries = layoutEntries;
+
+    bindGroupLayout_ = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
+
+    WGPUPipelineLayoutDescriptor pipelineLayoutDescriptor;
+    pipelineLayoutDescriptor.nextInChain = nullptr;
+    pipelineLayoutDescriptor.label = nullptr;
+    pipelineLayoutDescriptor.bindGroupLayoutCount = 1;
+    pipelineLayoutDescriptor.bindGroupLayouts = &bindGroupLayout_;
+
+    pipelineLayout_ = wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDescriptor);
+
+    WGPUShaderModule shaderModule = shaderRegistry.loadShaderModule("lbvh");
+
+    computeCentroidBoundsPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "computeCentroidBounds");
+    computeMortonCodesPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "computeMortonCodes");
+    radixHistogramPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "radixHistogram");
+    radixScanPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "radixScan");
+    radixScatterPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "radixScatter");
+    emitHierarchyPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "emitHierarchy");
+    refitPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "refit");
+    gatherTrianglesPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "gatherTriangles");
+    remapEmissiveTrianglesPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "remapEmissiveTriangles");
+}
+
+GpuLBVHBuilder::~GpuLBVHBuilder()
+{
+    wgpuComputePipelineRelease(remapEmissiveTrianglesPipeline_);
+    wgpuComputePipelineRelease(gatherTrianglesPipeline_);
+    wgpuComputePipelineRelease(refitPipeline_);
+    wgpuComputePipelineRelease(emitHierarchyPipeline_);
+    wgpuComputePipelineRelease(radixScatterPipeline_);
+    wgpuComputePipelineRelease(radixScanPipeline_);
+    wgpuComputePipelineRelease(radixHistogramPipeline_);
+    wgpuComputePipelineRelease(computeMortonCodesPipeline_);
+    wgpuComputePipelineRelease(computeCentroidBoundsPipeline_);
+    wgpuPipelineLayoutRelease(pipelineLayout_);
+    wgpuBindGroupLayoutRelease(bindGroupLayout_);
+}
+
+GpuLBVHBuilder::Result GpuLBVHBuilder::build(WGPUDevice device, WGPUQueue queue, WGPUBuffer vertexPositionsBuffer, WGPUBuffer vertexAttributesBuffer,
+    WGPUBuffer emissiveTrianglesBuffer, std::uint32_t triangleCount, std::uint32_t emissiveTriangleCount)
+{
+    if (triangleCount == 0)
+        throw std::runtime_error("Can't build an LBVH without triangles");
+
+    std::uint32_t const tileCount = workgroupCount(triangleCount);
+    if (tileCount > MAX_WORKGROUP_COUNT || workgroupCount(emissiveTriangleCount) > MAX_WORKGROUP_COUNT)
+        throw std::runtime_error("Too many triangles for the GPU LBVH builder: " + std::to_string(triangleCount));
+
+    std::uint32_t const nodeCount = 2 * triangleCount - 1;
+
+    std::uint64_t const vertexPositionsSize = wgpuBufferGetSize(vertexPositionsBuffer);
+    std::uint64_t const vertexAttributesSize = wgpuBufferGetSize(vertexAttributesBuffer);
+
+    Result result;
+
+    result.vertexPositionsBuffer = createBuffer(device, "vertexPositions",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage, vertexPositionsSize);
+    result.vertexAttributesBuffer = createBuffer(device, "vertexAttributes",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage, vertexAttributesSize);
+    result.bvhNodesBuffer = createBuffer(device, "bvhNodes",
+        WGPUBufferUsage_CopyDst | WGPUBufferUsage_CopySrc | WGPUBufferUsage_Storage, nodeCount * sizeof(BVH::Node));
+
+    WGPUBuffer paramsBuffer = createBuffer(device, "lbvhParams", WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform,
+        RADIX_PASS_COUNT * PARAMS_STRIDE);
+    WGPUBuffer stateBuffer = createBuffer(device, "lbvhState", WGPUBufferUsage_CopyDst | WGPUBufferUsage_CopySrc | WGPUBufferUsage_Storage,
+        STATE_SIZE);
+    WGPUBuffer pairsBuffer = createBuffer(device, "lbvhPairs", WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage,
+        triangleCount * sizeof(glm::uvec2));
+    WGPUBuffer sortedPairsBuffer = createBuffer(device, "lbvhSortedPairs", WGPUBufferUsage_CopySrc | WGPUBufferUsage_Storage,
+        triangleCount * sizeof(glm::uvec2));
+    WGPUBuffer histogramsBuffer = createBuffer(device, "lbvhHistograms", WGPUBufferUsage_Storage,
+        RADIX_DIGIT_COUNT * tileCount * sizeof(std::uint32_t));
+    WGPUBuffer parentsBuffer = createBuffer(device, "lbvhParents", WGPUBufferUsage_Storage,
+        nodeCount * sizeof(std::uint32_t));
+    WGPUBuffer refitNodesBuffer = createBuffer(device, "lbvhRefitNodes", WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage,
+        triangleCount * REFIT_NODE_SIZE);
+    WGPUBuffer inversePermutationBuffer = createBuffer(device, "lbvhInversePermutation", WGPUBufferUsage_Storage,
+        triangleCount * sizeof(std::uint32_t));
+
+    // The radix sort passes only differ by the bit offset
+    std::vector<char> params(RADIX_PASS_COUNT * PARAMS_STRIDE, 0);
+    for (std::uint32_t pass = 0; pass < RADIX_PASS_COUNT; ++pass)
+    {
+        Params const passParams{triangleCount, 8 * pass, tileCount, 0};
+        std::memcpy(params.data() + pass * PARAMS_STRIDE, &passParams, sizeof(passParams));
+    }
+    wgpuQueueWriteBuffer(queue, paramsBuffer, 0, params.data(), params.size());
+
+    WGPUBindGroupEntry entries[BindingCount];
+    entries[ParamsBinding] = bufferEntry(ParamsBinding, paramsBuffer, sizeof(Params));
+    entries[VertexPositionsBinding] = bufferEntry(VertexPositionsBinding, vertexPositionsBuffer, vertexPositionsSize);
+    entries[VertexAttributesBinding] = bufferEntry(VertexAttributesBinding, vertexAttributesBuffer, vertexAttributesSize);
+    entries[StateBinding] = bufferEntry(StateBinding, stateBuffer, wgpuBufferGetSize(stateBuffer));
+    entries[PairsBinding] = bufferEntry(PairsBinding, pairsBuffer, wgpuBufferGetSize(pairsBuffer));
+    entries[SortedPairsBinding] = bufferEntry(SortedPairsBinding, sortedPairsBuffer, wgpuBufferGetSize(sortedPairsBuffer));
+    entries[HistogramsBinding] = bufferEntry(HistogramsBinding, histogramsBuffer, wgpuBufferGetSize(histogramsBuffer));
+    entries[ParentsBinding] = bufferEntry(ParentsBinding, parentsBuffer, wgpuBufferGetSize(parentsBuffer));
+    entries[RefitNodesBinding] = bufferEntry(RefitNodesBinding, refitNodesBuffer, wgpuBufferGetSize(refitNodesBuffer));
+    entries[NodesBinding] = bufferEntry(NodesBinding, result.bvhNodesBuffer, wgpuBufferGetSize(result.bvhNodesBuffer));
+    entries[SortedVertexPositionsBinding] = bufferEntry(SortedVertexPositionsBinding, result.vertexPositionsBuffer, vertexPositionsSize);
+    entries[SortedVertexAttributesBinding] = bufferEntry(SortedVertexAttributesBinding, result.vertexAttributesBuffer, vertexAttributesSize);
+    entries[InversePermutationBinding] = bufferEntry(InversePermutationBinding, inversePermutationBuffer, wgpuBufferGetSize(inversePermutationBuffer));
+    entries[EmissiveTrianglesBinding] = bufferEntry(EmissiveTrianglesBinding, emissiveTrianglesBuffer, wgpuBufferGetSize(emissiveTrianglesBuffer));
+
+    WGPUBindGroupDescriptor bindGroupDescriptor;
+    bindGroupDescriptor.nextInChain = nullptr;
+    bindGroupDescriptor.label = "lbvh";
+    bindGroupDescriptor.layout = bindGroupLayout_;
+    bindGroupDescriptor.entryCount = BindingCount;
+    bindGroupDescriptor.entries = entries;
+
+    WGPUBindGroup bindGroup = wgpuDeviceCreateBindGroup(device, &bindGroupDescriptor);
+
+    Timer timer;
+
+    WGPUCommandEncoder commandEncoder = createCommandEncoder(device);
+
+    wgpuCommandEncoderClearBuffer(commandEncoder, stateBuffer, 0, wgpuBufferGetSize(stateBuffer));
+    wgpuCommandEncoderClearBuffer(commandEncoder, refitNodesBuffer, 0, wgpuBufferGetSize(refitNodesBuffer));
+
+    WGPUComputePassDescriptor computePassDescriptor;
+    computePassDescriptor.nextInChain = nullptr;
+    computePassDescriptor.label = "lbvh";
+    computePassDescriptor.timestampWrites = nullptr;
+
+    // Every dispatch is a separate usage scope, so that
+    // storage writes are visible to the following dispatches
+    auto dispatch = [&](WGPUComputePassEncoder computePassEncoder, WGPUComputePipeline pipeline, std::uint32_t groupCount, std::uint32_t pass)
+    {
+        if (groupCount == 0)
+            return;
+
+        std::uint32_t const dynamicOffset = pass * PARAMS_STRIDE;
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, bindGroup, 1, &dynamicOffset);
+        wgpuComputePassEncoderSetPipeline(computePassEncoder, pipeline);
+        wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, groupCount, 1, 1);
+    };
+
+    {
+        WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+        dispatch(computePassEncoder, computeCentroidBoundsPipeline_, tileCount, 0);
+        dispatch(computePassEncoder, computeMortonCodesPipeline_, tileCount, 0);
+        wgpuComputePassEncoderEnd(computePassEncoder);
+        wgpuComputePassEncoderRelease(computePassEncoder);
+    }
+
+    for (std::uint32_t pass = 0; pass < RADIX_PASS_COUNT; ++pass)
+    {
+        WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+        dispatch(computePassEncoder, radixHistogramPipeline_, tileCount, pass);
+        dispatch(computePassEncoder, radixScanPipeline_, 1, pass);
+        dispatch(computePassEncoder, radixScatterPipeline_, tileCount, pass);
+        wgpuComputePassEncoderEnd(computePassEncoder);
+        wgpuComputePassEncoderRelease(computePassEncoder);
+
+        wgpuCommandEncoderCopyBufferToBuffer(commandEncoder, sortedPairsBuffer, 0, pairsBuffer, 0, triangleCount * sizeof(glm::uvec2));
+    }
+
+    {
+        WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+        dispatch(computePassEncoder, emitHierarchyPipeline_, workgroupCount(triangleCount - 1), 0);
+        dispatch(computePassEncoder, refitPipeline_, tileCount, 0);
+        dispatch(computePassEncoder, gatherTrianglesPipeline_, tileCount, 0);
+        dispatch(computePassEncoder, remapEmissiveTrianglesPipeline_, workgroupCount(emissiveTriangleCount), 0);
+        wgpuComputePassEncoderEnd(computePassEncoder);
+        wgpuComputePassEncoderRelease(computePassEncoder);
+    }
+
+    submit(queue, commandEncoder);
+    wgpuDevicePoll(device, true, nullptr);
+
+    result.buildTime = timer.duration();
+
+    auto const depth = readBuffer(device, queue, stateBuffer, STATE_MAX_DEPTH_OFFSET, sizeof(std::uint32_t));
+    std::memcpy(&result.maxDepth, depth.data(), sizeof(std::uint32_t));
+
+    auto const nodes = readBuffer(device, queue, result.bvhNodesBuffer, 0, nodeCount * sizeof(BVH::Node));
+    result.nodes.resize(nodeCount);
+    std::memcpy(result.nodes.data(), nodes.data(), nodes.size());
+
+    wgpuBindGroupRelease(bindGroup);
+    wgpuBufferRelease(inversePermutationBuffer);
+    wgpuBufferRelease(refitNodesBuffer);
+    wgpuBufferRelease(parentsBuffer);
+    wgpuBufferRelease(histogramsBuffer);
+    wgpuBufferRelease(sortedPairsBuffer);
+    wgpuBufferRelease(pairsBuffer);
+    wgpuBufferRelease(stateBuffer);
+    wgpuBufferRelease(paramsBuffer);
+
+    return result;
+}
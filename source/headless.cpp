@@ -0,0 +1,382 @@
+#include <webgpu-raytracer/headless.hpp>
+#include <webgpu-raytracer/device.hpp>
+#include <webgpu-raytracer/image_io.hpp>
+#include <webgpu-raytracer/color.hpp>
+#include <webgpu-raytracer/timer.hpp>
+#include <webgpu-raytracer/dynamic_geometry.hpp>
+#include <webgpu-raytracer/instancing.hpp>
+
+#include <wgpu.h>
+
+#include <glm/ext.hpp>
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <stdexcept>
+#include <cmath>
+
+HeadlessContext::HeadlessContext()
+{
+    WGPUInstance instance = createInstance();
+    WGPUAdapter adapter = requestAdapter(instance, nullptr);
+    device_ = requestDevice(adapter);
+    queue_ = wgpuDeviceGetQueue(device_);
+
+    wgpuAdapterRelease(adapter);
+    wgpuInstanceRelease(instance);
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    wgpuQueueRelease(queue_);
+    wgpuDeviceRelease(device_);
+}
+
+namespace
+{
+
+    WGPUTexture createTargetTexture(WGPUDevice device, WGPUTextureFormat format, glm::uvec2 const & size)
+    {
+        WGPUTextureDescriptor textureDescriptor;
+        textureDescriptor.nextInChain = nullptr;
+        textureDescriptor.label = "headless target";
+        textureDescriptor.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc;
+        textureDescriptor.dimension = WGPUTextureDimension_2D;
+        textureDescriptor.size = {size.x, size.y, 1};
+        textureDescriptor.format = format;
+        textureDescriptor.mipLevelCount = 1;
+        textureDescriptor.sampleCount = 1;
+        textureDescriptor.viewFormatCount = 0;
+        textureDescriptor.viewFormats = nullptr;
+
+        return wgpuDeviceCreateTexture(device, &textureDescriptor);
+    }
+
+    // Copy the texture into a mappable buffer and wait for the mapping
+    // to complete, returns tightly packed rows
+    std::vector<char> readTexture(WGPUDevice device, WGPUQueue queue, WGPUTexture texture, std::uint32_t bytesPerPixel)
+    {
+        std::uint32_t const width = wgpuTextureGetWidth(texture);
+        std::uint32_t const height = wgpuTextureGetHeight(texture);
+
+        std::uint32_t const rowSize = width * bytesPerPixel;
+        // Buffer rows must be aligned to 256 bytes
+        std::uint32_t const paddedRowSize = (rowSize + 255) / 256 * 256;
+
+        WGPUBufferDescriptor bufferDescriptor;
+        bufferDescriptor.nextInChain = nullptr;
+        bufferDescriptor.label = "readback";
+        bufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_MapRead;
+        bufferDescriptor.size = paddedRowSize * height;
+        bufferDescriptor.mappedAtCreation = false;
+
+        WGPUBuffer buffer = wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+
+        WGPUCommandEncoderDescriptor commandEncoderDescriptor;
+        commandEncoderDescriptor.nextInChain = nullptr;
+        commandEncoderDescriptor.label = nullptr;
+
+        WGPUCommandEncoder commandEncoder = wgpuDeviceCreateCommandEncoder(device, &commandEncoderDescriptor);
+
+        WGPUImageCopyTexture source;
+        source.nextInChain = nullptr;
+        source.texture = texture;
+        source.mipLevel = 0;
+        source.origin = {0, 0, 0};
+        source.aspect = WGPUTextureAspect_All;
+
+        WGPUImageCopyBuffer destination;
+        destination.nextInChain = nullptr;
+        destination.layout.nextInChain = nullptr;
+        destination.layout.offset = 0;
+        destination.layout.bytesPerRow = paddedRowSize;
+        destination.layout.rowsPerImage = height;
+        destination.buffer = buffer;
+
+        WGPUExtent3D copySize{width, height, 1};
+
+        wgpuCommandEncoderCopyTextureToBuffer(commandEncoder, &source, &destination, &copySize);
+
+        WGPUCommandBufferDescriptor commandBufferDescriptor;
+        commandBufferDescriptor.nextInChain = nullptr;
+        commandBufferDescriptor.label = nullptr;
+
+        WGPUCommandBuffer commandBuffer = wgpuCommandEncoderFinish(commandEncoder, &commandBufferDescriptor);
+
+        wgpuQueueSubmit(queue, 1, &commandBuffer);
+
+        wgpuCommandBufferRelease(commandBuffer);
+        wgpuCommandEncoderRelease(commandEncoder);
+
+        std::optional<WGPUBufferMapAsyncStatus> mapStatus;
+
+        auto callback = [](WGPUBufferMapAsyncStatus status, void * userData)
+        {
+            *static_cast<std::optional<WGPUBufferMapAsyncStatus> *>(userData) = status;
+        };
+
+        wgpuBufferMapAsync(buffer, WGPUMapMode_Read, 0, bufferDescriptor.size, callback, &mapStatus);
+
+        while (!mapStatus)
+            wgpuDevicePoll(device, true, nullptr);
+
+        if (*mapStatus != WGPUBufferMapAsyncStatus_Success)
+        {
+            wgpuBufferRelease(buffer);
+            throw std::runtime_error("Failed to map readback buffer: " + std::to_string(*mapStatus));
+        }
+
+        auto mappedData = static_cast<char const *>(wgpuBufferGetConstMappedRange(buffer, 0, bufferDescriptor.size));
+
+        std::vector<char> result(rowSize * height);
+        for (std::uint32_t y = 0; y < height; ++y)
+            std::memcpy(result.data() + y * rowSize, mappedData + y * paddedRowSize, rowSize);
+
+        wgpuBufferUnmap(buffer);
+        wgpuBufferRelease(buffer);
+
+        return result;
+    }
+
+    void saveOutput(HeadlessContext const & context, Renderer & renderer, HeadlessOptions const & options, WGPUTexture targetTexture)
+    {
+        auto extension = options.output.extension().string();
+        if (extension == ".exr")
+        {
+            auto pixels = readTexture(context.device(), context.queue(), renderer.accumulationTexture(), 4 * sizeof(float));
+            writeEXR(options.output, options.size.x, options.size.y, reinterpret_cast<float const *>(pixels.data()));
+        }
+        else
+        {
+            auto pixels = readTexture(context.device(), context.queue(), targetTexture, 4);
+            writePNG(options.output, options.size.x, options.size.y, reinterpret_cast<std::uint8_t const *>(pixels.data()));
+        }
+
+        std::cout << "Saved " << options.output << std::endl;
+    }
+
+    void renderHeatmap(HeadlessContext const & context, Renderer & renderer, Camera const & camera, SceneData const & sceneData, HeadlessOptions const & options,
+        WGPUTexture targetTexture)
+    {
+        renderer.setRenderMode(Renderer::Mode::TraversalHeatmap);
+
+        // The colour ramp is scaled by the stats of the previous
+        // frame, so the saved image is the second one
+        std::optional<TraversalHeatmapStats> stats;
+        for (int frame = 0; frame < 2; ++frame)
+        {
+            renderer.renderFrame(targetTexture, camera, sceneData, 1.f);
+            wgpuDevicePoll(context.device(), true, nullptr);
+
+            while (!(stats = renderer.traversalStats()))
+                wgpuDevicePoll(context.device(), true, nullptr);
+        }
+
+        std::cout << "Camera ray BVH traversal: " << stats->rayCount << " rays, visited nodes per ray: mean " << stats->meanVisitedNodes
+            << ", max " << stats->maxVisitedNodes << ", 99th percentile " << stats->p99VisitedNodes << std::endl;
+
+        saveOutput(context, renderer, options, targetTexture);
+    }
+
+    std::vector<AABB> triangleBounds(std::span<glm::vec4 const> vertexPositions)
+    {
+        std::vector<AABB> result(vertexPositions.size() / 3);
+        for (std::size_t i = 0; i < result.size(); ++i)
+            for (std::size_t k = 0; k < 3; ++k)
+                result[i].extend(glm::vec3(vertexPositions[3 * i + k]));
+        return result;
+    }
+
+}
+
+void renderHeadless(HeadlessContext const & context, Renderer & renderer, Camera const & camera, SceneData const & sceneData, HeadlessOptions const & options)
+{
+    WGPUTexture targetTexture = createTargetTexture(context.device(), context.targetFormat(), options.size);
+
+    if (options.heatmap)
+    {
+        renderHeatmap(context, renderer, camera, sceneData, options, targetTexture);
+        wgpuTextureRelease(targetTexture);
+        return;
+    }
+
+    renderer.setRenderMode(options.wavefront ? Renderer::Mode::RaytraceWavefront : Renderer::Mode::RaytraceMonteCarlo);
+
+    bool const adaptive = options.targetRelativeError > 0.f;
+    if (adaptive && options.wavefront)
+        throw std::runtime_error("Adaptive sampling is not supported by the wavefront renderer");
+
+    if (adaptive)
+    {
+        AdaptiveSamplingOptions adaptiveSamplingOptions;
+        adaptiveSamplingOptions.targetRelativeError = options.targetRelativeError;
+        renderer.setAdaptiveSampling(adaptiveSamplingOptions);
+    }
+
+    // The last frame only traces the samples left to reach the limit
+    renderer.setSampleLimit(options.sampleCount);
+
+    Timer timer;
+    std::uint32_t frameCount = 0;
+
+    while (true)
+    {
+        renderer.renderFrame(targetTexture, camera, sceneData, 1.f);
+        ++frameCount;
+
+        // Wait for the frame so that the time budget accounts for GPU time
+        wgpuDevicePoll(context.device(), true, nullptr);
+
+        if (options.sampleCount > 0 && renderer.sampleCount() >= options.sampleCount)
+            break;
+
+        if (options.timeBudget > 0.0 && timer.duration() >= options.timeBudget)
+            break;
+
+        // The stats of a map are read back right after its frame, so it stops
+        // on the first frame that has nothing left to sample
+        if (adaptive)
+            if (auto const stats = renderer.adaptiveSamplingStats(); stats && stats->activeTileCount == 0)
+                break;
+    }
+
+    double const duration = timer.duration();
+
+    // Only the unconverged tiles are sampled in adaptive frames, the sample count
+    // is then the mean over the pixels as of the last sample allocation map
+    double meanSampleCount = renderer.sampleCount();
+    auto const adaptiveStats = adaptive ? renderer.adaptiveSamplingStats() : std::nullopt;
+    if (adaptiveStats)
+        meanSampleCount = adaptiveStats->meanSampleCount;
+
+    std::cout << "Rendered " << meanSampleCount << " samples per pixel in " << duration << " seconds ("
+        << (meanSampleCount * options.size.x * options.size.y / duration / 1e6) << " M camera rays/s) over " << frameCount << " frames" << std::endl;
+
+    if (!options.wavefront)
+        std::cout << "Frame budget: " << renderer.samplesPerDispatch() << " samples per pixel per frame at the end" << std::endl;
+
+    if (adaptiveStats)
+        std::cout << "Adaptive sampling: " << adaptiveStats->activeTileCount << " of " << adaptiveStats->tileCount
+            << " tiles above the target relative error of " << options.targetRelativeError << std::endl;
+
+    {
+        // Efficiency of the estimator: lower variance or faster samples are both better
+        auto pixels = readTexture(context.device(), context.queue(), renderer.accumulationTexture(), 4 * sizeof(float));
+        double const variance = meanSampleVariance({reinterpret_cast<glm::vec4 const *>(pixels.data()), pixels.size() / sizeof(glm::vec4)});
+        std::cout << "Mean per-pixel sample variance: " << variance << ", efficiency 1 / (variance * seconds per sample): "
+            << (meanSampleCount / (variance * duration)) << std::endl;
+    }
+
+    saveOutput(context, renderer, options, targetTexture);
+
+    wgpuTextureRelease(targetTexture);
+}
+
+void renderAnimationHeadless(HeadlessContext const & context, Renderer & renderer, Camera const & camera, SceneData & sceneData,
+    SceneGeometryView const & geometry, BVHBuildOptions const & bvhOptions, HeadlessOptions const & options)
+{
+    WGPUTexture targetTexture = createTargetTexture(context.device(), context.targetFormat(), options.size);
+
+    auto const renderMode = options.wavefront ? Renderer::Mode::RaytraceWavefront : Renderer::Mode::RaytraceMonteCarlo;
+
+    bool const instanced = !geometry.instances.empty();
+
+    std::optional<DynamicGeometry> dynamicGeometry;
+    std::vector<glm::vec4> vertexPositions;
+    std::vector<SceneInstance> instances;
+
+    if (instanced)
+        instances.assign(geometry.instances.begin(), geometry.instances.end());
+    else
+    {
+        dynamicGeometry.emplace(geometry, DynamicGeometryOptions{.bvhOptions = bvhOptions});
+        vertexPositions.resize(geometry.vertexPositions.size());
+    }
+
+    BVH::Node const & root = instanced ? geometry.instanceBvhNodes[0] : geometry.bvhNodes[0];
+    glm::vec3 const sceneMin = root.aabbMin;
+    glm::vec3 const sceneExtent = glm::max(root.aabbMax - root.aabbMin, glm::vec3(1e-6f));
+
+    double updateTime = 0.0;
+    double uploadTime = 0.0;
+    double renderTime = 0.0;
+    std::uint32_t rebuildCount = 0;
+
+    for (std::uint32_t frame = 0; frame < options.animationFrameCount; ++frame)
+    {
+        float const phase = 2.f * glm::pi<float>() * (frame + 1) / options.animationFrameCount;
+
+        if (instanced)
+        {
+            for (auto & instance : instances)
+            {
+                glm::vec3 const center = instanceBounds(instance, geometry.bvhNodes).center();
+                glm::mat4 rotation = glm::translate(glm::mat4(1.f), center);
+                rotation = glm::rotate(rotation, 2.f * glm::pi<float>() / options.animationFrameCount, glm::vec3(0.f, 1.f, 0.f));
+                rotation = glm::translate(rotation, -center);
+                instance = makeSceneInstance(rotation * instanceObjectToWorld(instance), instance.bvhRoot, instance.firstTriangle, instance.triangleCount);
+            }
+
+            Timer updateTimer;
+            auto const instanceBvhNodes = buildInstanceBVH(instances, geometry.bvhNodes, bvhOptions);
+            updateTime += updateTimer.duration();
+
+            std::vector<AABB> instanceAABB;
+            for (auto const & instance : instances)
+                instanceAABB.push_back(instanceBounds(instance, geometry.bvhNodes));
+
+            if (!bvhBoundsContain(instanceBvhNodes, instanceAABB))
+                throw std::runtime_error("Instance BVH bounds don't contain every instance at animation frame " + std::to_string(frame));
+
+            Timer uploadTimer;
+            sceneData.updateInstances(context.device(), context.queue(), instances, instanceBvhNodes);
+            uploadTime += uploadTimer.duration();
+        }
+        else
+        {
+            // A wave along X moves the vertices along Y by up to 2% of the scene height
+            for (std::size_t i = 0; i < vertexPositions.size(); ++i)
+            {
+                glm::vec4 p = geometry.vertexPositions[i];
+                p.y += 0.02f * sceneExtent.y * std::sin(4.f * glm::pi<float>() * (p.x - sceneMin.x) / sceneExtent.x + phase);
+                vertexPositions[i] = p;
+            }
+
+            auto const result = dynamicGeometry->update(vertexPositions);
+            updateTime += result.duration;
+            rebuildCount += result.rebuilt ? 1 : 0;
+
+            auto const & updated = dynamicGeometry->geometry();
+            if (!bvhBoundsContain(updated.bvhNodes, triangleBounds(updated.vertexPositions)))
+                throw std::runtime_error("Refitted BVH bounds don't contain every triangle at animation frame " + std::to_string(frame));
+
+            Timer uploadTimer;
+            sceneData.updateGeometry(context.device(), context.queue(), updated, result.rebuilt);
+            uploadTime += uploadTimer.duration();
+        }
+
+        // Moved geometry invalidates the accumulated samples
+        renderer.setRenderMode(renderMode);
+
+        Timer renderTimer;
+        renderer.renderFrame(targetTexture, camera, sceneData, 1.f);
+        wgpuDevicePoll(context.device(), true, nullptr);
+        renderTime += renderTimer.duration();
+    }
+
+    double const frameCount = options.animationFrameCount;
+
+    std::cout << "Animated " << (instanced ? instances.size() : vertexPositions.size() / 3) << (instanced ? " instances" : " triangles") << " for "
+        << options.animationFrameCount << " frames, mean per frame: " << (instanced ? "instance BVH rebuild " : "BVH refit ") << (updateTime / frameCount * 1000.0)
+        << " ms, upload " << (uploadTime / frameCount * 1000.0) << " ms, render " << (renderTime / frameCount * 1000.0) << " ms";
+    if (!instanced)
+        std::cout << ", " << rebuildCount << " full rebuilds";
+    std::cout << "; updated bounds contain every " << (instanced ? "instance" : "triangle") << std::endl;
+
+    saveOutput(context, renderer, options, targetTexture);
+
+    wgpuTextureRelease(targetTexture);
+}
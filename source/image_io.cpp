@@ -0,0 +1,152 @@
+#include <webgpu-raytracer/image_io.hpp>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <fstream>
+#include <array>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+
+    struct EXRWriter
+    {
+        std::vector<char> data;
+
+        template <typename T>
+        void write(T const & value)
+        {
+            char const * bytes = reinterpret_cast<char const *>(&value);
+            data.insert(data.end(), bytes, bytes + sizeof(value));
+        }
+
+        void writeString(char const * string)
+        {
+            data.insert(data.end(), string, string + std::strlen(string) + 1);
+        }
+
+        template <typename T>
+        void writeAttribute(char const * name, char const * type, T const & value)
+        {
+            writeString(name);
+            writeString(type);
+            write<std::int32_t>(sizeof(value));
+            write(value);
+        }
+    };
+
+    // Same as AcesTonemap in tonemap.wgsl
+    float acesTonemap(float x)
+    {
+        float const A = 2.51f;
+        float const B = 0.03f;
+        float const C = 2.43f;
+        float const D = 0.59f;
+        float const E = 0.14f;
+
+        return std::clamp((x * (A * x + B)) / (x * (C * x + D) + E), 0.f, 1.f);
+    }
+
+    // The GPU applies this when writing to the sRGB render target
+    std::uint8_t linearToSRGB(float x)
+    {
+        float const c = (x <= 0.0031308f) ? 12.92f * x : 1.055f * std::pow(x, 1.f / 2.4f) - 0.055f;
+        return std::uint8_t(std::lround(std::clamp(c, 0.f, 1.f) * 255.f));
+    }
+
+}
+
+void writePNG(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, std::uint8_t const * pixels)
+{
+    if (!stbi_write_png(path.string().c_str(), width, height, 4, pixels, width * 4))
+        throw std::runtime_error("Failed to write " + path.string());
+}
+
+void writeEXR(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, float const * pixels)
+{
+    // See "The OpenEXR File Layout": a single-part scanline file
+    // with no compression, one scanline per chunk
+
+    EXRWriter writer;
+
+    writer.write<std::uint32_t>(20000630);
+    writer.write<std::uint32_t>(2);
+
+    // Channels must be sorted by name
+    char const * channelNames[] = {"B", "G", "R"};
+    int const channelOffsets[] = {2, 1, 0};
+
+    writer.writeString("channels");
+    writer.writeString("chlist");
+    writer.write<std::int32_t>(3 * (2 + 16) + 1);
+    for (auto name : channelNames)
+    {
+        writer.writeString(name);
+        // Pixel type FLOAT
+        writer.write<std::int32_t>(2);
+        // pLinear & reserved bytes
+        writer.write<std::uint32_t>(0);
+        // x & y sampling
+        writer.write<std::int32_t>(1);
+        writer.write<std::int32_t>(1);
+    }
+    writer.write<char>(0);
+
+    struct Box2i
+    {
+        std::int32_t xMin, yMin, xMax, yMax;
+    };
+
+    Box2i const window{0, 0, std::int32_t(width) - 1, std::int32_t(height) - 1};
+
+    // NO_COMPRESSION
+    writer.writeAttribute("compression", "compression", std::uint8_t(0));
+    writer.writeAttribute("dataWindow", "box2i", window);
+    writer.writeAttribute("displayWindow", "box2i", window);
+    // INCREASING_Y
+    writer.writeAttribute("lineOrder", "lineOrder", std::uint8_t(0));
+    writer.writeAttribute("pixelAspectRatio", "float", 1.f);
+    writer.writeAttribute("screenWindowCenter", "v2f", std::array{0.f, 0.f});
+    writer.writeAttribute("screenWindowWidth", "float", 1.f);
+    writer.write<char>(0);
+
+    std::uint32_t const scanlineSize = width * 3 * sizeof(float);
+    std::uint64_t const firstScanlineOffset = writer.data.size() + height * sizeof(std::uint64_t);
+
+    for (std::uint32_t y = 0; y < height; ++y)
+        writer.write<std::uint64_t>(firstScanlineOffset + y * (8 + scanlineSize));
+
+    for (std::uint32_t y = 0; y < height; ++y)
+    {
+        writer.write<std::int32_t>(y);
+        writer.write<std::int32_t>(scanlineSize);
+
+        for (int c = 0; c < 3; ++c)
+            for (std::uint32_t x = 0; x < width; ++x)
+                writer.write(pixels[4 * (x + y * width) + channelOffsets[c]]);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(writer.data.data(), writer.data.size());
+    if (!file)
+        throw std::runtime_error("Failed to write " + path.string());
+}
+
+void writeTonemappedPNG(std::filesystem::path const & path, std::uint32_t width, std::uint32_t height, float const * pixels)
+{
+    std::vector<std::uint8_t> tonemapped(std::size_t(width) * height * 4);
+    for (std::size_t i = 0; i < std::size_t(width) * height; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+            tonemapped[4 * i + c] = linearToSRGB(acesTonemap(pixels[4 * i + c]));
+        tonemapped[4 * i + 3] = 255;
+    }
+
+    writePNG(path, width, height, tonemapped.data());
+}
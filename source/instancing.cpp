@@ -0,0 +1,83 @@
+#include <webgpu-raytracer/instancing.hpp>
+
+namespace
+{
+
+    void storeRows(glm::mat4 const & matrix, glm::vec4 * rows)
+    {
+        for (int i = 0; i < 3; ++i)
+            rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+    }
+
+}
+
+SceneInstance makeSceneInstance(glm::mat4 const & objectToWorld, std::uint32_t bvhRoot, std::uint32_t firstTriangle, std::uint32_t triangleCount)
+{
+    SceneInstance result;
+    storeRows(objectToWorld, result.objectToWorld);
+    storeRows(glm::inverse(objectToWorld), result.worldToObject);
+    result.bvhRoot = bvhRoot;
+    result.firstTriangle = firstTriangle;
+    result.triangleCount = triangleCount;
+    return result;
+}
+
+glm::mat4 instanceObjectToWorld(SceneInstance const & instance)
+{
+    glm::mat4 result(1.f);
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j)
+            result[j][i] = instance.objectToWorld[i][j];
+    return result;
+}
+
+AABB instanceBounds(SceneInstance const & instance, std::span<BVH::Node const> bvhNodes)
+{
+    auto const & root = bvhNodes[instance.bvhRoot];
+    glm::mat4 const objectToWorld = instanceObjectToWorld(instance);
+
+    AABB result;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        glm::vec3 const p = glm::mix(root.aabbMin, root.aabbMax, glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+        result.extend(glm::vec3(objectToWorld * glm::vec4(p, 1.f)));
+    }
+    return result;
+}
+
+std::uint32_t appendMeshBVH(std::vector<BVH::Node> & bvhNodes, std::span<BVH::Node const> meshNodes, std::uint32_t firstTriangle)
+{
+    std::uint32_t const root = bvhNodes.size();
+
+    for (auto node : meshNodes)
+    {
+        if (node.triangleCount > 0)
+            node.leftChildOrFirstTriangle += firstTriangle;
+        else
+            node.leftChildOrFirstTriangle += root;
+
+        bvhNodes.push_back(node);
+    }
+
+    return root;
+}
+
+std::vector<BVH::Node> buildInstanceBVH(std::vector<SceneInstance> & instances, std::span<BVH::Node const> bvhNodes, BVHBuildOptions const & options)
+{
+    std::vector<AABB> instanceAABB(instances.size());
+    for (std::uint32_t i = 0; i < instances.size(); ++i)
+        instanceAABB[i] = instanceBounds(instances[i], bvhNodes);
+
+    auto instanceBvhOptions = options;
+    if (instanceBvhOptions.method == BVHBuildOptions::Method::SpatialSAH)
+        instanceBvhOptions.method = BVHBuildOptions::Method::BinnedSAH;
+
+    BVH bvh = buildBVH(instanceAABB, instanceBvhOptions);
+
+    std::vector<SceneInstance> sortedInstances;
+    for (auto instanceID : bvh.triangleIDs)
+        sortedInstances.push_back(instances[instanceID]);
+    instances = std::move(sortedInstances);
+
+    return std::move(bvh.nodes);
+}
@@ -1,6 +1,11 @@
 #include <webgpu-raytracer/application.hpp>
+#include <webgpu-raytracer/headless.hpp>
 #include <webgpu-raytracer/gltf_loader.hpp>
 #include <webgpu-raytracer/scene_data.hpp>
+#include <webgpu-raytracer/gpu_lbvh.hpp>
+#include <webgpu-raytracer/reference_renderer.hpp>
+#include <webgpu-raytracer/bvh_stats.hpp>
+#include <webgpu-raytracer/image_io.hpp>
 #include <webgpu-raytracer/camera.hpp>
 #include <webgpu-raytracer/shader_registry.hpp>
 #include <webgpu-raytracer/renderer.hpp>
@@ -11,29 +16,411 @@
 #include <sstream>
 #include <unordered_set>
 #include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <limits>
 
 static std::filesystem::path const projectRoot = PROJECT_ROOT;
 
+// Default frame budgets: responsive in the window, long dispatches in headless mode
+static double const interactiveFrameTime = 1.0 / 60.0;
+static double const headlessFrameTime = 0.1;
+
+static void printUsage(char const * program)
+{
+    std::cout << "Usage: " << program << " [ options ] input [ background ]\n";
+    std::cout << "    input        Path to a glTF (.gltf or .glb) file with the input scene\n";
+    std::cout << "    background   Background emission color in R,G,B format (black \"0,0,0\" by default)\n";
+    std::cout << "                 or path to an HDRI environment map\n";
+    std::cout << "Options:\n";
+    std::cout << "    --bvh-builder sweep|binned[:bins]|sbvh[:budget]|lbvh|gpu-lbvh\n";
+    std::cout << "                 BVH construction method: exact SAH sweep (default), binned SAH\n";
+    std::cout << "                 with an optional bin count (16 by default), binned SAH with spatial splits\n";
+    std::cout << "                 with an optional budget of duplicated triangles (0.3 of the triangle count by default),\n";
+    std::cout << "                 Morton code based linear BVH, or linear BVH rebuilt on the GPU after loading\n";
+    std::cout << "                 and checked against the CPU one (binary layout only)\n";
+    std::cout << "    --bvh-layout binary|bvh4|bvh8|bvh4q|bvh8q\n";
+    std::cout << "                 BVH node layout for GPU traversal: binary nodes (default), or the binary BVH\n";
+    std::cout << "                 collapsed into 4- or 8-wide nodes, optionally with 8-bit quantized child bounds\n";
+    std::cout << "    --bvh-order creation|dfs|treelet\n";
+    std::cout << "                 Memory order of the BVH nodes: as created by the builder (default), sibling pairs\n";
+    std::cout << "                 in depth-first order, or clustered into 256 byte treelets\n";
+    std::cout << "    --bvh-optimize passes\n";
+    std::cout << "                 Lower the SAH cost of the built BVH by at most the given number of treelet\n";
+    std::cout << "                 restructuring passes (disabled by default)\n";
+    std::cout << "    --bvh-locality\n";
+    std::cout << "                 Measure node fetch locality of all node orders on the CPU before rendering\n";
+    std::cout << "    --bvh-stats path.json\n";
+    std::cout << "                 Write BVH quality statistics and a CPU traversal probe from the camera as JSON\n";
+    std::cout << "    --instancing Store every glTF mesh once with its own BVH and trace a two-level BVH over\n";
+    std::cout << "                 the mesh instances (binary layout only, not supported by --cpu)\n";
+    std::cout << "    --bvh-threads N\n";
+    std::cout << "                 Number of threads used for BVH construction (all hardware threads by default)\n";
+    std::cout << "    --cache-dir path\n";
+    std::cout << "                 Directory for processed scene geometry cache (\"cache\" in the project root by default)\n";
+    std::cout << "    --no-cache   Don't read or write the scene geometry cache\n";
+    std::cout << "    --headless   Render without a window and save the result, requires --output\n";
+    std::cout << "    --cpu        Render with the multithreaded CPU reference path tracer instead of the GPU,\n";
+    std::cout << "                 implies --headless\n";
+    std::cout << "    --output path\n";
+    std::cout << "                 Output image for headless mode: .png (tonemapped) or .exr (raw radiance)\n";
+    std::cout << "    --size WxH   Output image size for headless mode (1024x768 by default)\n";
+    std::cout << "    --spp N      Samples per pixel for headless mode\n";
+    std::cout << "    --time S     Time budget in seconds for headless mode\n";
+    std::cout << "                 (256 samples per pixel if neither --spp, --time nor --target-error is given)\n";
+    std::cout << "    --samples-per-frame N\n";
+    std::cout << "                 Samples per pixel traced by every megakernel frame, fixed unless --frame-time is given\n";
+    std::cout << "    --frame-time MS\n";
+    std::cout << "                 Adjust the samples per frame to this GPU frame time (16.7 ms in the window and\n";
+    std::cout << "                 100 ms in headless mode by default), 0 keeps --samples-per-frame fixed\n";
+    std::cout << "    --target-error E\n";
+    std::cout << "                 Adaptive sampling: only sample the pixels whose mean luminance has a relative\n";
+    std::cout << "                 standard error above E (e.g. 0.01); headless mode stops once all pixels are below it\n";
+    std::cout << "    --heatmap    Save the BVH traversal cost heatmap of the camera rays in headless mode\n";
+    std::cout << "                 and print the mean, max and 99th percentile visited nodes per ray\n";
+    std::cout << "    --wavefront  Path trace with separate kernels per bounce over compacted ray queues\n";
+    std::cout << "                 instead of the single megakernel, both in the window and in headless mode\n";
+    std::cout << "    --animate N  Headless benchmark of dynamic geometry: deform the scene (or rotate its instances)\n";
+    std::cout << "                 for N frames, updating the BVH, uploading it and rendering one sample each,\n";
+    std::cout << "                 print the mean times and save the last frame (binary layout only)\n";
+    std::cout << "    --sort-materials\n";
+    std::cout << "                 Sort the hits of every bounce by material before shading, with --wavefront\n";
+    std::cout << "    --max-depth N\n";
+    std::cout << "                 Maximum number of bounces per path (8 by default)\n";
+    std::cout << "    --russian-roulette N|off\n";
+    std::cout << "                 Terminate paths randomly by throughput from bounce N on (3 by default)\n";
+}
+
+static void printBVHLocality(SceneGeometryView const & geometry, Camera const & camera, glm::uvec2 const & size, std::uint32_t threadCount)
+{
+    std::cout << "BVH node fetch locality per ray (visited nodes, distinct 128 byte lines, misses of a 64-line cache per 8x4 tile):" << std::endl;
+
+    auto print = [](char const * name, BVHLocalityStats::RayStats const & stats)
+    {
+        double const rayCount = std::max<std::uint64_t>(1, stats.rayCount);
+        std::cout << "    " << name << ": " << (stats.visitedNodeCount / rayCount) << " nodes, " << (stats.cacheLineCount / rayCount)
+            << " lines, " << (stats.cacheMissCount / rayCount) << " misses";
+    };
+
+    struct Variant
+    {
+        char const * name;
+        std::optional<BVHBuildOptions::NodeOrder> order;
+    };
+
+    for (auto const & variant : {Variant{"as built", std::nullopt}, Variant{"depth-first", BVHBuildOptions::NodeOrder::DepthFirst},
+        Variant{"treelet", BVHBuildOptions::NodeOrder::Treelet}})
+    {
+        std::vector<BVH::Node> nodes(geometry.bvhNodes.begin(), geometry.bvhNodes.end());
+        if (variant.order)
+            reorderBVHNodes(nodes, *variant.order);
+
+        SceneGeometryView view = geometry;
+        view.bvhNodes = nodes;
+
+        Timer timer;
+        auto const stats = measureBVHLocality(view, camera, size, threadCount);
+
+        std::cout << "  " << variant.name << std::endl;
+        print("primary", stats.primary);
+        std::cout << std::endl;
+        print("secondary", stats.secondary);
+        std::cout << " (" << timer.duration() << " seconds)" << std::endl;
+    }
+}
+
+static void writeBVHStats(std::filesystem::path const & path, std::string const & scene, SceneGeometryView const & geometry,
+    BVHBuildOptions const & bvhOptions, Camera const & camera, glm::uvec2 const & size)
+{
+    Timer timer;
+
+    BVHReport report;
+    report.scene = scene;
+    report.options = bvhOptions;
+    report.instancing = !geometry.instances.empty();
+
+    if (report.instancing)
+    {
+        report.trees.push_back({"instances", computeBVHStats(geometry.instanceBvhNodes)});
+
+        std::unordered_set<std::uint32_t> meshRoots;
+        for (auto const & instance : geometry.instances)
+            if (meshRoots.insert(instance.bvhRoot).second)
+                report.trees.push_back({"mesh " + std::to_string(meshRoots.size() - 1), computeBVHStats(geometry.bvhNodes, instance.bvhRoot)});
+    }
+    else
+    {
+        report.trees.push_back({"scene", computeBVHStats(geometry.bvhNodes)});
+
+        // The CPU traversal doesn't support instances
+        report.rays = measureBVHLocality(geometry, camera, size, bvhOptions.threadCount);
+        report.raysImageSize = size;
+    }
+
+    report.trees.push_back({"lights", computeBVHStats(geometry.emissiveBvhNodes)});
+
+    writeBVHReport(path, report);
+
+    std::cout << "Saved BVH statistics to " << path << " in " << timer.duration() << " seconds" << std::endl;
+}
+
 int main(int argc, char ** argv) try
 {
-    if ((argc != 2 && argc != 3) || (argc == 2 && (argv[1] == std::string("-h") || argv[1] == std::string("--help"))))
+    std::vector<std::string> arguments;
+    BVHBuildOptions bvhOptions;
+    BVHLayout bvhLayout = BVHLayout::Binary;
+    bool gpuBvh = false;
+    bool instancing = false;
+    bool bvhLocality = false;
+    std::filesystem::path bvhStatsPath;
+    std::filesystem::path cacheDirectory = projectRoot / "cache";
+    bool headless = false;
+    bool cpu = false;
+    bool sortMaterials = false;
+    PathTracingOptions pathTracingOptions;
+    std::optional<std::uint32_t> samplesPerFrame;
+    std::optional<double> targetFrameTime;
+    HeadlessOptions headlessOptions;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string const argument = argv[i];
+
+        auto optionValue = [&]() -> std::string
+        {
+            if (i + 1 >= argc)
+                throw std::runtime_error("Missing value for " + argument);
+            return argv[++i];
+        };
+
+        if (argument == "-h" || argument == "--help")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        else if (argument == "--bvh-builder")
+        {
+            auto const value = optionValue();
+            if (value == "sweep")
+                bvhOptions.method = BVHBuildOptions::Method::SweepSAH;
+            else if (value == "binned")
+                bvhOptions.method = BVHBuildOptions::Method::BinnedSAH;
+            else if (value.starts_with("binned:"))
+            {
+                bvhOptions.method = BVHBuildOptions::Method::BinnedSAH;
+                bvhOptions.binCount = std::stoul(value.substr(7));
+            }
+            else if (value == "sbvh")
+                bvhOptions.method = BVHBuildOptions::Method::SpatialSAH;
+            else if (value.starts_with("sbvh:"))
+            {
+                bvhOptions.method = BVHBuildOptions::Method::SpatialSAH;
+                bvhOptions.spatialSplitBudget = std::stof(value.substr(5));
+            }
+            else if (value == "lbvh")
+                bvhOptions.method = BVHBuildOptions::Method::LBVH;
+            else if (value == "gpu-lbvh")
+            {
+                // The CPU LBVH is still built for the scene cache and the
+                // reference renderer; the GPU one is validated separately
+                bvhOptions.method = BVHBuildOptions::Method::LBVH;
+                gpuBvh = true;
+            }
+            else
+                throw std::runtime_error("Unknown BVH builder \"" + value + "\"");
+        }
+        else if (argument == "--bvh-layout")
+        {
+            auto const value = optionValue();
+            if (value == "binary")
+                bvhLayout = BVHLayout::Binary;
+            else if (value == "bvh4")
+                bvhLayout = BVHLayout::Wide4;
+            else if (value == "bvh8")
+                bvhLayout = BVHLayout::Wide8;
+            else if (value == "bvh4q")
+                bvhLayout = BVHLayout::Wide4Quantized;
+            else if (value == "bvh8q")
+                bvhLayout = BVHLayout::Wide8Quantized;
+            else
+                throw std::runtime_error("Unknown BVH layout \"" + value + "\"");
+        }
+        else if (argument == "--bvh-order")
+        {
+            auto const value = optionValue();
+            if (value == "creation")
+                bvhOptions.nodeOrder = BVHBuildOptions::NodeOrder::Creation;
+            else if (value == "dfs")
+                bvhOptions.nodeOrder = BVHBuildOptions::NodeOrder::DepthFirst;
+            else if (value == "treelet")
+                bvhOptions.nodeOrder = BVHBuildOptions::NodeOrder::Treelet;
+            else
+                throw std::runtime_error("Unknown BVH node order \"" + value + "\"");
+        }
+        else if (argument == "--bvh-optimize")
+            bvhOptions.optimizationPassCount = std::stoul(optionValue());
+        else if (argument == "--bvh-locality")
+            bvhLocality = true;
+        else if (argument == "--bvh-stats")
+            bvhStatsPath = optionValue();
+        else if (argument == "--instancing")
+            instancing = true;
+        else if (argument == "--bvh-threads")
+            bvhOptions.threadCount = std::stoul(optionValue());
+        else if (argument == "--cache-dir")
+            cacheDirectory = optionValue();
+        else if (argument == "--no-cache")
+            cacheDirectory.clear();
+        else if (argument == "--headless")
+            headless = true;
+        else if (argument == "--cpu")
+            headless = cpu = true;
+        else if (argument == "--output")
+            headlessOptions.output = optionValue();
+        else if (argument == "--size")
+        {
+            auto const value = optionValue();
+            auto const separator = value.find('x');
+            if (separator == std::string::npos)
+                throw std::runtime_error("Invalid size \"" + value + "\", expected WxH");
+            headlessOptions.size.x = std::stoul(value.substr(0, separator));
+            headlessOptions.size.y = std::stoul(value.substr(separator + 1));
+        }
+        else if (argument == "--spp")
+            headlessOptions.sampleCount = std::stoul(optionValue());
+        else if (argument == "--time")
+            headlessOptions.timeBudget = std::stod(optionValue());
+        else if (argument == "--samples-per-frame")
+        {
+            samplesPerFrame = std::stoul(optionValue());
+            if (*samplesPerFrame == 0)
+                throw std::runtime_error("--samples-per-frame must be at least 1");
+        }
+        else if (argument == "--frame-time")
+            targetFrameTime = std::stod(optionValue()) / 1000.0;
+        else if (argument == "--target-error")
+        {
+            headlessOptions.targetRelativeError = std::stof(optionValue());
+            if (!(headlessOptions.targetRelativeError > 0.f))
+                throw std::runtime_error("--target-error must be positive");
+        }
+        else if (argument == "--heatmap")
+            headlessOptions.heatmap = true;
+        else if (argument == "--wavefront")
+            headlessOptions.wavefront = true;
+        else if (argument == "--animate")
+        {
+            headlessOptions.animationFrameCount = std::stoul(optionValue());
+            if (headlessOptions.animationFrameCount == 0)
+                throw std::runtime_error("--animate must be at least 1");
+        }
+        else if (argument == "--sort-materials")
+            sortMaterials = true;
+        else if (argument == "--max-depth")
+        {
+            pathTracingOptions.maxDepth = std::stoul(optionValue());
+            if (pathTracingOptions.maxDepth == 0)
+                throw std::runtime_error("--max-depth must be at least 1");
+        }
+        else if (argument == "--russian-roulette")
+        {
+            auto const value = optionValue();
+            if (value == "off")
+                pathTracingOptions.russianRouletteDepth = std::numeric_limits<std::uint32_t>::max();
+            else
+                pathTracingOptions.russianRouletteDepth = std::stoul(value);
+        }
+        else if (argument.starts_with("--"))
+            throw std::runtime_error("Unknown option " + argument);
+        else
+            arguments.push_back(argument);
+    }
+
+    if (arguments.size() != 1 && arguments.size() != 2)
     {
-        std::cout << "Usage: " << argv[0] << " input [ background ]\n";
-        std::cout << "    input        Path to a glTF file with the input scene\n";
-        std::cout << "    background   Background emission color in R,G,B format (black \"0,0,0\" by default)\n";
-        std::cout << "                 or path to an HDRI environment map\n";
+        printUsage(argv[0]);
         return 0;
     }
 
-    Application application;
-    ShaderRegistry shaderRegistry(projectRoot / "shaders", application.device());
-    Renderer renderer(application.device(), application.queue(), application.surfaceFormat(), shaderRegistry);
+    // Ignoring it would silently fall back to a fixed sample count
+    if (headless && headlessOptions.targetRelativeError > 0.f && (cpu || headlessOptions.wavefront || headlessOptions.animationFrameCount > 0))
+        throw std::runtime_error("--target-error is only supported by the GPU megakernel renderer, not with --cpu, --wavefront or --animate");
+
+    if (headlessOptions.animationFrameCount > 0)
+    {
+        if (!headless || cpu)
+            throw std::runtime_error("--animate requires --headless and the GPU renderer");
+        if (gpuBvh)
+            throw std::runtime_error("--animate doesn't support the GPU LBVH builder");
+        if (headlessOptions.heatmap)
+        {
+            std::cout << "Warning: --heatmap doesn't apply to --animate, ignoring it\n";
+            headlessOptions.heatmap = false;
+        }
+    }
+
+    if (headless)
+    {
+        auto const extension = headlessOptions.output.extension();
+        if (extension != ".png" && extension != ".exr")
+            throw std::runtime_error("Headless mode requires --output with a .png or .exr extension");
+
+        if (headlessOptions.size.x == 0 || headlessOptions.size.y == 0)
+            throw std::runtime_error("Invalid output size");
+
+        if (headlessOptions.sampleCount == 0 && headlessOptions.timeBudget <= 0.0 && headlessOptions.targetRelativeError <= 0.f)
+            headlessOptions.sampleCount = 256;
+    }
+
+    std::optional<Application> application;
+    std::optional<HeadlessContext> headlessContext;
+    std::optional<ShaderRegistry> shaderRegistry;
+    std::optional<Renderer> renderer;
+
+    WGPUDevice device = nullptr;
+    WGPUQueue queue = nullptr;
 
-    auto assetPath = std::filesystem::path(argv[1]);
+    // The CPU renderer doesn't need a device at all
+    if (!cpu)
+    {
+        WGPUTextureFormat targetFormat;
+
+        if (headless)
+        {
+            headlessContext.emplace();
+            device = headlessContext->device();
+            queue = headlessContext->queue();
+            targetFormat = headlessContext->targetFormat();
+        }
+        else
+        {
+            application.emplace();
+            device = application->device();
+            queue = application->queue();
+            targetFormat = application->surfaceFormat();
+        }
+
+        shaderRegistry.emplace(projectRoot / "shaders", device);
+        renderer.emplace(device, queue, targetFormat, *shaderRegistry);
+        renderer->setWavefrontMaterialSorting(sortMaterials);
+        renderer->setPathTracingOptions(pathTracingOptions);
+
+        FrameBudgetOptions frameBudgetOptions;
+        frameBudgetOptions.samplesPerDispatch = samplesPerFrame.value_or(1);
+        frameBudgetOptions.targetFrameTime = targetFrameTime.value_or(samplesPerFrame ? 0.0 : (headless ? headlessFrameTime : interactiveFrameTime));
+        renderer->setFrameBudget(frameBudgetOptions);
+
+        // Headless rendering enables it itself, together with the stopping criterion
+        if (!headless && headlessOptions.targetRelativeError > 0.f)
+            renderer->setAdaptiveSampling({.targetRelativeError = headlessOptions.targetRelativeError});
+    }
+
+    auto assetPath = std::filesystem::path(arguments[0]);
     glTF::Asset asset;
     {
         Timer timer;
-        asset = glTF::load(assetPath);
+        asset = glTF::load(assetPath, !cacheDirectory.empty());
         std::cout << "Loaded asset " << assetPath << " in " << timer.duration() << " seconds" << std::endl;
     }
 
@@ -44,14 +431,16 @@ int main(int argc, char ** argv) try
         .pixels = {0.f, 0.f, 0.f, 0.f},
     };
 
-    if (argc >= 3)
+    if (arguments.size() >= 2)
     {
-        if (std::filesystem::exists(argv[2]))
+        auto const & background = arguments[1];
+
+        if (std::filesystem::exists(background))
         {
             // Try to parse an HDRI
             Timer timer;
             int width, height, channels;
-            auto pixels = stbi_loadf(argv[2], &width, &height, &channels, 4);
+            auto pixels = stbi_loadf(background.c_str(), &width, &height, &channels, 4);
             if (pixels)
             {
                 environmentMap.width = width;
@@ -59,18 +448,18 @@ int main(int argc, char ** argv) try
                 environmentMap.pixels.resize(width * height * 4);
                 std::copy(pixels, pixels + width * height * 4, environmentMap.pixels.data());
                 stbi_image_free(pixels);
-                std::cout << "Loaded HDRI from " << argv[2] << " in " << timer.duration() << " seconds, max intensity: " << *std::max_element(environmentMap.pixels.begin(), environmentMap.pixels.end()) << ")" << std::endl;
+                std::cout << "Loaded HDRI from " << background << " in " << timer.duration() << " seconds, max intensity: " << *std::max_element(environmentMap.pixels.begin(), environmentMap.pixels.end()) << ")" << std::endl;
             }
             else
             {
-                std::cout << "Failed to load HDRI from " << argv[2] << std::endl;
+                std::cout << "Failed to load HDRI from " << background << std::endl;
             }
         }
         else
         {
             // Try to parse R,G,B background color
 
-            std::istringstream is(argv[2]);
+            std::istringstream is(background);
             is >> environmentMap.pixels[0];
             is.get();
             is >> environmentMap.pixels[1];
@@ -78,7 +467,7 @@ int main(int argc, char ** argv) try
             is >> environmentMap.pixels[2];
             if (!is)
             {
-                std::cout << "Failed to parse background color \"" << argv[2] << "\"" << std::endl;
+                std::cout << "Failed to parse background color \"" << background << "\"" << std::endl;
                 environmentMap.pixels = {0.f, 0.f, 0.f, 0.f};
             }
         }
@@ -92,13 +481,89 @@ int main(int argc, char ** argv) try
     Camera camera;
     if (!cameraNodes.empty())
         camera = Camera(asset, asset.nodes[cameraNodes.front()]);
-    camera.setAspectRatio(application.width() * 1.f / application.height());
+
+    if (headless)
+        camera.setAspectRatio(headlessOptions.size.x * 1.f / headlessOptions.size.y);
+    else
+        camera.setAspectRatio(application->width() * 1.f / application->height());
+
+    if (cpu && headlessOptions.heatmap)
+    {
+        std::cout << "Warning: the CPU renderer doesn't support the traversal heatmap, use --bvh-stats instead\n";
+        headlessOptions.heatmap = false;
+    }
+
+    if (sortMaterials && !headlessOptions.wavefront)
+        std::cout << "Warning: --sort-materials only applies to the wavefront renderer, enable it with --wavefront\n";
+
+    if (cpu && headlessOptions.wavefront)
+    {
+        std::cout << "Warning: --wavefront only applies to the GPU renderer, ignoring it\n";
+        headlessOptions.wavefront = false;
+    }
+
+    if (cpu && instancing)
+    {
+        std::cout << "Warning: the CPU renderer doesn't support instancing, flattening the scene\n";
+        instancing = false;
+    }
+
+    if (headlessOptions.animationFrameCount > 0 && bvhLayout != BVHLayout::Binary)
+        throw std::runtime_error("--animate requires --bvh-layout binary");
+
+    PreparedScene preparedScene(asset, std::move(environmentMap), bvhOptions, cacheDirectory, instancing);
+
+    if (bvhLocality && instancing)
+        std::cout << "Warning: BVH locality can only be measured for scenes without instances\n";
+    else if (bvhLocality)
+        printBVHLocality(preparedScene.geometry(), camera, headless ? headlessOptions.size : glm::uvec2(application->width(), application->height()),
+            bvhOptions.threadCount);
+
+    if (!bvhStatsPath.empty())
+        writeBVHStats(bvhStatsPath, arguments[0], preparedScene.geometry(), bvhOptions, camera,
+            headless ? headlessOptions.size : glm::uvec2(application->width(), application->height()));
+
+    if (cpu)
+    {
+        auto pixels = renderReference(preparedScene, camera, {
+            .size = headlessOptions.size,
+            .sampleCount = headlessOptions.sampleCount,
+            .timeBudget = headlessOptions.timeBudget,
+            .pathTracing = pathTracingOptions,
+        });
+
+        if (headlessOptions.output.extension() == ".exr")
+            writeEXR(headlessOptions.output, headlessOptions.size.x, headlessOptions.size.y, &pixels[0].x);
+        else
+            writeTonemappedPNG(headlessOptions.output, headlessOptions.size.x, headlessOptions.size.y, &pixels[0].x);
+
+        std::cout << "Saved " << headlessOptions.output << std::endl;
+        return 0;
+    }
 
     Timer sceneDataTimer;
-    SceneData sceneData(asset, environmentMap, application.device(), application.queue(),
-        renderer.geometryBindGroupLayout(), renderer.materialBindGroupLayout());
+    SceneData sceneData(preparedScene, device, queue, renderer->geometryBindGroupLayout(), renderer->materialBindGroupLayout(),
+        bvhLayout);
     std::cout << "Loaded scene to GPU in " << sceneDataTimer.duration() << " seconds" << std::endl;
 
+    if (gpuBvh)
+    {
+        GpuLBVHBuilder builder(device, *shaderRegistry);
+        sceneData.rebuildBVH(device, queue, builder, preparedScene.geometry());
+    }
+
+    if (headless && headlessOptions.animationFrameCount > 0)
+    {
+        renderAnimationHeadless(*headlessContext, *renderer, camera, sceneData, preparedScene.geometry(), bvhOptions, headlessOptions);
+        return 0;
+    }
+
+    if (headless)
+    {
+        renderHeadless(*headlessContext, *renderer, camera, sceneData, headlessOptions);
+        return 0;
+    }
+
     std::unordered_set<SDL_Scancode> keysDown;
 
     int frameId = 0;
@@ -106,6 +571,8 @@ int main(int argc, char ** argv) try
 
     float exposure = 1.f;
 
+    double lastHeatmapReportTime = 0.0;
+
     bool leftMouseButtonDown = false;
 
     auto lastFrameStart = std::chrono::high_resolution_clock::now();
@@ -115,7 +582,7 @@ int main(int argc, char ** argv) try
         bool cameraMoved = false;
         bool screenResized = false;
 
-        while (auto event = application.poll()) switch (event->type)
+        while (auto event = application->poll()) switch (event->type)
         {
         case SDL_QUIT:
             running = false;
@@ -124,7 +591,7 @@ int main(int argc, char ** argv) try
             switch (event->window.event)
             {
             case SDL_WINDOWEVENT_RESIZED:
-                application.resize(event->window.data1, event->window.data2, false);
+                application->resize(event->window.data1, event->window.data2, false);
                 screenResized = true;
                 break;
             }
@@ -133,20 +600,20 @@ int main(int argc, char ** argv) try
             if (event->button.button == SDL_BUTTON_LEFT)
             {
                 leftMouseButtonDown = true;
-                application.setMouseHidden(true);
+                application->setMouseHidden(true);
             }
             break;
         case SDL_MOUSEBUTTONUP:
             if (event->button.button == SDL_BUTTON_LEFT)
             {
                 leftMouseButtonDown = false;
-                application.setMouseHidden(false);
+                application->setMouseHidden(false);
             }
             break;
         case SDL_MOUSEMOTION:
             if (leftMouseButtonDown)
             {
-                float speed = 2.f / application.height();
+                float speed = 2.f / application->height();
                 camera.rotateX(event->motion.xrel * speed);
                 camera.rotateY(event->motion.yrel * speed);
                 cameraMoved = true;
@@ -155,21 +622,23 @@ int main(int argc, char ** argv) try
         case SDL_KEYDOWN:
             keysDown.insert(event->key.keysym.scancode);
             if (event->key.keysym.scancode == SDL_SCANCODE_SPACE)
-                renderer.setRenderMode(Renderer::Mode::RaytraceMonteCarlo);
+                renderer->setRenderMode(headlessOptions.wavefront ? Renderer::Mode::RaytraceWavefront : Renderer::Mode::RaytraceMonteCarlo);
+            if (event->key.keysym.scancode == SDL_SCANCODE_H)
+                renderer->setRenderMode(renderer->renderMode() == Renderer::Mode::TraversalHeatmap ? Renderer::Mode::Preview : Renderer::Mode::TraversalHeatmap);
             break;
         case SDL_KEYUP:
             keysDown.erase(event->key.keysym.scancode);
             break;
         }
 
-        auto surfaceTexture = application.nextSwapchainTexture();
+        auto surfaceTexture = application->nextSwapchainTexture();
         if (!surfaceTexture)
         {
             ++frameId;
             continue;
         }
 
-        camera.setAspectRatio(application.width() * 1.f / application.height());
+        camera.setAspectRatio(application->width() * 1.f / application->height());
 
         auto thisFrameStart = std::chrono::high_resolution_clock::now();
         float const dt = std::chrono::duration_cast<std::chrono::duration<float>>(thisFrameStart - lastFrameStart).count();
@@ -244,11 +713,20 @@ int main(int argc, char ** argv) try
             }
         }
 
-        if (cameraMoved || screenResized)
-            renderer.setRenderMode(Renderer::Mode::Preview);
+        // The heatmap is recomputed every frame, so it follows the camera
+        if ((cameraMoved || screenResized) && renderer->renderMode() != Renderer::Mode::TraversalHeatmap)
+            renderer->setRenderMode(Renderer::Mode::Preview);
+
+        if (renderer->renderMode() == Renderer::Mode::TraversalHeatmap && time >= lastHeatmapReportTime + 1.0)
+        {
+            if (auto stats = renderer->traversalStats())
+                std::cout << "Visited nodes per camera ray: mean " << stats->meanVisitedNodes << ", max " << stats->maxVisitedNodes
+                    << ", 99th percentile " << stats->p99VisitedNodes << std::endl;
+            lastHeatmapReportTime = time;
+        }
 
-        renderer.renderFrame(surfaceTexture, camera, sceneData, exposure);
-        application.present();
+        renderer->renderFrame(surfaceTexture, camera, sceneData, exposure);
+        application->present();
 
         wgpuTextureRelease(surfaceTexture);
 
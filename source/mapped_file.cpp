@@ -0,0 +1,156 @@
+#include <webgpu-raytracer/mapped_file.hpp>
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(std::filesystem::path const & path)
+{
+    fileHandle_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle_ == INVALID_HANDLE_VALUE)
+    {
+        fileHandle_ = nullptr;
+        throw std::runtime_error("Failed to open " + path.string());
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle_, &fileSize))
+    {
+        reset();
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+
+    size_ = fileSize.QuadPart;
+
+    // Empty files can't be mapped
+    if (size_ == 0)
+        return;
+
+    mappingHandle_ = CreateFileMappingW(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle_)
+    {
+        reset();
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+
+    data_ = static_cast<char const *>(MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_)
+    {
+        reset();
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+}
+
+void MappedFile::reset()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mappingHandle_)
+        CloseHandle(mappingHandle_);
+    if (fileHandle_)
+        CloseHandle(fileHandle_);
+
+    data_ = nullptr;
+    size_ = 0;
+    mappingHandle_ = nullptr;
+    fileHandle_ = nullptr;
+}
+
+MappedFile::MappedFile(MappedFile && other)
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+    , fileHandle_(std::exchange(other.fileHandle_, nullptr))
+    , mappingHandle_(std::exchange(other.mappingHandle_, nullptr))
+{}
+
+MappedFile & MappedFile::operator = (MappedFile && other)
+{
+    if (this != &other)
+    {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        fileHandle_ = std::exchange(other.fileHandle_, nullptr);
+        mappingHandle_ = std::exchange(other.mappingHandle_, nullptr);
+    }
+    return *this;
+}
+
+#else
+
+MappedFile::MappedFile(std::filesystem::path const & path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+
+    size_ = fileStat.st_size;
+
+    // Empty files can't be mapped
+    if (size_ > 0)
+    {
+        void * data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            size_ = 0;
+            throw std::runtime_error("Failed to map " + path.string());
+        }
+
+        data_ = static_cast<char const *>(data);
+    }
+
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+}
+
+void MappedFile::reset()
+{
+    if (data_)
+        munmap(const_cast<char *>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+}
+
+MappedFile::MappedFile(MappedFile && other)
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+{}
+
+MappedFile & MappedFile::operator = (MappedFile && other)
+{
+    if (this != &other)
+    {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    reset();
+}
@@ -2,7 +2,7 @@
 
 WGPUBindGroupLayout createMaterialBindGroupLayout(WGPUDevice device)
 {
-    WGPUBindGroupLayoutEntry layoutEntries[6];
+    WGPUBindGroupLayoutEntry layoutEntries[7];
 
     layoutEntries[0].nextInChain = nullptr;
     layoutEntries[0].binding = 0;
@@ -112,19 +112,37 @@ WGPUBindGroupLayout createMaterialBindGroupLayout(WGPUDevice device)
     layoutEntries[5].storageTexture.format = WGPUTextureFormat_Undefined;
     layoutEntries[5].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
 
+    layoutEntries[6].nextInChain = nullptr;
+    layoutEntries[6].binding = 6;
+    layoutEntries[6].visibility = WGPUShaderStage_Compute;
+    layoutEntries[6].buffer.nextInChain = nullptr;
+    layoutEntries[6].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+    layoutEntries[6].buffer.hasDynamicOffset = false;
+    layoutEntries[6].buffer.minBindingSize = 0;
+    layoutEntries[6].sampler.nextInChain = nullptr;
+    layoutEntries[6].sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntries[6].texture.nextInChain = nullptr;
+    layoutEntries[6].texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntries[6].texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntries[6].texture.multisampled = false;
+    layoutEntries[6].storageTexture.nextInChain = nullptr;
+    layoutEntries[6].storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntries[6].storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntries[6].storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
     WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
     bindGroupLayoutDescriptor.nextInChain = nullptr;
     bindGroupLayoutDescriptor.label = "materials";
-    bindGroupLayoutDescriptor.entryCount = 6;
+    bindGroupLayoutDescriptor.entryCount = 7;
     bindGroupLayoutDescriptor.entries = layoutEntries;
 
     return wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
 }
 
 WGPUBindGroup createMaterialBindGroup(WGPUDevice device, WGPUBindGroupLayout bindGroupLayout, WGPUBuffer materialBuffer, WGPUSampler textureSampler,
-    WGPUTextureView albedoTexture, WGPUTextureView materialTexture, WGPUTextureView normalTexture, WGPUTextureView environmentTexture)
+    WGPUTextureView albedoTexture, WGPUTextureView materialTexture, WGPUTextureView normalTexture, WGPUTextureView environmentTexture, WGPUBuffer environmentAliasBuffer)
 {
-    WGPUBindGroupEntry entries[6];
+    WGPUBindGroupEntry entries[7];
 
     entries[0].nextInChain = nullptr;
     entries[0].binding = 0;
@@ -174,11 +192,19 @@ WGPUBindGroup createMaterialBindGroup(WGPUDevice device, WGPUBindGroupLayout bin
     entries[5].sampler = nullptr;
     entries[5].textureView = normalTexture;
 
+    entries[6].nextInChain = nullptr;
+    entries[6].binding = 6;
+    entries[6].buffer = environmentAliasBuffer;
+    entries[6].offset = 0;
+    entries[6].size = wgpuBufferGetSize(environmentAliasBuffer);
+    entries[6].sampler = nullptr;
+    entries[6].textureView = nullptr;
+
     WGPUBindGroupDescriptor bindGroupDescriptor;
     bindGroupDescriptor.nextInChain = nullptr;
     bindGroupDescriptor.label = "materials";
     bindGroupDescriptor.layout = bindGroupLayout;
-    bindGroupDescriptor.entryCount = 6;
+    bindGroupDescriptor.entryCount = 7;
     bindGroupDescriptor.entries = entries;
 
     return wgpuDeviceCreateBindGroup(device, &bindGroupDescriptor);
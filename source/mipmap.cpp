@@ -0,0 +1,148 @@
+#include <webgpu-raytracer/mipmap.hpp>
+
+#include <array>
+#include <cmath>
+#include <bit>
+
+namespace
+{
+
+    std::array<float, 256> const srgbToLinearTable = []{
+        std::array<float, 256> result;
+        for (int i = 0; i < 256; ++i)
+        {
+            float const c = i / 255.f;
+            result[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return result;
+    }();
+
+    constexpr std::size_t LINEAR_TO_SRGB_TABLE_SIZE = 4096;
+
+    std::array<std::uint8_t, LINEAR_TO_SRGB_TABLE_SIZE> const linearToSrgbTable = []{
+        std::array<std::uint8_t, LINEAR_TO_SRGB_TABLE_SIZE> result;
+        for (std::size_t i = 0; i < LINEAR_TO_SRGB_TABLE_SIZE; ++i)
+        {
+            float const c = i / float(LINEAR_TO_SRGB_TABLE_SIZE - 1);
+            float const s = (c <= 0.0031308f) ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+            result[i] = std::lround(s * 255.f);
+        }
+        return result;
+    }();
+
+    glm::vec4 decodeTexel(std::uint32_t texel, TextureEncoding encoding)
+    {
+        glm::vec4 result;
+        for (int c = 0; c < 4; ++c)
+            result[c] = ((texel >> (8 * c)) & 0xffu) / 255.f;
+
+        switch (encoding)
+        {
+        case TextureEncoding::Linear:
+            break;
+        case TextureEncoding::SRGB:
+            for (int c = 0; c < 3; ++c)
+                result[c] = srgbToLinearTable[(texel >> (8 * c)) & 0xffu];
+            break;
+        case TextureEncoding::Normal:
+            for (int c = 0; c < 3; ++c)
+                result[c] = result[c] * 2.f - 1.f;
+            break;
+        }
+
+        return result;
+    }
+
+    std::uint32_t encodeTexel(glm::vec4 value, TextureEncoding encoding)
+    {
+        std::uint32_t result = 0;
+
+        auto packChannel = [&](int c, float v)
+        {
+            result |= std::uint32_t(std::lround(glm::clamp(v, 0.f, 1.f) * 255.f)) << (8 * c);
+        };
+
+        switch (encoding)
+        {
+        case TextureEncoding::Linear:
+            for (int c = 0; c < 3; ++c)
+                packChannel(c, value[c]);
+            break;
+        case TextureEncoding::SRGB:
+            for (int c = 0; c < 3; ++c)
+                result |= std::uint32_t(linearToSrgbTable[std::lround(glm::clamp(value[c], 0.f, 1.f) * (LINEAR_TO_SRGB_TABLE_SIZE - 1))]) << (8 * c);
+            break;
+        case TextureEncoding::Normal:
+            {
+                glm::vec3 normal(value[0], value[1], value[2]);
+                float const length = glm::length(normal);
+                if (length > 0.f)
+                    for (int c = 0; c < 3; ++c)
+                        packChannel(c, 0.5f + 0.5f * normal[c] / length);
+                else
+                    result = 0x007f7fffu;
+            }
+            break;
+        }
+
+        packChannel(3, value[3]);
+
+        return result;
+    }
+
+}
+
+std::uint32_t mipLevelCount(glm::uvec2 const & size)
+{
+    return std::bit_width(std::max(1u, std::min(size.x, size.y)));
+}
+
+std::vector<MipLevel> generateMipmaps(ThreadPool & pool, std::uint32_t width, std::uint32_t height, std::uint32_t const * pixels, TextureEncoding encoding)
+{
+    std::uint32_t const levelCount = mipLevelCount({width, height});
+
+    std::vector<MipLevel> result;
+    result.reserve(levelCount);
+
+    std::uint32_t sourceWidth = width;
+    std::uint32_t sourceHeight = height;
+    std::uint32_t const * sourcePixels = pixels;
+
+    for (std::uint32_t level = 1; level < levelCount; ++level)
+    {
+        auto & mip = result.emplace_back();
+        mip.width = width >> level;
+        mip.height = height >> level;
+        mip.pixels.resize(mip.width * mip.height);
+
+        // Each target texel averages the source texels its footprint
+        // touches, i.e. 2x2 texels for even sizes and up to 3x3 otherwise
+        parallelFor(pool, mip.height, std::max<std::size_t>(1, 16384 / mip.width), [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t y = begin; y < end; ++y)
+            {
+                std::uint32_t const y0 = (y * sourceHeight) / mip.height;
+                std::uint32_t const y1 = ((y + 1) * sourceHeight + mip.height - 1) / mip.height;
+
+                for (std::uint32_t x = 0; x < mip.width; ++x)
+                {
+                    std::uint32_t const x0 = (x * sourceWidth) / mip.width;
+                    std::uint32_t const x1 = ((x + 1) * sourceWidth + mip.width - 1) / mip.width;
+
+                    glm::vec4 sum(0.f);
+                    for (std::uint32_t sy = y0; sy < y1; ++sy)
+                        for (std::uint32_t sx = x0; sx < x1; ++sx)
+                            sum += decodeTexel(sourcePixels[sx + sy * sourceWidth], encoding);
+
+                    mip.pixels[x + y * mip.width] = encodeTexel(sum / float((x1 - x0) * (y1 - y0)), encoding);
+                }
+            }
+        });
+
+        sourceWidth = mip.width;
+        sourceHeight = mip.height;
+        sourcePixels = mip.pixels.data();
+    }
+
+    return result;
+}
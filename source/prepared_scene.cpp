@@ -0,0 +1,889 @@
+#include <webgpu-raytracer/prepared_scene.hpp>
+#include <webgpu-raytracer/instancing.hpp>
+#include <webgpu-raytracer/gltf_iterator.hpp>
+#include <webgpu-raytracer/color.hpp>
+#include <webgpu-raytracer/thread_pool.hpp>
+#include <webgpu-raytracer/timer.hpp>
+#include <mikktspace.h>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <iostream>
+#include <optional>
+#include <unordered_map>
+
+namespace
+{
+
+    struct Vertex
+    {
+        glm::vec3 position;
+        std::uint32_t padding = 0;
+        VertexAttributes attributes;
+    };
+
+    void readIndices(glTF::Asset const & asset, glTF::Accessor const & indexAccessor, std::vector<std::uint32_t> & indices, std::uint32_t baseVertex)
+    {
+        switch (indexAccessor.componentType)
+        {
+        case glTF::Accessor::ComponentType::UnsignedByte:
+            for (auto index : glTF::AccessorRange<std::uint8_t>(asset, indexAccessor))
+                indices.push_back(baseVertex + index);
+            break;
+        case glTF::Accessor::ComponentType::UnsignedShort:
+            for (auto index : glTF::AccessorRange<std::uint16_t>(asset, indexAccessor))
+                indices.push_back(baseVertex + index);
+            break;
+        case glTF::Accessor::ComponentType::UnsignedInt:
+            for (auto index : glTF::AccessorRange<std::uint32_t>(asset, indexAccessor))
+                indices.push_back(baseVertex + index);
+            break;
+        default:
+            std::cout << "Warning: unsupported index component type: " << (int)indexAccessor.componentType << "\n";
+            break;
+        }
+    }
+
+    void fillIndices(glTF::Accessor const & positionAccessor, std::vector<std::uint32_t> & indices, std::uint32_t baseVertex)
+    {
+        for (std::uint32_t index = 0; index < positionAccessor.count; ++index)
+            indices.push_back(baseVertex + index);
+    }
+
+    void readPositions(glTF::Asset const & asset, glTF::Accessor const & positionAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    {
+        auto vertexIt = vertices.begin() + baseVertex;
+
+        switch (positionAccessor.componentType)
+        {
+        case glTF::Accessor::ComponentType::Float:
+            for (auto position : glTF::AccessorRange<glm::vec3>(asset, positionAccessor))
+            {
+                vertexIt->position = position;
+                ++vertexIt;
+            }
+            break;
+        default:
+            std::cout << "Warning: unsupported position component type: " << (int)positionAccessor.componentType << "\n";
+
+            // Prevent uninitialized data
+            for (std::uint32_t i = 0; i < positionAccessor.count; ++i)
+            {
+                vertexIt->position = glm::vec3(0.f);
+                ++vertexIt;
+            }
+            break;
+        }
+    }
+
+    void readNormals(glTF::Asset const & asset, glTF::Accessor const & normalAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    {
+        auto vertexIt = vertices.begin() + baseVertex;
+
+        switch (normalAccessor.componentType)
+        {
+        case glTF::Accessor::ComponentType::Float:
+            for (auto normal : glTF::AccessorRange<glm::vec3>(asset, normalAccessor))
+            {
+                vertexIt->attributes.normal = normal;
+                ++vertexIt;
+            }
+            break;
+        default:
+            std::cout << "Warning: unsupported normal component type: " << (int)normalAccessor.componentType << "\n";
+
+            // Prevent uninitialized data
+            for (std::uint32_t i = 0; i < normalAccessor.count; ++i)
+            {
+                vertexIt->attributes.normal = glm::vec3(0.f, 0.f, 1.f);
+                ++vertexIt;
+            }
+            break;
+        }
+    }
+
+    void reconstructNormals(std::vector<Vertex> & vertices, std::vector<std::uint32_t> const & indices, std::uint32_t baseVertex, std::uint32_t baseIndex,
+        std::uint32_t vertexCount, std::uint32_t indexCount)
+    {
+        for (std::uint32_t i = 0; i < vertexCount; ++i)
+            vertices[baseVertex + i].attributes.normal = glm::vec3(0.f);
+
+        // Compute average adjacent triangle normal
+        for (std::uint32_t i = 0; i < indexCount; i += 3)
+        {
+            auto & v0 = vertices[baseVertex + indices[baseIndex + i + 0]];
+            auto & v1 = vertices[baseVertex + indices[baseIndex + i + 1]];
+            auto & v2 = vertices[baseVertex + indices[baseIndex + i + 2]];
+
+            auto normal = glm::normalize(glm::cross(v1.position - v0.position, v2.position - v0.position));
+
+            v0.attributes.normal += normal;
+            v1.attributes.normal += normal;
+            v2.attributes.normal += normal;
+        }
+
+        for (std::uint32_t i = 0; i < vertexCount; ++i)
+        {
+            auto & v = vertices[baseVertex + i];
+            v.attributes.normal = glm::normalize(v.attributes.normal);
+        }
+    }
+
+    void fillDefaultTexcoords(std::vector<Vertex> & vertices, std::uint32_t baseVertex, std::uint32_t count)
+    {
+        auto vertexBegin = vertices.begin() + baseVertex;
+        auto vertexEnd = vertexBegin + count;
+
+        for (auto vertexIt = vertexBegin; vertexIt != vertexEnd; ++vertexIt)
+            vertexIt->attributes.texcoords = {0.5f, 0.5f};
+    }
+
+    void readTexcoords(glTF::Asset const & asset, glTF::Accessor const & texcoordAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    {
+        auto vertexIt = vertices.begin() + baseVertex;
+
+        switch (texcoordAccessor.componentType)
+        {
+        case glTF::Accessor::ComponentType::Float:
+            for (auto texcoord : glTF::AccessorRange<glm::vec2>(asset, texcoordAccessor))
+            {
+                vertexIt->attributes.texcoords = texcoord;
+                ++vertexIt;
+            }
+            break;
+        default:
+            std::cout << "Warning: unsupported normal component type: " << (int)texcoordAccessor.componentType << "\n";
+
+            // Prevent uninitialized data
+            fillDefaultTexcoords(vertices, baseVertex, texcoordAccessor.count);
+            break;
+        }
+    }
+
+    void readTangents(glTF::Asset const & asset, glTF::Accessor const & tangentAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    {
+        auto vertexIt = vertices.begin() + baseVertex;
+
+        switch (tangentAccessor.componentType)
+        {
+        case glTF::Accessor::ComponentType::Float:
+            for (auto tangent : glTF::AccessorRange<glm::vec4>(asset, tangentAccessor))
+            {
+                vertexIt->attributes.tangent = tangent;
+                ++vertexIt;
+            }
+            break;
+        default:
+            std::cout << "Warning: unsupported tangent component type: " << (int)tangentAccessor.componentType << "\n";
+
+            // Prevent uninitialized data
+            for (std::uint32_t i = 0; i < tangentAccessor.count; ++i)
+            {
+                vertexIt->attributes.tangent = glm::vec4(1.f, 0.f, 0.f, 1.f);
+                ++vertexIt;
+            }
+            break;
+        }
+    }
+
+    void fillDefaultTangents(std::vector<Vertex> & vertices, std::uint32_t baseVertex, std::uint32_t count)
+    {
+        auto vertexBegin = vertices.begin() + baseVertex;
+        auto vertexEnd = vertexBegin + count;
+
+        for (auto vertexIt = vertexBegin; vertexIt != vertexEnd; ++vertexIt)
+        {
+            glm::vec3 tangent;
+            if (std::abs(vertexIt->attributes.normal.z) < 0.5f)
+                tangent = glm::cross(vertexIt->attributes.normal, glm::vec3(0.f, 0.f, 1.f));
+            else
+                tangent = glm::cross(vertexIt->attributes.normal, glm::vec3(1.f, 0.f, 0.f));
+            vertexIt->attributes.tangent = glm::vec4(glm::normalize(tangent), 1.f);
+        }
+    }
+
+    void reconstructTangents(std::vector<Vertex> & vertices, std::vector<std::uint32_t> const & indices, std::uint32_t baseVertex, std::uint32_t baseIndex,
+        std::uint32_t vertexCount, std::uint32_t indexCount)
+    {
+        struct Context
+        {
+            Vertex * vertices;
+            std::uint32_t const * indices;
+            std::uint32_t vertexCount;
+            std::uint32_t indexCount;
+        };
+
+        Context context
+        {
+            .vertices = vertices.data(),
+            .indices = indices.data() + baseIndex,
+            .vertexCount = vertexCount,
+            .indexCount = indexCount,
+        };
+
+        SMikkTSpaceInterface mikkTSpaceInterface
+        {
+            .m_getNumFaces = [](SMikkTSpaceContext const * pContext) -> int
+            {
+                return ((Context *)(pContext->m_pUserData))->indexCount / 3;
+            },
+            .m_getNumVerticesOfFace = [](SMikkTSpaceContext const *, int) -> int
+            {
+                return 3;
+            },
+            .m_getPosition = [](SMikkTSpaceContext const * pContext, float * fvPosOut, int iFace, int iVert)
+            {
+                auto context = (Context *)(pContext->m_pUserData);
+                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
+                fvPosOut[0] = vertex.position.x;
+                fvPosOut[1] = vertex.position.y;
+                fvPosOut[2] = vertex.position.z;
+            },
+            .m_getNormal = [](SMikkTSpaceContext const * pContext, float * fvNormOut, int iFace, int iVert)
+            {
+                auto context = (Context *)(pContext->m_pUserData);
+                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
+                fvNormOut[0] = vertex.attributes.normal.x;
+                fvNormOut[1] = vertex.attributes.normal.y;
+                fvNormOut[2] = vertex.attributes.normal.z;
+            },
+            .m_getTexCoord = [](SMikkTSpaceContext const * pContext, float * fvTexcOut, int iFace, int iVert)
+            {
+                auto context = (Context *)(pContext->m_pUserData);
+                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
+                fvTexcOut[0] = vertex.attributes.texcoords.x;
+                fvTexcOut[1] = vertex.attributes.texcoords.y;
+            },
+            .m_setTSpaceBasic = [](SMikkTSpaceContext const * pContext, float const * fvTangent, float fSign, int iFace, int iVert)
+            {
+                auto context = (Context *)(pContext->m_pUserData);
+                auto & vertex = context->vertices[context->indices[3 * iFace + iVert]];
+                vertex.attributes.tangent.x = fvTangent[0];
+                vertex.attributes.tangent.y = fvTangent[1];
+                vertex.attributes.tangent.z = fvTangent[2];
+                vertex.attributes.tangent.w = fSign;
+            },
+            .m_setTSpace = nullptr,
+        };
+
+        SMikkTSpaceContext mikkTSpaceContext
+        {
+            .m_pInterface = &mikkTSpaceInterface,
+            .m_pUserData = &context,
+        };
+
+        genTangSpaceDefault(&mikkTSpaceContext);
+    }
+
+    // Same as in env_map.wgsl
+    constexpr float MAX_ENV_MAP_INTENSITY = 100.f;
+
+    // Tables for sampling environment map pixels in proportion to their luminance
+    // times the solid angle they cover: a header record storing the total weight,
+    // the marginal alias table over rows, and the conditional table of each row
+    std::vector<AliasRecord> generateEnvironmentMapAlias(HDRIData const & environmentMap)
+    {
+        Timer timer;
+
+        std::uint32_t const width = environmentMap.width;
+        std::uint32_t const height = environmentMap.height;
+
+        std::vector<AliasRecord> result(1 + height + width * height);
+        std::vector<float> rowWeights(height);
+
+        ThreadPool pool;
+        parallelFor(pool, height, 16, [&](std::size_t begin, std::size_t end)
+        {
+            std::vector<float> weights(width);
+
+            for (std::size_t y = begin; y < end; ++y)
+            {
+                // Pixel solid angle is proportional to the cosine of its elevation
+                float const elevation = (0.5f - (y + 0.5f) / height) * glm::pi<float>();
+                float const solidAngleWeight = std::cos(elevation);
+
+                float rowWeight = 0.f;
+                for (std::uint32_t x = 0; x < width; ++x)
+                {
+                    float const * pixel = environmentMap.pixels.data() + 4 * (x + y * width);
+                    glm::vec3 const color = glm::min(glm::vec3(pixel[0], pixel[1], pixel[2]), glm::vec3(MAX_ENV_MAP_INTENSITY));
+                    weights[x] = glm::dot(LUMINANCE_FACTORS, color) * solidAngleWeight;
+                    rowWeight += weights[x];
+                }
+
+                if (rowWeight > 0.f)
+                    for (auto & weight : weights)
+                        weight /= rowWeight;
+
+                rowWeights[y] = rowWeight;
+                fillAliasTable(weights, std::span(result).subspan(1 + height + y * width, width));
+            }
+        });
+
+        float totalWeight = 0.f;
+        for (auto weight : rowWeights)
+            totalWeight += weight;
+
+        if (totalWeight > 0.f)
+            for (auto & weight : rowWeights)
+                weight /= totalWeight;
+
+        result[0] = {
+            .probability = totalWeight,
+            .alias = 0,
+        };
+        fillAliasTable(rowWeights, std::span(result).subspan(1, height));
+
+        std::cout << "Built environment map alias table for " << width << "x" << height << " pixels in " << timer.duration() << " seconds" << std::endl;
+
+        return result;
+    }
+
+    // Appends the triangles of all primitives of the mesh, transformed by matrix
+    void readMesh(glTF::Asset const & asset, glTF::Mesh const & mesh, glm::mat4 const & matrix, std::vector<Vertex> & vertices, std::vector<std::uint32_t> & indices)
+    {
+        glm::mat3 normalMatrix = glm::inverse(glm::transpose(glm::mat3(matrix)));
+
+        for (auto const & primitive : mesh.primitives)
+        {
+            if (primitive.mode != glTF::Primitive::Mode::Triangles)
+            {
+                std::cout << "Warning: only 'triangles' primitive mode is supported\n";
+                continue;
+            }
+
+            if (!primitive.attributes.position)
+            {
+                std::cout << "Warning: cannot render a primitive without positions\n";
+                continue;
+            }
+
+            // Fetch all accessors
+
+            glTF::Accessor const * indexAccessor = nullptr;
+            glTF::Accessor const * positionAccessor = nullptr;
+            glTF::Accessor const * normalAccessor = nullptr;
+            glTF::Accessor const * texcoordAccessor = nullptr;
+            glTF::Accessor const * tangentAccessor = nullptr;
+
+            if (primitive.indices) indexAccessor = &asset.accessors[*primitive.indices];
+
+            positionAccessor = &asset.accessors[*primitive.attributes.position];
+
+            if (primitive.attributes.normal) normalAccessor = &asset.accessors[*primitive.attributes.normal];
+            if (primitive.attributes.texcoord) texcoordAccessor = &asset.accessors[*primitive.attributes.texcoord];
+            if (primitive.attributes.tangent) tangentAccessor = &asset.accessors[*primitive.attributes.tangent];
+
+            // Read indices
+
+            std::uint32_t baseIndex = indices.size();
+            std::uint32_t baseVertex = vertices.size();
+            std::uint32_t indexCount = indexAccessor ? indexAccessor->count : positionAccessor->count;
+
+            if (indexAccessor)
+                readIndices(asset, *indexAccessor, indices, baseVertex);
+            else
+                fillIndices(*positionAccessor, indices, baseVertex);
+
+            // Preallocate vertices
+
+            vertices.resize(vertices.size() + positionAccessor->count);
+
+            // Read positions
+            readPositions(asset, *positionAccessor, vertices, baseVertex);
+
+            // Read normals
+            if (normalAccessor)
+                readNormals(asset, *normalAccessor, vertices, baseVertex);
+            else
+                reconstructNormals(vertices, indices, baseVertex, baseIndex, positionAccessor->count, indexCount);
+
+            // Read texture coordinates
+            if (texcoordAccessor)
+                readTexcoords(asset, *texcoordAccessor, vertices, baseVertex);
+            else
+                fillDefaultTexcoords(vertices, baseVertex, positionAccessor->count);
+
+            // Read tangents
+            if (tangentAccessor)
+                readTangents(asset, *tangentAccessor, vertices, baseVertex);
+            else if (texcoordAccessor)
+                reconstructTangents(vertices, indices, baseVertex, baseIndex, positionAccessor->count, indexCount);
+            else
+                fillDefaultTangents(vertices, baseVertex, positionAccessor->count);
+
+            std::uint32_t materialID = primitive.material ? 1 + *primitive.material : 0;
+
+            for (std::uint32_t i = 0; i < positionAccessor->count; ++i)
+            {
+                auto & v = vertices[baseVertex + i];
+
+                v.position = glm::vec3(matrix * glm::vec4(v.position, 1.f));
+                v.attributes.normal = glm::normalize(normalMatrix * v.attributes.normal);
+                v.attributes.tangent = glm::vec4(glm::normalize(glm::mat3(matrix) * glm::vec3(v.attributes.tangent)), v.attributes.tangent.w);
+                v.attributes.materialID = materialID;
+            }
+        }
+    }
+
+    // Builds the BVH over the triangles and appends them to the geometry in BVH order.
+    // Emissive triangles are collected relative to the first appended one
+    BVH appendTriangles(SceneGeometry & result, std::vector<Vertex> vertices, std::vector<std::uint32_t> indices, std::vector<SceneMaterial> const & materials,
+        BVHBuildOptions const & bvhOptions, std::vector<std::uint32_t> & emissiveTriangles)
+    {
+        std::vector<AABB> triangleAABB(indices.size() / 3);
+        std::vector<glm::vec3> triangleVertices(indices.size());
+        for (std::uint32_t i = 0; i < triangleAABB.size(); ++i)
+        {
+            for (std::uint32_t k = 0; k < 3; ++k)
+            {
+                triangleVertices[3 * i + k] = vertices[indices[3 * i + k]].position;
+                triangleAABB[i].extend(triangleVertices[3 * i + k]);
+            }
+        }
+
+        BVH bvh = buildBVH(triangleAABB, bvhOptions, triangleVertices);
+        triangleVertices = {};
+
+        {
+            // Instead of storing triangleID's per BVH node, store triangles
+            // themselves (as index triples), thereby removing the need for
+            // extra indirection in the shader
+
+            std::vector<std::uint32_t> sortedIndices;
+            for (auto triangleID : bvh.triangleIDs)
+            {
+                sortedIndices.push_back(indices[3 * triangleID + 0]);
+                sortedIndices.push_back(indices[3 * triangleID + 1]);
+                sortedIndices.push_back(indices[3 * triangleID + 2]);
+            }
+            indices = std::move(sortedIndices);
+        }
+
+        {
+            // Instead of using indexing, store triangles as vertex triples directly,
+            // removing another indirection in the shader
+
+            std::vector<Vertex> deindexedVertices;
+            for (std::uint32_t i = 0; i < indices.size(); i += 3)
+            {
+                deindexedVertices.push_back(vertices[indices[i + 0]]);
+                deindexedVertices.push_back(vertices[indices[i + 1]]);
+                deindexedVertices.push_back(vertices[indices[i + 2]]);
+            }
+
+            vertices = std::move(deindexedVertices);
+        }
+
+        for (auto const & v : vertices)
+        {
+            result.vertexPositions.push_back(glm::vec4(v.position, 1.f));
+            result.vertexAttributes.push_back(v.attributes);
+        }
+
+        // Spatial splits can reference a triangle from several leaves,
+        // only its first copy is used for light sampling
+        std::vector<bool> triangleSeen(triangleAABB.size(), false);
+
+        for (std::uint32_t i = 0; i < bvh.triangleIDs.size(); ++i)
+        {
+            if (triangleSeen[bvh.triangleIDs[i]])
+                continue;
+            triangleSeen[bvh.triangleIDs[i]] = true;
+
+            if (glm::lMaxNorm(glm::vec3(materials[vertices[3 * i].attributes.materialID].emissiveFactorAndTransmission)) > 0.f)
+            {
+                emissiveTriangles.push_back(i);
+            }
+        }
+
+        return bvh;
+    }
+
+    // Builds the light sampling tables and the light BVH over the given world space triangles
+    void buildEmissiveTriangles(SceneGeometry & result, std::vector<std::uint32_t> const & emissiveTriangles, std::vector<SceneMaterial> const & materials,
+        BVHBuildOptions const & bvhOptions)
+    {
+        std::vector<AABB> emissiveTriangleAABB(emissiveTriangles.size());
+        std::vector<float> emissiveTriangleWeight(emissiveTriangles.size());
+        float emissiveTrianglesTotalWeight = 0.f;
+
+        for (std::uint32_t i = 0; i < emissiveTriangleAABB.size(); ++i)
+        {
+            auto triangleID = emissiveTriangles[i];
+
+            auto v0 = glm::vec3(result.vertexPositions[3 * triangleID + 0]);
+            auto v1 = glm::vec3(result.vertexPositions[3 * triangleID + 1]);
+            auto v2 = glm::vec3(result.vertexPositions[3 * triangleID + 2]);
+
+            emissiveTriangleAABB[i].extend(v0);
+            emissiveTriangleAABB[i].extend(v1);
+            emissiveTriangleAABB[i].extend(v2);
+
+            float areaWeight = glm::length(glm::cross(v1 - v0, v2 - v0));
+
+            auto materialID = result.vertexAttributes[3 * triangleID + 0].materialID;
+
+            // Weight based on percieved luminance
+            float emissiveWeight = glm::dot(LUMINANCE_FACTORS, glm::vec3(materials[materialID].emissiveFactorAndTransmission));
+
+            float weight = areaWeight * emissiveWeight;
+
+            emissiveTriangleWeight[i] = weight;
+            emissiveTrianglesTotalWeight += weight;
+        }
+
+        for (auto & weight : emissiveTriangleWeight)
+            weight /= emissiveTrianglesTotalWeight;
+
+        // Light sampling tables need every emissive triangle exactly once
+        auto emissiveBvhOptions = bvhOptions;
+        if (emissiveBvhOptions.method == BVHBuildOptions::Method::SpatialSAH)
+            emissiveBvhOptions.method = BVHBuildOptions::Method::BinnedSAH;
+
+        BVH emissiveBvh = buildBVH(emissiveTriangleAABB, emissiveBvhOptions);
+        auto emissiveAliasTable = generateAlias(emissiveTriangleWeight);
+
+        // Instead of storing triangleID's per light BVH node, store triangles
+        // themselves, thereby removing the need for extra indirection in the shader
+
+        auto & sortedEmissiveTriangles = result.emissiveTriangles;
+        auto & sortedEmissiveAliasTable = result.emissiveAliasTable;
+
+        // First element is actually the array size, see geometry.wgsl
+        sortedEmissiveTriangles.push_back({(std::uint32_t)emissiveTriangles.size(), 0.f});
+
+        {
+            std::vector<std::uint32_t> sortedTrianglesNewID(emissiveTriangles.size());
+
+            for (auto triangleIndex : emissiveBvh.triangleIDs)
+            {
+                sortedTrianglesNewID[triangleIndex] = sortedEmissiveTriangles.size() - 1;
+                sortedEmissiveTriangles.push_back({emissiveTriangles[triangleIndex], emissiveTriangleWeight[triangleIndex]});
+            }
+
+            for (auto triangleIndex : emissiveBvh.triangleIDs){
+                auto aliasRecord = emissiveAliasTable[triangleIndex];
+                sortedEmissiveAliasTable.push_back({
+                    .probability = aliasRecord.probability,
+                    .alias = sortedTrianglesNewID[aliasRecord.alias],
+                });
+            }
+
+            // Prevent the triangle buffer from being empty
+            if (emissiveBvh.triangleIDs.empty())
+            {
+                sortedEmissiveTriangles.push_back({0, 0.f});
+                sortedEmissiveAliasTable.push_back({1.f, 0});
+            }
+        }
+
+        result.emissiveBvhNodes = std::move(emissiveBvh.nodes);
+    }
+
+    SceneGeometry buildSceneGeometry(glTF::Asset const & asset, std::vector<SceneMaterial> const & materials, BVHBuildOptions const & bvhOptions)
+    {
+        SceneGeometry result;
+
+        std::vector<Vertex> vertices;
+        std::vector<std::uint32_t> indices;
+
+        for (auto const & node : asset.nodes)
+        {
+            if (!node.mesh) continue;
+
+            readMesh(asset, asset.meshes[*node.mesh], node.globalMatrix, vertices, indices);
+        }
+
+        std::vector<std::uint32_t> emissiveTriangles;
+        BVH bvh = appendTriangles(result, std::move(vertices), std::move(indices), materials, bvhOptions, emissiveTriangles);
+        result.bvhNodes = std::move(bvh.nodes);
+
+        buildEmissiveTriangles(result, emissiveTriangles, materials, bvhOptions);
+
+        return result;
+    }
+
+    SceneGeometry buildInstancedSceneGeometry(glTF::Asset const & asset, std::vector<SceneMaterial> const & materials, BVHBuildOptions const & bvhOptions)
+    {
+        Timer timer;
+
+        SceneGeometry result;
+
+        struct MeshInfo
+        {
+            std::uint32_t bvhRoot = 0;
+            std::uint32_t firstTriangle = 0;
+            std::uint32_t triangleCount = 0;
+            std::vector<std::uint32_t> emissiveTriangles;
+        };
+
+        // Every mesh is stored once, in object space, with its own BVH
+        std::vector<std::optional<MeshInfo>> meshes(asset.meshes.size());
+        std::vector<std::uint32_t> instanceMeshIDs;
+
+        std::uint64_t flattenedTriangleCount = 0;
+
+        for (auto const & node : asset.nodes)
+        {
+            if (!node.mesh) continue;
+
+            auto & mesh = meshes[*node.mesh];
+            if (!mesh)
+            {
+                std::vector<Vertex> vertices;
+                std::vector<std::uint32_t> indices;
+                readMesh(asset, asset.meshes[*node.mesh], glm::mat4(1.f), vertices, indices);
+
+                mesh.emplace();
+                mesh->firstTriangle = result.vertexPositions.size() / 3;
+
+                if (!indices.empty())
+                {
+                    BVH bvh = appendTriangles(result, std::move(vertices), std::move(indices), materials, bvhOptions, mesh->emissiveTriangles);
+                    mesh->bvhRoot = appendMeshBVH(result.bvhNodes, bvh.nodes, mesh->firstTriangle);
+                }
+
+                mesh->triangleCount = result.vertexPositions.size() / 3 - mesh->firstTriangle;
+            }
+
+            if (mesh->triangleCount == 0) continue;
+
+            result.instances.push_back(makeSceneInstance(node.globalMatrix, mesh->bvhRoot, mesh->firstTriangle, mesh->triangleCount));
+            instanceMeshIDs.push_back(*node.mesh);
+            flattenedTriangleCount += mesh->triangleCount;
+        }
+
+        std::uint32_t const meshTriangleCount = result.vertexPositions.size() / 3;
+
+        // Light sampling works in world space, so emissive triangles of every instance
+        // are copied to world space after the mesh triangles. They aren't referenced
+        // by any mesh BVH, so rays still hit the object space originals
+
+        std::vector<std::uint32_t> emissiveTriangles;
+        for (std::uint32_t i = 0; i < result.instances.size(); ++i)
+        {
+            auto const & mesh = meshes[instanceMeshIDs[i]];
+
+            glm::mat4 const objectToWorld = instanceObjectToWorld(result.instances[i]);
+            glm::mat3 const normalMatrix = glm::inverse(glm::transpose(glm::mat3(objectToWorld)));
+
+            for (auto triangle : mesh->emissiveTriangles)
+            {
+                emissiveTriangles.push_back(result.vertexPositions.size() / 3);
+
+                for (std::uint32_t k = 0; k < 3; ++k)
+                {
+                    std::uint32_t const vertex = 3 * (mesh->firstTriangle + triangle) + k;
+
+                    auto position = objectToWorld * result.vertexPositions[vertex];
+                    auto attributes = result.vertexAttributes[vertex];
+                    attributes.normal = glm::normalize(normalMatrix * attributes.normal);
+                    attributes.tangent = glm::vec4(glm::normalize(glm::mat3(objectToWorld) * glm::vec3(attributes.tangent)), attributes.tangent.w);
+
+                    result.vertexPositions.push_back(position);
+                    result.vertexAttributes.push_back(attributes);
+                }
+            }
+        }
+
+        buildEmissiveTriangles(result, emissiveTriangles, materials, bvhOptions);
+
+        // Keep the node buffer non-empty for scenes without any triangles
+        if (result.bvhNodes.empty())
+            result.bvhNodes.emplace_back();
+
+        result.instanceBvhNodes = buildInstanceBVH(result.instances, result.bvhNodes, bvhOptions);
+
+        std::cout << "Built instanced scene geometry in " << timer.duration() << " seconds: " << result.instances.size() << " instances, "
+            << meshTriangleCount << " mesh triangles stored for " << flattenedTriangleCount << " scene triangles, "
+            << (result.vertexPositions.size() / 3 - meshTriangleCount) << " world space emissive triangles" << std::endl;
+
+        return result;
+    }
+
+    // Default textures only need a single texel
+    std::uint32_t const whitePixel = 0xffffffffu;
+    std::uint32_t const bluePixel = 0xffff7f7f;
+
+}
+
+PreparedScene::PreparedScene(glTF::Asset const & asset, HDRIData environmentMap, BVHBuildOptions const & bvhOptions,
+    std::filesystem::path const & cacheDirectory, bool instancing)
+    : environmentMap(std::move(environmentMap))
+{
+    // Add default rough diffuse material
+    materials.push_back({
+        .baseColorFactorAndAlpha = glm::vec4(1.f, 1.f, 1.f, 1.f),
+        .metallicRoughnessFactorAndIor = glm::vec4(0.f, 1.f, 0.f, 1.5f),
+        .emissiveFactorAndTransmission = glm::vec4(0.f),
+    });
+
+    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToAlbedoID;
+    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToMaterialID;
+    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToNormalID;
+
+    albedoImages.push_back({
+        .width = 1,
+        .height = 1,
+        .pixels = nullptr,
+    });
+
+    materialImages.push_back({
+        .width = 1,
+        .height = 1,
+        .pixels = nullptr,
+    });
+
+    normalImages.push_back({
+        .width = 1,
+        .height = 1,
+        .pixels = nullptr,
+    });
+
+    for (auto const & materialIn : asset.materials)
+    {
+        auto & material = materials.emplace_back();
+        material.baseColorFactorAndAlpha = materialIn.baseColorFactor;
+        material.metallicRoughnessFactorAndIor = glm::vec4(0.f, materialIn.roughnessFactor, materialIn.metallicFactor, materialIn.ior);
+        material.emissiveFactorAndTransmission = glm::vec4(materialIn.emissiveFactor, materialIn.transmission);
+        material.textureIDs = glm::uvec4(0);
+
+        if (materialIn.baseColorTexture)
+        {
+            if (auto sourceImage = asset.textures[*materialIn.baseColorTexture].source)
+            {
+                if (glTFImageToAlbedoID.contains(*sourceImage))
+                {
+                    material.textureIDs.x = glTFImageToAlbedoID.at(*sourceImage);
+                }
+                else
+                {
+                    auto const & image = asset.images[*sourceImage];
+                    glTFImageToAlbedoID[*sourceImage] = albedoImages.size();
+                    material.textureIDs.x = albedoImages.size();
+
+                    albedoImages.push_back({
+                        .width = image.width,
+                        .height = image.height,
+                        .pixels = image.data.get(),
+                    });
+                }
+            }
+        }
+
+        if (materialIn.metallicRoughnessTexture)
+        {
+            if (auto sourceImage = asset.textures[*materialIn.metallicRoughnessTexture].source)
+            {
+                if (glTFImageToMaterialID.contains(*sourceImage))
+                {
+                    material.textureIDs.y = glTFImageToMaterialID.at(*sourceImage);
+                }
+                else
+                {
+                    auto const & image = asset.images[*sourceImage];
+                    glTFImageToMaterialID[*sourceImage] = materialImages.size();
+                    material.textureIDs.y = materialImages.size();
+
+                    materialImages.push_back({
+                        .width = image.width,
+                        .height = image.height,
+                        .pixels = image.data.get(),
+                    });
+                }
+            }
+        }
+
+        if (materialIn.normalTexture)
+        {
+            if (auto sourceImage = asset.textures[*materialIn.normalTexture].source)
+            {
+                if (glTFImageToNormalID.contains(*sourceImage))
+                {
+                    material.textureIDs.z = glTFImageToNormalID.at(*sourceImage);
+                }
+                else
+                {
+                    auto const & image = asset.images[*sourceImage];
+                    glTFImageToNormalID[*sourceImage] = normalImages.size();
+                    material.textureIDs.z = normalImages.size();
+
+                    normalImages.push_back({
+                        .width = image.width,
+                        .height = image.height,
+                        .pixels = image.data.get(),
+                    });
+                }
+            }
+        }
+    }
+
+    albedoImages[0].pixels = &whitePixel;
+    materialImages[0].pixels = &whitePixel;
+    normalImages[0].pixels = &bluePixel;
+
+    {
+        Timer mipmapTimer;
+
+        ThreadPool pool;
+        TaskGroup mipmapTasks(pool);
+
+        auto generateImageMipmaps = [&](std::vector<SceneImage> & images, TextureEncoding encoding)
+        {
+            for (auto & image : images)
+                mipmapTasks.run([&pool, &image, encoding]{
+                    image.mipmaps = generateMipmaps(pool, image.width, image.height, image.pixels, encoding);
+                });
+        };
+
+        generateImageMipmaps(albedoImages, TextureEncoding::SRGB);
+        generateImageMipmaps(materialImages, TextureEncoding::Linear);
+        generateImageMipmaps(normalImages, TextureEncoding::Normal);
+
+        mipmapTasks.wait();
+
+        std::cout << "Generated mipmaps for " << (albedoImages.size() + materialImages.size() + normalImages.size()) << " textures in " << mipmapTimer.duration() << " seconds" << std::endl;
+    }
+
+    std::filesystem::path cachePath;
+    std::uint64_t cacheKey = 0;
+    if (!cacheDirectory.empty())
+    {
+        Timer cacheTimer;
+        cacheKey = sceneCacheKey(asset.contentHash, bvhOptions, instancing);
+        cachePath = sceneCachePath(cacheDirectory, cacheKey);
+        cache_ = SceneCache::open(cachePath, cacheKey);
+        if (cache_)
+        {
+            geometry_ = cache_->geometry();
+            std::cout << "Loaded scene cache " << cachePath << " in " << cacheTimer.duration() << " seconds" << std::endl;
+        }
+    }
+
+    if (!cache_)
+    {
+        if (instancing)
+            builtGeometry_ = buildInstancedSceneGeometry(asset, materials, bvhOptions);
+        else
+            builtGeometry_ = buildSceneGeometry(asset, materials, bvhOptions);
+        geometry_ = builtGeometry_;
+
+        if (!cachePath.empty())
+        {
+            Timer cacheTimer;
+            try
+            {
+                writeSceneCache(cachePath, cacheKey, geometry_);
+                std::cout << "Saved scene cache " << cachePath << " in " << cacheTimer.duration() << " seconds" << std::endl;
+            }
+            catch (std::exception const & e)
+            {
+                std::cout << "Warning: failed to save scene cache: " << e.what() << std::endl;
+            }
+        }
+    }
+
+    environmentAliasTable = generateEnvironmentMapAlias(this->environmentMap);
+}
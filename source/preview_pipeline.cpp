@@ -38,7 +38,16 @@ PreviewPipeline::PreviewPipeline(WGPUDevice device, ShaderRegistry & shaderRegis
     vertexAttributes[3].offset = 32;
     vertexAttributes[3].shaderLocation = 4;
 
-    WGPUVertexBufferLayout vertexBufferLayouts[2];
+    // Rows of SceneInstance::objectToWorld and worldToObject
+    WGPUVertexAttribute instanceAttributes[6];
+    for (int i = 0; i < 6; ++i)
+    {
+        instanceAttributes[i].format = WGPUVertexFormat_Float32x4;
+        instanceAttributes[i].offset = 16 * i;
+        instanceAttributes[i].shaderLocation = 5 + i;
+    }
+
+    WGPUVertexBufferLayout vertexBufferLayouts[3];
     vertexBufferLayouts[0].arrayStride = 16;
     vertexBufferLayouts[0].stepMode = WGPUVertexStepMode_Vertex;
     vertexBufferLayouts[0].attributeCount = 1;
@@ -47,6 +56,10 @@ PreviewPipeline::PreviewPipeline(WGPUDevice device, ShaderRegistry & shaderRegis
     vertexBufferLayouts[1].stepMode = WGPUVertexStepMode_Vertex;
     vertexBufferLayouts[1].attributeCount = 4;
     vertexBufferLayouts[1].attributes = vertexAttributes;
+    vertexBufferLayouts[2].arrayStride = sizeof(SceneInstance);
+    vertexBufferLayouts[2].stepMode = WGPUVertexStepMode_Instance;
+    vertexBufferLayouts[2].attributeCount = 6;
+    vertexBufferLayouts[2].attributes = instanceAttributes;
 
     WGPUDepthStencilState depthStencilState;
     depthStencilState.nextInChain = nullptr;
@@ -91,7 +104,7 @@ PreviewPipeline::PreviewPipeline(WGPUDevice device, ShaderRegistry & shaderRegis
     renderPipelineDescriptor.vertex.entryPoint = "vertexMain";
     renderPipelineDescriptor.vertex.constantCount = 0;
     renderPipelineDescriptor.vertex.constants = nullptr;
-    renderPipelineDescriptor.vertex.bufferCount = 2;
+    renderPipelineDescriptor.vertex.bufferCount = 3;
     renderPipelineDescriptor.vertex.buffers = vertexBufferLayouts;
     renderPipelineDescriptor.primitive.nextInChain = nullptr;
     renderPipelineDescriptor.primitive.topology = WGPUPrimitiveTopology_TriangleList;
@@ -206,7 +219,17 @@ void renderPreview(PreviewPipeline const & previewPipeline, WGPUCommandEncoder c
     wgpuRenderPassEncoderSetPipeline(renderPassEncoder, previewPipeline.renderPipeline());
     wgpuRenderPassEncoderSetVertexBuffer(renderPassEncoder, 0, sceneData.vertexPositionsBuffer(), 0, wgpuBufferGetSize(sceneData.vertexPositionsBuffer()));
     wgpuRenderPassEncoderSetVertexBuffer(renderPassEncoder, 1, sceneData.vertexAttributesBuffer(), 0, wgpuBufferGetSize(sceneData.vertexAttributesBuffer()));
-    wgpuRenderPassEncoderDraw(renderPassEncoder, sceneData.vertexCount(), 1, 0, 0);
+    // Skip the header of the instances buffer
+    wgpuRenderPassEncoderSetVertexBuffer(renderPassEncoder, 2, sceneData.instancesBuffer(), 16, wgpuBufferGetSize(sceneData.instancesBuffer()) - 16);
+
+    if (sceneData.instanced())
+    {
+        auto const instances = sceneData.instances();
+        for (std::uint32_t i = 0; i < instances.size(); ++i)
+            wgpuRenderPassEncoderDraw(renderPassEncoder, 3 * instances[i].triangleCount, 1, 3 * instances[i].firstTriangle, i);
+    }
+    else
+        wgpuRenderPassEncoderDraw(renderPassEncoder, sceneData.vertexCount(), 1, 0, 0);
     wgpuRenderPassEncoderEnd(renderPassEncoder);
     wgpuRenderPassEncoderRelease(renderPassEncoder);
 }
@@ -1,25 +1,29 @@
 #include <webgpu-raytracer/profiler.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
-static std::uint32_t MAX_QUERY_COUNT = 16;
-static std::uint32_t RESOLVE_BUFFER_SIZE = MAX_QUERY_COUNT * 8;
+// Enough for the megakernel modes, the wavefront renderer grows it
+static std::uint32_t const INITIAL_QUERY_COUNT = 16;
 
-FrameProfiler::FrameProfiler(WGPUQuerySet querySet, WGPUCommandEncoder commandEncoder)
+// WebGPU limit on the size of a query set
+static std::uint32_t const MAX_QUERY_COUNT = 4096;
+
+FrameProfiler::FrameProfiler(WGPUQuerySet querySet, WGPUCommandEncoder commandEncoder, std::uint32_t queryCount)
     : querySet_(querySet)
     , commandEncoder_(commandEncoder)
-    , maxSize_(wgpuQuerySetGetCount(querySet_))
+    , maxSize_(queryCount)
 {}
 
-bool FrameProfiler::timestamp(std::string name)
+void FrameProfiler::timestamp(std::string name)
 {
+    // Dropping the timestamp would silently attribute its interval to the next one
     if (names_.size() >= maxSize_)
-        return false;
+        throw std::runtime_error("Profiler timestamp \"" + name + "\" exceeds the " + std::to_string(maxSize_) + " timestamps planned for the frame");
 
     wgpuCommandEncoderWriteTimestamp(commandEncoder_, querySet_, names_.size());
     names_.push_back(std::move(name));
-
-    return true;
 }
 
 std::vector<std::string> FrameProfiler::grabNames()
@@ -34,14 +38,9 @@ WGPUCommandEncoder FrameProfiler::commandEncoder()
 
 Profiler::Profiler(WGPUDevice device)
     : device_(device)
+    , queryCount_(INITIAL_QUERY_COUNT)
 {
-    WGPUQuerySetDescriptor querySetDescriptor;
-    querySetDescriptor.nextInChain = nullptr;
-    querySetDescriptor.label = nullptr;
-    querySetDescriptor.type = WGPUQueryType_Timestamp;
-    querySetDescriptor.count = MAX_QUERY_COUNT;
-
-    querySet_ = wgpuDeviceCreateQuerySet(device_, &querySetDescriptor);
+    querySet_ = newQuerySet(queryCount_);
 }
 
 Profiler::~Profiler()
@@ -64,33 +63,63 @@ Profiler::~Profiler()
     wgpuQuerySetRelease(querySet_);
 }
 
-FrameProfiler Profiler::beginFrame(WGPUCommandEncoder commandEncoder)
+FrameProfiler Profiler::beginFrame(WGPUCommandEncoder commandEncoder, std::uint32_t queryCount)
 {
-    FrameProfiler frameProfiler(querySet_, commandEncoder);
+    if (queryCount > MAX_QUERY_COUNT)
+        throw std::runtime_error("Frame needs " + std::to_string(queryCount) + " profiler timestamps, at most " + std::to_string(MAX_QUERY_COUNT) + " are supported");
+
+    // Frames in flight keep the old query set alive until they complete
+    if (queryCount > queryCount_)
+    {
+        wgpuQuerySetRelease(querySet_);
+        queryCount_ = std::min(std::max(queryCount, 2 * queryCount_), MAX_QUERY_COUNT);
+        querySet_ = newQuerySet(queryCount_);
+    }
+
+    FrameProfiler frameProfiler(querySet_, commandEncoder, queryCount);
     frameProfiler.timestamp("beginFrame");
     return frameProfiler;
 }
 
-void Profiler::endFrame(FrameProfiler frameProfiler)
+std::uint64_t Profiler::endFrame(FrameProfiler frameProfiler)
 {
     auto data = std::make_unique<PendingData>();
 
-    if (availableBuffers_.empty())
-        data->buffers = newBufferPair();
-    else
+    data->names = frameProfiler.grabNames();
+
+    std::uint64_t const resolveSize = data->names.size() * sizeof(std::uint64_t);
+
+    std::optional<BufferPair> buffers;
+
     {
-        data->buffers = availableBuffers_.back();
-        availableBuffers_.pop_back();
+        // Map callbacks return buffers from other threads
+        std::lock_guard lock{availableBuffersMutex_};
+
+        // Buffers made before the query set grew may be too small
+        while (!availableBuffers_.empty() && availableBuffers_.back().size < resolveSize)
+        {
+            availableBuffers_.back().destroy();
+            availableBuffers_.pop_back();
+        }
+
+        if (!availableBuffers_.empty())
+        {
+            buffers = availableBuffers_.back();
+            availableBuffers_.pop_back();
+        }
     }
 
-    data->names = frameProfiler.grabNames();
+    data->buffers = buffers ? *buffers : newBufferPair(queryCount_ * sizeof(std::uint64_t));
 
+    data->frameIndex = frameCount_++;
     data->parent = this;
 
     wgpuCommandEncoderResolveQuerySet(frameProfiler.commandEncoder(), querySet_, 0, data->names.size(), data->buffers.resolveBuffer, 0);
-    wgpuCommandEncoderCopyBufferToBuffer(frameProfiler.commandEncoder(), data->buffers.resolveBuffer, 0, data->buffers.mapBuffer, 0, RESOLVE_BUFFER_SIZE);
+    wgpuCommandEncoderCopyBufferToBuffer(frameProfiler.commandEncoder(), data->buffers.resolveBuffer, 0, data->buffers.mapBuffer, 0, resolveSize);
 
     preparedBuffers_.push_back(std::move(data));
+
+    return frameCount_ - 1;
 }
 
 void Profiler::poll()
@@ -109,16 +138,26 @@ void Profiler::poll()
             auto buffers = data->buffers;
             auto parent = data->parent;
 
-            auto values = (std::uint64_t const *)wgpuBufferGetConstMappedRange(buffers.mapBuffer, 0, RESOLVE_BUFFER_SIZE);
+            auto values = (std::uint64_t const *)wgpuBufferGetConstMappedRange(buffers.mapBuffer, 0, data->names.size() * sizeof(std::uint64_t));
 
+            // Intervals with the same name are summed over the frame,
+            // e.g. the same stage of every bounce
+            std::unordered_map<std::string, double> frameTimes;
             for (int i = 1; i < data->names.size(); ++i)
-            {
-                double deltaTime = (values[i] - values[i - 1]) / 1e9;
+                frameTimes[data->names[i]] += (values[i] - values[i - 1]) / 1e9;
 
+            {
                 std::lock_guard lock{parent->profilingResultsMutex_};
-                auto & result = parent->profilingResults_[data->names[i]];
-                result.count += 1;
-                result.totalTime += deltaTime;
+                for (auto const & frameTime : frameTimes)
+                {
+                    auto & result = parent->profilingResults_[frameTime.first];
+                    result.count += 1;
+                    result.totalTime += frameTime.second;
+                }
+
+                // Readbacks may complete out of order
+                if (!data->names.empty() && (!parent->latestFrame_ || parent->latestFrame_->frameIndex < data->frameIndex))
+                    parent->latestFrame_ = ProfiledFrame{data->frameIndex, (values[data->names.size() - 1] - values[0]) / 1e9};
             }
 
             wgpuBufferUnmap(buffers.mapBuffer);
@@ -141,12 +180,18 @@ void Profiler::poll()
             }
         };
 
-        wgpuBufferMapAsync(buffers.mapBuffer, WGPUMapMode_Read, 0, RESOLVE_BUFFER_SIZE, callback, pendingBuffers_.back().get());
+        wgpuBufferMapAsync(buffers.mapBuffer, WGPUMapMode_Read, 0, pendingBuffers_.back()->names.size() * sizeof(std::uint64_t), callback, pendingBuffers_.back().get());
     }
 
     preparedBuffers_.clear();
 }
 
+std::optional<ProfiledFrame> Profiler::latestFrame() const
+{
+    std::lock_guard lock{profilingResultsMutex_};
+    return latestFrame_;
+}
+
 void Profiler::dump()
 {
     {
@@ -163,34 +208,46 @@ void Profiler::BufferPair::destroy()
     wgpuBufferRelease(resolveBuffer);
 }
 
-WGPUBuffer Profiler::newResolveBuffer()
+WGPUQuerySet Profiler::newQuerySet(std::uint32_t queryCount)
+{
+    WGPUQuerySetDescriptor querySetDescriptor;
+    querySetDescriptor.nextInChain = nullptr;
+    querySetDescriptor.label = nullptr;
+    querySetDescriptor.type = WGPUQueryType_Timestamp;
+    querySetDescriptor.count = queryCount;
+
+    return wgpuDeviceCreateQuerySet(device_, &querySetDescriptor);
+}
+
+WGPUBuffer Profiler::newResolveBuffer(std::uint64_t size)
 {
     WGPUBufferDescriptor bufferDescriptor;
     bufferDescriptor.nextInChain = nullptr;
     bufferDescriptor.label = nullptr;
     bufferDescriptor.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
-    bufferDescriptor.size = RESOLVE_BUFFER_SIZE;
+    bufferDescriptor.size = size;
     bufferDescriptor.mappedAtCreation = false;
 
     return wgpuDeviceCreateBuffer(device_, &bufferDescriptor);
 }
 
-WGPUBuffer Profiler::newMapBuffer()
+WGPUBuffer Profiler::newMapBuffer(std::uint64_t size)
 {
     WGPUBufferDescriptor bufferDescriptor;
     bufferDescriptor.nextInChain = nullptr;
     bufferDescriptor.label = nullptr;
     bufferDescriptor.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
-    bufferDescriptor.size = RESOLVE_BUFFER_SIZE;
+    bufferDescriptor.size = size;
     bufferDescriptor.mappedAtCreation = false;
 
     return wgpuDeviceCreateBuffer(device_, &bufferDescriptor);
 }
 
-Profiler::BufferPair Profiler::newBufferPair()
+Profiler::BufferPair Profiler::newBufferPair(std::uint64_t size)
 {
     return {
-        .resolveBuffer = newResolveBuffer(),
-        .mapBuffer = newMapBuffer(),
+        .resolveBuffer = newResolveBuffer(size),
+        .mapBuffer = newMapBuffer(size),
+        .size = size,
     };
 }
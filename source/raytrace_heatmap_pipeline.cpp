@@ -0,0 +1,61 @@
+#include <webgpu-raytracer/raytrace_heatmap_pipeline.hpp>
+
+RaytraceHeatmapPipeline::RaytraceHeatmapPipeline(WGPUDevice device, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
+    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout traversalStatsBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout)
+{
+    WGPUBindGroupLayout bindGroupLayouts[4]
+    {
+        cameraBindGroupLayout,
+        geometryBindGroupLayout,
+        traversalStatsBindGroupLayout,
+        accumulationStorageBindGroupLayout,
+    };
+
+    WGPUPipelineLayoutDescriptor pipelineLayoutDescriptor;
+    pipelineLayoutDescriptor.nextInChain = nullptr;
+    pipelineLayoutDescriptor.label = nullptr;
+    pipelineLayoutDescriptor.bindGroupLayoutCount = 4;
+    pipelineLayoutDescriptor.bindGroupLayouts = bindGroupLayouts;
+
+    pipelineLayout_ = wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDescriptor);
+
+    WGPUShaderModule shaderModule = shaderRegistry.loadShaderModule("raytrace_heatmap");
+
+    WGPUComputePipelineDescriptor pipelineDescriptor;
+    pipelineDescriptor.nextInChain = nullptr;
+    pipelineDescriptor.label = "raytrace_heatmap";
+    pipelineDescriptor.layout = pipelineLayout_;
+    pipelineDescriptor.compute.nextInChain = nullptr;
+    pipelineDescriptor.compute.module = shaderModule;
+    pipelineDescriptor.compute.entryPoint = "computeMain";
+    pipelineDescriptor.compute.constantCount = 0;
+    pipelineDescriptor.compute.constants = nullptr;
+
+    pipeline_ = wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
+}
+
+RaytraceHeatmapPipeline::~RaytraceHeatmapPipeline()
+{
+    wgpuComputePipelineRelease(pipeline_);
+    wgpuPipelineLayoutRelease(pipelineLayout_);
+}
+
+void renderRaytraceHeatmap(WGPUCommandEncoder commandEncoder, WGPUComputePipeline raytraceHeatmapPipeline, WGPUBindGroup cameraBindGroup,
+    SceneData const & sceneData, WGPUBindGroup traversalStatsBindGroup, WGPUBindGroup accumulationStorageBindGroup, glm::uvec2 const & screenSize)
+{
+    WGPUComputePassDescriptor computePassDescriptor;
+    computePassDescriptor.nextInChain = nullptr;
+    computePassDescriptor.label = "raytrace_heatmap";
+    computePassDescriptor.timestampWrites = nullptr;
+
+    WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, cameraBindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 1, sceneData.geometryBindGroup(), 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 2, traversalStatsBindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 3, accumulationStorageBindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetPipeline(computePassEncoder, raytraceHeatmapPipeline);
+    wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, (screenSize.x + 7) / 8, (screenSize.y + 7) / 8, 1);
+    wgpuComputePassEncoderEnd(computePassEncoder);
+    wgpuComputePassEncoderRelease(computePassEncoder);
+}
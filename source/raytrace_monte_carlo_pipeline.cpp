@@ -1,7 +1,8 @@
 #include <webgpu-raytracer/raytrace_monte_carlo_pipeline.hpp>
 
 RaytraceMonteCarloPipeline::RaytraceMonteCarloPipeline(WGPUDevice device, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
-    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout)
+    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUBindGroupLayout accumulationStorageBindGroupLayout,
+    WGPUBindGroupLayout adaptiveSamplingBindGroupLayout)
 {
     WGPUBindGroupLayout bindGroupLayouts[4]
     {
@@ -32,11 +33,23 @@ RaytraceMonteCarloPipeline::RaytraceMonteCarloPipeline(WGPUDevice device, Shader
     pipelineDescriptor.compute.constants = nullptr;
 
     pipeline_ = wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
+
+    bindGroupLayouts[3] = adaptiveSamplingBindGroupLayout;
+
+    adaptivePipelineLayout_ = wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDescriptor);
+
+    pipelineDescriptor.label = "raytrace_monte_carlo_adaptive";
+    pipelineDescriptor.layout = adaptivePipelineLayout_;
+    pipelineDescriptor.compute.entryPoint = "computeAdaptive";
+
+    adaptivePipeline_ = wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
 }
 
 RaytraceMonteCarloPipeline::~RaytraceMonteCarloPipeline()
 {
+    wgpuComputePipelineRelease(adaptivePipeline_);
     wgpuComputePipelineRelease(pipeline_);
+    wgpuPipelineLayoutRelease(adaptivePipelineLayout_);
     wgpuPipelineLayoutRelease(pipelineLayout_);
 }
 
@@ -59,3 +72,23 @@ void renderRaytraceMonteCarlo(WGPUCommandEncoder commandEncoder, WGPUTextureView
     wgpuComputePassEncoderEnd(computePassEncoder);
     wgpuComputePassEncoderRelease(computePassEncoder);
 }
+
+void renderRaytraceMonteCarloAdaptive(WGPUCommandEncoder commandEncoder, WGPUComputePipeline raytraceMonteCarloAdaptivePipeline,
+    WGPUBindGroup cameraBindGroup, SceneData const & sceneData, WGPUBindGroup adaptiveSamplingBindGroup, WGPUBuffer dispatchArgsBuffer)
+{
+    WGPUComputePassDescriptor computePassDescriptor;
+    computePassDescriptor.nextInChain = nullptr;
+    computePassDescriptor.label = "raytrace_monte_carlo_adaptive";
+    computePassDescriptor.timestampWrites = nullptr;
+
+    WGPUComputePassEncoder computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, cameraBindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 1, sceneData.geometryBindGroup(), 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 2, sceneData.materialBindGroup(), 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePassEncoder, 3, adaptiveSamplingBindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetPipeline(computePassEncoder, raytraceMonteCarloAdaptivePipeline);
+    wgpuComputePassEncoderDispatchWorkgroupsIndirect(computePassEncoder, dispatchArgsBuffer, 0);
+    wgpuComputePassEncoderEnd(computePassEncoder);
+    wgpuComputePassEncoderRelease(computePassEncoder);
+}
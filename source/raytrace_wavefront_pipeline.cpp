@@ -0,0 +1,475 @@
+#include <webgpu-raytracer/raytrace_wavefront_pipeline.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+namespace
+{
+
+    constexpr std::uint32_t WORKGROUP_SIZE = 64;
+
+    // Uniform buffer dynamic offsets must be aligned to
+    // minUniformBufferOffsetAlignment, which is at most 256
+    constexpr std::uint32_t PARAMS_STRIDE = 256;
+
+    // WavefrontParams in wavefront.wgsl
+    struct Params
+    {
+        std::uint32_t pixelOffset;
+        std::uint32_t pathCount;
+        std::uint32_t depth;
+        std::uint32_t inputQueue;
+        std::uint32_t dispatchQueue;
+        std::uint32_t dispatchSlot;
+        std::uint32_t resetQueueMask;
+        std::uint32_t flags;
+    };
+
+    // WavefrontParams.flags in wavefront.wgsl
+    constexpr std::uint32_t SORT_BY_MATERIAL_FLAG = 1;
+
+    // SORT_BIN_COUNT in wavefront.wgsl
+    constexpr std::uint32_t SORT_BIN_COUNT = 1024;
+    constexpr std::uint32_t SORT_BINS_SIZE = 2 * SORT_BIN_COUNT * sizeof(std::uint32_t);
+
+    // Queue indices in wavefront.wgsl
+    constexpr std::uint32_t CONNECT_QUEUE = 2;
+    constexpr std::uint32_t QUEUE_COUNT = 4;
+
+    // Indirect dispatch arguments for the ray queue and the connect queue
+    constexpr std::uint32_t RAY_DISPATCH_SLOT = 0;
+    constexpr std::uint32_t CONNECT_DISPATCH_SLOT = 1;
+    constexpr std::uint32_t DISPATCH_ARGS_SIZE = 3 * sizeof(std::uint32_t);
+
+    // Generate & accumulate, then prepare the extend/shade and the connect dispatches per bounce
+    std::uint32_t paramsPerChunk(std::uint32_t maxPathDepth)
+    {
+        return 1 + 2 * maxPathDepth;
+    }
+
+    // Sizes of PathState, QueuedRay, QueuedHit and PendingBounce in raytrace_wavefront.wgsl
+    constexpr std::uint32_t PATH_STATE_SIZE = 48;
+    constexpr std::uint32_t QUEUED_RAY_SIZE = 32;
+    constexpr std::uint32_t QUEUED_HIT_SIZE = 32;
+    constexpr std::uint32_t PENDING_BOUNCE_SIZE = 64;
+
+    enum StateBinding : std::uint32_t
+    {
+        AccumulationBinding,
+        ParamsBinding,
+        PathsBinding,
+        RayQueuesBinding,
+        HitsBinding,
+        PendingBouncesBinding,
+        QueueCountsBinding,
+        SortBinsBinding,
+        SortedHitsBinding,
+        StateBindingCount,
+    };
+
+    enum DispatchBinding : std::uint32_t
+    {
+        DispatchParamsBinding,
+        DispatchQueueCountsBinding,
+        DispatchArgsBinding,
+        DispatchBindingCount,
+    };
+
+    WGPUBindGroupLayoutEntry bufferLayoutEntry(std::uint32_t binding, WGPUBufferBindingType type, bool hasDynamicOffset)
+    {
+        WGPUBindGroupLayoutEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.visibility = WGPUShaderStage_Compute;
+        entry.buffer.nextInChain = nullptr;
+        entry.buffer.type = type;
+        entry.buffer.hasDynamicOffset = hasDynamicOffset;
+        entry.buffer.minBindingSize = 0;
+        entry.sampler.nextInChain = nullptr;
+        entry.sampler.type = WGPUSamplerBindingType_Undefined;
+        entry.texture.nextInChain = nullptr;
+        entry.texture.sampleType = WGPUTextureSampleType_Undefined;
+        entry.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+        entry.texture.multisampled = false;
+        entry.storageTexture.nextInChain = nullptr;
+        entry.storageTexture.access = WGPUStorageTextureAccess_Undefined;
+        entry.storageTexture.format = WGPUTextureFormat_Undefined;
+        entry.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+        return entry;
+    }
+
+    WGPUBindGroupEntry bufferEntry(std::uint32_t binding, WGPUBuffer buffer, std::uint64_t size)
+    {
+        WGPUBindGroupEntry entry;
+        entry.nextInChain = nullptr;
+        entry.binding = binding;
+        entry.buffer = buffer;
+        entry.offset = 0;
+        entry.size = size;
+        entry.sampler = nullptr;
+        entry.textureView = nullptr;
+        return entry;
+    }
+
+    WGPUBuffer createBuffer(WGPUDevice device, char const * label, WGPUBufferUsageFlags usage, std::uint64_t size)
+    {
+        WGPUBufferDescriptor bufferDescriptor;
+        bufferDescriptor.nextInChain = nullptr;
+        bufferDescriptor.label = label;
+        bufferDescriptor.usage = usage;
+        bufferDescriptor.size = size;
+        bufferDescriptor.mappedAtCreation = false;
+
+        return wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+    }
+
+    WGPUBindGroupLayout createBindGroupLayout(WGPUDevice device, char const * label, WGPUBindGroupLayoutEntry const * entries, std::uint32_t entryCount)
+    {
+        WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
+        bindGroupLayoutDescriptor.nextInChain = nullptr;
+        bindGroupLayoutDescriptor.label = label;
+        bindGroupLayoutDescriptor.entryCount = entryCount;
+        bindGroupLayoutDescriptor.entries = entries;
+
+        return wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
+    }
+
+    WGPUPipelineLayout createPipelineLayout(WGPUDevice device, WGPUBindGroupLayout const * bindGroupLayouts, std::uint32_t bindGroupLayoutCount)
+    {
+        WGPUPipelineLayoutDescriptor pipelineLayoutDescriptor;
+        pipelineLayoutDescriptor.nextInChain = nullptr;
+        pipelineLayoutDescriptor.label = nullptr;
+        pipelineLayoutDescriptor.bindGroupLayoutCount = bindGroupLayoutCount;
+        pipelineLayoutDescriptor.bindGroupLayouts = bindGroupLayouts;
+
+        return wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDescriptor);
+    }
+
+    WGPUComputePipeline createPipeline(WGPUDevice device, WGPUPipelineLayout pipelineLayout, WGPUShaderModule shaderModule, char const * entryPoint)
+    {
+        WGPUComputePipelineDescriptor pipelineDescriptor;
+        pipelineDescriptor.nextInChain = nullptr;
+        pipelineDescriptor.label = entryPoint;
+        pipelineDescriptor.layout = pipelineLayout;
+        pipelineDescriptor.compute.nextInChain = nullptr;
+        pipelineDescriptor.compute.module = shaderModule;
+        pipelineDescriptor.compute.entryPoint = entryPoint;
+        pipelineDescriptor.compute.constantCount = 0;
+        pipelineDescriptor.compute.constants = nullptr;
+
+        return wgpuDeviceCreateComputePipeline(device, &pipelineDescriptor);
+    }
+
+}
+
+RaytraceWavefrontPipeline::RaytraceWavefrontPipeline(WGPUDevice device, WGPUQueue queue, ShaderRegistry & shaderRegistry, WGPUBindGroupLayout cameraBindGroupLayout,
+    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout, WGPUTextureFormat accumulationTextureFormat)
+    : device_(device)
+    , queue_(queue)
+{
+    WGPUBindGroupLayoutEntry stateLayoutEntries[StateBindingCount];
+    stateLayoutEntries[AccumulationBinding] = bufferLayoutEntry(AccumulationBinding, WGPUBufferBindingType_Undefined, false);
+    stateLayoutEntries[AccumulationBinding].storageTexture.access = WGPUStorageTextureAccess_ReadWrite;
+    stateLayoutEntries[AccumulationBinding].storageTexture.format = accumulationTextureFormat;
+    stateLayoutEntries[AccumulationBinding].storageTexture.viewDimension = WGPUTextureViewDimension_2D;
+    stateLayoutEntries[ParamsBinding] = bufferLayoutEntry(ParamsBinding, WGPUBufferBindingType_Uniform, true);
+    for (std::uint32_t binding = PathsBinding; binding < StateBindingCount; ++binding)
+        stateLayoutEntries[binding] = bufferLayoutEntry(binding, WGPUBufferBindingType_Storage, false);
+
+    stateBindGroupLayout_ = createBindGroupLayout(device, "wavefront_state", stateLayoutEntries, StateBindingCount);
+
+    // The dispatch arguments can't be bound to the kernels that are dispatched indirectly,
+    // since a buffer can't be both writable storage and indirect in the same dispatch
+    WGPUBindGroupLayoutEntry dispatchLayoutEntries[DispatchBindingCount];
+    dispatchLayoutEntries[DispatchParamsBinding] = bufferLayoutEntry(DispatchParamsBinding, WGPUBufferBindingType_Uniform, true);
+    dispatchLayoutEntries[DispatchQueueCountsBinding] = bufferLayoutEntry(DispatchQueueCountsBinding, WGPUBufferBindingType_Storage, false);
+    dispatchLayoutEntries[DispatchArgsBinding] = bufferLayoutEntry(DispatchArgsBinding, WGPUBufferBindingType_Storage, false);
+
+    dispatchBindGroupLayout_ = createBindGroupLayout(device, "wavefront_dispatch", dispatchLayoutEntries, DispatchBindingCount);
+
+    WGPUBindGroupLayout bindGroupLayouts[4]
+    {
+        cameraBindGroupLayout,
+        geometryBindGroupLayout,
+        materialBindGroupLayout,
+        stateBindGroupLayout_,
+    };
+
+    pipelineLayout_ = createPipelineLayout(device, bindGroupLayouts, 4);
+    dispatchPipelineLayout_ = createPipelineLayout(device, &dispatchBindGroupLayout_, 1);
+
+    WGPUShaderModule shaderModule = shaderRegistry.loadShaderModule("raytrace_wavefront");
+
+    generatePipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "generate");
+    extendPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "extend");
+    shadePipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "shade");
+    connectPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "connect");
+    accumulatePipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "accumulate");
+    scanSortBinsPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "scanSortBins");
+    scatterSortedHitsPipeline_ = createPipeline(device, pipelineLayout_, shaderModule, "scatterSortedHits");
+
+    WGPUShaderModule dispatchShaderModule = shaderRegistry.loadShaderModule("wavefront_dispatch");
+
+    prepareDispatchPipeline_ = createPipeline(device, dispatchPipelineLayout_, dispatchShaderModule, "prepareDispatch");
+
+    queueCountsBuffer_ = createBuffer(device, "wavefrontQueueCounts", WGPUBufferUsage_Storage, QUEUE_COUNT * sizeof(std::uint32_t));
+    dispatchArgsBuffer_ = createBuffer(device, "wavefrontDispatchArgs", WGPUBufferUsage_Storage | WGPUBufferUsage_Indirect, 2 * DISPATCH_ARGS_SIZE);
+    sortBinsBuffer_ = createBuffer(device, "wavefrontSortBins", WGPUBufferUsage_Storage, SORT_BINS_SIZE);
+}
+
+RaytraceWavefrontPipeline::~RaytraceWavefrontPipeline()
+{
+    releaseState();
+
+    wgpuBufferRelease(sortBinsBuffer_);
+    wgpuBufferRelease(dispatchArgsBuffer_);
+    wgpuBufferRelease(queueCountsBuffer_);
+    wgpuComputePipelineRelease(prepareDispatchPipeline_);
+    wgpuComputePipelineRelease(scatterSortedHitsPipeline_);
+    wgpuComputePipelineRelease(scanSortBinsPipeline_);
+    wgpuComputePipelineRelease(accumulatePipeline_);
+    wgpuComputePipelineRelease(connectPipeline_);
+    wgpuComputePipelineRelease(shadePipeline_);
+    wgpuComputePipelineRelease(extendPipeline_);
+    wgpuComputePipelineRelease(generatePipeline_);
+    wgpuPipelineLayoutRelease(dispatchPipelineLayout_);
+    wgpuPipelineLayoutRelease(pipelineLayout_);
+    wgpuBindGroupLayoutRelease(dispatchBindGroupLayout_);
+    wgpuBindGroupLayoutRelease(stateBindGroupLayout_);
+}
+
+void RaytraceWavefrontPipeline::releaseState()
+{
+    if (!stateBindGroup_)
+        return;
+
+    wgpuBindGroupRelease(dispatchBindGroup_);
+    wgpuBindGroupRelease(stateBindGroup_);
+    wgpuBufferRelease(sortedHitsBuffer_);
+    wgpuBufferRelease(pendingBouncesBuffer_);
+    wgpuBufferRelease(hitsBuffer_);
+    wgpuBufferRelease(rayQueuesBuffer_);
+    wgpuBufferRelease(pathsBuffer_);
+    wgpuBufferRelease(paramsBuffer_);
+
+    stateBindGroup_ = nullptr;
+    paramsBuffer_ = nullptr;
+}
+
+void RaytraceWavefrontPipeline::recreateState(WGPUTextureView accumulationTextureView, glm::uvec2 const & screenSize, std::uint32_t maxPathDepth)
+{
+    releaseState();
+
+    accumulationTextureView_ = accumulationTextureView;
+    screenSize_ = screenSize;
+    maxPathDepth_ = maxPathDepth;
+
+    std::uint32_t const pixelCount = screenSize.x * screenSize.y;
+    std::uint32_t const pathCount = std::clamp<std::uint32_t>(pixelCount, 1, MAX_PATH_COUNT);
+    std::uint32_t const chunkCount = std::max<std::uint32_t>(1, (pixelCount + MAX_PATH_COUNT - 1) / MAX_PATH_COUNT);
+
+    paramsBuffer_ = createBuffer(device_, "wavefrontParams", WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform, chunkCount * paramsPerChunk(maxPathDepth_) * PARAMS_STRIDE);
+    writeParams();
+
+    pathsBuffer_ = createBuffer(device_, "wavefrontPaths", WGPUBufferUsage_Storage, std::uint64_t(pathCount) * PATH_STATE_SIZE);
+    rayQueuesBuffer_ = createBuffer(device_, "wavefrontRayQueues", WGPUBufferUsage_Storage, 2 * std::uint64_t(pathCount) * QUEUED_RAY_SIZE);
+    hitsBuffer_ = createBuffer(device_, "wavefrontHits", WGPUBufferUsage_Storage, std::uint64_t(pathCount) * QUEUED_HIT_SIZE);
+    pendingBouncesBuffer_ = createBuffer(device_, "wavefrontPendingBounces", WGPUBufferUsage_Storage, std::uint64_t(pathCount) * PENDING_BOUNCE_SIZE);
+    sortedHitsBuffer_ = createBuffer(device_, "wavefrontSortedHits", WGPUBufferUsage_Storage, std::uint64_t(pathCount) * sizeof(std::uint32_t));
+
+    WGPUBindGroupEntry stateEntries[StateBindingCount];
+    stateEntries[AccumulationBinding] = bufferEntry(AccumulationBinding, nullptr, 0);
+    stateEntries[AccumulationBinding].textureView = accumulationTextureView;
+    stateEntries[ParamsBinding] = bufferEntry(ParamsBinding, paramsBuffer_, sizeof(Params));
+    stateEntries[PathsBinding] = bufferEntry(PathsBinding, pathsBuffer_, wgpuBufferGetSize(pathsBuffer_));
+    stateEntries[RayQueuesBinding] = bufferEntry(RayQueuesBinding, rayQueuesBuffer_, wgpuBufferGetSize(rayQueuesBuffer_));
+    stateEntries[HitsBinding] = bufferEntry(HitsBinding, hitsBuffer_, wgpuBufferGetSize(hitsBuffer_));
+    stateEntries[PendingBouncesBinding] = bufferEntry(PendingBouncesBinding, pendingBouncesBuffer_, wgpuBufferGetSize(pendingBouncesBuffer_));
+    stateEntries[QueueCountsBinding] = bufferEntry(QueueCountsBinding, queueCountsBuffer_, wgpuBufferGetSize(queueCountsBuffer_));
+    stateEntries[SortBinsBinding] = bufferEntry(SortBinsBinding, sortBinsBuffer_, SORT_BINS_SIZE);
+    stateEntries[SortedHitsBinding] = bufferEntry(SortedHitsBinding, sortedHitsBuffer_, wgpuBufferGetSize(sortedHitsBuffer_));
+
+    WGPUBindGroupDescriptor bindGroupDescriptor;
+    bindGroupDescriptor.nextInChain = nullptr;
+    bindGroupDescriptor.label = "wavefront_state";
+    bindGroupDescriptor.layout = stateBindGroupLayout_;
+    bindGroupDescriptor.entryCount = StateBindingCount;
+    bindGroupDescriptor.entries = stateEntries;
+
+    stateBindGroup_ = wgpuDeviceCreateBindGroup(device_, &bindGroupDescriptor);
+
+    WGPUBindGroupEntry dispatchEntries[DispatchBindingCount];
+    dispatchEntries[DispatchParamsBinding] = bufferEntry(DispatchParamsBinding, paramsBuffer_, sizeof(Params));
+    dispatchEntries[DispatchQueueCountsBinding] = bufferEntry(DispatchQueueCountsBinding, queueCountsBuffer_, wgpuBufferGetSize(queueCountsBuffer_));
+    dispatchEntries[DispatchArgsBinding] = bufferEntry(DispatchArgsBinding, dispatchArgsBuffer_, wgpuBufferGetSize(dispatchArgsBuffer_));
+
+    bindGroupDescriptor.label = "wavefront_dispatch";
+    bindGroupDescriptor.layout = dispatchBindGroupLayout_;
+    bindGroupDescriptor.entryCount = DispatchBindingCount;
+    bindGroupDescriptor.entries = dispatchEntries;
+
+    dispatchBindGroup_ = wgpuDeviceCreateBindGroup(device_, &bindGroupDescriptor);
+}
+
+void RaytraceWavefrontPipeline::writeParams()
+{
+    std::uint32_t const pixelCount = screenSize_.x * screenSize_.y;
+    std::uint32_t const flags = sortByMaterial_ ? SORT_BY_MATERIAL_FLAG : 0;
+    std::uint32_t const chunkCount = std::max<std::uint32_t>(1, (pixelCount + MAX_PATH_COUNT - 1) / MAX_PATH_COUNT);
+
+    std::uint32_t const chunkParamsCount = paramsPerChunk(maxPathDepth_);
+
+    std::vector<char> params(chunkCount * chunkParamsCount * PARAMS_STRIDE, 0);
+    for (std::uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        std::uint32_t const pixelOffset = chunk * MAX_PATH_COUNT;
+        std::uint32_t const chunkPathCount = std::min(pixelCount - pixelOffset, MAX_PATH_COUNT);
+
+        auto store = [&](std::uint32_t index, Params const & value)
+        {
+            std::memcpy(params.data() + (chunk * chunkParamsCount + index) * PARAMS_STRIDE, &value, sizeof(value));
+        };
+
+        store(0, Params{pixelOffset, chunkPathCount, 0, 0, 0, 0, 0, flags});
+
+        for (std::uint32_t depth = 0; depth < maxPathDepth_; ++depth)
+        {
+            std::uint32_t const inputQueue = depth % 2;
+            std::uint32_t const outputQueue = 1 - inputQueue;
+
+            // The output queues are empty at this point, their contents
+            // were consumed during the previous bounce
+            store(1 + 2 * depth, Params{pixelOffset, chunkPathCount, depth, inputQueue,
+                inputQueue, RAY_DISPATCH_SLOT, (1u << outputQueue) | (1u << CONNECT_QUEUE), flags});
+            store(2 + 2 * depth, Params{pixelOffset, chunkPathCount, depth, inputQueue,
+                CONNECT_QUEUE, CONNECT_DISPATCH_SLOT, 0, flags});
+        }
+    }
+
+    wgpuQueueWriteBuffer(queue_, paramsBuffer_, 0, params.data(), params.size());
+}
+
+void RaytraceWavefrontPipeline::setSortByMaterial(bool sortByMaterial)
+{
+    if (sortByMaterial == sortByMaterial_)
+        return;
+
+    sortByMaterial_ = sortByMaterial;
+
+    if (paramsBuffer_)
+        writeParams();
+}
+
+std::uint32_t RaytraceWavefrontPipeline::timestampCount(glm::uvec2 const & screenSize, std::uint32_t maxPathDepth) const
+{
+    std::uint32_t const chunkCount = (screenSize.x * screenSize.y + MAX_PATH_COUNT - 1) / MAX_PATH_COUNT;
+
+    // Generate & accumulate per chunk, extend, shade, connect and optionally sort per bounce
+    return chunkCount * (2 + (sortByMaterial_ ? 4 : 3) * maxPathDepth);
+}
+
+void RaytraceWavefrontPipeline::render(WGPUCommandEncoder commandEncoder, WGPUTextureView accumulationTextureView, WGPUBindGroup cameraBindGroup,
+    SceneData const & sceneData, glm::uvec2 const & screenSize, std::uint32_t maxPathDepth, FrameProfiler * frameProfiler)
+{
+    if (!stateBindGroup_ || accumulationTextureView != accumulationTextureView_ || screenSize != screenSize_ || maxPathDepth != maxPathDepth_)
+        recreateState(accumulationTextureView, screenSize, maxPathDepth);
+
+    std::uint32_t const pixelCount = screenSize.x * screenSize.y;
+    std::uint32_t const chunkCount = (pixelCount + MAX_PATH_COUNT - 1) / MAX_PATH_COUNT;
+
+    // Every stage is a separate pass so that it can be profiled, the times of
+    // a stage are summed over all bounces. Within a pass, every dispatch is a
+    // separate usage scope, so the queues written by one kernel are visible to the next one
+    WGPUComputePassEncoder computePassEncoder = nullptr;
+
+    auto beginStage = [&]
+    {
+        WGPUComputePassDescriptor computePassDescriptor;
+        computePassDescriptor.nextInChain = nullptr;
+        computePassDescriptor.label = "raytrace_wavefront";
+        computePassDescriptor.timestampWrites = nullptr;
+
+        computePassEncoder = wgpuCommandEncoderBeginComputePass(commandEncoder, &computePassDescriptor);
+
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 1, sceneData.geometryBindGroup(), 0, nullptr);
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 2, sceneData.materialBindGroup(), 0, nullptr);
+    };
+
+    auto endStage = [&](char const * name)
+    {
+        wgpuComputePassEncoderEnd(computePassEncoder);
+        wgpuComputePassEncoderRelease(computePassEncoder);
+
+        if (frameProfiler)
+            frameProfiler->timestamp(name);
+    };
+
+    auto bindState = [&](WGPUComputePipeline pipeline, std::uint32_t paramsIndex)
+    {
+        std::uint32_t const dynamicOffset = paramsIndex * PARAMS_STRIDE;
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, cameraBindGroup, 0, nullptr);
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 3, stateBindGroup_, 1, &dynamicOffset);
+        wgpuComputePassEncoderSetPipeline(computePassEncoder, pipeline);
+    };
+
+    auto prepareDispatch = [&](std::uint32_t paramsIndex)
+    {
+        std::uint32_t const dynamicOffset = paramsIndex * PARAMS_STRIDE;
+        wgpuComputePassEncoderSetBindGroup(computePassEncoder, 0, dispatchBindGroup_, 1, &dynamicOffset);
+        wgpuComputePassEncoderSetPipeline(computePassEncoder, prepareDispatchPipeline_);
+        wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, 1, 1, 1);
+    };
+
+    auto dispatchIndirect = [&](WGPUComputePipeline pipeline, std::uint32_t paramsIndex, std::uint32_t dispatchSlot)
+    {
+        bindState(pipeline, paramsIndex);
+        wgpuComputePassEncoderDispatchWorkgroupsIndirect(computePassEncoder, dispatchArgsBuffer_, dispatchSlot * DISPATCH_ARGS_SIZE);
+    };
+
+    for (std::uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        std::uint32_t const chunkParams = chunk * paramsPerChunk(maxPathDepth);
+        std::uint32_t const chunkPathCount = std::min(pixelCount - chunk * MAX_PATH_COUNT, MAX_PATH_COUNT);
+        std::uint32_t const groupCount = (chunkPathCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+
+        beginStage();
+        bindState(generatePipeline_, chunkParams);
+        wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, groupCount, 1, 1);
+        endStage("wavefront_generate");
+
+        for (std::uint32_t depth = 0; depth < maxPathDepth; ++depth)
+        {
+            std::uint32_t const rayParams = chunkParams + 1 + 2 * depth;
+            std::uint32_t const connectParams = chunkParams + 2 + 2 * depth;
+
+            beginStage();
+            prepareDispatch(rayParams);
+            dispatchIndirect(extendPipeline_, rayParams, RAY_DISPATCH_SLOT);
+            endStage("wavefront_extend");
+
+            if (sortByMaterial_)
+            {
+                beginStage();
+                bindState(scanSortBinsPipeline_, rayParams);
+                wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, 1, 1, 1);
+                dispatchIndirect(scatterSortedHitsPipeline_, rayParams, RAY_DISPATCH_SLOT);
+                endStage("wavefront_sort");
+            }
+
+            beginStage();
+            dispatchIndirect(shadePipeline_, rayParams, RAY_DISPATCH_SLOT);
+            endStage("wavefront_shade");
+
+            beginStage();
+            prepareDispatch(connectParams);
+            dispatchIndirect(connectPipeline_, connectParams, CONNECT_DISPATCH_SLOT);
+            endStage("wavefront_connect");
+        }
+
+        beginStage();
+        bindState(accumulatePipeline_, chunkParams);
+        wgpuComputePassEncoderDispatchWorkgroups(computePassEncoder, groupCount, 1, 1);
+        endStage("wavefront_accumulate");
+    }
+}
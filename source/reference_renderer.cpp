@@ -0,0 +1,995 @@
+#include <webgpu-raytracer/reference_renderer.hpp>
+#include <webgpu-raytracer/color.hpp>
+#include <webgpu-raytracer/thread_pool.hpp>
+#include <webgpu-raytracer/timer.hpp>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include <iostream>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+// The functions below are ports of the WGSL kernels (raytrace_common.wgsl,
+// bvh_traverse.wgsl, random.wgsl, brdf.wgsl, material.wgsl, env_map.wgsl,
+// env_map_sampling.wgsl and raytrace_monte_carlo.wgsl) with the same names,
+// and must be kept in sync with them
+
+namespace
+{
+
+    constexpr float PI = glm::pi<float>();
+
+    // Same as in env_map.wgsl
+    constexpr float MAX_ENV_MAP_INTENSITY = 100.f;
+
+    // Same as in geometry.wgsl
+    constexpr std::uint32_t MAX_BVH_DEPTH = 64;
+    constexpr std::uint32_t MAX_BVH_STACK_SIZE = MAX_BVH_DEPTH + 1;
+    constexpr std::uint32_t BVH_NODE_AXIS_MASK = 3u << 30;
+    constexpr std::uint32_t BVH_NODE_AXIS_SHIFT = 30;
+
+    constexpr std::uint32_t TILE_SIZE = 16;
+
+    std::uint32_t pcg(std::uint32_t n)
+    {
+        std::uint32_t h = n * 747796405u + 2891336453u;
+        h = ((h >> ((h >> 28u) + 4u)) ^ h) * 277803737u;
+        return (h >> 22u) ^ h;
+    }
+
+    struct RandomState
+    {
+        std::uint32_t value = 0;
+    };
+
+    void initRandom(RandomState & state, std::uint32_t value)
+    {
+        state.value ^= value;
+        state.value = pcg(state.value);
+    }
+
+    float uniformFloat(RandomState & state)
+    {
+        state.value = pcg(state.value);
+        return float(state.value) / 4294967295.f;
+    }
+
+    // Heaviside step function
+    float chiPlus(float x)
+    {
+        return (x >= 0.f) ? 1.f : 0.f;
+    }
+
+    glm::mat3 completeBasis(glm::vec3 const & Z)
+    {
+        glm::vec3 X = (std::abs(Z.x) > 0.5f) ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(1.f, 0.f, 0.f);
+        X -= Z * glm::dot(X, Z);
+        X = glm::normalize(X);
+        glm::vec3 const Y = glm::cross(Z, X);
+        return glm::mat3(X, Y, Z);
+    }
+
+    glm::vec3 cosineHemisphere(RandomState & state, glm::vec3 const & normal)
+    {
+        float const theta = std::acos(std::sqrt(uniformFloat(state)));
+        float const phi = 2.f * PI * uniformFloat(state);
+
+        auto const basis = completeBasis(normal);
+        return std::sin(theta) * (std::cos(phi) * basis[0] + std::sin(phi) * basis[1]) + std::cos(theta) * basis[2];
+    }
+
+    struct Ray
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    Ray computeCameraRay(glm::vec3 const & cameraPosition, glm::mat4 const & viewProjectionInverseMatrix, glm::vec2 const & screenSpacePosition)
+    {
+        glm::vec4 const p = viewProjectionInverseMatrix * glm::vec4(screenSpacePosition, 0.f, 1.f);
+        return {cameraPosition, glm::normalize(glm::vec3(p) / p.w - cameraPosition)};
+    }
+
+    float det(glm::vec3 const & v0, glm::vec3 const & v1, glm::vec3 const & v2)
+    {
+        return glm::dot(v0, glm::cross(v1, v2));
+    }
+
+    struct TriangleHit
+    {
+        float distance;
+        glm::vec2 uv;
+        bool intersects;
+    };
+
+    TriangleHit intersectRayTriangle(Ray const & ray, glm::vec3 const & p0, glm::vec3 const & p1, glm::vec3 const & p2)
+    {
+        // Solve origin + t * direction = p0 + u * (p1 - p0) + v * (p2 - p0) using Cramer's rule
+        glm::vec3 const column1 = p0 - p1;
+        glm::vec3 const column2 = p0 - p2;
+        glm::vec3 const rhs = p0 - ray.origin;
+
+        float const d = det(ray.direction, column1, column2);
+        glm::vec3 const solution = glm::vec3(det(rhs, column1, column2), det(ray.direction, rhs, column2), det(ray.direction, column1, rhs)) / d;
+
+        bool const intersects = solution.x >= 0.f && solution.y >= 0.f && solution.z >= 0.f && (solution.y + solution.z) <= 1.f;
+
+        return {solution.x, {solution.y, solution.z}, intersects};
+    }
+
+    struct AABBHit
+    {
+        float distance;
+        bool intersects;
+    };
+
+    AABBHit intersectRayAABB(Ray const & ray, glm::vec3 const & aabbMin, glm::vec3 const & aabbMax)
+    {
+        glm::vec3 const tMin = (aabbMin - ray.origin) / ray.direction;
+        glm::vec3 const tMax = (aabbMax - ray.origin) / ray.direction;
+
+        glm::vec3 const tNear = glm::min(tMin, tMax);
+        glm::vec3 const tFar = glm::max(tMin, tMax);
+
+        float const t0 = std::max(tNear.x, std::max(tNear.y, tNear.z));
+        float const t1 = std::min(tFar.x, std::min(tFar.y, tFar.z));
+
+        return {std::max(t0, 0.f), t1 >= t0 && t1 >= 0.f};
+    }
+
+    struct SceneIntersection
+    {
+        bool intersects = false;
+        float distance = 1e30f;
+        std::uint32_t triangleID = 0;
+        std::array<glm::vec3, 3> vertices{};
+        glm::vec2 uv{0.f};
+    };
+
+    glm::vec3 vertexPosition(SceneGeometryView const & geometry, std::uint32_t index)
+    {
+        return glm::vec3(geometry.vertexPositions[index]);
+    }
+
+    // Filled by intersectScene when given
+    struct TraversalRecord
+    {
+        // IDs of all fetched nodes in traversal order,
+        // their count is visitedNodeCount in bvh_traverse.wgsl
+        std::vector<std::uint32_t> visitedNodes;
+
+        std::uint32_t testedTriangleCount = 0;
+
+        void clear()
+        {
+            visitedNodes.clear();
+            testedTriangleCount = 0;
+        }
+    };
+
+    SceneIntersection intersectScene(SceneGeometryView const & geometry, Ray const & ray, TraversalRecord * record = nullptr)
+    {
+        SceneIntersection result;
+
+        if (geometry.bvhNodes.empty())
+            return result;
+
+        std::uint32_t nodeStack[MAX_BVH_STACK_SIZE];
+        std::uint32_t nodeStackSize = 0;
+        std::uint32_t currentNodeID = 0;
+
+        while (true)
+        {
+            if (record)
+                record->visitedNodes.push_back(currentNodeID);
+
+            auto const & node = geometry.bvhNodes[currentNodeID];
+
+            auto const hit = intersectRayAABB(ray, node.aabbMin, node.aabbMax);
+
+            if (hit.intersects && hit.distance <= result.distance)
+            {
+                if (node.triangleCount == 0)
+                {
+                    std::uint32_t const firstChild = node.leftChildOrFirstTriangle & (~BVH_NODE_AXIS_MASK);
+
+                    // Ordered traversal: visit closer child first (i.e. put closer child higher on the stack)
+
+                    std::uint32_t const nodeAxis = node.leftChildOrFirstTriangle >> BVH_NODE_AXIS_SHIFT;
+
+                    std::uint32_t const positive = (ray.direction[nodeAxis] > 0.f) ? 1 : 0;
+
+                    nodeStack[nodeStackSize++] = firstChild + positive;
+                    currentNodeID = firstChild + (1 - positive);
+                    continue;
+                }
+
+                if (record)
+                    record->testedTriangleCount += node.triangleCount;
+
+                for (std::uint32_t i = 0; i < node.triangleCount; ++i)
+                {
+                    std::uint32_t const triangleID = node.leftChildOrFirstTriangle + i;
+
+                    glm::vec3 const v0 = vertexPosition(geometry, 3 * triangleID + 0);
+                    glm::vec3 const v1 = vertexPosition(geometry, 3 * triangleID + 1);
+                    glm::vec3 const v2 = vertexPosition(geometry, 3 * triangleID + 2);
+
+                    auto const triangleHit = intersectRayTriangle(ray, v0, v1, v2);
+                    if (triangleHit.intersects && triangleHit.distance < result.distance)
+                    {
+                        result.intersects = true;
+                        result.distance = triangleHit.distance;
+                        result.triangleID = triangleID;
+                        result.vertices = {v0, v1, v2};
+                        result.uv = triangleHit.uv;
+                    }
+                }
+            }
+
+            if (nodeStackSize == 0)
+                break;
+
+            currentNodeID = nodeStack[--nodeStackSize];
+        }
+
+        return result;
+    }
+
+    // The first element of emissiveTriangles is the triangle count, see geometry.wgsl
+    std::uint32_t emissiveTriangleCount(SceneGeometryView const & geometry)
+    {
+        return geometry.emissiveTriangles[0].index;
+    }
+
+    float lightSamplingProbability(SceneGeometryView const & geometry, Ray const & ray)
+    {
+        if (emissiveTriangleCount(geometry) == 0)
+            return 0.f;
+
+        float result = 0.f;
+
+        std::uint32_t nodeStack[MAX_BVH_STACK_SIZE];
+        std::uint32_t nodeStackSize = 0;
+        std::uint32_t currentNodeID = 0;
+
+        while (true)
+        {
+            auto const & node = geometry.emissiveBvhNodes[currentNodeID];
+
+            if (intersectRayAABB(ray, node.aabbMin, node.aabbMax).intersects)
+            {
+                if (node.triangleCount == 0)
+                {
+                    std::uint32_t const firstChild = node.leftChildOrFirstTriangle & (~BVH_NODE_AXIS_MASK);
+                    std::uint32_t const nodeAxis = node.leftChildOrFirstTriangle >> BVH_NODE_AXIS_SHIFT;
+                    std::uint32_t const positive = (ray.direction[nodeAxis] > 0.f) ? 1 : 0;
+
+                    nodeStack[nodeStackSize++] = firstChild + positive;
+                    currentNodeID = firstChild + (1 - positive);
+                    continue;
+                }
+
+                for (std::uint32_t i = 0; i < node.triangleCount; ++i)
+                {
+                    auto const & triangle = geometry.emissiveTriangles[1 + node.leftChildOrFirstTriangle + i];
+
+                    glm::vec3 const v0 = vertexPosition(geometry, 3 * triangle.index + 0);
+                    glm::vec3 const v1 = vertexPosition(geometry, 3 * triangle.index + 1);
+                    glm::vec3 const v2 = vertexPosition(geometry, 3 * triangle.index + 2);
+
+                    auto const hit = intersectRayTriangle(ray, v0, v1, v2);
+                    if (hit.intersects)
+                    {
+                        glm::vec3 const c = glm::cross(v1 - v0, v2 - v0);
+                        float const l = glm::length(c);
+                        glm::vec3 const n = c / l;
+
+                        float const area = l * 0.5f;
+
+                        result += (1.f / area) * hit.distance * hit.distance / std::max(1e-8f, std::abs(glm::dot(ray.direction, n))) * triangle.probability;
+                    }
+                }
+            }
+
+            if (nodeStackSize == 0)
+                break;
+
+            currentNodeID = nodeStack[--nodeStackSize];
+        }
+
+        return result;
+    }
+
+    // Schlick's approximation for Fresnel equations
+    glm::vec3 fresnel(glm::vec3 const & f0, glm::vec3 const & f90, float VdotH)
+    {
+        return f0 + (f90 - f0) * std::pow(std::max(0.f, 1.f - std::abs(VdotH)), 5.f);
+    }
+
+    // Cook-Torrance BRDF with GGX normal distribution & Smith geometry term + transmission
+    glm::vec3 cookTorranceGGX(glm::vec3 const & N, glm::vec3 const & L, glm::vec3 const & V, glm::vec3 const & baseColor,
+        float metallic, float roughness, float ior, float transmission)
+    {
+        glm::vec3 const Lt = L - 2.f * N * glm::dot(L, N);
+
+        glm::vec3 const H = glm::normalize(V + L);
+        glm::vec3 const Ht = glm::normalize(V + Lt);
+
+        float const VdotN = glm::dot(V, N);
+        float const VdotH = glm::dot(V, H);
+        float const LdotN = glm::dot(L, N);
+        float const NdotH = glm::dot(N, H);
+
+        float const VdotHt = glm::dot(V, Ht);
+        float const NdotHt = glm::dot(N, Ht);
+
+        float const alpha = roughness * roughness;
+        float const alpha2 = alpha * alpha;
+
+        float const dDenominator = NdotH * NdotH * (alpha2 - 1.f) + 1.f;
+        float const dtDenominator = NdotHt * NdotHt * (alpha2 - 1.f) + 1.f;
+
+        float const D = alpha2 / PI / (dDenominator * dDenominator) * chiPlus(NdotH);
+        float const Dt = alpha2 / PI / (dtDenominator * dtDenominator) * chiPlus(NdotHt);
+
+        float const visV = 1.f / (std::abs(VdotN) + std::sqrt(alpha2 + (1.f - alpha2) * VdotN * VdotN));
+        float const visL = 1.f / (std::abs(LdotN) + std::sqrt(alpha2 + (1.f - alpha2) * LdotN * LdotN));
+
+        float const vis = visV * visL;
+
+        glm::vec3 const specularBrdf = glm::vec3(D * vis) * chiPlus(VdotN) * chiPlus(LdotN);
+
+        float const f0Root = (1.f - ior) / (1.f + ior);
+        float const f0 = f0Root * f0Root;
+
+        glm::vec3 const transmissionFresnel = fresnel(glm::vec3(f0), glm::vec3(1.f), VdotHt);
+        glm::vec3 const transmissionBtdf = baseColor * Dt * vis * chiPlus(-LdotN) * chiPlus(VdotN);
+
+        glm::vec3 const metallicFresnel = fresnel(baseColor, glm::vec3(1.f), VdotH);
+        glm::vec3 const metallicBrdf = metallicFresnel * specularBrdf;
+
+        glm::vec3 const diffuseBrdf = baseColor / PI * chiPlus(LdotN);
+
+        glm::vec3 const dielectricFresnel = fresnel(glm::vec3(f0), glm::vec3(1.f), VdotH);
+
+        glm::vec3 const opaqueDielectricBrdf = glm::mix(diffuseBrdf, specularBrdf, dielectricFresnel);
+        glm::vec3 const transparentDielectricBrdf = specularBrdf * dielectricFresnel + transmissionBtdf * (glm::vec3(1.f) - transmissionFresnel);
+
+        glm::vec3 const dielectricBrdf = glm::mix(opaqueDielectricBrdf, transparentDielectricBrdf, transmission);
+
+        return glm::mix(dielectricBrdf, metallicBrdf, metallic);
+    }
+
+    glm::vec3 sampleVNDF(RandomState & randomState, glm::vec3 const & N, glm::vec3 const & V, float roughness)
+    {
+        glm::mat3 const toGlobal = completeBasis(N);
+        glm::mat3 const toLocal = glm::transpose(toGlobal);
+
+        float const alpha = roughness * roughness;
+
+        glm::vec3 const Vlocal = toLocal * V;
+
+        glm::vec3 const Vh = glm::normalize(glm::vec3(alpha, alpha, 1.f) * Vlocal);
+
+        glm::vec3 const T1 = glm::normalize(glm::cross(glm::vec3(0.f, 0.f, 1.f), Vh));
+        glm::vec3 const T2 = glm::cross(Vh, T1);
+
+        float const r = std::sqrt(uniformFloat(randomState));
+        float const phi = 2.f * PI * uniformFloat(randomState);
+        float const t1 = r * std::cos(phi);
+        float t2 = r * std::sin(phi);
+        float const s = 0.5f * (1.f + Vh.z);
+        t2 = (1.f - s) * std::sqrt(std::max(0.f, 1.f - t1 * t1)) + s * t2;
+
+        glm::vec3 const Nh = t1 * T1 + t2 * T2 + std::sqrt(std::max(0.f, 1.f - t1 * t1 - t2 * t2)) * Vh;
+
+        glm::vec3 const Ne = glm::normalize(glm::vec3(alpha * Nh.x, alpha * Nh.y, std::max(0.f, Nh.z)));
+
+        glm::vec3 const L = 2.f * Ne * glm::dot(Ne, Vlocal) - Vlocal;
+
+        return toGlobal * L;
+    }
+
+    glm::vec3 sampleTransmissionVNDF(RandomState & randomState, glm::vec3 const & N, glm::vec3 const & V, float roughness)
+    {
+        glm::vec3 const reflectedDirection = sampleVNDF(randomState, N, V, roughness);
+        return reflectedDirection - 2.f * glm::dot(reflectedDirection, N) * N;
+    }
+
+    float probabilityVNDF(glm::vec3 const & N, glm::vec3 const & V, glm::vec3 const & L, float roughness)
+    {
+        glm::mat3 const toLocal = glm::transpose(completeBasis(N));
+
+        float const alpha = roughness * roughness;
+        float const alpha2 = alpha * alpha;
+
+        glm::vec3 const Vlocal = toLocal * V;
+        glm::vec3 const Llocal = toLocal * L;
+        glm::vec3 const H = glm::normalize(Llocal + Vlocal);
+
+        float const dDenominator = (alpha2 - 1.f) * H.z * H.z + 1.f;
+        float const D = alpha2 / PI / (dDenominator * dDenominator) * chiPlus(H.z);
+
+        float const visV = 2.f * std::abs(Vlocal.z) / (std::abs(Vlocal.z) + std::sqrt(alpha2 + (1.f - alpha2) * Vlocal.z * Vlocal.z)) * chiPlus(Vlocal.z);
+
+        return D * visV / 4.f / Vlocal.z;
+    }
+
+    float probabilityTransmissionVNDF(glm::vec3 const & N, glm::vec3 const & V, glm::vec3 const & L, float roughness)
+    {
+        glm::vec3 const reflectedDirection = L - 2.f * glm::dot(L, N) * N;
+        return probabilityVNDF(N, V, reflectedDirection, roughness);
+    }
+
+    std::array<float, 256> const srgbToLinearTable = []
+    {
+        std::array<float, 256> result;
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            float const c = i / 255.f;
+            result[i] = (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return result;
+    }();
+
+    glm::vec4 loadTexel(std::uint32_t const * pixels, std::uint32_t index, bool srgb)
+    {
+        std::uint32_t const pixel = pixels[index];
+        glm::uvec4 const channels{pixel & 0xffu, (pixel >> 8) & 0xffu, (pixel >> 16) & 0xffu, pixel >> 24};
+
+        if (srgb)
+            return {srgbToLinearTable[channels.x], srgbToLinearTable[channels.y], srgbToLinearTable[channels.z], channels.w / 255.f};
+
+        return glm::vec4(channels) / 255.f;
+    }
+
+    // Bilinear lookup of a single mip level, clamped half a texel
+    // inside the texture like the atlas rects in sampleAtlas
+    glm::vec4 sampleLevel(SceneImage const & image, std::uint32_t level, glm::vec2 const & texcoord, bool srgb)
+    {
+        std::uint32_t const width = std::max(1u, image.width >> level);
+        std::uint32_t const height = std::max(1u, image.height >> level);
+        std::uint32_t const * pixels = (level == 0) ? image.pixels : image.mipmaps[level - 1].pixels.data();
+
+        glm::vec2 const position = glm::clamp(glm::fract(texcoord) * glm::vec2(width, height) - 0.5f, glm::vec2(0.f), glm::vec2(width - 1, height - 1));
+        glm::uvec2 const p0 = glm::uvec2(position);
+        glm::uvec2 const p1 = glm::min(p0 + 1u, glm::uvec2(width - 1, height - 1));
+        glm::vec2 const t = position - glm::vec2(p0);
+
+        glm::vec4 const row0 = glm::mix(loadTexel(pixels, p0.x + p0.y * width, srgb), loadTexel(pixels, p1.x + p0.y * width, srgb), t.x);
+        glm::vec4 const row1 = glm::mix(loadTexel(pixels, p0.x + p1.y * width, srgb), loadTexel(pixels, p1.x + p1.y * width, srgb), t.x);
+        return glm::mix(row0, row1, t.y);
+    }
+
+    // Trilinear sampling with the same level selection as sampleAtlas
+    glm::vec4 sampleTexture(SceneImage const & image, glm::vec2 const & texcoord, float uvLod, bool srgb)
+    {
+        glm::vec2 const textureSize(image.width, image.height);
+        float const maxLevel = std::floor(std::log2(std::min(textureSize.x, textureSize.y)) + 1e-3f);
+
+        // Written to map NaN to level 0
+        float const level = std::min(std::max(0.f, uvLod + 0.5f * std::log2(textureSize.x * textureSize.y)), maxLevel);
+
+        std::uint32_t const level0 = std::uint32_t(level);
+        std::uint32_t const level1 = std::min<std::uint32_t>(level0 + 1, maxLevel);
+
+        glm::vec4 const sample0 = sampleLevel(image, level0, texcoord, srgb);
+        if (level1 == level0)
+            return sample0;
+
+        return glm::mix(sample0, sampleLevel(image, level1, texcoord, srgb), level - level0);
+    }
+
+    // Ray cone texture LOD, see "Improved Shader and Texture Level of Detail Using Ray Cones"
+    // by Akenine-Möller et al. Areas may be scaled by the same factor
+    float rayConeLod(float coneWidth, float cosine, float triangleArea, float texcoordArea)
+    {
+        return 0.5f * std::log2(std::max(texcoordArea, 1e-20f) / std::max(triangleArea, 1e-20f)) + std::log2(coneWidth / std::max(cosine, 1e-4f));
+    }
+
+    glm::vec3 loadEnvMap(HDRIData const & environmentMap, glm::uvec2 const & pixel)
+    {
+        glm::uvec2 const clampedPixel = glm::min(pixel, glm::uvec2(environmentMap.width - 1, environmentMap.height - 1));
+        float const * color = environmentMap.pixels.data() + 4 * (clampedPixel.x + clampedPixel.y * environmentMap.width);
+        return glm::min(glm::vec3(color[0], color[1], color[2]), glm::vec3(MAX_ENV_MAP_INTENSITY));
+    }
+
+    glm::uvec2 envMapPixel(HDRIData const & environmentMap, glm::vec3 const & direction)
+    {
+        float const x = std::atan2(direction.z, direction.x) / PI * 0.5f + 0.5f;
+        float const y = - std::atan2(direction.y, glm::length(glm::vec2(direction.x, direction.z))) / PI + 0.5f;
+        return glm::uvec2(glm::vec2(environmentMap.width, environmentMap.height) * glm::vec2(x, y));
+    }
+
+    glm::vec3 sampleEnvMap(HDRIData const & environmentMap, glm::vec3 const & direction)
+    {
+        return loadEnvMap(environmentMap, envMapPixel(environmentMap, direction));
+    }
+
+    // Inverse of the mapping used in sampleEnvMap
+    glm::vec3 envMapDirection(glm::vec2 const & texcoord)
+    {
+        float const azimuth = (texcoord.x - 0.5f) * 2.f * PI;
+        float const elevation = (0.5f - texcoord.y) * PI;
+        return {std::cos(elevation) * std::cos(azimuth), std::sin(elevation), std::cos(elevation) * std::sin(azimuth)};
+    }
+
+    // The first record of the environment alias table is the total weight
+    float envMapTotalWeight(PreparedScene const & scene)
+    {
+        return scene.environmentAliasTable[0].probability;
+    }
+
+    glm::vec3 sampleEnvMapDirection(PreparedScene const & scene, RandomState & randomState)
+    {
+        std::uint32_t const width = scene.environmentMap.width;
+        std::uint32_t const height = scene.environmentMap.height;
+        AliasRecord const * records = scene.environmentAliasTable.data() + 1;
+
+        float const rowPick = height * uniformFloat(randomState);
+        std::uint32_t row = std::min(height - 1, std::uint32_t(rowPick));
+        if (rowPick - row > records[row].probability)
+            row = records[row].alias;
+
+        float const columnPick = width * uniformFloat(randomState);
+        std::uint32_t column = std::min(width - 1, std::uint32_t(columnPick));
+        auto const & columnRecord = records[height + row * width + column];
+        if (columnPick - column > columnRecord.probability)
+            column = columnRecord.alias;
+
+        float const u = uniformFloat(randomState);
+        float const v = uniformFloat(randomState);
+        return envMapDirection((glm::vec2(column, row) + glm::vec2(u, v)) / glm::vec2(width, height));
+    }
+
+    // Solid angle probability density of sampleEnvMapDirection generating a direction
+    float envMapSamplingProbability(PreparedScene const & scene, glm::vec3 const & direction)
+    {
+        float const totalWeight = envMapTotalWeight(scene);
+        if (totalWeight <= 0.f)
+            return 0.f;
+
+        auto const & environmentMap = scene.environmentMap;
+        glm::vec2 const dimensions(environmentMap.width, environmentMap.height);
+        glm::uvec2 const pixel = glm::min(envMapPixel(environmentMap, direction), glm::uvec2(dimensions) - 1u);
+
+        glm::vec3 const color = loadEnvMap(environmentMap, pixel);
+
+        float const rowElevation = (0.5f - (pixel.y + 0.5f) / dimensions.y) * PI;
+        float const elevation = std::atan2(direction.y, glm::length(glm::vec2(direction.x, direction.z)));
+
+        float const pixelProbability = glm::dot(LUMINANCE_FACTORS, color) * std::cos(rowElevation) / totalWeight;
+        return pixelProbability * dimensions.x * dimensions.y / (2.f * PI * PI * std::max(std::cos(elevation), 1e-6f));
+    }
+
+    // Same as russianRoulette in path_tracing.wgsl
+    float russianRoulette(PathTracingOptions const & options, glm::vec3 const & throughput, std::uint32_t depth, RandomState & randomState)
+    {
+        if (depth < options.russianRouletteDepth || depth >= options.maxDepth)
+            return 1.f;
+
+        float const survival = std::min(1.f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+
+        if (uniformFloat(randomState) >= survival)
+            return 0.f;
+
+        return survival;
+    }
+
+    glm::vec3 raytraceMonteCarlo(PreparedScene const & scene, PathTracingOptions const & options, Ray const & ray, float pixelSpreadAngle,
+        RandomState & randomState, std::uint64_t & rayCount)
+    {
+        auto const & geometry = scene.geometry();
+        std::uint32_t const lightCount = emissiveTriangleCount(geometry);
+
+        glm::vec3 accumulatedColor(0.f);
+        glm::vec3 colorFactor(1.f);
+
+        Ray currentRay = ray;
+
+        // Ray cone used for texture LOD selection
+        float coneWidth = 0.f;
+        float coneSpreadAngle = pixelSpreadAngle;
+
+        for (std::uint32_t rayDepth = 0; rayDepth < options.maxDepth; ++rayDepth)
+        {
+            auto const intersection = intersectScene(geometry, currentRay);
+            ++rayCount;
+
+            if (!intersection.intersects)
+            {
+                accumulatedColor += colorFactor * sampleEnvMap(scene.environmentMap, currentRay.direction);
+                break;
+            }
+
+            glm::vec3 const intersectionPoint = currentRay.origin + currentRay.direction * intersection.distance;
+
+            auto const & v0 = geometry.vertexAttributes[3 * intersection.triangleID + 0];
+            auto const & v1 = geometry.vertexAttributes[3 * intersection.triangleID + 1];
+            auto const & v2 = geometry.vertexAttributes[3 * intersection.triangleID + 2];
+
+            auto const & material = scene.materials[v0.materialID];
+
+            glm::vec2 const uv = intersection.uv;
+
+            glm::vec2 const texcoord = v0.texcoords + uv.x * (v1.texcoords - v0.texcoords) + uv.y * (v2.texcoords - v0.texcoords);
+
+            glm::vec3 const triangleCross = glm::cross(intersection.vertices[1] - intersection.vertices[0], intersection.vertices[2] - intersection.vertices[0]);
+            glm::vec2 const texcoordEdge1 = v1.texcoords - v0.texcoords;
+            glm::vec2 const texcoordEdge2 = v2.texcoords - v0.texcoords;
+            float const texcoordArea = std::abs(texcoordEdge1.x * texcoordEdge2.y - texcoordEdge2.x * texcoordEdge1.y);
+
+            coneWidth += coneSpreadAngle * intersection.distance;
+            float const uvLod = rayConeLod(coneWidth, std::abs(glm::dot(currentRay.direction, glm::normalize(triangleCross))), glm::length(triangleCross), texcoordArea);
+
+            glm::vec4 const albedoSample = sampleTexture(scene.albedoImages[material.textureIDs.x], texcoord, uvLod, true);
+
+            float const alpha = albedoSample.w * material.baseColorFactorAndAlpha.w;
+
+            if (alpha < 0.5f)
+            {
+                currentRay.origin = intersectionPoint + currentRay.direction * 1e-4f;
+                continue;
+            }
+
+            glm::vec4 const materialSample = sampleTexture(scene.materialImages[material.textureIDs.y], texcoord, uvLod, false);
+            glm::vec4 const normalSample = sampleTexture(scene.normalImages[material.textureIDs.z], texcoord, uvLod, false);
+
+            glm::vec3 const baseColor = glm::vec3(material.baseColorFactorAndAlpha) * glm::vec3(albedoSample);
+            float const metallic = material.metallicRoughnessFactorAndIor.z * materialSample.z;
+            float const roughness = std::max(0.05f, material.metallicRoughnessFactorAndIor.y * materialSample.y);
+            float ior = material.metallicRoughnessFactorAndIor.w;
+            float const transmission = material.emissiveFactorAndTransmission.w;
+
+            glm::vec3 geometryNormal = glm::normalize(triangleCross);
+
+            glm::vec3 shadingNormal = glm::normalize(v0.normal + uv.x * (v1.normal - v0.normal) + uv.y * (v2.normal - v0.normal));
+
+            // Invert the normals if we're looking at the surface from the inside
+            if (glm::dot(geometryNormal, currentRay.direction) > 0.f)
+            {
+                geometryNormal = -geometryNormal;
+                shadingNormal = -shadingNormal;
+                ior = 1.f / ior;
+            }
+
+            glm::vec3 const tangent = glm::normalize(glm::vec3(v0.tangent) + uv.x * glm::vec3(v1.tangent - v0.tangent) + uv.y * glm::vec3(v2.tangent - v0.tangent));
+            glm::vec3 const bitangent = v0.tangent.w * glm::normalize(glm::cross(shadingNormal, tangent));
+
+            shadingNormal = glm::normalize(glm::mat3(tangent, bitangent, shadingNormal) * (glm::vec3(normalSample) * 2.f - glm::vec3(1.f)));
+
+            Ray newRay{intersectionPoint, glm::vec3(0.f)};
+
+            float cosineSamplingWeight = (1.f - metallic) * (1.f - transmission);
+            float lightSamplingWeight = (1.f - metallic) * (1.f - transmission) * ((lightCount > 0) ? 1.f : 0.f);
+            float envMapSamplingWeight = (1.f - metallic) * (1.f - transmission) * ((envMapTotalWeight(scene) > 0.f) ? 1.f : 0.f);
+            float vndfSamplingWeight = 1.f - (1.f - metallic) * roughness;
+            float vndfTransmissionWeight = transmission;
+
+            float const sumSamplingWeights = cosineSamplingWeight + lightSamplingWeight + envMapSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight;
+
+            cosineSamplingWeight /= sumSamplingWeights;
+            lightSamplingWeight /= sumSamplingWeights;
+            envMapSamplingWeight /= sumSamplingWeights;
+            vndfSamplingWeight /= sumSamplingWeights;
+            vndfTransmissionWeight /= sumSamplingWeights;
+
+            float const strategyPick = uniformFloat(randomState);
+
+            if (strategyPick < cosineSamplingWeight)
+                newRay.direction = cosineHemisphere(randomState, shadingNormal);
+            else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight)
+                newRay.direction = sampleVNDF(randomState, shadingNormal, -currentRay.direction, roughness);
+            else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight)
+                newRay.direction = sampleTransmissionVNDF(randomState, shadingNormal, -currentRay.direction, roughness);
+            else if (strategyPick < cosineSamplingWeight + vndfSamplingWeight + vndfTransmissionWeight + envMapSamplingWeight)
+                newRay.direction = sampleEnvMapDirection(scene, randomState);
+            else
+            {
+                float const lightPick = lightCount * uniformFloat(randomState);
+                std::uint32_t lightTriangleIndex = std::min(lightCount - 1, std::uint32_t(lightPick));
+                auto const & lightTriangleAliasRecord = geometry.emissiveAliasTable[lightTriangleIndex];
+
+                if (lightPick - lightTriangleIndex > lightTriangleAliasRecord.probability)
+                    lightTriangleIndex = lightTriangleAliasRecord.alias;
+
+                std::uint32_t const lightTriangle = geometry.emissiveTriangles[1 + lightTriangleIndex].index;
+
+                float const lightU = uniformFloat(randomState);
+                float const lightV = uniformFloat(randomState);
+                glm::vec2 lightUV(lightU, lightV);
+                if (lightUV.x + lightUV.y > 1.f)
+                    lightUV = glm::vec2(1.f) - lightUV;
+
+                glm::vec3 const lightV0 = vertexPosition(geometry, 3 * lightTriangle + 0);
+                glm::vec3 const lightV1 = vertexPosition(geometry, 3 * lightTriangle + 1);
+                glm::vec3 const lightV2 = vertexPosition(geometry, 3 * lightTriangle + 2);
+
+                glm::vec3 const lightPoint = lightV0 * (1.f - lightUV.x - lightUV.y) + lightV1 * lightUV.x + lightV2 * lightUV.y;
+
+                newRay.direction = glm::normalize(lightPoint - intersectionPoint);
+            }
+
+            float const cosineHemisphereProbability = std::max(0.f, glm::dot(newRay.direction, shadingNormal)) / PI;
+            float const vndfSamplingProbability = probabilityVNDF(shadingNormal, -currentRay.direction, newRay.direction, roughness);
+            float const vndfTransmissionProbability = probabilityTransmissionVNDF(shadingNormal, -currentRay.direction, newRay.direction, roughness);
+            float const directLightSamplingProbability = lightSamplingProbability(geometry, newRay);
+            float const envMapDirectionProbability = envMapSamplingProbability(scene, newRay.direction);
+
+            float const totalMISProbability = cosineHemisphereProbability * cosineSamplingWeight
+                + vndfSamplingProbability * vndfSamplingWeight
+                + vndfTransmissionProbability * vndfTransmissionWeight
+                + directLightSamplingProbability * lightSamplingWeight
+                + envMapDirectionProbability * envMapSamplingWeight;
+
+            accumulatedColor += glm::vec3(material.emissiveFactorAndTransmission) * colorFactor;
+
+            float const ndotr = glm::dot(shadingNormal, newRay.direction);
+
+            // A non-transmissive material with the new ray pointing
+            // inside the object wouldn't contribute anything
+            if (!(transmission > 0.f || ndotr > 0.f))
+                break;
+
+            glm::vec3 const brdf = cookTorranceGGX(shadingNormal, newRay.direction, -currentRay.direction, baseColor, metallic, roughness, ior, transmission);
+
+            colorFactor *= brdf * std::abs(ndotr) / std::max(1e-8f, totalMISProbability);
+
+            float const survival = russianRoulette(options, colorFactor, rayDepth + 1, randomState);
+            if (survival == 0.f)
+                break;
+            colorFactor /= survival;
+
+            // Offset ray origin to side of the surface where new ray direction is pointing to,
+            // to prevent self-intersection artifacts
+            newRay.origin += glm::sign(glm::dot(newRay.direction, geometryNormal)) * geometryNormal * 1e-4f;
+
+            // Crude approximation of the cone widening after a rough bounce
+            coneSpreadAngle += roughness * roughness;
+
+            currentRay = newRay;
+        }
+
+        return accumulatedColor;
+    }
+
+    struct FrameParameters
+    {
+        glm::uvec2 screenSize;
+        glm::mat4 viewProjectionInverseMatrix;
+        glm::vec3 position;
+        std::uint32_t frameID;
+        PathTracingOptions pathTracing;
+    };
+
+    // Same as computeMain in raytrace_monte_carlo.wgsl, for a rectangle of pixels
+    void renderTile(PreparedScene const & scene, FrameParameters const & frame, glm::uvec2 const & begin, glm::uvec2 const & end,
+        std::vector<glm::vec4> & accumulation, std::uint64_t & rayCount)
+    {
+        float const alpha = 1.f / (frame.frameID + 1.f);
+
+        for (std::uint32_t y = begin.y; y < end.y; ++y)
+        {
+            for (std::uint32_t x = begin.x; x < end.x; ++x)
+            {
+                RandomState randomState;
+                initRandom(randomState, frame.frameID);
+                initRandom(randomState, x);
+                initRandom(randomState, y);
+
+                float const jitterX = uniformFloat(randomState);
+                float const jitterY = uniformFloat(randomState);
+                glm::vec2 const screenPosition = 2.f * glm::vec2(x + jitterX, y + jitterY) / glm::vec2(frame.screenSize) - glm::vec2(1.f);
+
+                Ray const cameraRay = computeCameraRay(frame.position, frame.viewProjectionInverseMatrix, screenPosition * glm::vec2(1.f, -1.f));
+
+                // Angle between rays through neighbouring pixels
+                Ray const neighbourRay = computeCameraRay(frame.position, frame.viewProjectionInverseMatrix,
+                    (screenPosition + glm::vec2(2.f / frame.screenSize.x, 0.f)) * glm::vec2(1.f, -1.f));
+                float const pixelSpreadAngle = glm::length(neighbourRay.direction - cameraRay.direction);
+
+                glm::vec3 const color = glm::clamp(raytraceMonteCarlo(scene, frame.pathTracing, cameraRay, pixelSpreadAngle, randomState, rayCount), glm::vec3(0.f), glm::vec3(10.f));
+
+                auto & accumulatedColor = accumulation[x + y * frame.screenSize.x];
+                float const colorLuminance = glm::dot(LUMINANCE_FACTORS, color);
+                accumulatedColor = glm::mix(accumulatedColor, glm::vec4(color, colorLuminance * colorLuminance), alpha);
+            }
+        }
+    }
+
+}
+
+std::vector<glm::vec4> renderReference(PreparedScene const & scene, Camera const & camera, ReferenceRenderOptions const & options)
+{
+    if (!scene.geometry().instances.empty())
+        throw std::runtime_error("The reference renderer doesn't support instanced scenes");
+
+    std::vector<glm::vec4> accumulation(options.size.x * options.size.y, glm::vec4(0.f));
+
+    FrameParameters frame
+    {
+        .screenSize = options.size,
+        .viewProjectionInverseMatrix = glm::inverse(camera.viewProjectionMatrix()),
+        .position = camera.position(),
+        .frameID = 0,
+        .pathTracing = options.pathTracing,
+    };
+
+    glm::uvec2 const tileCount = (options.size + TILE_SIZE - 1u) / TILE_SIZE;
+
+    ThreadPool pool(options.threadCount);
+
+    Timer timer;
+    std::atomic<std::uint64_t> rayCount{0};
+
+    while (true)
+    {
+        parallelFor(pool, tileCount.x * tileCount.y, 1, [&](std::size_t begin, std::size_t end)
+        {
+            std::uint64_t tileRayCount = 0;
+
+            for (std::size_t tile = begin; tile < end; ++tile)
+            {
+                glm::uvec2 const tileBegin = glm::uvec2(tile % tileCount.x, tile / tileCount.x) * TILE_SIZE;
+                glm::uvec2 const tileEnd = glm::min(tileBegin + TILE_SIZE, options.size);
+                renderTile(scene, frame, tileBegin, tileEnd, accumulation, tileRayCount);
+            }
+
+            rayCount.fetch_add(tileRayCount);
+        });
+
+        ++frame.frameID;
+
+        if (options.sampleCount > 0 && frame.frameID >= options.sampleCount)
+            break;
+
+        if (options.timeBudget > 0.0 && timer.duration() >= options.timeBudget)
+            break;
+    }
+
+    double const duration = timer.duration();
+    std::cout << "Rendered " << frame.frameID << " samples per pixel on " << pool.threadCount() << " CPU threads in " << duration
+        << " seconds (" << (rayCount.load() / duration * 1e-6) << " Mrays/s)" << std::endl;
+    std::cout << "Mean per-pixel sample variance: " << meanSampleVariance(accumulation) << std::endl;
+
+    return accumulation;
+}
+
+namespace
+{
+
+    constexpr std::uint32_t LOCALITY_TILE_WIDTH = 8;
+    constexpr std::uint32_t LOCALITY_TILE_HEIGHT = 4;
+    constexpr std::uint32_t CACHE_LINE_SIZE = 128;
+    constexpr std::uint32_t CACHE_LINE_COUNT = 64;
+
+    // Fully associative cache with least recently used replacement
+    struct CacheSimulator
+    {
+        std::vector<std::uint32_t> lines;
+
+        // Returns true on a miss
+        bool access(std::uint32_t line)
+        {
+            auto it = std::find(lines.begin(), lines.end(), line);
+            bool const miss = (it == lines.end());
+
+            if (miss)
+            {
+                if (lines.size() == CACHE_LINE_COUNT)
+                    lines.pop_back();
+                lines.insert(lines.begin(), line);
+            }
+            else
+                std::rotate(lines.begin(), it, it + 1);
+
+            return miss;
+        }
+    };
+
+    void addTraversal(BVHLocalityStats::RayStats & stats, TraversalRecord const & record, bool hit, CacheSimulator & cache)
+    {
+        std::vector<std::uint32_t> lines;
+        for (auto nodeID : record.visitedNodes)
+        {
+            std::uint32_t const line = nodeID * sizeof(BVH::Node) / CACHE_LINE_SIZE;
+            lines.push_back(line);
+            stats.cacheMissCount += cache.access(line);
+        }
+
+        std::sort(lines.begin(), lines.end());
+
+        stats.rayCount += 1;
+        stats.hitCount += hit;
+        stats.visitedNodeCount += record.visitedNodes.size();
+        stats.testedTriangleCount += record.testedTriangleCount;
+        stats.cacheLineCount += std::unique(lines.begin(), lines.end()) - lines.begin();
+    }
+
+}
+
+BVHLocalityStats measureBVHLocality(SceneGeometryView const & geometry, Camera const & camera, glm::uvec2 const & size, std::uint32_t threadCount)
+{
+    if (!geometry.instances.empty())
+        throw std::runtime_error("BVH locality can only be measured for scenes without instances");
+
+    glm::mat4 const viewProjectionInverseMatrix = glm::inverse(camera.viewProjectionMatrix());
+    glm::vec3 const position = camera.position();
+
+    glm::uvec2 const tileCount = (size + glm::uvec2(LOCALITY_TILE_WIDTH - 1, LOCALITY_TILE_HEIGHT - 1)) / glm::uvec2(LOCALITY_TILE_WIDTH, LOCALITY_TILE_HEIGHT);
+
+    std::vector<BVHLocalityStats> tileStats(tileCount.x * tileCount.y);
+
+    ThreadPool pool(threadCount);
+
+    parallelFor(pool, tileStats.size(), 16, [&](std::size_t begin, std::size_t end)
+    {
+        TraversalRecord record;
+
+        for (std::size_t tile = begin; tile < end; ++tile)
+        {
+            glm::uvec2 const tileBegin = glm::uvec2(tile % tileCount.x, tile / tileCount.x) * glm::uvec2(LOCALITY_TILE_WIDTH, LOCALITY_TILE_HEIGHT);
+            glm::uvec2 const tileEnd = glm::min(tileBegin + glm::uvec2(LOCALITY_TILE_WIDTH, LOCALITY_TILE_HEIGHT), size);
+
+            // Rays of a tile share the cache, like the threads of a workgroup
+            CacheSimulator primaryCache;
+            CacheSimulator secondaryCache;
+
+            for (std::uint32_t y = tileBegin.y; y < tileEnd.y; ++y)
+            {
+                for (std::uint32_t x = tileBegin.x; x < tileEnd.x; ++x)
+                {
+                    glm::vec2 const screenPosition = 2.f * (glm::vec2(x, y) + 0.5f) / glm::vec2(size) - glm::vec2(1.f);
+                    Ray const cameraRay = computeCameraRay(position, viewProjectionInverseMatrix, screenPosition * glm::vec2(1.f, -1.f));
+
+                    record.clear();
+                    auto const intersection = intersectScene(geometry, cameraRay, &record);
+                    addTraversal(tileStats[tile].primary, record, intersection.intersects, primaryCache);
+
+                    if (!intersection.intersects)
+                        continue;
+
+                    // A diffuse bounce, which is much less coherent
+
+                    RandomState randomState;
+                    initRandom(randomState, x);
+                    initRandom(randomState, y);
+
+                    glm::vec3 normal = glm::normalize(glm::cross(intersection.vertices[1] - intersection.vertices[0], intersection.vertices[2] - intersection.vertices[0]));
+                    if (glm::dot(normal, cameraRay.direction) > 0.f)
+                        normal = -normal;
+
+                    Ray const bounceRay{cameraRay.origin + cameraRay.direction * intersection.distance + normal * 1e-4f, cosineHemisphere(randomState, normal)};
+
+                    record.clear();
+                    auto const bounceIntersection = intersectScene(geometry, bounceRay, &record);
+                    addTraversal(tileStats[tile].secondary, record, bounceIntersection.intersects, secondaryCache);
+                }
+            }
+        }
+    });
+
+    auto accumulate = [](BVHLocalityStats::RayStats & total, BVHLocalityStats::RayStats const & tile)
+    {
+        total.rayCount += tile.rayCount;
+        total.hitCount += tile.hitCount;
+        total.visitedNodeCount += tile.visitedNodeCount;
+        total.testedTriangleCount += tile.testedTriangleCount;
+        total.cacheLineCount += tile.cacheLineCount;
+        total.cacheMissCount += tile.cacheMissCount;
+    };
+
+    BVHLocalityStats result;
+    for (auto const & stats : tileStats)
+    {
+        accumulate(result.primary, stats.primary);
+        accumulate(result.secondary, stats.secondary);
+    }
+
+    return result;
+}
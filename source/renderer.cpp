@@ -7,9 +7,14 @@
 #include <webgpu-raytracer/preview_pipeline.hpp>
 #include <webgpu-raytracer/raytrace_first_hit_pipeline.hpp>
 #include <webgpu-raytracer/raytrace_monte_carlo_pipeline.hpp>
+#include <webgpu-raytracer/raytrace_wavefront_pipeline.hpp>
+#include <webgpu-raytracer/raytrace_heatmap_pipeline.hpp>
 #include <webgpu-raytracer/compose_pipeline.hpp>
 #include <webgpu-raytracer/profiler.hpp>
 
+#include <algorithm>
+#include <array>
+
 struct Renderer::Impl
 {
     Impl(WGPUDevice device, WGPUQueue queue, WGPUTextureFormat surfaceFormat, ShaderRegistry & shaderRegistry);
@@ -20,8 +25,28 @@ struct Renderer::Impl
 
     Mode renderMode() const { return renderMode_; }
 
+    WGPUTexture accumulationTexture() const { return accumulationTexture_; }
+
+    std::optional<TraversalHeatmapStats> traversalStats() const { return traversalStats_.stats(); }
+
+    std::optional<AdaptiveSamplingStats> adaptiveSamplingStats() const { return adaptiveSampling_.stats(); }
+
     void setRenderMode(Mode mode);
 
+    void setWavefrontMaterialSorting(bool enabled) { raytraceWavefrontPipeline_.setSortByMaterial(enabled); }
+
+    void setPathTracingOptions(PathTracingOptions const & options);
+
+    void setAdaptiveSampling(AdaptiveSamplingOptions const & options);
+
+    void setFrameBudget(FrameBudgetOptions const & options) { frameBudget_ = FrameBudgetController(options); }
+
+    std::uint32_t samplesPerDispatch() const { return frameBudget_.samplesPerDispatch(); }
+
+    void setSampleLimit(std::uint32_t sampleLimit) { sampleLimit_ = sampleLimit; }
+
+    std::uint32_t sampleCount() const { return sampleID_; }
+
     void resetAccumulationBuffer();
 
     void renderFrame(WGPUTexture surfaceTexture, Camera const & camera, SceneData const & sceneData, float exposure);
@@ -41,6 +66,8 @@ private:
 
     CameraBindGroup camera_;
     ComposeUniformsBindGroup composeUniforms_;
+    TraversalStatsBuffer traversalStats_;
+    AdaptiveSampling adaptiveSampling_;
 
     WGPUBindGroupLayout geometryBindGroupLayout_;
     WGPUBindGroupLayout materialBindGroupLayout_;
@@ -50,32 +77,61 @@ private:
     PreviewPipeline previewPipeline_;
     RaytraceFirstHitPipeline raytraceFirstHitPipeline_;
     RaytraceMonteCarloPipeline raytraceMonteCarloPipeline_;
+    RaytraceWavefrontPipeline raytraceWavefrontPipeline_;
+    RaytraceHeatmapPipeline raytraceHeatmapPipeline_;
     ComposePipeline composePipeline_;
 
     Mode renderMode_ = Mode::Preview;
+    PathTracingOptions pathTracingOptions_;
+    AdaptiveSamplingOptions adaptiveSamplingOptions_;
+    FrameBudgetController frameBudget_;
+    std::uint32_t sampleLimit_ = 0;
     bool needClearAccumulationTexture_ = false;
 
+    // Frames and samples per pixel since the last reset
     std::uint32_t frameID_ = 0;
-    std::uint32_t globalFrameID_ = 0;
+    std::uint32_t sampleID_ = 0;
+    std::uint32_t globalSampleID_ = 0;
 
     Profiler profiler_;
+
+    // Sample counts of the frames whose GPU time hasn't been read back yet,
+    // by profiler frame index; zero for frames that don't count
+    struct FrameSampleCount
+    {
+        std::uint64_t frameIndex = 0;
+        std::uint32_t sampleCount = 0;
+    };
+
+    std::array<FrameSampleCount, 16> frameSampleCounts_;
+    std::optional<std::uint64_t> measuredFrameIndex_;
+
+    std::uint32_t nextSampleCount();
 };
 
 static WGPUTextureFormat accumulationTextureFormat = WGPUTextureFormat_RGBA32Float;
 
+// Heatmap range until the first traversal stats are read back
+static float defaultHeatmapRange = 128.f;
+
 Renderer::Impl::Impl(WGPUDevice device, WGPUQueue queue, WGPUTextureFormat surfaceFormat, ShaderRegistry & shaderRegistry)
     : device_(device)
     , queue_(queue)
     , surfaceFormat_(surfaceFormat)
     , camera_(device)
     , composeUniforms_(device)
+    , traversalStats_(device)
+    , adaptiveSampling_(device, queue, shaderRegistry, accumulationTextureFormat)
     , geometryBindGroupLayout_(createGeometryBindGroupLayout(device))
     , materialBindGroupLayout_(createMaterialBindGroupLayout(device))
     , accumulationStorageBindGroupLayout_(createAccumulationStorageBindGroupLayout(device, accumulationTextureFormat))
     , accumulationSampleBindGroupLayout_(createAccumulationSampleBindGroupLayout(device))
     , previewPipeline_(device, shaderRegistry, surfaceFormat, camera_.bindGroupLayout(), materialBindGroupLayout_)
     , raytraceFirstHitPipeline_(device, shaderRegistry, camera_.bindGroupLayout(), geometryBindGroupLayout_, materialBindGroupLayout_, accumulationStorageBindGroupLayout_)
-    , raytraceMonteCarloPipeline_(device, shaderRegistry, camera_.bindGroupLayout(), geometryBindGroupLayout_, materialBindGroupLayout_, accumulationStorageBindGroupLayout_)
+    , raytraceMonteCarloPipeline_(device, shaderRegistry, camera_.bindGroupLayout(), geometryBindGroupLayout_, materialBindGroupLayout_, accumulationStorageBindGroupLayout_,
+        adaptiveSampling_.bindGroupLayout())
+    , raytraceWavefrontPipeline_(device, queue, shaderRegistry, camera_.bindGroupLayout(), geometryBindGroupLayout_, materialBindGroupLayout_, accumulationTextureFormat)
+    , raytraceHeatmapPipeline_(device, shaderRegistry, camera_.bindGroupLayout(), geometryBindGroupLayout_, traversalStats_.bindGroupLayout(), accumulationStorageBindGroupLayout_)
     , composePipeline_(device, shaderRegistry, surfaceFormat, accumulationSampleBindGroupLayout_, composeUniforms_.bindGroupLayout())
     , profiler_(device)
 {}
@@ -115,10 +171,43 @@ void Renderer::Impl::setRenderMode(Mode mode)
         resetAccumulationBuffer();
 }
 
+void Renderer::Impl::setPathTracingOptions(PathTracingOptions const & options)
+{
+    pathTracingOptions_ = options;
+    resetAccumulationBuffer();
+}
+
+void Renderer::Impl::setAdaptiveSampling(AdaptiveSamplingOptions const & options)
+{
+    adaptiveSamplingOptions_ = options;
+    resetAccumulationBuffer();
+}
+
 void Renderer::Impl::resetAccumulationBuffer()
 {
     needClearAccumulationTexture_ = true;
     frameID_ = 0;
+    sampleID_ = 0;
+}
+
+std::uint32_t Renderer::Impl::nextSampleCount()
+{
+    // Feed the frame budget with the GPU time of the frames read back since the last call
+    if (auto const frame = profiler_.latestFrame(); frame && (!measuredFrameIndex_ || *measuredFrameIndex_ < frame->frameIndex))
+    {
+        auto const & record = frameSampleCounts_[frame->frameIndex % frameSampleCounts_.size()];
+        if (record.frameIndex == frame->frameIndex)
+            frameBudget_.addMeasurement(frame->time, record.sampleCount);
+        measuredFrameIndex_ = frame->frameIndex;
+    }
+
+    if (renderMode_ != Mode::RaytraceMonteCarlo)
+        return 1;
+
+    std::uint32_t sampleCount = frameBudget_.samplesPerDispatch();
+    if (sampleLimit_ > 0)
+        sampleCount = std::min(sampleCount, sampleLimit_ - std::min(sampleID_, sampleLimit_));
+    return sampleCount;
 }
 
 namespace
@@ -161,7 +250,7 @@ namespace
         WGPUTextureDescriptor accumulationTextureDescriptor;
         accumulationTextureDescriptor.nextInChain = nullptr;
         accumulationTextureDescriptor.label = "accumulation";
-        accumulationTextureDescriptor.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding | WGPUTextureUsage_StorageBinding;
+        accumulationTextureDescriptor.usage = WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding | WGPUTextureUsage_StorageBinding | WGPUTextureUsage_CopySrc;
         accumulationTextureDescriptor.dimension = WGPUTextureDimension_2D;
         accumulationTextureDescriptor.size = {width, height, 1};
         accumulationTextureDescriptor.format = accumulationTextureFormat;
@@ -194,8 +283,18 @@ void Renderer::Impl::renderFrame(WGPUTexture surfaceTexture, Camera const & came
 {
     glm::uvec2 const screenSize{wgpuTextureGetWidth(surfaceTexture), wgpuTextureGetHeight(surfaceTexture)};
 
-    camera_.update(queue_, camera, screenSize, frameID_, globalFrameID_);
-    composeUniforms_.update(queue_, exposure);
+    std::uint32_t const sampleCount = nextSampleCount();
+
+    camera_.update(queue_, camera, screenSize, sampleID_, globalSampleID_, sampleCount, pathTracingOptions_);
+
+    float heatmapRange = 0.f;
+    if (renderMode_ == Mode::TraversalHeatmap)
+    {
+        auto const stats = traversalStats_.stats();
+        heatmapRange = (stats ? std::max<float>(1.f, stats->p99VisitedNodes) : defaultHeatmapRange) / exposure;
+    }
+
+    composeUniforms_.update(queue_, exposure, heatmapRange);
 
     WGPUCommandEncoderDescriptor commandEncoderDescriptor;
     commandEncoderDescriptor.nextInChain = nullptr;
@@ -203,7 +302,12 @@ void Renderer::Impl::renderFrame(WGPUTexture surfaceTexture, Camera const & came
 
     WGPUCommandEncoder commandEncoder = wgpuDeviceCreateCommandEncoder(device_, &commandEncoderDescriptor);
 
-    auto frameProfiler = profiler_.beginFrame(commandEncoder);
+    // beginFrame, compose and at most two timestamps of the render mode
+    std::uint32_t timestampCount = 4;
+    if (renderMode_ == Mode::RaytraceWavefront)
+        timestampCount += raytraceWavefrontPipeline_.timestampCount(screenSize, pathTracingOptions_.maxDepth);
+
+    auto frameProfiler = profiler_.beginFrame(commandEncoder, timestampCount);
 
     WGPUTextureViewDescriptor surfaceTextureViewDescriptor;
     surfaceTextureViewDescriptor.nextInChain = nullptr;
@@ -258,12 +362,38 @@ void Renderer::Impl::renderFrame(WGPUTexture surfaceTexture, Camera const & came
         if (renderMode_ == Mode::RaytraceFirstHit)
             renderRaytraceFirstHit(commandEncoder, accumulationTextureView_, raytraceFirstHitPipeline_.pipeline(),
                 camera_.bindGroup(), sceneData, accumulationStorageBindGroup_, screenSize);
+        else if (renderMode_ == Mode::RaytraceMonteCarlo && sampleCount == 0)
+        {
+            // The sample limit has been reached, the accumulated image is only composed
+        }
+        else if (renderMode_ == Mode::RaytraceMonteCarlo && adaptiveSamplingOptions_.targetRelativeError > 0.f)
+        {
+            adaptiveSampling_.update(commandEncoder, accumulationTextureView_, screenSize, frameID_, adaptiveSamplingOptions_);
+            frameProfiler.timestamp("adaptive_sample_map");
+
+            renderRaytraceMonteCarloAdaptive(commandEncoder, raytraceMonteCarloPipeline_.adaptivePipeline(),
+                camera_.bindGroup(), sceneData, adaptiveSampling_.bindGroup(), adaptiveSampling_.dispatchArgsBuffer());
+            frameProfiler.timestamp("raytrace");
+        }
         else if (renderMode_ == Mode::RaytraceMonteCarlo)
         {
             renderRaytraceMonteCarlo(commandEncoder, accumulationTextureView_, raytraceMonteCarloPipeline_.pipeline(),
                 camera_.bindGroup(), sceneData, accumulationStorageBindGroup_, screenSize);
             frameProfiler.timestamp("raytrace");
         }
+        else if (renderMode_ == Mode::RaytraceWavefront)
+        {
+            raytraceWavefrontPipeline_.render(commandEncoder, accumulationTextureView_, camera_.bindGroup(), sceneData, screenSize,
+                pathTracingOptions_.maxDepth, &frameProfiler);
+        }
+        else if (renderMode_ == Mode::TraversalHeatmap)
+        {
+            traversalStats_.clear(commandEncoder);
+            renderRaytraceHeatmap(commandEncoder, raytraceHeatmapPipeline_.pipeline(), camera_.bindGroup(), sceneData,
+                traversalStats_.bindGroup(), accumulationStorageBindGroup_, screenSize);
+            traversalStats_.resolve(commandEncoder);
+            frameProfiler.timestamp("heatmap");
+        }
 
         renderCompose(commandEncoder, surfaceTextureView, composePipeline_.renderPipeline(), accumulationSampleBindGroup_, composeUniforms_.bindGroup());
         frameProfiler.timestamp("compose");
@@ -271,7 +401,8 @@ void Renderer::Impl::renderFrame(WGPUTexture surfaceTexture, Camera const & came
         needClearAccumulationTexture_ = false;
     }
 
-    profiler_.endFrame(std::move(frameProfiler));
+    std::uint64_t const profiledFrameIndex = profiler_.endFrame(std::move(frameProfiler));
+    frameSampleCounts_[profiledFrameIndex % frameSampleCounts_.size()] = {profiledFrameIndex, renderMode_ == Mode::RaytraceMonteCarlo ? sampleCount : 0};
 
     WGPUCommandBufferDescriptor commandBufferDescriptor;
     commandBufferDescriptor.nextInChain = nullptr;
@@ -286,9 +417,12 @@ void Renderer::Impl::renderFrame(WGPUTexture surfaceTexture, Camera const & came
     wgpuCommandEncoderRelease(commandEncoder);
 
     ++frameID_;
-    ++globalFrameID_;
+    sampleID_ += sampleCount;
+    globalSampleID_ += sampleCount;
 
     profiler_.poll();
+    traversalStats_.poll();
+    adaptiveSampling_.poll();
 }
 
 Renderer::Renderer(WGPUDevice device, WGPUQueue queue, WGPUTextureFormat surfaceFormat, ShaderRegistry & shaderRegistry)
@@ -319,7 +453,57 @@ void Renderer::setRenderMode(Mode mode)
     pimpl_->setRenderMode(mode);
 }
 
+void Renderer::setPathTracingOptions(PathTracingOptions const & options)
+{
+    pimpl_->setPathTracingOptions(options);
+}
+
+void Renderer::setWavefrontMaterialSorting(bool enabled)
+{
+    pimpl_->setWavefrontMaterialSorting(enabled);
+}
+
+void Renderer::setAdaptiveSampling(AdaptiveSamplingOptions const & options)
+{
+    pimpl_->setAdaptiveSampling(options);
+}
+
+void Renderer::setFrameBudget(FrameBudgetOptions const & options)
+{
+    pimpl_->setFrameBudget(options);
+}
+
+std::uint32_t Renderer::samplesPerDispatch() const
+{
+    return pimpl_->samplesPerDispatch();
+}
+
+void Renderer::setSampleLimit(std::uint32_t sampleLimit)
+{
+    pimpl_->setSampleLimit(sampleLimit);
+}
+
+std::uint32_t Renderer::sampleCount() const
+{
+    return pimpl_->sampleCount();
+}
+
 void Renderer::renderFrame(WGPUTexture surfaceTexture, Camera const & camera, SceneData const & sceneData, float exposure)
 {
     pimpl_->renderFrame(surfaceTexture, camera, sceneData, exposure);
 }
+
+WGPUTexture Renderer::accumulationTexture() const
+{
+    return pimpl_->accumulationTexture();
+}
+
+std::optional<TraversalHeatmapStats> Renderer::traversalStats() const
+{
+    return pimpl_->traversalStats();
+}
+
+std::optional<AdaptiveSamplingStats> Renderer::adaptiveSamplingStats() const
+{
+    return pimpl_->adaptiveSamplingStats();
+}
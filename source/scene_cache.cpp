@@ -0,0 +1,194 @@
+#include <webgpu-raytracer/scene_cache.hpp>
+#include <webgpu-raytracer/hash.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstring>
+
+namespace
+{
+
+    constexpr char MAGIC[8] = {'W', 'G', 'R', 'T', 'S', 'C', 'N', 'E'};
+
+    // Bump whenever the layout of any section or the way
+    // the geometry is processed changes
+    constexpr std::uint32_t VERSION = 3;
+
+    constexpr std::uint64_t SECTION_ALIGNMENT = 64;
+
+    enum Section : std::uint32_t
+    {
+        VertexPositionsSection,
+        VertexAttributesSection,
+        BvhNodesSection,
+        EmissiveTrianglesSection,
+        EmissiveAliasTableSection,
+        EmissiveBvhNodesSection,
+        InstancesSection,
+        InstanceBvhNodesSection,
+
+        SectionCount,
+    };
+
+    struct SectionHeader
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t sectionCount;
+        std::uint64_t key;
+        SectionHeader sections[SectionCount];
+    };
+
+    template <typename T>
+    bool readSection(MappedFile const & file, Header const & header, Section section, std::span<T const> & result)
+    {
+        auto const & sectionHeader = header.sections[section];
+
+        if (sectionHeader.offset % SECTION_ALIGNMENT != 0 || sectionHeader.size % sizeof(T) != 0)
+            return false;
+
+        if (sectionHeader.offset > file.size() || sectionHeader.size > file.size() - sectionHeader.offset)
+            return false;
+
+        result = {reinterpret_cast<T const *>(file.data() + sectionHeader.offset), sectionHeader.size / sizeof(T)};
+        return true;
+    }
+
+}
+
+std::optional<SceneCache> SceneCache::open(std::filesystem::path const & path, std::uint64_t key)
+{
+    if (!std::filesystem::exists(path))
+        return std::nullopt;
+
+    SceneCache result;
+
+    try
+    {
+        result.file_ = MappedFile(path);
+    }
+    catch (std::exception const &)
+    {
+        return std::nullopt;
+    }
+
+    auto const & file = result.file_;
+
+    if (file.size() < sizeof(Header))
+        return std::nullopt;
+
+    Header header;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.sectionCount != SectionCount || header.key != key)
+        return std::nullopt;
+
+    auto & geometry = result.geometry_;
+
+    bool valid = true;
+    valid = valid && readSection(file, header, VertexPositionsSection, geometry.vertexPositions);
+    valid = valid && readSection(file, header, VertexAttributesSection, geometry.vertexAttributes);
+    valid = valid && readSection(file, header, BvhNodesSection, geometry.bvhNodes);
+    valid = valid && readSection(file, header, EmissiveTrianglesSection, geometry.emissiveTriangles);
+    valid = valid && readSection(file, header, EmissiveAliasTableSection, geometry.emissiveAliasTable);
+    valid = valid && readSection(file, header, EmissiveBvhNodesSection, geometry.emissiveBvhNodes);
+    valid = valid && readSection(file, header, InstancesSection, geometry.instances);
+    valid = valid && readSection(file, header, InstanceBvhNodesSection, geometry.instanceBvhNodes);
+
+    if (!valid)
+        return std::nullopt;
+
+    return result;
+}
+
+void writeSceneCache(std::filesystem::path const & path, std::uint64_t key, SceneGeometryView const & geometry)
+{
+    auto bytes = [](auto const & span){ return std::span<char const>((char const *)span.data(), span.size_bytes()); };
+
+    std::span<char const> sections[SectionCount];
+    sections[VertexPositionsSection] = bytes(geometry.vertexPositions);
+    sections[VertexAttributesSection] = bytes(geometry.vertexAttributes);
+    sections[BvhNodesSection] = bytes(geometry.bvhNodes);
+    sections[EmissiveTrianglesSection] = bytes(geometry.emissiveTriangles);
+    sections[EmissiveAliasTableSection] = bytes(geometry.emissiveAliasTable);
+    sections[EmissiveBvhNodesSection] = bytes(geometry.emissiveBvhNodes);
+    sections[InstancesSection] = bytes(geometry.instances);
+    sections[InstanceBvhNodesSection] = bytes(geometry.instanceBvhNodes);
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.sectionCount = SectionCount;
+    header.key = key;
+
+    auto align = [](std::uint64_t offset){ return (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT; };
+
+    std::uint64_t offset = align(sizeof(Header));
+    for (std::uint32_t i = 0; i < SectionCount; ++i)
+    {
+        header.sections[i].offset = offset;
+        header.sections[i].size = sections[i].size();
+        offset = align(offset + sections[i].size());
+    }
+
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path());
+
+    auto temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    {
+        std::ofstream output(temporaryPath, std::ios::binary);
+        if (!output)
+            throw std::runtime_error("Failed to open " + temporaryPath.string());
+
+        char const padding[SECTION_ALIGNMENT] = {};
+
+        output.write((char const *)&header, sizeof(header));
+        std::uint64_t written = sizeof(header);
+
+        for (std::uint32_t i = 0; i < SectionCount; ++i)
+        {
+            output.write(padding, header.sections[i].offset - written);
+            output.write(sections[i].data(), sections[i].size());
+            written = header.sections[i].offset + sections[i].size();
+        }
+
+        if (!output)
+            throw std::runtime_error("Failed to write " + temporaryPath.string());
+    }
+
+    std::filesystem::rename(temporaryPath, path);
+}
+
+std::uint64_t sceneCacheKey(std::uint64_t assetContentHash, BVHBuildOptions const & bvhOptions, bool instancing)
+{
+    // NB: the BVH thread count doesn't affect the result
+
+    Hasher hasher;
+    hasher.update(VERSION);
+    hasher.update(assetContentHash);
+    hasher.update(instancing);
+    hasher.update(bvhOptions.method);
+    hasher.update(bvhOptions.binCount);
+    hasher.update(bvhOptions.nodeOrder);
+    hasher.update(bvhOptions.optimizationPassCount);
+    if (bvhOptions.method == BVHBuildOptions::Method::SpatialSAH)
+        hasher.update(bvhOptions.spatialSplitBudget);
+    return hasher.digest();
+}
+
+std::filesystem::path sceneCachePath(std::filesystem::path const & cacheDirectory, std::uint64_t key)
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << ".scene";
+    return cacheDirectory / name.str();
+}
@@ -1,697 +1,168 @@
 #include <webgpu-raytracer/scene_data.hpp>
-#include <webgpu-raytracer/gltf_iterator.hpp>
 #include <webgpu-raytracer/material_bind_group.hpp>
 #include <webgpu-raytracer/geometry_bind_group.hpp>
-#include <webgpu-raytracer/color.hpp>
-#include <webgpu-raytracer/bvh.hpp>
-#include <webgpu-raytracer/alias.hpp>
-#include <webgpu-raytracer/timer.hpp>
-#include <stb_image.h>
-#include <mikktspace.h>
+#include <webgpu-raytracer/texture_atlas.hpp>
+#include <webgpu-raytracer/wide_bvh.hpp>
+#include <webgpu-raytracer/instancing.hpp>
 
 #include <glm/glm.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <cstring>
 
 namespace
 {
 
-    struct VertexAttributes
-    {
-        glm::vec3 normal;
-        std::uint32_t materialID;
-        glm::vec4 tangent;
-        glm::vec2 texcoords;
-        char padding[8];
-    };
-
-    static_assert(sizeof(VertexAttributes) == 48);
-
-    struct Vertex
-    {
-        glm::vec3 position;
-        std::uint32_t padding = 0;
-        VertexAttributes attributes;
-    };
-
     struct Material
     {
         glm::vec4 baseColorFactorAndAlpha;
         // vec4(0, roughness, metallic, ior)
         glm::vec4 metallicRoughnessFactorAndIor;
         glm::vec4 emissiveFactorAndTransmission;
-        // uvec4(albedo, material, 0, 0)
+        // uvec4(albedo, material, normal, 0) atlas layers
         glm::uvec4 textureLayers;
+        // uvec4(offset, size) of the textures within their atlas layers, in texels
+        glm::uvec4 albedoRect;
+        glm::uvec4 materialRect;
+        glm::uvec4 normalRect;
     };
 
-    void readIndices(glTF::Asset const & asset, glTF::Accessor const & indexAccessor, std::vector<std::uint32_t> & indices, std::uint32_t baseVertex)
-    {
-        switch (indexAccessor.componentType)
-        {
-        case glTF::Accessor::ComponentType::UnsignedByte:
-            for (auto index : glTF::AccessorRange<std::uint8_t>(asset, indexAccessor))
-                indices.push_back(baseVertex + index);
-            break;
-        case glTF::Accessor::ComponentType::UnsignedShort:
-            for (auto index : glTF::AccessorRange<std::uint16_t>(asset, indexAccessor))
-                indices.push_back(baseVertex + index);
-            break;
-        case glTF::Accessor::ComponentType::UnsignedInt:
-            for (auto index : glTF::AccessorRange<std::uint32_t>(asset, indexAccessor))
-                indices.push_back(baseVertex + index);
-            break;
-        default:
-            std::cout << "Warning: unsupported index component type: " << (int)indexAccessor.componentType << "\n";
-            break;
-        }
-    }
-
-    void fillIndices(glTF::Accessor const & positionAccessor, std::vector<std::uint32_t> & indices, std::uint32_t baseVertex)
+    std::vector<glm::uvec2> imageSizes(std::vector<SceneImage> const & images)
     {
-        for (std::uint32_t index = 0; index < positionAccessor.count; ++index)
-            indices.push_back(baseVertex + index);
+        std::vector<glm::uvec2> result;
+        for (auto const & image : images)
+            result.push_back({image.width, image.height});
+        return result;
     }
 
-    void readPositions(glTF::Asset const & asset, glTF::Accessor const & positionAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    void writeAtlasImages(WGPUQueue queue, WGPUTexture texture, std::vector<SceneImage> const & images, TextureAtlas const & atlas)
     {
-        auto vertexIt = vertices.begin() + baseVertex;
-
-        switch (positionAccessor.componentType)
-        {
-        case glTF::Accessor::ComponentType::Float:
-            for (auto position : glTF::AccessorRange<glm::vec3>(asset, positionAccessor))
-            {
-                vertexIt->position = position;
-                ++vertexIt;
-            }
-            break;
-        default:
-            std::cout << "Warning: unsupported position component type: " << (int)positionAccessor.componentType << "\n";
-
-            // Prevent uninitialized data
-            for (std::uint32_t i = 0; i < positionAccessor.count; ++i)
-            {
-                vertexIt->position = glm::vec3(0.f);
-                ++vertexIt;
-            }
-            break;
-        }
-    }
-
-    void readNormals(glTF::Asset const & asset, glTF::Accessor const & normalAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
-    {
-        auto vertexIt = vertices.begin() + baseVertex;
-
-        switch (normalAccessor.componentType)
-        {
-        case glTF::Accessor::ComponentType::Float:
-            for (auto normal : glTF::AccessorRange<glm::vec3>(asset, normalAccessor))
-            {
-                vertexIt->attributes.normal = normal;
-                ++vertexIt;
-            }
-            break;
-        default:
-            std::cout << "Warning: unsupported normal component type: " << (int)normalAccessor.componentType << "\n";
-
-            // Prevent uninitialized data
-            for (std::uint32_t i = 0; i < normalAccessor.count; ++i)
-            {
-                vertexIt->attributes.normal = glm::vec3(0.f, 0.f, 1.f);
-                ++vertexIt;
-            }
-            break;
-        }
-    }
-
-    void reconstructNormals(std::vector<Vertex> & vertices, std::vector<std::uint32_t> const & indices, std::uint32_t baseVertex, std::uint32_t baseIndex,
-        std::uint32_t vertexCount, std::uint32_t indexCount)
-    {
-        for (std::uint32_t i = 0; i < vertexCount; ++i)
-            vertices[baseVertex + i].attributes.normal = glm::vec3(0.f);
-
-        // Compute average adjacent triangle normal
-        for (std::uint32_t i = 0; i < indexCount; i += 3)
+        for (std::uint32_t i = 0; i < images.size(); ++i)
         {
-            auto & v0 = vertices[baseVertex + indices[baseIndex + i + 0]];
-            auto & v1 = vertices[baseVertex + indices[baseIndex + i + 1]];
-            auto & v2 = vertices[baseVertex + indices[baseIndex + i + 2]];
+            auto const & image = images[i];
+            auto const & placement = atlas.placements[i];
 
-            auto normal = glm::normalize(glm::cross(v1.position - v0.position, v2.position - v0.position));
-
-            v0.attributes.normal += normal;
-            v1.attributes.normal += normal;
-            v2.attributes.normal += normal;
-        }
-
-        for (std::uint32_t i = 0; i < vertexCount; ++i)
-        {
-            auto & v = vertices[baseVertex + i];
-            v.attributes.normal = glm::normalize(v.attributes.normal);
-        }
-    }
-
-    void fillDefaultTexcoords(std::vector<Vertex> & vertices, std::uint32_t baseVertex, std::uint32_t count)
-    {
-        auto vertexBegin = vertices.begin() + baseVertex;
-        auto vertexEnd = vertexBegin + count;
-
-        for (auto vertexIt = vertexBegin; vertexIt != vertexEnd; ++vertexIt)
-            vertexIt->attributes.texcoords = {0.5f, 0.5f};
-    }
-
-    void readTexcoords(glTF::Asset const & asset, glTF::Accessor const & texcoordAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
-    {
-        auto vertexIt = vertices.begin() + baseVertex;
-
-        switch (texcoordAccessor.componentType)
-        {
-        case glTF::Accessor::ComponentType::Float:
-            for (auto texcoord : glTF::AccessorRange<glm::vec2>(asset, texcoordAccessor))
+            for (std::uint32_t level = 0; level < placement.mipLevelCount; ++level)
             {
-                vertexIt->attributes.texcoords = texcoord;
-                ++vertexIt;
+                std::uint32_t const width = image.width >> level;
+                std::uint32_t const height = image.height >> level;
+                std::uint32_t const * pixels = (level == 0) ? image.pixels : image.mipmaps[level - 1].pixels.data();
+
+                WGPUImageCopyTexture textureDestination;
+                textureDestination.nextInChain = nullptr;
+                textureDestination.texture = texture;
+                textureDestination.mipLevel = level;
+                textureDestination.origin = {placement.offset.x >> level, placement.offset.y >> level, placement.layer};
+                textureDestination.aspect = WGPUTextureAspect_All;
+
+                WGPUTextureDataLayout textureDataLayout;
+                textureDataLayout.nextInChain = nullptr;
+                textureDataLayout.offset = 0;
+                textureDataLayout.bytesPerRow = width * 4;
+                textureDataLayout.rowsPerImage = height;
+
+                WGPUExtent3D textureWriteSize;
+                textureWriteSize.width = width;
+                textureWriteSize.height = height;
+                textureWriteSize.depthOrArrayLayers = 1;
+
+                wgpuQueueWriteTexture(queue, &textureDestination, pixels, width * height * 4, &textureDataLayout, &textureWriteSize);
             }
-            break;
-        default:
-            std::cout << "Warning: unsupported normal component type: " << (int)texcoordAccessor.componentType << "\n";
-
-            // Prevent uninitialized data
-            fillDefaultTexcoords(vertices, baseVertex, texcoordAccessor.count);
-            break;
         }
     }
 
-    void readTangents(glTF::Asset const & asset, glTF::Accessor const & tangentAccessor, std::vector<Vertex> & vertices, std::uint32_t baseVertex)
+    // Compares the atlas against storing every image in its own
+    // array layer, rescaled to the largest image size
+    std::uint64_t printAtlasMemoryUsage(char const * name, std::vector<SceneImage> const & images, TextureAtlas const & atlas, std::uint64_t & rescaledBytes)
     {
-        auto vertexIt = vertices.begin() + baseVertex;
+        std::uint64_t layerBytes = 0;
+        for (std::uint32_t level = 0; level < atlas.mipLevelCount; ++level)
+            layerBytes += std::uint64_t(std::max(1u, atlas.layerSize.x >> level)) * std::max(1u, atlas.layerSize.y >> level) * 4;
+        std::uint64_t const atlasBytes = layerBytes * atlas.layerCount;
+        rescaledBytes += layerBytes * images.size();
 
-        switch (tangentAccessor.componentType)
-        {
-        case glTF::Accessor::ComponentType::Float:
-            for (auto tangent : glTF::AccessorRange<glm::vec4>(asset, tangentAccessor))
-            {
-                vertexIt->attributes.tangent = tangent;
-                ++vertexIt;
-            }
-            break;
-        default:
-            std::cout << "Warning: unsupported tangent component type: " << (int)tangentAccessor.componentType << "\n";
+        std::cout << "  " << name << ": " << images.size() << " images in " << atlas.layerCount << " layers of "
+            << atlas.layerSize.x << "x" << atlas.layerSize.y << ", " << (atlasBytes >> 20) << " MB (was "
+            << ((layerBytes * images.size()) >> 20) << " MB)" << std::endl;
 
-            // Prevent uninitialized data
-            for (std::uint32_t i = 0; i < tangentAccessor.count; ++i)
-            {
-                vertexIt->attributes.tangent = glm::vec4(1.f, 0.f, 0.f, 1.f);
-                ++vertexIt;
-            }
-            break;
-        }
+        return atlasBytes;
     }
 
-    void fillDefaultTangents(std::vector<Vertex> & vertices, std::uint32_t baseVertex, std::uint32_t count)
+    // Returns true if the buffer had to be recreated
+    bool uploadBuffer(WGPUDevice device, WGPUQueue queue, WGPUBuffer & buffer, void const * data, std::uint64_t size)
     {
-        auto vertexBegin = vertices.begin() + baseVertex;
-        auto vertexEnd = vertexBegin + count;
+        bool const recreate = (wgpuBufferGetSize(buffer) != size);
 
-        for (auto vertexIt = vertexBegin; vertexIt != vertexEnd; ++vertexIt)
+        if (recreate)
         {
-            glm::vec3 tangent;
-            if (std::abs(vertexIt->attributes.normal.z) < 0.5f)
-                tangent = glm::cross(vertexIt->attributes.normal, glm::vec3(0.f, 0.f, 1.f));
-            else
-                tangent = glm::cross(vertexIt->attributes.normal, glm::vec3(1.f, 0.f, 0.f));
-            vertexIt->attributes.tangent = glm::vec4(glm::normalize(tangent), 1.f);
+            WGPUBufferDescriptor bufferDescriptor;
+            bufferDescriptor.nextInChain = nullptr;
+            bufferDescriptor.label = nullptr;
+            bufferDescriptor.usage = wgpuBufferGetUsage(buffer);
+            bufferDescriptor.size = size;
+            bufferDescriptor.mappedAtCreation = false;
+
+            wgpuBufferRelease(buffer);
+            buffer = wgpuDeviceCreateBuffer(device, &bufferDescriptor);
         }
-    }
-
-    void reconstructTangents(std::vector<Vertex> & vertices, std::vector<std::uint32_t> const & indices, std::uint32_t baseVertex, std::uint32_t baseIndex,
-        std::uint32_t vertexCount, std::uint32_t indexCount)
-    {
-        struct Context
-        {
-            Vertex * vertices;
-            std::uint32_t const * indices;
-            std::uint32_t vertexCount;
-            std::uint32_t indexCount;
-        };
-
-        Context context
-        {
-            .vertices = vertices.data(),
-            .indices = indices.data() + baseIndex,
-            .vertexCount = vertexCount,
-            .indexCount = indexCount,
-        };
 
-        SMikkTSpaceInterface mikkTSpaceInterface
-        {
-            .m_getNumFaces = [](SMikkTSpaceContext const * pContext) -> int
-            {
-                return ((Context *)(pContext->m_pUserData))->indexCount / 3;
-            },
-            .m_getNumVerticesOfFace = [](SMikkTSpaceContext const *, int) -> int
-            {
-                return 3;
-            },
-            .m_getPosition = [](SMikkTSpaceContext const * pContext, float * fvPosOut, int iFace, int iVert)
-            {
-                auto context = (Context *)(pContext->m_pUserData);
-                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
-                fvPosOut[0] = vertex.position.x;
-                fvPosOut[1] = vertex.position.y;
-                fvPosOut[2] = vertex.position.z;
-            },
-            .m_getNormal = [](SMikkTSpaceContext const * pContext, float * fvNormOut, int iFace, int iVert)
-            {
-                auto context = (Context *)(pContext->m_pUserData);
-                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
-                fvNormOut[0] = vertex.attributes.normal.x;
-                fvNormOut[1] = vertex.attributes.normal.y;
-                fvNormOut[2] = vertex.attributes.normal.z;
-            },
-            .m_getTexCoord = [](SMikkTSpaceContext const * pContext, float * fvTexcOut, int iFace, int iVert)
-            {
-                auto context = (Context *)(pContext->m_pUserData);
-                auto const & vertex = context->vertices[context->indices[3 * iFace + iVert]];
-                fvTexcOut[0] = vertex.attributes.texcoords.x;
-                fvTexcOut[1] = vertex.attributes.texcoords.y;
-            },
-            .m_setTSpaceBasic = [](SMikkTSpaceContext const * pContext, float const * fvTangent, float fSign, int iFace, int iVert)
-            {
-                auto context = (Context *)(pContext->m_pUserData);
-                auto & vertex = context->vertices[context->indices[3 * iFace + iVert]];
-                vertex.attributes.tangent.x = fvTangent[0];
-                vertex.attributes.tangent.y = fvTangent[1];
-                vertex.attributes.tangent.z = fvTangent[2];
-                vertex.attributes.tangent.w = fSign;
-            },
-            .m_setTSpace = nullptr,
-        };
-
-        SMikkTSpaceContext mikkTSpaceContext
-        {
-            .m_pInterface = &mikkTSpaceInterface,
-            .m_pUserData = &context,
-        };
+        wgpuQueueWriteBuffer(queue, buffer, 0, data, size);
 
-        genTangSpaceDefault(&mikkTSpaceContext);
-    }
-
-    struct Image
-    {
-        std::uint32_t width;
-        std::uint32_t height;
-        std::uint32_t const * pixels;
-    };
-
-    std::vector<std::uint32_t> rescaleImage(Image & image, glm::uvec2 const & targetSize)
-    {
-        if (image.width == targetSize.x && image.height == targetSize.y)
-            return {};
-
-        std::vector<std::uint32_t> scaledPixels(targetSize.x * targetSize.y);
-
-        for (std::uint32_t y = 0; y < targetSize.y; ++y)
-        {
-            for (std::uint32_t x = 0; x < targetSize.x; ++x)
-            {
-                auto sx = (x * image.width) / targetSize.x;
-                auto sy = (y * image.height) / targetSize.y;
-                scaledPixels[x + y * targetSize.x] = image.pixels[sx + sy * image.width];
-            }
-        }
-
-        image.width = targetSize.x;
-        image.height = targetSize.y;
-        image.pixels = scaledPixels.data();
-
-        return scaledPixels;
+        return recreate;
     }
 
 }
 
-SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap, WGPUDevice device, WGPUQueue queue,
-    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout)
+SceneData::SceneData(PreparedScene const & scene, WGPUDevice device, WGPUQueue queue,
+    WGPUBindGroupLayout geometryBindGroupLayout, WGPUBindGroupLayout materialBindGroupLayout,
+    BVHLayout bvhLayout)
 {
-    std::vector<Vertex> vertices;
-    std::vector<std::uint32_t> indices;
-    std::vector<Material> materials;
-
-    // Add default rough diffuse material
-    materials.push_back({
-        .baseColorFactorAndAlpha = glm::vec4(1.f, 1.f, 1.f, 1.f),
-        .metallicRoughnessFactorAndIor = glm::vec4(0.f, 1.f, 0.f, 1.5f),
-        .emissiveFactorAndTransmission = glm::vec4(0.f),
-    });
-
-    for (auto const & node : asset.nodes)
-    {
-        if (!node.mesh) continue;
-
-        glm::mat3 normalMatrix = glm::inverse(glm::transpose(glm::mat3(node.globalMatrix)));
-
-        for (auto const & primitive : asset.meshes[*node.mesh].primitives)
-        {
-            if (primitive.mode != glTF::Primitive::Mode::Triangles)
-            {
-                std::cout << "Warning: only 'triangles' primitive mode is supported\n";
-                continue;
-            }
-
-            if (!primitive.attributes.position)
-            {
-                std::cout << "Warning: cannot render a primitive without positions\n";
-                continue;
-            }
-
-            // Fetch all accessors
-
-            glTF::Accessor const * indexAccessor = nullptr;
-            glTF::Accessor const * positionAccessor = nullptr;
-            glTF::Accessor const * normalAccessor = nullptr;
-            glTF::Accessor const * texcoordAccessor = nullptr;
-            glTF::Accessor const * tangentAccessor = nullptr;
-
-            if (primitive.indices) indexAccessor = &asset.accessors[*primitive.indices];
-
-            positionAccessor = &asset.accessors[*primitive.attributes.position];
-
-            if (primitive.attributes.normal) normalAccessor = &asset.accessors[*primitive.attributes.normal];
-            if (primitive.attributes.texcoord) texcoordAccessor = &asset.accessors[*primitive.attributes.texcoord];
-            if (primitive.attributes.tangent) tangentAccessor = &asset.accessors[*primitive.attributes.tangent];
-
-            // Read indices
-
-            std::uint32_t baseIndex = indices.size();
-            std::uint32_t baseVertex = vertices.size();
-            std::uint32_t indexCount = indexAccessor ? indexAccessor->count : positionAccessor->count;
-
-            if (indexAccessor)
-                readIndices(asset, *indexAccessor, indices, baseVertex);
-            else
-                fillIndices(*positionAccessor, indices, baseVertex);
-
-            // Preallocate vertices
-
-            vertices.resize(vertices.size() + positionAccessor->count);
-
-            // Read positions
-            readPositions(asset, *positionAccessor, vertices, baseVertex);
-
-            // Read normals
-            if (normalAccessor)
-                readNormals(asset, *normalAccessor, vertices, baseVertex);
-            else
-                reconstructNormals(vertices, indices, baseVertex, baseIndex, positionAccessor->count, indexCount);
-
-            // Read texture coordinates
-            if (texcoordAccessor)
-                readTexcoords(asset, *texcoordAccessor, vertices, baseVertex);
-            else
-                fillDefaultTexcoords(vertices, baseVertex, positionAccessor->count);
-
-            // Read tangents
-            if (tangentAccessor)
-                readTangents(asset, *tangentAccessor, vertices, baseVertex);
-            else if (texcoordAccessor)
-                reconstructTangents(vertices, indices, baseVertex, baseIndex, positionAccessor->count, indexCount);
-            else
-                fillDefaultTangents(vertices, baseVertex, positionAccessor->count);
-
-            std::uint32_t materialID = primitive.material ? 1 + *primitive.material : 0;
-
-            for (std::uint32_t i = 0; i < positionAccessor->count; ++i)
-            {
-                auto & v = vertices[baseVertex + i];
-
-                v.position = glm::vec3(node.globalMatrix * glm::vec4(v.position, 1.f));
-                v.attributes.normal = glm::normalize(normalMatrix * v.attributes.normal);
-                v.attributes.tangent = glm::vec4(glm::normalize(glm::mat3(node.globalMatrix) * glm::vec3(v.attributes.tangent)), v.attributes.tangent.w);
-                v.attributes.materialID = materialID;
-            }
-        }
-    }
-
-    glm::uvec2 maxAlbedoTextureSize(1);
-    glm::uvec2 maxMaterialTextureSize(1);
-    glm::uvec2 maxNormalTextureSize(1);
-
-    std::vector<Image> albedoImages;
-    std::vector<Image> materialImages;
-    std::vector<Image> normalImages;
-
-    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToAlbedoArrayLayer;
-    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToMaterialArrayLayer;
-    std::unordered_map<std::uint32_t, std::uint32_t> glTFImageToNormalArrayLayer;
-
-    albedoImages.push_back({
-        .width = 1,
-        .height = 1,
-        .pixels = nullptr,
-    });
-
-    materialImages.push_back({
-        .width = 1,
-        .height = 1,
-        .pixels = nullptr,
-    });
-
-    normalImages.push_back({
-        .width = 1,
-        .height = 1,
-        .pixels = nullptr,
-    });
-
-    for (auto const & materialIn : asset.materials)
-    {
-        auto & material = materials.emplace_back();
-        material.baseColorFactorAndAlpha = materialIn.baseColorFactor;
-        material.metallicRoughnessFactorAndIor = glm::vec4(0.f, materialIn.roughnessFactor, materialIn.metallicFactor, materialIn.ior);
-        material.emissiveFactorAndTransmission = glm::vec4(materialIn.emissiveFactor, materialIn.transmission);
-        material.textureLayers = glm::uvec4(0);
-
-        if (materialIn.baseColorTexture)
-        {
-            if (auto sourceImage = asset.textures[*materialIn.baseColorTexture].source)
-            {
-                if (glTFImageToAlbedoArrayLayer.contains(*sourceImage))
-                {
-                    material.textureLayers.x = glTFImageToAlbedoArrayLayer.at(*sourceImage);
-                }
-                else
-                {
-                    auto const & image = asset.images[*sourceImage];
-                    maxAlbedoTextureSize = glm::max(maxAlbedoTextureSize, glm::uvec2(image.width, image.height));
-
-                    glTFImageToAlbedoArrayLayer[*sourceImage] = albedoImages.size();
-                    material.textureLayers.x = albedoImages.size();
-
-                    albedoImages.push_back({
-                        .width = image.width,
-                        .height = image.height,
-                        .pixels = image.data.data(),
-                    });
-                }
-            }
-        }
-
-        if (materialIn.metallicRoughnessTexture)
-        {
-            if (auto sourceImage = asset.textures[*materialIn.metallicRoughnessTexture].source)
-            {
-                if (glTFImageToMaterialArrayLayer.contains(*sourceImage))
-                {
-                    material.textureLayers.y = glTFImageToMaterialArrayLayer.at(*sourceImage);
-                }
-                else
-                {
-                    auto const & image = asset.images[*sourceImage];
-                    maxMaterialTextureSize = glm::max(maxMaterialTextureSize, glm::uvec2(image.width, image.height));
-
-                    glTFImageToMaterialArrayLayer[*sourceImage] = materialImages.size();
-                    material.textureLayers.y = materialImages.size();
-
-                    materialImages.push_back({
-                        .width = image.width,
-                        .height = image.height,
-                        .pixels = image.data.data(),
-                    });
-                }
-            }
-        }
-
-        if (materialIn.normalTexture)
-        {
-            if (auto sourceImage = asset.textures[*materialIn.normalTexture].source)
-            {
-                if (glTFImageToNormalArrayLayer.contains(*sourceImage))
-                {
-                    material.textureLayers.z = glTFImageToNormalArrayLayer.at(*sourceImage);
-                }
-                else
-                {
-                    auto const & image = asset.images[*sourceImage];
-                    maxNormalTextureSize = glm::max(maxNormalTextureSize, glm::uvec2(image.width, image.height));
-
-                    glTFImageToNormalArrayLayer[*sourceImage] = normalImages.size();
-                    material.textureLayers.z = normalImages.size();
-
-                    normalImages.push_back({
-                        .width = image.width,
-                        .height = image.height,
-                        .pixels = image.data.data(),
-                    });
-                }
-            }
-        }
-    }
-
-    std::vector<std::uint32_t> whiteAlbedoPixels(maxAlbedoTextureSize.x * maxAlbedoTextureSize.y, 0xffffffffu);
-    albedoImages[0].width = maxAlbedoTextureSize.x;
-    albedoImages[0].height = maxAlbedoTextureSize.y;
-    albedoImages[0].pixels = whiteAlbedoPixels.data();
-
-    std::vector<std::uint32_t> whiteMaterialPixels(maxMaterialTextureSize.x * maxMaterialTextureSize.y, 0xffffffffu);
-    materialImages[0].width = maxMaterialTextureSize.x;
-    materialImages[0].height = maxMaterialTextureSize.y;
-    materialImages[0].pixels = whiteMaterialPixels.data();
-
-    std::vector<std::uint32_t> blueNormalPixels(maxNormalTextureSize.x * maxNormalTextureSize.y, 0xffff7f7f);
-    normalImages[0].width = maxNormalTextureSize.x;
-    normalImages[0].height = maxNormalTextureSize.y;
-    normalImages[0].pixels = blueNormalPixels.data();
-
-    std::vector<AABB> triangleAABB(indices.size() / 3);
-    for (std::uint32_t i = 0; i < triangleAABB.size(); ++i)
-    {
-        triangleAABB[i].extend(vertices[indices[3 * i + 0]].position);
-        triangleAABB[i].extend(vertices[indices[3 * i + 1]].position);
-        triangleAABB[i].extend(vertices[indices[3 * i + 2]].position);
-    }
-
-    BVH bvh = buildBVH(triangleAABB);
-
-    {
-        // Instead of storing triangleID's per BVH node, store triangles
-        // themselves (as index triples), thereby removing the need for
-        // extra indirection in the shader
-
-        std::vector<std::uint32_t> sortedIndices;
-        for (auto triangleID : bvh.triangleIDs)
-        {
-            sortedIndices.push_back(indices[3 * triangleID + 0]);
-            sortedIndices.push_back(indices[3 * triangleID + 1]);
-            sortedIndices.push_back(indices[3 * triangleID + 2]);
-        }
-        indices = std::move(sortedIndices);
-    }
+    auto const & albedoImages = scene.albedoImages;
+    auto const & materialImages = scene.materialImages;
+    auto const & normalImages = scene.normalImages;
 
-    {
-        // Instead of using indexing, store triangles as vertex triples directly,
-        // removing another indirection in the shader
-
-        std::vector<Vertex> deindexedVertices;
-        for (std::uint32_t i = 0; i < indices.size(); i += 3)
-        {
-            deindexedVertices.push_back(vertices[indices[i + 0]]);
-            deindexedVertices.push_back(vertices[indices[i + 1]]);
-            deindexedVertices.push_back(vertices[indices[i + 2]]);
-        }
-
-        vertices = std::move(deindexedVertices);
-    }
-
-    std::vector<glm::vec4> vertexPositions;
-    std::vector<VertexAttributes> vertexAttributes;
-    for (auto const & v : vertices)
-    {
-        vertexPositions.push_back(glm::vec4(v.position, 1.f));
-        vertexAttributes.push_back(v.attributes);
-    }
+    TextureAtlas const albedoAtlas = packTextureAtlas(imageSizes(albedoImages));
+    TextureAtlas const materialAtlas = packTextureAtlas(imageSizes(materialImages));
+    TextureAtlas const normalAtlas = packTextureAtlas(imageSizes(normalImages));
 
-    std::vector<std::uint32_t> emissiveTriangles;
-    for (std::uint32_t i = 0; i < vertexAttributes.size(); i += 3)
+    std::vector<Material> materials;
+    for (auto const & sceneMaterial : scene.materials)
     {
-        if (glm::lMaxNorm(glm::vec3(materials[vertexAttributes[i].materialID].emissiveFactorAndTransmission)) > 0.f)
-        {
-            emissiveTriangles.push_back(i / 3);
-        }
+        auto const & textureIDs = sceneMaterial.textureIDs;
+
+        materials.push_back({
+            .baseColorFactorAndAlpha = sceneMaterial.baseColorFactorAndAlpha,
+            .metallicRoughnessFactorAndIor = sceneMaterial.metallicRoughnessFactorAndIor,
+            .emissiveFactorAndTransmission = sceneMaterial.emissiveFactorAndTransmission,
+            .textureLayers = glm::uvec4(albedoAtlas.placements[textureIDs.x].layer, materialAtlas.placements[textureIDs.y].layer,
+                normalAtlas.placements[textureIDs.z].layer, 0),
+            .albedoRect = albedoAtlas.rect(textureIDs.x),
+            .materialRect = materialAtlas.rect(textureIDs.y),
+            .normalRect = normalAtlas.rect(textureIDs.z),
+        });
     }
 
-    std::vector<AABB> emissiveTriangleAABB(emissiveTriangles.size());
-    std::vector<float> emissiveTriangleWeight(emissiveTriangles.size());
-    float emissiveTrianglesTotalWeight = 0.f;
-
-    for (std::uint32_t i = 0; i < emissiveTriangleAABB.size(); ++i)
     {
-        auto triangleID = emissiveTriangles[i];
-
-        auto v0 = vertices[3 * triangleID + 0].position;
-        auto v1 = vertices[3 * triangleID + 1].position;
-        auto v2 = vertices[3 * triangleID + 2].position;
-
-        emissiveTriangleAABB[i].extend(v0);
-        emissiveTriangleAABB[i].extend(v1);
-        emissiveTriangleAABB[i].extend(v2);
-
-        float areaWeight = glm::length(glm::cross(v1 - v0, v2 - v0));
-
-        auto materialID = vertexAttributes[3 * triangleID + 0].materialID;
-
-        // Weight based on percieved luminance
-        float emissiveWeight = glm::dot(LUMINANCE_FACTORS, glm::vec3(materials[materialID].emissiveFactorAndTransmission));
+        std::cout << "Texture memory usage:" << std::endl;
 
-        float weight = areaWeight * emissiveWeight;
+        std::uint64_t rescaledBytes = 0;
+        std::uint64_t atlasBytes = 0;
+        atlasBytes += printAtlasMemoryUsage("albedo", albedoImages, albedoAtlas, rescaledBytes);
+        atlasBytes += printAtlasMemoryUsage("material", materialImages, materialAtlas, rescaledBytes);
+        atlasBytes += printAtlasMemoryUsage("normal", normalImages, normalAtlas, rescaledBytes);
 
-        emissiveTriangleWeight[i] = weight;
-        emissiveTrianglesTotalWeight += weight;
+        std::cout << "  total: " << (atlasBytes >> 20) << " MB (was " << (rescaledBytes >> 20) << " MB)" << std::endl;
     }
 
-    for (auto & weight : emissiveTriangleWeight)
-        weight /= emissiveTrianglesTotalWeight;
-
-    BVH emissiveBvh = buildBVH(emissiveTriangleAABB);
-    auto emissiveAliasTable = generateAlias(emissiveTriangleWeight);
-
-    struct TriangleIndexAndProbability
-    {
-        std::uint32_t index;
-        float probability;
-    };
-
-    // Instead of storing triangleID's per light BVH node, store triangles
-    // themselves, thereby removing the need for extra indirection in the shader
-
-    std::vector<TriangleIndexAndProbability> sortedEmissiveTriangles;
-    std::vector<AliasRecord> sortedEmissiveAliasTable;
-
-    // First element is actually the array size, see geometry.wgsl
-    sortedEmissiveTriangles.push_back({(std::uint32_t)emissiveTriangles.size(), 0.f});
-
-    {
-        std::vector<std::uint32_t> sortedTrianglesNewID(emissiveTriangles.size());
-
-        for (auto triangleIndex : emissiveBvh.triangleIDs)
-        {
-            sortedTrianglesNewID[triangleIndex] = sortedEmissiveTriangles.size() - 1;
-            sortedEmissiveTriangles.push_back({emissiveTriangles[triangleIndex], emissiveTriangleWeight[triangleIndex]});
-        }
-
-        for (auto triangleIndex : emissiveBvh.triangleIDs){
-            auto aliasRecord = emissiveAliasTable[triangleIndex];
-            sortedEmissiveAliasTable.push_back({
-                .probability = aliasRecord.probability,
-                .alias = sortedTrianglesNewID[aliasRecord.alias],
-            });
-        }
-
-        // Prevent the triangle buffer from being empty
-        if (emissiveBvh.triangleIDs.empty())
-        {
-            sortedEmissiveTriangles.push_back({0, 0.f});
-            sortedEmissiveAliasTable.push_back({1.f, 0});
-        }
-    }
+    auto const & geometry = scene.geometry();
+    auto const & vertexPositions = geometry.vertexPositions;
+    auto const & vertexAttributes = geometry.vertexAttributes;
+    auto const & sortedEmissiveTriangles = geometry.emissiveTriangles;
+    auto const & sortedEmissiveAliasTable = geometry.emissiveAliasTable;
 
     WGPUBufferDescriptor vertexPositionsBufferDescriptor;
     vertexPositionsBufferDescriptor.nextInChain = nullptr;
@@ -723,15 +194,80 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     materialBuffer_ = wgpuDeviceCreateBuffer(device, &materialBufferDescriptor);
     wgpuQueueWriteBuffer(queue, materialBuffer_, 0, materials.data(), materialBufferDescriptor.size);
 
+    if (!geometry.instances.empty() && bvhLayout != BVHLayout::Binary)
+    {
+        std::cout << "Warning: instanced scenes only support the binary BVH layout; using binary BVH instead\n";
+        bvhLayout = BVHLayout::Binary;
+    }
+
+    // The shader uses the wide BVH if it isn't empty, otherwise the binary one;
+    // only a single node of the unused binary BVH is uploaded
+    WideBVH wideBvh;
+    std::optional<QuantizedWideBVH> quantizedBvh;
+    if (bvhLayout != BVHLayout::Binary)
+    {
+        bool const wide8 = (bvhLayout == BVHLayout::Wide8 || bvhLayout == BVHLayout::Wide8Quantized);
+        wideBvh = collapseBVH(geometry.bvhNodes, wide8 ? 8 : 4);
+        if (wideBvh.maxStackSize > WideBVH::MAX_STACK_SIZE)
+        {
+            std::cout << "Warning: wide BVH needs a traversal stack of " << wideBvh.maxStackSize << " entries, but only "
+                << WideBVH::MAX_STACK_SIZE << " are supported; using binary BVH instead\n";
+            wideBvh.groups.clear();
+        }
+        else if (bvhLayout == BVHLayout::Wide4Quantized || bvhLayout == BVHLayout::Wide8Quantized)
+        {
+            quantizedBvh = quantizeBVH(wideBvh);
+            if (!quantizedBvh)
+                std::cout << "Warning: BVH leaves are too large or bounds are out of range to be quantized; using unquantized wide BVH instead\n";
+        }
+    }
+
+    std::size_t const binaryBvhBytes = geometry.bvhNodes.size_bytes();
+    std::size_t const bvhBytes = quantizedBvh ? quantizedBvh->groups.size() * sizeof(QuantizedWideBVH::ChildGroup)
+        : !wideBvh.groups.empty() ? wideBvh.groups.size() * sizeof(WideBVH::ChildGroup)
+        : binaryBvhBytes;
+    float const triangleCount = std::max<std::size_t>(1, vertexPositions.size() / 3);
+
+    std::cout << "BVH size: " << (bvhBytes / triangleCount) << " bytes per triangle (binary layout: "
+        << (binaryBvhBytes / triangleCount) << " bytes per triangle)" << std::endl;
+
     WGPUBufferDescriptor bvhNodesBufferDescriptor;
     bvhNodesBufferDescriptor.nextInChain = nullptr;
     bvhNodesBufferDescriptor.label = nullptr;
     bvhNodesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
-    bvhNodesBufferDescriptor.size = bvh.nodes.size() * sizeof(bvh.nodes[0]);
+    bvhNodesBufferDescriptor.size = wideBvh.groups.empty() ? geometry.bvhNodes.size_bytes() : sizeof(BVH::Node);
     bvhNodesBufferDescriptor.mappedAtCreation = false;
 
     bvhNodesBuffer_ = wgpuDeviceCreateBuffer(device, &bvhNodesBufferDescriptor);
-    wgpuQueueWriteBuffer(queue, bvhNodesBuffer_, 0, bvh.nodes.data(), bvhNodesBufferDescriptor.size);
+    wgpuQueueWriteBuffer(queue, bvhNodesBuffer_, 0, geometry.bvhNodes.data(), bvhNodesBufferDescriptor.size);
+
+    // uvec4(groupsPerNode, quantized, 0, 0) header followed by the unquantized child groups,
+    // at least one group is needed for a valid binding
+    glm::uvec4 wideBvhHeader(wideBvh.groups.empty() ? 0 : wideBvh.width / 4, quantizedBvh ? 1 : 0, 0, 0);
+    bool const uploadWideBvh = !wideBvh.groups.empty() && !quantizedBvh;
+
+    WGPUBufferDescriptor wideBvhNodesBufferDescriptor;
+    wideBvhNodesBufferDescriptor.nextInChain = nullptr;
+    wideBvhNodesBufferDescriptor.label = nullptr;
+    wideBvhNodesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+    wideBvhNodesBufferDescriptor.size = sizeof(wideBvhHeader) + (uploadWideBvh ? wideBvh.groups.size() : 1) * sizeof(WideBVH::ChildGroup);
+    wideBvhNodesBufferDescriptor.mappedAtCreation = false;
+
+    wideBvhNodesBuffer_ = wgpuDeviceCreateBuffer(device, &wideBvhNodesBufferDescriptor);
+    wgpuQueueWriteBuffer(queue, wideBvhNodesBuffer_, 0, &wideBvhHeader, sizeof(wideBvhHeader));
+    if (uploadWideBvh)
+        wgpuQueueWriteBuffer(queue, wideBvhNodesBuffer_, sizeof(wideBvhHeader), wideBvh.groups.data(), wideBvh.groups.size() * sizeof(WideBVH::ChildGroup));
+
+    WGPUBufferDescriptor quantizedBvhNodesBufferDescriptor;
+    quantizedBvhNodesBufferDescriptor.nextInChain = nullptr;
+    quantizedBvhNodesBufferDescriptor.label = nullptr;
+    quantizedBvhNodesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+    quantizedBvhNodesBufferDescriptor.size = (quantizedBvh ? quantizedBvh->groups.size() : 1) * sizeof(QuantizedWideBVH::ChildGroup);
+    quantizedBvhNodesBufferDescriptor.mappedAtCreation = false;
+
+    quantizedBvhNodesBuffer_ = wgpuDeviceCreateBuffer(device, &quantizedBvhNodesBufferDescriptor);
+    if (quantizedBvh)
+        wgpuQueueWriteBuffer(queue, quantizedBvhNodesBuffer_, 0, quantizedBvh->groups.data(), quantizedBvhNodesBufferDescriptor.size);
 
     WGPUBufferDescriptor emissiveTrianglesBufferDescriptor;
     emissiveTrianglesBufferDescriptor.nextInChain = nullptr;
@@ -757,13 +293,54 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     emissiveBvhNodesBufferDescriptor.nextInChain = nullptr;
     emissiveBvhNodesBufferDescriptor.label = nullptr;
     emissiveBvhNodesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
-    emissiveBvhNodesBufferDescriptor.size = emissiveBvh.nodes.size() * sizeof(emissiveBvh.nodes[0]);
+    emissiveBvhNodesBufferDescriptor.size = geometry.emissiveBvhNodes.size_bytes();
     emissiveBvhNodesBufferDescriptor.mappedAtCreation = false;
 
     emissiveBvhNodesBuffer_ = wgpuDeviceCreateBuffer(device, &emissiveBvhNodesBufferDescriptor);
-    wgpuQueueWriteBuffer(queue, emissiveBvhNodesBuffer_, 0, emissiveBvh.nodes.data(), emissiveBvhNodesBufferDescriptor.size);
-
-    vertexCount_ = vertices.size();
+    wgpuQueueWriteBuffer(queue, emissiveBvhNodesBuffer_, 0, geometry.emissiveBvhNodes.data(), emissiveBvhNodesBufferDescriptor.size);
+
+    // uvec4(instanceCount, 0, 0, 0) header followed by the instances; flat scenes get a
+    // single identity instance over all triangles, which is only used for rasterization
+    instances_.assign(geometry.instances.begin(), geometry.instances.end());
+    if (instances_.empty())
+        instances_.push_back(makeSceneInstance(glm::mat4(1.f), 0, 0, vertexPositions.size() / 3));
+
+    glm::uvec4 instancesHeader(geometry.instances.size(), 0, 0, 0);
+
+    WGPUBufferDescriptor instancesBufferDescriptor;
+    instancesBufferDescriptor.nextInChain = nullptr;
+    instancesBufferDescriptor.label = nullptr;
+    instancesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex | WGPUBufferUsage_Storage;
+    instancesBufferDescriptor.size = sizeof(instancesHeader) + instances_.size() * sizeof(SceneInstance);
+    instancesBufferDescriptor.mappedAtCreation = false;
+
+    instancesBuffer_ = wgpuDeviceCreateBuffer(device, &instancesBufferDescriptor);
+    wgpuQueueWriteBuffer(queue, instancesBuffer_, 0, &instancesHeader, sizeof(instancesHeader));
+    wgpuQueueWriteBuffer(queue, instancesBuffer_, sizeof(instancesHeader), instances_.data(), instances_.size() * sizeof(SceneInstance));
+
+    BVH::Node const emptyNode;
+    std::span<BVH::Node const> instanceBvhNodes = geometry.instanceBvhNodes.empty() ? std::span(&emptyNode, 1) : geometry.instanceBvhNodes;
+
+    WGPUBufferDescriptor instanceBvhNodesBufferDescriptor;
+    instanceBvhNodesBufferDescriptor.nextInChain = nullptr;
+    instanceBvhNodesBufferDescriptor.label = nullptr;
+    instanceBvhNodesBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+    instanceBvhNodesBufferDescriptor.size = instanceBvhNodes.size_bytes();
+    instanceBvhNodesBufferDescriptor.mappedAtCreation = false;
+
+    instanceBvhNodesBuffer_ = wgpuDeviceCreateBuffer(device, &instanceBvhNodesBufferDescriptor);
+    wgpuQueueWriteBuffer(queue, instanceBvhNodesBuffer_, 0, instanceBvhNodes.data(), instanceBvhNodesBufferDescriptor.size);
+
+    vertexCount_ = vertexPositions.size();
+    emissiveTriangleCount_ = sortedEmissiveTriangles.empty() ? 0 : sortedEmissiveTriangles.size() - 1;
+    bvhLayout_ = bvhLayout;
+    instanced_ = !geometry.instances.empty();
+
+    // World space copies of emissive instance triangles follow the mesh triangles
+    std::uint32_t meshTriangleCount = 0;
+    for (auto const & instance : geometry.instances)
+        meshTriangleCount = std::max(meshTriangleCount, instance.firstTriangle + instance.triangleCount);
+    emissiveInstances_ = instanced_ && geometry.vertexPositions.size() / 3 > meshTriangleCount;
 
     WGPUSamplerDescriptor samplerDescriptor;
     samplerDescriptor.nextInChain = nullptr;
@@ -773,9 +350,9 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     samplerDescriptor.addressModeW = WGPUAddressMode_Repeat;
     samplerDescriptor.magFilter = WGPUFilterMode_Linear;
     samplerDescriptor.minFilter = WGPUFilterMode_Linear;
-    samplerDescriptor.mipmapFilter = WGPUMipmapFilterMode_Nearest;
+    samplerDescriptor.mipmapFilter = WGPUMipmapFilterMode_Linear;
     samplerDescriptor.lodMinClamp = 0.f;
-    samplerDescriptor.lodMaxClamp = 0.f;
+    samplerDescriptor.lodMaxClamp = 32.f;
     samplerDescriptor.compare = WGPUCompareFunction_Undefined;
     samplerDescriptor.maxAnisotropy = 1;
 
@@ -786,9 +363,9 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     albedoTextureDescriptor.label = nullptr;
     albedoTextureDescriptor.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
     albedoTextureDescriptor.dimension = WGPUTextureDimension_2D;
-    albedoTextureDescriptor.size = {maxAlbedoTextureSize.x, maxAlbedoTextureSize.y, (std::uint32_t)albedoImages.size()};
+    albedoTextureDescriptor.size = {albedoAtlas.layerSize.x, albedoAtlas.layerSize.y, albedoAtlas.layerCount};
     albedoTextureDescriptor.format = WGPUTextureFormat_RGBA8UnormSrgb;
-    albedoTextureDescriptor.mipLevelCount = 1;
+    albedoTextureDescriptor.mipLevelCount = albedoAtlas.mipLevelCount;
     albedoTextureDescriptor.sampleCount = 1;
     albedoTextureDescriptor.viewFormatCount = 0;
     albedoTextureDescriptor.viewFormats = nullptr;
@@ -800,47 +377,22 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     albedoTextureViewDescriptor.format = WGPUTextureFormat_RGBA8UnormSrgb;
     albedoTextureViewDescriptor.dimension = WGPUTextureViewDimension_2DArray;
     albedoTextureViewDescriptor.baseMipLevel = 0;
-    albedoTextureViewDescriptor.mipLevelCount = 1;
+    albedoTextureViewDescriptor.mipLevelCount = albedoAtlas.mipLevelCount;
     albedoTextureViewDescriptor.baseArrayLayer = 0;
-    albedoTextureViewDescriptor.arrayLayerCount = albedoImages.size();
+    albedoTextureViewDescriptor.arrayLayerCount = albedoAtlas.layerCount;
     albedoTextureViewDescriptor.aspect = WGPUTextureAspect_All;
     albedoTextureView_ = wgpuTextureCreateView(albedoTexture_, &albedoTextureViewDescriptor);
 
-    for (std::uint32_t layer = 0; layer < albedoImages.size(); ++layer)
-    {
-        auto & image = albedoImages[layer];
-
-        std::vector<std::uint32_t> scaledPixels = rescaleImage(image, maxAlbedoTextureSize);
-
-        WGPUImageCopyTexture textureDestination;
-        textureDestination.nextInChain = nullptr;
-        textureDestination.texture = albedoTexture_;
-        textureDestination.mipLevel = 0;
-        textureDestination.origin = {0, 0, layer};
-        textureDestination.aspect = WGPUTextureAspect_All;
-
-        WGPUTextureDataLayout textureDataLayout;
-        textureDataLayout.nextInChain = nullptr;
-        textureDataLayout.offset = 0;
-        textureDataLayout.bytesPerRow = image.width * 4;
-        textureDataLayout.rowsPerImage = image.height;
-
-        WGPUExtent3D textureWriteSize;
-        textureWriteSize.width = image.width;
-        textureWriteSize.height = image.height;
-        textureWriteSize.depthOrArrayLayers = 1;
-
-        wgpuQueueWriteTexture(queue, &textureDestination, image.pixels, image.width * image.height * 4, &textureDataLayout, &textureWriteSize);
-    }
+    writeAtlasImages(queue, albedoTexture_, albedoImages, albedoAtlas);
 
     WGPUTextureDescriptor materialTextureDescriptor;
     materialTextureDescriptor.nextInChain = nullptr;
     materialTextureDescriptor.label = nullptr;
     materialTextureDescriptor.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
     materialTextureDescriptor.dimension = WGPUTextureDimension_2D;
-    materialTextureDescriptor.size = {maxMaterialTextureSize.x, maxMaterialTextureSize.y, (std::uint32_t)materialImages.size()};
+    materialTextureDescriptor.size = {materialAtlas.layerSize.x, materialAtlas.layerSize.y, materialAtlas.layerCount};
     materialTextureDescriptor.format = WGPUTextureFormat_RGBA8Unorm;
-    materialTextureDescriptor.mipLevelCount = 1;
+    materialTextureDescriptor.mipLevelCount = materialAtlas.mipLevelCount;
     materialTextureDescriptor.sampleCount = 1;
     materialTextureDescriptor.viewFormatCount = 0;
     materialTextureDescriptor.viewFormats = nullptr;
@@ -852,47 +404,22 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     materialTextureViewDescriptor.format = WGPUTextureFormat_RGBA8Unorm;
     materialTextureViewDescriptor.dimension = WGPUTextureViewDimension_2DArray;
     materialTextureViewDescriptor.baseMipLevel = 0;
-    materialTextureViewDescriptor.mipLevelCount = 1;
+    materialTextureViewDescriptor.mipLevelCount = materialAtlas.mipLevelCount;
     materialTextureViewDescriptor.baseArrayLayer = 0;
-    materialTextureViewDescriptor.arrayLayerCount = materialImages.size();
+    materialTextureViewDescriptor.arrayLayerCount = materialAtlas.layerCount;
     materialTextureViewDescriptor.aspect = WGPUTextureAspect_All;
     materialTextureView_ = wgpuTextureCreateView(materialTexture_, &materialTextureViewDescriptor);
 
-    for (std::uint32_t layer = 0; layer < materialImages.size(); ++layer)
-    {
-        auto & image = materialImages[layer];
-
-        std::vector<std::uint32_t> scaledPixels = rescaleImage(image, maxMaterialTextureSize);
-
-        WGPUImageCopyTexture textureDestination;
-        textureDestination.nextInChain = nullptr;
-        textureDestination.texture = materialTexture_;
-        textureDestination.mipLevel = 0;
-        textureDestination.origin = {0, 0, layer};
-        textureDestination.aspect = WGPUTextureAspect_All;
-
-        WGPUTextureDataLayout textureDataLayout;
-        textureDataLayout.nextInChain = nullptr;
-        textureDataLayout.offset = 0;
-        textureDataLayout.bytesPerRow = image.width * 4;
-        textureDataLayout.rowsPerImage = image.height;
-
-        WGPUExtent3D textureWriteSize;
-        textureWriteSize.width = image.width;
-        textureWriteSize.height = image.height;
-        textureWriteSize.depthOrArrayLayers = 1;
-
-        wgpuQueueWriteTexture(queue, &textureDestination, image.pixels, image.width * image.height * 4, &textureDataLayout, &textureWriteSize);
-    }
+    writeAtlasImages(queue, materialTexture_, materialImages, materialAtlas);
 
     WGPUTextureDescriptor normalTextureDescriptor;
     normalTextureDescriptor.nextInChain = nullptr;
     normalTextureDescriptor.label = nullptr;
     normalTextureDescriptor.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
     normalTextureDescriptor.dimension = WGPUTextureDimension_2D;
-    normalTextureDescriptor.size = {maxNormalTextureSize.x, maxNormalTextureSize.y, (std::uint32_t)normalImages.size()};
+    normalTextureDescriptor.size = {normalAtlas.layerSize.x, normalAtlas.layerSize.y, normalAtlas.layerCount};
     normalTextureDescriptor.format = WGPUTextureFormat_RGBA8Unorm;
-    normalTextureDescriptor.mipLevelCount = 1;
+    normalTextureDescriptor.mipLevelCount = normalAtlas.mipLevelCount;
     normalTextureDescriptor.sampleCount = 1;
     normalTextureDescriptor.viewFormatCount = 0;
     normalTextureDescriptor.viewFormats = nullptr;
@@ -904,38 +431,15 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     normalTextureViewDescriptor.format = WGPUTextureFormat_RGBA8Unorm;
     normalTextureViewDescriptor.dimension = WGPUTextureViewDimension_2DArray;
     normalTextureViewDescriptor.baseMipLevel = 0;
-    normalTextureViewDescriptor.mipLevelCount = 1;
+    normalTextureViewDescriptor.mipLevelCount = normalAtlas.mipLevelCount;
     normalTextureViewDescriptor.baseArrayLayer = 0;
-    normalTextureViewDescriptor.arrayLayerCount = normalImages.size();
+    normalTextureViewDescriptor.arrayLayerCount = normalAtlas.layerCount;
     normalTextureViewDescriptor.aspect = WGPUTextureAspect_All;
     normalTextureView_ = wgpuTextureCreateView(normalTexture_, &normalTextureViewDescriptor);
 
-    for (std::uint32_t layer = 0; layer < normalImages.size(); ++layer)
-    {
-        auto & image = normalImages[layer];
-
-        std::vector<std::uint32_t> scaledPixels = rescaleImage(image, maxNormalTextureSize);
-
-        WGPUImageCopyTexture textureDestination;
-        textureDestination.nextInChain = nullptr;
-        textureDestination.texture = normalTexture_;
-        textureDestination.mipLevel = 0;
-        textureDestination.origin = {0, 0, layer};
-        textureDestination.aspect = WGPUTextureAspect_All;
+    writeAtlasImages(queue, normalTexture_, normalImages, normalAtlas);
 
-        WGPUTextureDataLayout textureDataLayout;
-        textureDataLayout.nextInChain = nullptr;
-        textureDataLayout.offset = 0;
-        textureDataLayout.bytesPerRow = image.width * 4;
-        textureDataLayout.rowsPerImage = image.height;
-
-        WGPUExtent3D textureWriteSize;
-        textureWriteSize.width = image.width;
-        textureWriteSize.height = image.height;
-        textureWriteSize.depthOrArrayLayers = 1;
-
-        wgpuQueueWriteTexture(queue, &textureDestination, image.pixels, image.width * image.height * 4, &textureDataLayout, &textureWriteSize);
-    }
+    auto const & environmentMap = scene.environmentMap;
 
     WGPUTextureDescriptor environmentTextureDescriptor;
     environmentTextureDescriptor.nextInChain = nullptr;
@@ -982,10 +486,169 @@ SceneData::SceneData(glTF::Asset const & asset, HDRIData const & environmentMap,
     environmentTextureViewDescriptor.aspect = WGPUTextureAspect_All;
     environmentTextureView_ = wgpuTextureCreateView(environmentTexture_, &environmentTextureViewDescriptor);
 
+    auto const & environmentAliasTable = scene.environmentAliasTable;
+
+    WGPUBufferDescriptor environmentAliasBufferDescriptor;
+    environmentAliasBufferDescriptor.nextInChain = nullptr;
+    environmentAliasBufferDescriptor.label = nullptr;
+    environmentAliasBufferDescriptor.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+    environmentAliasBufferDescriptor.size = environmentAliasTable.size() * sizeof(environmentAliasTable[0]);
+    environmentAliasBufferDescriptor.mappedAtCreation = false;
+
+    environmentAliasBuffer_ = wgpuDeviceCreateBuffer(device, &environmentAliasBufferDescriptor);
+    wgpuQueueWriteBuffer(queue, environmentAliasBuffer_, 0, environmentAliasTable.data(), environmentAliasBufferDescriptor.size);
+
+    geometryBindGroupLayout_ = geometryBindGroupLayout;
     geometryBindGroup_ = createGeometryBindGroup(device, geometryBindGroupLayout, vertexPositionsBuffer_, vertexAttributesBuffer_,
-        bvhNodesBuffer_, emissiveTrianglesBuffer_, emissiveTrianglesAliasBuffer_, emissiveBvhNodesBuffer_);
+        bvhNodesBuffer_, emissiveTrianglesBuffer_, emissiveTrianglesAliasBuffer_, emissiveBvhNodesBuffer_, wideBvhNodesBuffer_,
+        quantizedBvhNodesBuffer_, instancesBuffer_, instanceBvhNodesBuffer_);
     materialBindGroup_ = createMaterialBindGroup(device, materialBindGroupLayout, materialBuffer_, sampler_,
-        albedoTextureView_, materialTextureView_, normalTextureView_, environmentTextureView_);
+        albedoTextureView_, materialTextureView_, normalTextureView_, environmentTextureView_, environmentAliasBuffer_);
+}
+
+void SceneData::rebuildBVH(WGPUDevice device, WGPUQueue queue, GpuLBVHBuilder & builder, SceneGeometryView const & geometry)
+{
+    if (bvhLayout_ != BVHLayout::Binary)
+    {
+        std::cout << "Warning: GPU BVH builder only supports the binary BVH layout, keeping the prepared BVH" << std::endl;
+        return;
+    }
+
+    if (instanced_)
+    {
+        std::cout << "Warning: GPU BVH builder doesn't support instanced scenes, keeping the prepared BVH" << std::endl;
+        return;
+    }
+
+    std::uint32_t const triangleCount = vertexCount_ / 3;
+    if (triangleCount == 0)
+        return;
+
+    // The prepared triangles are usually already sorted by their Morton codes,
+    // which leaves nothing for the GPU radix sort to do. Shuffle them first,
+    // and build the CPU reference from the same shuffled triangles, so that
+    // Morton code ties are broken the same way by both builders
+
+    std::vector<std::uint32_t> shuffledTriangles(triangleCount);
+    std::iota(shuffledTriangles.begin(), shuffledTriangles.end(), 0u);
+    std::shuffle(shuffledTriangles.begin(), shuffledTriangles.end(), std::mt19937(triangleCount));
+
+    std::vector<std::uint32_t> inverseShuffle(triangleCount);
+    std::vector<glm::vec4> vertexPositions(3 * triangleCount);
+    std::vector<VertexAttributes> vertexAttributes(3 * triangleCount);
+    std::vector<AABB> triangleAABB(triangleCount);
+
+    for (std::uint32_t i = 0; i < triangleCount; ++i)
+    {
+        std::uint32_t const triangle = shuffledTriangles[i];
+        inverseShuffle[triangle] = i;
+
+        for (std::uint32_t k = 0; k < 3; ++k)
+        {
+            vertexPositions[3 * i + k] = geometry.vertexPositions[3 * triangle + k];
+            vertexAttributes[3 * i + k] = geometry.vertexAttributes[3 * triangle + k];
+            triangleAABB[i].extend(glm::vec3(vertexPositions[3 * i + k]));
+        }
+    }
+
+    // Element 0 is the header
+    std::vector<EmissiveTriangle> emissiveTriangles(geometry.emissiveTriangles.begin(), geometry.emissiveTriangles.end());
+    for (std::size_t i = 1; i < emissiveTriangles.size(); ++i)
+        emissiveTriangles[i].index = inverseShuffle[emissiveTriangles[i].index];
+
+    wgpuQueueWriteBuffer(queue, vertexPositionsBuffer_, 0, vertexPositions.data(), vertexPositions.size() * sizeof(vertexPositions[0]));
+    wgpuQueueWriteBuffer(queue, vertexAttributesBuffer_, 0, vertexAttributes.data(), vertexAttributes.size() * sizeof(vertexAttributes[0]));
+    wgpuQueueWriteBuffer(queue, emissiveTrianglesBuffer_, 0, emissiveTriangles.data(), emissiveTriangles.size() * sizeof(emissiveTriangles[0]));
+
+    auto result = builder.build(device, queue, vertexPositionsBuffer_, vertexAttributesBuffer_, emissiveTrianglesBuffer_,
+        triangleCount, emissiveTriangleCount_);
+
+    std::cout << "Built LBVH on the GPU for " << triangleCount << " triangles in " << (result.buildTime * 1000.0) << " ms, max depth: "
+        << result.maxDepth << ", nodes: " << result.nodes.size() << std::endl;
+
+    if (result.maxDepth > BVH::MAX_DEPTH)
+        std::cout << "Warning: GPU BVH depth " << result.maxDepth << " exceeds the traversal stack size" << std::endl;
+
+    {
+        BVH const reference = buildBVH(triangleAABB, {.method = BVHBuildOptions::Method::LBVH});
+        auto const & referenceNodes = reference.nodes;
+
+        std::size_t mismatches = (referenceNodes.size() == result.nodes.size()) ? 0 : std::max(referenceNodes.size(), result.nodes.size());
+        for (std::size_t i = 0; i < std::min(referenceNodes.size(), result.nodes.size()); ++i)
+            if (std::memcmp(&referenceNodes[i], &result.nodes[i], sizeof(BVH::Node)) != 0)
+                ++mismatches;
+
+        std::cout << "GPU BVH nodes differing from the CPU reference: " << mismatches << std::endl;
+    }
+
+    wgpuBufferRelease(vertexPositionsBuffer_);
+    wgpuBufferRelease(vertexAttributesBuffer_);
+    wgpuBufferRelease(bvhNodesBuffer_);
+
+    vertexPositionsBuffer_ = result.vertexPositionsBuffer;
+    vertexAttributesBuffer_ = result.vertexAttributesBuffer;
+    bvhNodesBuffer_ = result.bvhNodesBuffer;
+
+    wgpuBindGroupRelease(geometryBindGroup_);
+    geometryBindGroup_ = createGeometryBindGroup(device, geometryBindGroupLayout_, vertexPositionsBuffer_, vertexAttributesBuffer_,
+        bvhNodesBuffer_, emissiveTrianglesBuffer_, emissiveTrianglesAliasBuffer_, emissiveBvhNodesBuffer_, wideBvhNodesBuffer_,
+        quantizedBvhNodesBuffer_, instancesBuffer_, instanceBvhNodesBuffer_);
+}
+
+void SceneData::updateGeometry(WGPUDevice device, WGPUQueue queue, SceneGeometryView const & geometry, bool reordered)
+{
+    if (bvhLayout_ != BVHLayout::Binary)
+        throw std::runtime_error("Geometry updates are only supported for the binary BVH layout");
+
+    if (instanced_)
+        throw std::runtime_error("Geometry updates are not supported for instanced scenes, use updateInstances instead");
+
+    bool recreated = false;
+
+    recreated |= uploadBuffer(device, queue, vertexPositionsBuffer_, geometry.vertexPositions.data(), geometry.vertexPositions.size_bytes());
+    recreated |= uploadBuffer(device, queue, bvhNodesBuffer_, geometry.bvhNodes.data(), geometry.bvhNodes.size_bytes());
+    recreated |= uploadBuffer(device, queue, emissiveBvhNodesBuffer_, geometry.emissiveBvhNodes.data(), geometry.emissiveBvhNodes.size_bytes());
+
+    if (reordered)
+    {
+        recreated |= uploadBuffer(device, queue, vertexAttributesBuffer_, geometry.vertexAttributes.data(), geometry.vertexAttributes.size_bytes());
+        recreated |= uploadBuffer(device, queue, emissiveTrianglesBuffer_, geometry.emissiveTriangles.data(), geometry.emissiveTriangles.size_bytes());
+    }
+
+    vertexCount_ = geometry.vertexPositions.size();
+
+    if (recreated)
+    {
+        wgpuBindGroupRelease(geometryBindGroup_);
+        geometryBindGroup_ = createGeometryBindGroup(device, geometryBindGroupLayout_, vertexPositionsBuffer_, vertexAttributesBuffer_,
+            bvhNodesBuffer_, emissiveTrianglesBuffer_, emissiveTrianglesAliasBuffer_, emissiveBvhNodesBuffer_, wideBvhNodesBuffer_,
+            quantizedBvhNodesBuffer_, instancesBuffer_, instanceBvhNodesBuffer_);
+    }
+}
+
+void SceneData::updateInstances(WGPUDevice device, WGPUQueue queue, std::span<SceneInstance const> instances, std::span<BVH::Node const> instanceBvhNodes)
+{
+    if (!instanced_)
+        throw std::runtime_error("Instance updates are only supported for instanced scenes");
+
+    if (instances.size() != instances_.size())
+        throw std::runtime_error("Instance count doesn't match the initial geometry");
+
+    // Light sampling would still target the emissive triangles at their initial positions
+    if (emissiveInstances_)
+        throw std::runtime_error("Instance updates are not supported for scenes with emissive instances");
+
+    instances_.assign(instances.begin(), instances.end());
+
+    wgpuQueueWriteBuffer(queue, instancesBuffer_, sizeof(glm::uvec4), instances_.data(), instances_.size() * sizeof(SceneInstance));
+
+    if (uploadBuffer(device, queue, instanceBvhNodesBuffer_, instanceBvhNodes.data(), instanceBvhNodes.size_bytes()))
+    {
+        wgpuBindGroupRelease(geometryBindGroup_);
+        geometryBindGroup_ = createGeometryBindGroup(device, geometryBindGroupLayout_, vertexPositionsBuffer_, vertexAttributesBuffer_,
+            bvhNodesBuffer_, emissiveTrianglesBuffer_, emissiveTrianglesAliasBuffer_, emissiveBvhNodesBuffer_, wideBvhNodesBuffer_,
+            quantizedBvhNodesBuffer_, instancesBuffer_, instanceBvhNodesBuffer_);
+    }
 }
 
 SceneData::~SceneData()
@@ -993,6 +656,7 @@ SceneData::~SceneData()
     wgpuBindGroupRelease(materialBindGroup_);
     wgpuBindGroupRelease(geometryBindGroup_);
 
+    wgpuBufferRelease(environmentAliasBuffer_);
     wgpuTextureViewRelease(environmentTextureView_);
     wgpuTextureRelease(environmentTexture_);
 
@@ -1005,9 +669,13 @@ SceneData::~SceneData()
     wgpuTextureViewRelease(albedoTextureView_);
     wgpuTextureRelease(albedoTexture_);
 
+    wgpuBufferRelease(instanceBvhNodesBuffer_);
+    wgpuBufferRelease(instancesBuffer_);
     wgpuBufferRelease(emissiveBvhNodesBuffer_);
     wgpuBufferRelease(emissiveTrianglesAliasBuffer_);
     wgpuBufferRelease(emissiveTrianglesBuffer_);
+    wgpuBufferRelease(quantizedBvhNodesBuffer_);
+    wgpuBufferRelease(wideBvhNodesBuffer_);
     wgpuBufferRelease(bvhNodesBuffer_);
     wgpuBufferRelease(materialBuffer_);
     wgpuBufferRelease(vertexAttributesBuffer_);
@@ -0,0 +1,86 @@
+#include <webgpu-raytracer/texture_atlas.hpp>
+#include <webgpu-raytracer/mipmap.hpp>
+
+#include <algorithm>
+#include <numeric>
+
+glm::uvec4 TextureAtlas::rect(std::uint32_t index) const
+{
+    auto const & placement = placements[index];
+    return {placement.offset.x, placement.offset.y, placement.size.x, placement.size.y};
+}
+
+TextureAtlas packTextureAtlas(std::vector<glm::uvec2> const & sizes)
+{
+    TextureAtlas result;
+
+    for (auto const & size : sizes)
+        result.layerSize = glm::max(result.layerSize, size);
+
+    result.placements.resize(sizes.size());
+
+    std::vector<std::uint32_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::uint32_t i, std::uint32_t j){
+        return sizes[i].y > sizes[j].y;
+    });
+
+    struct Shelf
+    {
+        std::uint32_t y;
+        std::uint32_t height;
+        std::uint32_t width;
+    };
+
+    struct Layer
+    {
+        std::vector<Shelf> shelves;
+        std::uint32_t height = 0;
+    };
+
+    std::vector<Layer> layers;
+
+    auto place = [&](glm::uvec2 const & size, TextureAtlas::Placement & placement)
+    {
+        for (std::uint32_t layerID = 0; layerID < layers.size(); ++layerID)
+        {
+            auto & layer = layers[layerID];
+
+            for (auto & shelf : layer.shelves)
+            {
+                if (size.y <= shelf.height && shelf.width + size.x <= result.layerSize.x)
+                {
+                    placement = {layerID, {shelf.width, shelf.y}, size, mipLevelCount(size)};
+                    shelf.width += size.x;
+                    return true;
+                }
+            }
+
+            if (layer.height + size.y <= result.layerSize.y)
+            {
+                placement = {layerID, {0, layer.height}, size, mipLevelCount(size)};
+                layer.shelves.push_back({layer.height, size.y, size.x});
+                layer.height += size.y;
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    for (auto index : order)
+    {
+        if (!place(sizes[index], result.placements[index]))
+        {
+            layers.emplace_back();
+            place(sizes[index], result.placements[index]);
+        }
+    }
+
+    result.layerCount = std::max<std::uint32_t>(1, layers.size());
+
+    for (auto const & placement : result.placements)
+        result.mipLevelCount = std::max(result.mipLevelCount, placement.mipLevelCount);
+
+    return result;
+}
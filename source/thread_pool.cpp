@@ -0,0 +1,238 @@
+#include <webgpu-raytracer/thread_pool.hpp>
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+}
+
+struct ThreadPool::Impl
+{
+    // Queue 0 is used by threads that don't belong to the pool,
+    // queue i + 1 is owned by worker i
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<std::size_t> pendingCount{0};
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    bool stop = false;
+
+    Impl(std::size_t threadCount);
+    ~Impl();
+
+    std::size_t currentQueue() const;
+
+    bool popTask(std::function<void()> & task);
+
+    void workerLoop(std::size_t queueIndex);
+};
+
+namespace
+{
+
+    thread_local void const * currentPool = nullptr;
+    thread_local std::size_t currentQueueIndex = 0;
+
+}
+
+ThreadPool::Impl::Impl(std::size_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+
+    for (std::size_t i = 0; i < threadCount; ++i)
+        queues.push_back(std::make_unique<TaskQueue>());
+
+    for (std::size_t i = 1; i < threadCount; ++i)
+        workers.emplace_back([this, i]{ workerLoop(i); });
+}
+
+ThreadPool::Impl::~Impl()
+{
+    {
+        std::lock_guard lock{wakeMutex};
+        stop = true;
+    }
+    wakeCondition.notify_all();
+
+    for (auto & worker : workers)
+        worker.join();
+}
+
+std::size_t ThreadPool::Impl::currentQueue() const
+{
+    return (currentPool == this) ? currentQueueIndex : 0;
+}
+
+bool ThreadPool::Impl::popTask(std::function<void()> & task)
+{
+    if (pendingCount.load() == 0)
+        return false;
+
+    std::size_t const ownQueue = currentQueue();
+
+    // Own tasks are taken LIFO for locality, stolen tasks
+    // are taken FIFO since they tend to be the largest ones
+    for (std::size_t i = 0; i < queues.size(); ++i)
+    {
+        auto & queue = *queues[(ownQueue + i) % queues.size()];
+
+        std::lock_guard lock{queue.mutex};
+        if (queue.tasks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+
+        pendingCount.fetch_sub(1);
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::Impl::workerLoop(std::size_t queueIndex)
+{
+    currentPool = this;
+    currentQueueIndex = queueIndex;
+
+    std::function<void()> task;
+    while (true)
+    {
+        if (popTask(task))
+        {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock lock{wakeMutex};
+        wakeCondition.wait(lock, [this]{ return stop || pendingCount.load() > 0; });
+        if (stop && pendingCount.load() == 0)
+            return;
+    }
+}
+
+ThreadPool::ThreadPool(std::size_t threadCount)
+    : pimpl_(std::make_unique<Impl>(threadCount))
+{}
+
+ThreadPool::~ThreadPool() = default;
+
+std::size_t ThreadPool::threadCount() const
+{
+    return pimpl_->queues.size();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    {
+        auto & queue = *pimpl_->queues[pimpl_->currentQueue()];
+        std::lock_guard lock{queue.mutex};
+        queue.tasks.push_back(std::move(task));
+    }
+
+    pimpl_->pendingCount.fetch_add(1);
+
+    // Taking the lock prevents a lost wake-up between a worker
+    // checking the predicate and starting to wait
+    {
+        std::lock_guard lock{pimpl_->wakeMutex};
+    }
+    pimpl_->wakeCondition.notify_one();
+}
+
+bool ThreadPool::runPendingTask()
+{
+    std::function<void()> task;
+    if (!pimpl_->popTask(task))
+        return false;
+
+    task();
+    return true;
+}
+
+TaskGroup::TaskGroup(ThreadPool & pool)
+    : pool_(pool)
+{}
+
+TaskGroup::~TaskGroup()
+{
+    // Tasks reference this group, so it must outlive them
+    while (pendingCount_.load() > 0)
+        if (!pool_.runPendingTask())
+            std::this_thread::yield();
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    pendingCount_.fetch_add(1);
+
+    pool_.submit([this, task = std::move(task)]{
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            std::lock_guard lock{exceptionMutex_};
+            if (!exception_)
+                exception_ = std::current_exception();
+        }
+
+        pendingCount_.fetch_sub(1);
+    });
+}
+
+void TaskGroup::wait()
+{
+    while (pendingCount_.load() > 0)
+        if (!pool_.runPendingTask())
+            std::this_thread::yield();
+
+    std::lock_guard lock{exceptionMutex_};
+    if (exception_)
+        std::rethrow_exception(std::exchange(exception_, nullptr));
+}
+
+void parallelFor(ThreadPool & pool, std::size_t count, std::size_t grainSize, std::function<void(std::size_t begin, std::size_t end)> const & body)
+{
+    grainSize = std::max<std::size_t>(1, grainSize);
+
+    if (count <= grainSize)
+    {
+        if (count > 0)
+            body(0, count);
+        return;
+    }
+
+    TaskGroup group(pool);
+    for (std::size_t begin = 0; begin < count; begin += grainSize)
+    {
+        std::size_t const end = std::min(count, begin + grainSize);
+        group.run([&body, begin, end]{ body(begin, end); });
+    }
+    group.wait();
+}
@@ -0,0 +1,156 @@
+#include <webgpu-raytracer/traversal_stats.hpp>
+
+#include <algorithm>
+
+namespace
+{
+
+    // Layout of TraversalStats in raytrace_heatmap.wgsl
+    constexpr std::uint32_t HISTOGRAM_SIZE = 1024;
+    constexpr std::uint32_t HEADER_SIZE = 4;
+    constexpr std::uint64_t BUFFER_SIZE = (HEADER_SIZE + HISTOGRAM_SIZE) * sizeof(std::uint32_t);
+
+    TraversalHeatmapStats computeStats(std::uint32_t const * counters)
+    {
+        TraversalHeatmapStats result;
+        result.rayCount = counters[0];
+        result.maxVisitedNodes = counters[3];
+
+        std::uint64_t const visitedNodeSum = counters[1] | (std::uint64_t(counters[2]) << 32);
+        result.meanVisitedNodes = visitedNodeSum * 1.0 / std::max<std::uint32_t>(1, result.rayCount);
+
+        std::uint32_t const * histogram = counters + HEADER_SIZE;
+        std::uint64_t const threshold = (std::uint64_t(result.rayCount) * 99 + 99) / 100;
+
+        std::uint64_t count = 0;
+        for (std::uint32_t i = 0; i < HISTOGRAM_SIZE; ++i)
+        {
+            count += histogram[i];
+            if (count >= threshold)
+            {
+                result.p99VisitedNodes = i;
+                break;
+            }
+        }
+
+        return result;
+    }
+
+}
+
+TraversalStatsBuffer::TraversalStatsBuffer(WGPUDevice device)
+{
+    WGPUBufferDescriptor bufferDescriptor;
+    bufferDescriptor.nextInChain = nullptr;
+    bufferDescriptor.label = "traversalStats";
+    bufferDescriptor.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc | WGPUBufferUsage_CopyDst;
+    bufferDescriptor.size = BUFFER_SIZE;
+    bufferDescriptor.mappedAtCreation = false;
+
+    buffer_ = wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+
+    bufferDescriptor.label = "traversalStatsMap";
+    bufferDescriptor.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+
+    mapBuffer_ = wgpuDeviceCreateBuffer(device, &bufferDescriptor);
+
+    WGPUBindGroupLayoutEntry layoutEntry;
+    layoutEntry.nextInChain = nullptr;
+    layoutEntry.binding = 0;
+    layoutEntry.visibility = WGPUShaderStage_Compute;
+    layoutEntry.buffer.nextInChain = nullptr;
+    layoutEntry.buffer.type = WGPUBufferBindingType_Storage;
+    layoutEntry.buffer.hasDynamicOffset = false;
+    layoutEntry.buffer.minBindingSize = BUFFER_SIZE;
+    layoutEntry.sampler.nextInChain = nullptr;
+    layoutEntry.sampler.type = WGPUSamplerBindingType_Undefined;
+    layoutEntry.texture.nextInChain = nullptr;
+    layoutEntry.texture.sampleType = WGPUTextureSampleType_Undefined;
+    layoutEntry.texture.viewDimension = WGPUTextureViewDimension_Undefined;
+    layoutEntry.texture.multisampled = false;
+    layoutEntry.storageTexture.nextInChain = nullptr;
+    layoutEntry.storageTexture.access = WGPUStorageTextureAccess_Undefined;
+    layoutEntry.storageTexture.format = WGPUTextureFormat_Undefined;
+    layoutEntry.storageTexture.viewDimension = WGPUTextureViewDimension_Undefined;
+
+    WGPUBindGroupLayoutDescriptor bindGroupLayoutDescriptor;
+    bindGroupLayoutDescriptor.nextInChain = nullptr;
+    bindGroupLayoutDescriptor.label = "traversalStats";
+    bindGroupLayoutDescriptor.entryCount = 1;
+    bindGroupLayoutDescriptor.entries = &layoutEntry;
+
+    bindGroupLayout_ = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDescriptor);
+
+    WGPUBindGroupEntry entry;
+    entry.nextInChain = nullptr;
+    entry.binding = 0;
+    entry.buffer = buffer_;
+    entry.offset = 0;
+    entry.size = BUFFER_SIZE;
+    entry.sampler = nullptr;
+    entry.textureView = nullptr;
+
+    WGPUBindGroupDescriptor bindGroupDescriptor;
+    bindGroupDescriptor.nextInChain = nullptr;
+    bindGroupDescriptor.label = "traversalStats";
+    bindGroupDescriptor.layout = bindGroupLayout_;
+    bindGroupDescriptor.entryCount = 1;
+    bindGroupDescriptor.entries = &entry;
+
+    bindGroup_ = wgpuDeviceCreateBindGroup(device, &bindGroupDescriptor);
+}
+
+TraversalStatsBuffer::~TraversalStatsBuffer()
+{
+    wgpuBindGroupRelease(bindGroup_);
+    wgpuBindGroupLayoutRelease(bindGroupLayout_);
+    wgpuBufferRelease(mapBuffer_);
+    wgpuBufferRelease(buffer_);
+}
+
+void TraversalStatsBuffer::clear(WGPUCommandEncoder commandEncoder)
+{
+    wgpuCommandEncoderClearBuffer(commandEncoder, buffer_, 0, BUFFER_SIZE);
+}
+
+void TraversalStatsBuffer::resolve(WGPUCommandEncoder commandEncoder)
+{
+    if (mapState_ != MapState::Idle)
+        return;
+
+    wgpuCommandEncoderCopyBufferToBuffer(commandEncoder, buffer_, 0, mapBuffer_, 0, BUFFER_SIZE);
+    mapState_ = MapState::Resolved;
+}
+
+void TraversalStatsBuffer::poll()
+{
+    if (mapState_ != MapState::Resolved)
+        return;
+
+    mapState_ = MapState::Mapping;
+
+    auto callback = [](WGPUBufferMapAsyncStatus status, void * userData)
+    {
+        auto self = static_cast<TraversalStatsBuffer *>(userData);
+
+        if (status == WGPUBufferMapAsyncStatus_Success)
+        {
+            auto counters = static_cast<std::uint32_t const *>(wgpuBufferGetConstMappedRange(self->mapBuffer_, 0, BUFFER_SIZE));
+            auto const stats = computeStats(counters);
+            wgpuBufferUnmap(self->mapBuffer_);
+
+            std::lock_guard lock{self->statsMutex_};
+            self->stats_ = stats;
+        }
+
+        self->mapState_ = MapState::Idle;
+    };
+
+    wgpuBufferMapAsync(mapBuffer_, WGPUMapMode_Read, 0, BUFFER_SIZE, callback, this);
+}
+
+std::optional<TraversalHeatmapStats> TraversalStatsBuffer::stats() const
+{
+    std::lock_guard lock{statsMutex_};
+    return stats_;
+}
@@ -0,0 +1,331 @@
+#include <webgpu-raytracer/wide_bvh.hpp>
+#include <webgpu-raytracer/timer.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace
+{
+
+    constexpr std::uint32_t BVH_NODE_AXIS_MASK = 3u << 30;
+
+    struct Collapser
+    {
+        std::span<BVH::Node const> nodes;
+        std::uint32_t width;
+        WideBVH & result;
+
+        float surfaceArea(std::uint32_t nodeID) const
+        {
+            auto const & node = nodes[nodeID];
+            return AABB{node.aabbMin, node.aabbMax}.surfaceArea();
+        }
+
+        bool isLeaf(std::uint32_t nodeID) const
+        {
+            return nodes[nodeID].triangleCount > 0;
+        }
+
+        std::uint32_t leftChild(std::uint32_t nodeID) const
+        {
+            return nodes[nodeID].leftChildOrFirstTriangle & ~BVH_NODE_AXIS_MASK;
+        }
+
+        // Collapses the subtree of a binary inner node into the wide node
+        // wideNodeID, returns the stack size needed to traverse it
+        std::uint32_t collapse(std::uint32_t nodeID, std::uint32_t wideNodeID)
+        {
+            std::vector<std::uint32_t> children{leftChild(nodeID), leftChild(nodeID) + 1};
+
+            while (children.size() < width)
+            {
+                auto best = children.end();
+                for (auto it = children.begin(); it != children.end(); ++it)
+                    if (!isLeaf(*it) && (best == children.end() || surfaceArea(*it) > surfaceArea(*best)))
+                        best = it;
+
+                if (best == children.end())
+                    break;
+
+                std::uint32_t const left = leftChild(*best);
+                *best = left;
+                children.insert(best + 1, left + 1);
+            }
+
+            std::uint32_t const groupsPerNode = width / 4;
+            std::uint32_t const firstGroup = wideNodeID * groupsPerNode;
+
+            std::uint32_t innerChildCount = 0;
+            std::uint32_t maxChildStackSize = 0;
+
+            for (std::uint32_t i = 0; i < children.size(); ++i)
+            {
+                auto const & child = nodes[children[i]];
+
+                // The recursive calls may reallocate the group array
+                std::uint32_t childID;
+                std::uint32_t triangleCount;
+
+                if (isLeaf(children[i]))
+                {
+                    childID = child.leftChildOrFirstTriangle;
+                    triangleCount = child.triangleCount;
+                }
+                else
+                {
+                    childID = result.groups.size() / groupsPerNode;
+                    triangleCount = 0;
+                    result.groups.resize(result.groups.size() + groupsPerNode, emptyGroup());
+                    maxChildStackSize = std::max(maxChildStackSize, collapse(children[i], childID));
+                    ++innerChildCount;
+                }
+
+                auto & group = result.groups[firstGroup + i / 4];
+                std::uint32_t const lane = i % 4;
+                group.minX[lane] = child.aabbMin.x;
+                group.minY[lane] = child.aabbMin.y;
+                group.minZ[lane] = child.aabbMin.z;
+                group.maxX[lane] = child.aabbMax.x;
+                group.maxY[lane] = child.aabbMax.y;
+                group.maxZ[lane] = child.aabbMax.z;
+                group.child[lane] = childID;
+                group.triangleCount[lane] = triangleCount;
+            }
+
+            result.groups[firstGroup].child.x |= nodes[nodeID].leftChildOrFirstTriangle & BVH_NODE_AXIS_MASK;
+
+            // All inner children but one stay on the stack while the
+            // deepest one is traversed
+            if (innerChildCount == 0)
+                return 0;
+            return std::max(innerChildCount, innerChildCount - 1 + maxChildStackSize);
+        }
+
+        static WideBVH::ChildGroup emptyGroup()
+        {
+            // Inverted bounds never intersect a ray
+            float const inf = std::numeric_limits<float>::infinity();
+
+            WideBVH::ChildGroup group;
+            group.minX = group.minY = group.minZ = glm::vec4(inf);
+            group.maxX = group.maxY = group.maxZ = glm::vec4(-inf);
+            group.child = glm::uvec4(0);
+            group.triangleCount = glm::uvec4(WideBVH::EMPTY_CHILD);
+            return group;
+        }
+    };
+
+    float exponentScale(std::uint32_t biasedExponent)
+    {
+        return std::bit_cast<float>(biasedExponent << 23);
+    }
+
+    float decodeBound(float origin, std::uint32_t biasedExponent, std::uint8_t quantized)
+    {
+        return origin + float(quantized) * exponentScale(biasedExponent);
+    }
+
+    // Quantizes the child bounds of a group along one axis, rounding outwards.
+    // Returns false if the bounds don't fit into 8 bits with this exponent
+    bool quantizeAxis(WideBVH::ChildGroup const & group, std::uint32_t axis, std::uint32_t lanes, float origin, std::uint32_t biasedExponent,
+        QuantizedWideBVH::ChildGroup & result)
+    {
+        glm::vec4 const & min = (axis == 0) ? group.minX : (axis == 1) ? group.minY : group.minZ;
+        glm::vec4 const & max = (axis == 0) ? group.maxX : (axis == 1) ? group.maxY : group.maxZ;
+
+        float const scale = exponentScale(biasedExponent);
+
+        for (std::uint32_t lane = 0; lane < 4; ++lane)
+        {
+            if ((lanes & (1u << lane)) == 0)
+            {
+                result.quantizedMin[axis][lane] = 255;
+                result.quantizedMax[axis][lane] = 0;
+                continue;
+            }
+
+            // Decoding rounds, so fix up the initial estimates until the bounds are conservative
+            int qmin = std::clamp<int>(std::floor((min[lane] - origin) / scale), 0, 255);
+            while (qmin > 0 && decodeBound(origin, biasedExponent, qmin) > min[lane])
+                --qmin;
+
+            int qmax = std::clamp<int>(std::ceil((max[lane] - origin) / scale), 0, 255);
+            while (qmax < 255 && decodeBound(origin, biasedExponent, qmax) < max[lane])
+                ++qmax;
+
+            if (decodeBound(origin, biasedExponent, qmin) > min[lane] || decodeBound(origin, biasedExponent, qmax) < max[lane])
+                return false;
+
+            result.quantizedMin[axis][lane] = qmin;
+            result.quantizedMax[axis][lane] = qmax;
+        }
+
+        return true;
+    }
+
+    // Whether the used children of a decoded group contain their exact bounds
+    bool containsChildBounds(WideBVH::ChildGroup const & decoded, WideBVH::ChildGroup const & exact)
+    {
+        for (std::uint32_t lane = 0; lane < 4; ++lane)
+        {
+            if (exact.triangleCount[lane] == WideBVH::EMPTY_CHILD)
+                continue;
+
+            bool const contains = decoded.minX[lane] <= exact.minX[lane] && decoded.minY[lane] <= exact.minY[lane] && decoded.minZ[lane] <= exact.minZ[lane]
+                && decoded.maxX[lane] >= exact.maxX[lane] && decoded.maxY[lane] >= exact.maxY[lane] && decoded.maxZ[lane] >= exact.maxZ[lane];
+
+            if (!contains)
+                return false;
+        }
+
+        return true;
+    }
+
+}
+
+WideBVH collapseBVH(std::span<BVH::Node const> nodes, std::uint32_t width)
+{
+    Timer timer;
+
+    WideBVH result;
+    result.width = width;
+
+    std::uint32_t const groupsPerNode = width / 4;
+
+    Collapser collapser{nodes, width, result};
+    result.groups.resize(groupsPerNode, Collapser::emptyGroup());
+
+    if (nodes.empty())
+        return result;
+
+    if (collapser.isLeaf(0))
+    {
+        auto & group = result.groups[0];
+        group.minX.x = nodes[0].aabbMin.x;
+        group.minY.x = nodes[0].aabbMin.y;
+        group.minZ.x = nodes[0].aabbMin.z;
+        group.maxX.x = nodes[0].aabbMax.x;
+        group.maxY.x = nodes[0].aabbMax.y;
+        group.maxZ.x = nodes[0].aabbMax.z;
+        group.child.x = nodes[0].leftChildOrFirstTriangle;
+        group.triangleCount.x = nodes[0].triangleCount;
+    }
+    else
+        result.maxStackSize = collapser.collapse(0, 0);
+
+    std::uint32_t usedSlots = 0;
+    for (auto const & group : result.groups)
+        for (std::uint32_t lane = 0; lane < 4; ++lane)
+            if (group.triangleCount[lane] != WideBVH::EMPTY_CHILD)
+                ++usedSlots;
+
+    std::cout << "Collapsed " << nodes.size() << " BVH nodes into " << result.nodeCount() << " " << width << "-wide nodes in "
+        << timer.duration() << " seconds, " << (usedSlots * 1.f / result.nodeCount()) << " children per node on average, "
+        << (result.groups.size() * sizeof(WideBVH::ChildGroup) / 1024.f / 1024.f) << " MB, traversal stack size " << result.maxStackSize << std::endl;
+
+    return result;
+}
+
+std::optional<QuantizedWideBVH> quantizeBVH(WideBVH const & bvh)
+{
+    Timer timer;
+
+    QuantizedWideBVH result;
+    result.width = bvh.width;
+    result.maxStackSize = bvh.maxStackSize;
+    result.groups.resize(bvh.groups.size());
+
+    for (std::size_t i = 0; i < bvh.groups.size(); ++i)
+    {
+        auto const & group = bvh.groups[i];
+        auto & quantized = result.groups[i];
+
+        quantized.child = group.child;
+
+        std::uint32_t lanes = 0;
+        glm::vec3 groupMin(std::numeric_limits<float>::infinity());
+        glm::vec3 groupMax(-std::numeric_limits<float>::infinity());
+
+        for (std::uint32_t lane = 0; lane < 4; ++lane)
+        {
+            if (group.triangleCount[lane] == WideBVH::EMPTY_CHILD)
+            {
+                quantized.triangleCount[lane] = QuantizedWideBVH::EMPTY_CHILD;
+                continue;
+            }
+
+            if (group.triangleCount[lane] >= QuantizedWideBVH::EMPTY_CHILD)
+                return std::nullopt;
+
+            quantized.triangleCount[lane] = group.triangleCount[lane];
+            lanes |= (1u << lane);
+
+            groupMin = glm::min(groupMin, glm::vec3(group.minX[lane], group.minY[lane], group.minZ[lane]));
+            groupMax = glm::max(groupMax, glm::vec3(group.maxX[lane], group.maxY[lane], group.maxZ[lane]));
+        }
+
+        if (lanes == 0)
+            groupMin = groupMax = glm::vec3(0.f);
+
+        quantized.origin = groupMin;
+        quantized.exponents = 0;
+
+        for (std::uint32_t axis = 0; axis < 3; ++axis)
+        {
+            // Smallest power of two scale such that 255 steps cover the group extent
+            int exponent;
+            std::frexp((groupMax[axis] - groupMin[axis]) / 255.f, &exponent);
+            std::uint32_t biasedExponent = std::clamp(exponent + 127, 1, 254);
+
+            while (!quantizeAxis(group, axis, lanes, groupMin[axis], biasedExponent, quantized))
+            {
+                // The extent is out of the float range, or the bounds aren't finite
+                if (biasedExponent == 254)
+                    return std::nullopt;
+
+                ++biasedExponent;
+            }
+
+            quantized.exponents |= biasedExponent << (8 * axis);
+        }
+
+        // Catches any decoding mismatch that would make the bounds non-conservative
+        if (!containsChildBounds(decodeChildGroup(quantized), group))
+            return std::nullopt;
+    }
+
+    std::cout << "Quantized " << result.groups.size() << " BVH child groups in " << timer.duration() << " seconds, "
+        << (result.groups.size() * sizeof(QuantizedWideBVH::ChildGroup) / 1024.f / 1024.f) << " MB" << std::endl;
+
+    return result;
+}
+
+WideBVH::ChildGroup decodeChildGroup(QuantizedWideBVH::ChildGroup const & group)
+{
+    WideBVH::ChildGroup result;
+
+    glm::vec4 * min[3] = {&result.minX, &result.minY, &result.minZ};
+    glm::vec4 * max[3] = {&result.maxX, &result.maxY, &result.maxZ};
+
+    for (std::uint32_t axis = 0; axis < 3; ++axis)
+    {
+        std::uint32_t const biasedExponent = (group.exponents >> (8 * axis)) & 0xffu;
+
+        for (std::uint32_t lane = 0; lane < 4; ++lane)
+        {
+            (*min[axis])[lane] = decodeBound(group.origin[axis], biasedExponent, group.quantizedMin[axis][lane]);
+            (*max[axis])[lane] = decodeBound(group.origin[axis], biasedExponent, group.quantizedMax[axis][lane]);
+        }
+    }
+
+    result.child = group.child;
+
+    for (std::uint32_t lane = 0; lane < 4; ++lane)
+        result.triangleCount[lane] = (group.triangleCount[lane] == QuantizedWideBVH::EMPTY_CHILD)
+            ? WideBVH::EMPTY_CHILD : group.triangleCount[lane];
+
+    return result;
+}